@@ -0,0 +1,224 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include "arena.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Strings are spread over independently locked stripes by hash, so threads
+// interning different strings rarely wait on each other.
+#define STRING_POOL_STRIPES 16
+#define STRING_POOL_INITIAL_SLOTS 64
+#define STRING_POOL_CHUNK (64U * 1024U)
+
+typedef struct ArenaChunk {
+    struct ArenaChunk* next;
+    size_t used;
+    size_t capacity;
+    unsigned char data[];
+} ArenaChunk;
+
+struct Arena {
+    ArenaChunk* head;       // the chunk allocations are carved from
+    size_t chunk_size;
+};
+
+Arena* new_arena(size_t chunk_size) {
+    Arena* arena = calloc(1, sizeof(Arena));
+    if (!arena) {
+        return NULL;
+    }
+    arena->chunk_size = chunk_size;
+    return arena;
+}
+
+void free_arena(Arena* arena) {
+    if (!arena) {
+        return;
+    }
+
+    ArenaChunk* chunk = arena->head;
+    while (chunk) {
+        ArenaChunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    free(arena);
+}
+
+static void* chunk_alloc(ArenaChunk* chunk, size_t size, size_t align) {
+    uintptr_t base = (uintptr_t)chunk->data;
+    uintptr_t start = (base + chunk->used + align - 1) & ~(uintptr_t)(align - 1);
+    if (start - base > chunk->capacity || size > chunk->capacity - (start - base)) {
+        return NULL;
+    }
+    chunk->used = start - base + size;
+    return (void*)start;
+}
+
+void* arena_alloc(Arena* arena, size_t size, size_t align) {
+    if (!arena || align == 0 || (align & (align - 1)) != 0) {
+        return NULL;
+    }
+
+    void* p = arena->head ? chunk_alloc(arena->head, size, align) : NULL;
+    if (p) {
+        return p;
+    }
+
+    // anything larger than a quarter chunk gets a chunk of its own, so it
+    // doesn't waste what's left of the current one
+    bool oversized = size > arena->chunk_size / 4;
+    size_t capacity = oversized ? size + align : arena->chunk_size;
+    ArenaChunk* chunk = malloc(sizeof(ArenaChunk) + capacity);
+    if (!chunk) {
+        return NULL;
+    }
+    chunk->used = 0;
+    chunk->capacity = capacity;
+
+    if (oversized && arena->head) {
+        chunk->next = arena->head->next;
+        arena->head->next = chunk;
+    } else {
+        chunk->next = arena->head;
+        arena->head = chunk;
+    }
+    return chunk_alloc(chunk, size, align);
+}
+
+char* arena_strndup(Arena* arena, const char* s, size_t len) {
+    char* copy = arena_alloc(arena, len + 1, 1);
+    if (copy) {
+        memcpy(copy, s, len);
+        copy[len] = '\0';
+    }
+    return copy;
+}
+
+typedef struct PoolSlot {
+    const char* s;          // NULL if free
+    size_t len;
+    uint64_t hash;
+} PoolSlot;
+
+typedef struct PoolStripe {
+    pthread_mutex_t mutex;
+    Arena* arena;
+    PoolSlot* slots;
+    size_t slot_count;      // always a power of 2
+    size_t count;
+} PoolStripe;
+
+struct StringPool {
+    PoolStripe stripes[STRING_POOL_STRIPES];
+};
+
+static uint64_t string_hash(const char* s, size_t len) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)s[i]) * 0x100000001b3ULL;
+    }
+    return h ^ (h >> 29);
+}
+
+StringPool* new_string_pool(void) {
+    StringPool* pool = calloc(1, sizeof(StringPool));
+    if (!pool) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < STRING_POOL_STRIPES; i++) {
+        PoolStripe* stripe = &pool->stripes[i];
+        pthread_mutex_init(&stripe->mutex, NULL);
+        stripe->arena = new_arena(STRING_POOL_CHUNK);
+        stripe->slots = calloc(STRING_POOL_INITIAL_SLOTS, sizeof(PoolSlot));
+        stripe->slot_count = STRING_POOL_INITIAL_SLOTS;
+        if (!stripe->arena || !stripe->slots) {
+            free_string_pool(pool);
+            return NULL;
+        }
+    }
+    return pool;
+}
+
+void free_string_pool(StringPool* pool) {
+    if (!pool) {
+        return;
+    }
+
+    for (size_t i = 0; i < STRING_POOL_STRIPES; i++) {
+        PoolStripe* stripe = &pool->stripes[i];
+        pthread_mutex_destroy(&stripe->mutex);
+        free_arena(stripe->arena);
+        free(stripe->slots);
+    }
+    free(pool);
+}
+
+static PoolSlot* stripe_find(PoolSlot* slots, size_t slot_count, const char* s, size_t len, uint64_t hash) {
+    size_t mask = slot_count - 1;
+    // the low bits picked the stripe, the slot comes from the high bits
+    for (size_t i = (size_t)(hash >> 32) & mask;; i = (i + 1) & mask) {
+        PoolSlot* slot = &slots[i];
+        if (!slot->s || (slot->hash == hash && slot->len == len && memcmp(slot->s, s, len) == 0)) {
+            return slot;
+        }
+    }
+}
+
+static bool stripe_grow(PoolStripe* stripe) {
+    size_t slot_count = stripe->slot_count * 2;
+    PoolSlot* slots = calloc(slot_count, sizeof(PoolSlot));
+    if (!slots) {
+        return false;
+    }
+
+    for (size_t i = 0; i < stripe->slot_count; i++) {
+        const PoolSlot* old = &stripe->slots[i];
+        if (old->s) {
+            *stripe_find(slots, slot_count, old->s, old->len, old->hash) = *old;
+        }
+    }
+    free(stripe->slots);
+    stripe->slots = slots;
+    stripe->slot_count = slot_count;
+    return true;
+}
+
+const char* string_pool_intern(StringPool* pool, const char* s, size_t len) {
+    if (!pool || !s) {
+        return NULL;
+    }
+
+    uint64_t hash = string_hash(s, len);
+    PoolStripe* stripe = &pool->stripes[hash % STRING_POOL_STRIPES];
+
+    pthread_mutex_lock(&stripe->mutex);
+    PoolSlot* slot = stripe_find(stripe->slots, stripe->slot_count, s, len, hash);
+    const char* interned = slot->s;
+    if (!interned) {
+        // keep at least a quarter of the slots free
+        if ((stripe->count + 1) * 4 > stripe->slot_count * 3) {
+            if (!stripe_grow(stripe)) {
+                pthread_mutex_unlock(&stripe->mutex);
+                return NULL;
+            }
+            slot = stripe_find(stripe->slots, stripe->slot_count, s, len, hash);
+        }
+
+        interned = arena_strndup(stripe->arena, s, len);
+        if (interned) {
+            *slot = (PoolSlot) { .s = interned, .len = len, .hash = hash };
+            stripe->count++;
+        }
+    }
+    pthread_mutex_unlock(&stripe->mutex);
+
+    return interned;
+}
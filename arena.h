@@ -0,0 +1,49 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#ifndef __DEDUP_ARENA_H__
+#define __DEDUP_ARENA_H__
+
+#include <stddef.h>
+
+/// Arenas
+///
+/// Records that live as long as the structure that made them, like the
+/// entries of the signature table, don't need to be freed one at a time.
+/// An arena carves them out of large chunks instead, which saves the
+/// allocator's per-allocation overhead and keeps millions of small records
+/// from fragmenting the heap. Everything is released at once by
+/// `free_arena`.
+///
+/// Arenas are not synchronized, callers that share one hold their own lock.
+typedef struct Arena Arena;
+
+/// Creates an arena that allocates `chunk_size` bytes at a time. The first
+/// chunk is only allocated on first use.
+Arena* new_arena(size_t chunk_size);
+void free_arena(Arena* arena);
+
+/// Returns `size` bytes aligned to `align`, a power of 2. Returns NULL if
+/// memory runs out.
+void* arena_alloc(Arena* arena, size_t size, size_t align);
+
+/// Copies the first `len` bytes of `s` and terminates the copy.
+char* arena_strndup(Arena* arena, const char* s, size_t len);
+
+/// Interned Strings
+///
+/// Stores every distinct string once, so that records referring to the
+/// same string, like files in the same directory, share one copy. Interned
+/// strings stay valid until the pool is freed. The pool may be shared
+/// between threads.
+typedef struct StringPool StringPool;
+
+StringPool* new_string_pool(void);
+void free_string_pool(StringPool* pool);
+
+/// Returns the interned copy of the first `len` bytes of `s`, adding one if
+/// necessary. Returns NULL if memory runs out.
+const char* string_pool_intern(StringPool* pool, const char* s, size_t len);
+
+#endif // __DEDUP_ARENA_H__
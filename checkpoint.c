@@ -0,0 +1,463 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include "checkpoint.h"
+
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CHECKPOINT_MAGIC "DDUPJRNL"
+#define CHECKPOINT_VERSION 1
+
+// Records are written once this much is buffered or this many seconds
+// have passed since the last write, whichever comes first.
+#define CHECKPOINT_BUFFER (256U * 1024U)
+#define CHECKPOINT_INTERVAL 5
+
+typedef struct CheckpointHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t mode;
+    char hash_name[16];
+} CheckpointHeader;
+
+typedef enum CheckpointRecordType {
+    RECORD_DONE = 1,
+    RECORD_ORIGIN = 2,
+    RECORD_CLONE = 3,
+} CheckpointRecordType;
+
+// Precedes every record, `check` covers the type, the length and the
+// `length` bytes that follow.
+typedef struct RecordHeader {
+    uint32_t type;
+    uint32_t length;
+    uint64_t check;
+} RecordHeader;
+
+typedef struct DoneRecord {
+    uint64_t device;
+    uint64_t inode;
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+} DoneRecord;
+
+// followed by the path
+typedef struct OriginRecord {
+    uint64_t device;
+    uint64_t size;
+    int32_t samples[4];
+    uint64_t quick_hash;
+    uint64_t clone_id;
+    uint64_t inode;
+} OriginRecord;
+
+// followed by both paths
+typedef struct CloneRecord {
+    uint32_t origin_length;
+    uint32_t clone_length;
+} CloneRecord;
+
+// Done files by (device, size, mtime) and inode. The first half is a hash,
+// which is never 0 so that 0 marks a free slot.
+typedef struct DoneKey {
+    uint64_t file;
+    uint64_t inode;
+} DoneKey;
+
+struct Checkpoint {
+    int fd;
+    off_t end;                  // where the next write goes
+
+    DoneKey* done;              // read only once the journal is open
+    size_t done_capacity;       // always a power of 2
+    size_t done_count;
+    size_t clone_count;
+
+    pthread_mutex_t mutex;      // guards everything below
+    unsigned char* pending;
+    size_t pending_count;
+    size_t pending_capacity;
+    time_t last_write;
+    bool failed;
+};
+
+static uint64_t record_check(uint32_t type, uint32_t length, const void* payload) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    uint32_t words[2] = { type, length };
+    const unsigned char* p = (const unsigned char*)words;
+    for (size_t i = 0; i < sizeof(words); i++) {
+        h = (h ^ p[i]) * 0x100000001b3ULL;
+    }
+    p = payload;
+    for (size_t i = 0; i < length; i++) {
+        h = (h ^ p[i]) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static DoneKey done_key(const DoneRecord* r) {
+    uint64_t h = r->device * 0x9E3779B97F4A7C15ULL;
+    h ^= r->size + 0x7F4A7C159E3779B9ULL + (h << 6) + (h >> 2);
+    h ^= (uint64_t)r->mtime_sec * 0xC2B2AE3D27D4EB4FULL + (h >> 29);
+    h ^= (uint64_t)r->mtime_nsec * 0x165667B19E3779F9ULL + (h << 7);
+    h ^= h >> 31;
+    return (DoneKey) { .file = h | 1, .inode = r->inode };
+}
+
+static inline size_t done_slot(uint64_t file, uint64_t inode, size_t mask) {
+    uint64_t h = (file ^ (inode * 0x9E3779B97F4A7C15ULL));
+    return (size_t)(h ^ (h >> 32)) & mask;
+}
+
+static bool done_insert(Checkpoint* checkpoint, DoneKey key) {
+    if ((checkpoint->done_count + 1) * 2 > checkpoint->done_capacity) {
+        size_t capacity = checkpoint->done_capacity ? checkpoint->done_capacity * 2 : 1024;
+        DoneKey* done = calloc(capacity, sizeof(DoneKey));
+        if (!done) {
+            return false;
+        }
+        for (size_t i = 0; i < checkpoint->done_capacity; i++) {
+            DoneKey old = checkpoint->done[i];
+            if (old.file == 0) {
+                continue;
+            }
+            size_t j = done_slot(old.file, old.inode, capacity - 1);
+            while (done[j].file != 0) {
+                j = (j + 1) & (capacity - 1);
+            }
+            done[j] = old;
+        }
+        free(checkpoint->done);
+        checkpoint->done = done;
+        checkpoint->done_capacity = capacity;
+    }
+
+    size_t mask = checkpoint->done_capacity - 1;
+    for (size_t i = done_slot(key.file, key.inode, mask);; i = (i + 1) & mask) {
+        DoneKey* slot = &checkpoint->done[i];
+        if (slot->file == 0) {
+            *slot = key;
+            checkpoint->done_count++;
+            return true;
+        }
+        if (slot->file == key.file && slot->inode == key.inode) {
+            return true;
+        }
+    }
+}
+
+static bool write_all(int fd, const void* data, size_t length, off_t offset) {
+    const char* p = data;
+    while (length > 0) {
+        ssize_t n = pwrite(fd, p, length, offset);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        length -= (size_t)n;
+        offset += n;
+    }
+    return true;
+}
+
+static CheckpointHeader make_header(const char* hash_name, uint32_t mode) {
+    CheckpointHeader header = {
+        .version = CHECKPOINT_VERSION,
+        .mode = mode,
+    };
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    strncpy(header.hash_name, hash_name, sizeof(header.hash_name) - 1);
+    return header;
+}
+
+// Loads the records after the header, returns the offset after the last
+// intact one.
+static off_t load_records(Checkpoint* checkpoint, const unsigned char* data, size_t length,
+                          CheckpointOriginFn fn, void* context) {
+    size_t offset = sizeof(CheckpointHeader);
+    char path[PATH_MAX];
+    while (length - offset >= sizeof(RecordHeader)) {
+        RecordHeader header;
+        memcpy(&header, data + offset, sizeof(header));
+        const unsigned char* payload = data + offset + sizeof(header);
+        if (header.length > length - offset - sizeof(header) ||
+            record_check(header.type, header.length, payload) != header.check) {
+            break;
+        }
+
+        if (header.type == RECORD_DONE && header.length == sizeof(DoneRecord)) {
+            DoneRecord done;
+            memcpy(&done, payload, sizeof(done));
+            if (!done_insert(checkpoint, done_key(&done))) {
+                break;
+            }
+        } else if (header.type == RECORD_ORIGIN && header.length > sizeof(OriginRecord) &&
+                   header.length - sizeof(OriginRecord) < sizeof(path)) {
+            OriginRecord origin;
+            memcpy(&origin, payload, sizeof(origin));
+            size_t path_length = header.length - sizeof(OriginRecord);
+            memcpy(path, payload + sizeof(origin), path_length);
+            path[path_length] = '\0';
+            CheckpointOrigin replay = {
+                .signature = {
+                    .device = (dev_t)origin.device,
+                    .size = origin.size,
+                    .quick_hash = origin.quick_hash,
+                },
+                .clone_id = origin.clone_id,
+                .inode = (ino_t)origin.inode,
+                .path = path,
+            };
+            memcpy(replay.signature.samples, origin.samples, sizeof(origin.samples));
+            if (fn) {
+                fn(&replay, context);
+            }
+        } else if (header.type == RECORD_CLONE) {
+            checkpoint->clone_count++;
+        }
+        offset += sizeof(header) + header.length;
+    }
+    return (off_t)offset;
+}
+
+Checkpoint* open_checkpoint(const char* path, const char* hash_name, uint32_t mode, bool resume,
+                            CheckpointOriginFn fn, void* context) {
+    if (!path || !hash_name) {
+        return NULL;
+    }
+
+    Checkpoint* checkpoint = calloc(1, sizeof(Checkpoint));
+    if (!checkpoint) {
+        return NULL;
+    }
+    pthread_mutex_init(&checkpoint->mutex, NULL);
+    checkpoint->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+
+    // one run at a time, a second one would interleave its records
+    struct stat st;
+    if (checkpoint->fd < 0 || flock(checkpoint->fd, LOCK_EX | LOCK_NB) != 0 || fstat(checkpoint->fd, &st) != 0) {
+        close_checkpoint(checkpoint);
+        return NULL;
+    }
+
+    CheckpointHeader expected = make_header(hash_name, mode);
+    CheckpointHeader header = { 0 };
+    bool valid = resume && (size_t)st.st_size >= sizeof(header) &&
+                 pread(checkpoint->fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+                 memcmp(&header, &expected, sizeof(header)) == 0;
+
+    if (valid && (size_t)st.st_size > sizeof(header)) {
+        void* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, checkpoint->fd, 0);
+        if (map == MAP_FAILED) {
+            close_checkpoint(checkpoint);
+            return NULL;
+        }
+        checkpoint->end = load_records(checkpoint, map, (size_t)st.st_size, fn, context);
+        munmap(map, (size_t)st.st_size);
+    } else {
+        checkpoint->end = sizeof(header);
+    }
+
+    // continue after the last intact record, or start over
+    if (!valid && !write_all(checkpoint->fd, &expected, sizeof(expected), 0)) {
+        close_checkpoint(checkpoint);
+        return NULL;
+    }
+    if (ftruncate(checkpoint->fd, checkpoint->end) != 0) {
+        close_checkpoint(checkpoint);
+        return NULL;
+    }
+    checkpoint->last_write = time(NULL);
+    return checkpoint;
+}
+
+// Callers hold the mutex.
+static void write_pending(Checkpoint* checkpoint) {
+    checkpoint->last_write = time(NULL);
+    if (checkpoint->failed || checkpoint->pending_count == 0) {
+        return;
+    }
+
+    if (!write_all(checkpoint->fd, checkpoint->pending, checkpoint->pending_count, checkpoint->end)) {
+        // keep the journal to whole records, the next resume would stop
+        // at a torn one anyway
+        checkpoint->failed = true;
+        (void)!ftruncate(checkpoint->fd, checkpoint->end);
+        return;
+    }
+    checkpoint->end += (off_t)checkpoint->pending_count;
+    checkpoint->pending_count = 0;
+
+    // fsync only reaches the drive's cache
+#ifdef F_FULLFSYNC
+    if (fcntl(checkpoint->fd, F_FULLFSYNC) == 0) {
+        return;
+    }
+#endif
+    fsync(checkpoint->fd);
+}
+
+bool close_checkpoint(Checkpoint* checkpoint) {
+    if (!checkpoint) {
+        return true;
+    }
+
+    bool ok = true;
+    if (checkpoint->fd >= 0) {
+        pthread_mutex_lock(&checkpoint->mutex);
+        write_pending(checkpoint);
+        ok = !checkpoint->failed;
+        pthread_mutex_unlock(&checkpoint->mutex);
+        close(checkpoint->fd);
+    }
+    free(checkpoint->done);
+    free(checkpoint->pending);
+    pthread_mutex_destroy(&checkpoint->mutex);
+    free(checkpoint);
+    return ok;
+}
+
+bool checkpoint_is_done(const Checkpoint* checkpoint, const CheckpointFile* file) {
+    if (!checkpoint || !file || checkpoint->done_count == 0) {
+        return false;
+    }
+
+    DoneRecord record = {
+        .device = (uint64_t)file->device,
+        .inode = (uint64_t)file->inode,
+        .size = file->size,
+        .mtime_sec = file->mtime.tv_sec,
+        .mtime_nsec = file->mtime.tv_nsec,
+    };
+    DoneKey key = done_key(&record);
+    size_t mask = checkpoint->done_capacity - 1;
+    for (size_t i = done_slot(key.file, key.inode, mask);; i = (i + 1) & mask) {
+        const DoneKey* slot = &checkpoint->done[i];
+        if (slot->file == 0) {
+            return false;
+        }
+        if (slot->file == key.file && slot->inode == key.inode) {
+            return true;
+        }
+    }
+}
+
+size_t checkpoint_resumed_files(const Checkpoint* checkpoint) {
+    return checkpoint ? checkpoint->done_count : 0;
+}
+
+size_t checkpoint_resumed_clones(const Checkpoint* checkpoint) {
+    return checkpoint ? checkpoint->clone_count : 0;
+}
+
+// Appends a record made of `count` parts to the buffer.
+static void append_record(Checkpoint* checkpoint, CheckpointRecordType type, const void* const* parts,
+                          const size_t* lengths, size_t count) {
+    size_t length = 0;
+    for (size_t i = 0; i < count; i++) {
+        length += lengths[i];
+    }
+    if (length > UINT32_MAX - sizeof(RecordHeader)) {
+        return;
+    }
+
+    pthread_mutex_lock(&checkpoint->mutex);
+    size_t needed = checkpoint->pending_count + sizeof(RecordHeader) + length;
+    if (needed > checkpoint->pending_capacity) {
+        size_t capacity = checkpoint->pending_capacity ? checkpoint->pending_capacity : CHECKPOINT_BUFFER;
+        while (capacity < needed) {
+            capacity *= 2;
+        }
+        unsigned char* pending = realloc(checkpoint->pending, capacity);
+        if (!pending) {
+            checkpoint->failed = true;
+            pthread_mutex_unlock(&checkpoint->mutex);
+            return;
+        }
+        checkpoint->pending = pending;
+        checkpoint->pending_capacity = capacity;
+    }
+
+    unsigned char* record = checkpoint->pending + checkpoint->pending_count;
+    unsigned char* payload = record + sizeof(RecordHeader);
+    size_t offset = 0;
+    for (size_t i = 0; i < count; i++) {
+        memcpy(payload + offset, parts[i], lengths[i]);
+        offset += lengths[i];
+    }
+    RecordHeader header = {
+        .type = type,
+        .length = (uint32_t)length,
+        .check = record_check(type, (uint32_t)length, payload),
+    };
+    memcpy(record, &header, sizeof(header));
+    checkpoint->pending_count = needed;
+
+    if (checkpoint->pending_count >= CHECKPOINT_BUFFER || time(NULL) - checkpoint->last_write >= CHECKPOINT_INTERVAL) {
+        write_pending(checkpoint);
+    }
+    pthread_mutex_unlock(&checkpoint->mutex);
+}
+
+void checkpoint_record_done(Checkpoint* checkpoint, const CheckpointFile* file) {
+    if (!checkpoint || !file) {
+        return;
+    }
+
+    DoneRecord record = {
+        .device = (uint64_t)file->device,
+        .inode = (uint64_t)file->inode,
+        .size = file->size,
+        .mtime_sec = file->mtime.tv_sec,
+        .mtime_nsec = file->mtime.tv_nsec,
+    };
+    const void* parts[] = { &record };
+    size_t lengths[] = { sizeof(record) };
+    append_record(checkpoint, RECORD_DONE, parts, lengths, 1);
+}
+
+void checkpoint_record_origin(Checkpoint* checkpoint, const CheckpointOrigin* origin) {
+    if (!checkpoint || !origin || !origin->path) {
+        return;
+    }
+
+    OriginRecord record = {
+        .device = (uint64_t)origin->signature.device,
+        .size = origin->signature.size,
+        .quick_hash = origin->signature.quick_hash,
+        .clone_id = origin->clone_id,
+        .inode = (uint64_t)origin->inode,
+    };
+    memcpy(record.samples, origin->signature.samples, sizeof(record.samples));
+    const void* parts[] = { &record, origin->path };
+    size_t lengths[] = { sizeof(record), strlen(origin->path) };
+    append_record(checkpoint, RECORD_ORIGIN, parts, lengths, 2);
+}
+
+void checkpoint_record_clone(Checkpoint* checkpoint, const char* origin, const char* clone) {
+    if (!checkpoint || !origin || !clone) {
+        return;
+    }
+
+    CloneRecord record = {
+        .origin_length = (uint32_t)strlen(origin),
+        .clone_length = (uint32_t)strlen(clone),
+    };
+    const void* parts[] = { &record, origin, clone };
+    size_t lengths[] = { sizeof(record), record.origin_length, record.clone_length };
+    append_record(checkpoint, RECORD_CLONE, parts, lengths, 3);
+}
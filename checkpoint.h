@@ -0,0 +1,79 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#ifndef __DEDUP_CHECKPOINT_H__
+#define __DEDUP_CHECKPOINT_H__
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "signature.h"
+
+/// Checkpoint Journal
+///
+/// Records the progress of a run in a file so that an interrupted run can
+/// be resumed rather than started over. The journal is a header followed
+/// by records that are only ever appended:
+///
+///   - a "done" record for every file that has been visited,
+///   - an "origin" record for every file added to the signature table,
+///   - a "clone" record for every duplicate that was replaced.
+///
+/// Records are buffered and written and synced every few seconds, so a
+/// crash loses at most the last of them. Each carries a checksum, a resume
+/// reads up to the first record that is torn or damaged and continues the
+/// journal from there.
+///
+/// Resuming replays the origins into the signature table, so files visited
+/// later are matched against them without reading them again, and skips
+/// files that are done as long as their size and modification time are
+/// unchanged. A journal written by a different hash backend or replace mode
+/// is started over.
+typedef struct Checkpoint Checkpoint;
+
+typedef struct CheckpointFile {
+    dev_t device;
+    ino_t inode;
+    uint64_t size;
+    struct timespec mtime;
+} CheckpointFile;
+
+typedef struct CheckpointOrigin {
+    FileSignature signature;
+    uint64_t clone_id;
+    ino_t inode;
+    const char* path;
+} CheckpointOrigin;
+
+typedef void (*CheckpointOriginFn)(const CheckpointOrigin* origin, void* context);
+
+/// Opens or creates the journal at `path`. With `resume` the records of the
+/// journal are loaded, calling `fn` for every origin, otherwise it is
+/// started over. `hash_name` and `mode` must match those of the run that
+/// wrote the journal for it to be resumed. Returns NULL if the journal can't
+/// be used, e.g. because another process holds it.
+Checkpoint* open_checkpoint(const char* path, const char* hash_name, uint32_t mode, bool resume,
+                            CheckpointOriginFn fn, void* context);
+
+/// Writes what is still buffered and closes the journal. Returns false if
+/// any record couldn't be written.
+bool close_checkpoint(Checkpoint* checkpoint);
+
+/// Whether the file was done, unchanged, when the journal was resumed.
+/// Lock free.
+bool checkpoint_is_done(const Checkpoint* checkpoint, const CheckpointFile* file);
+
+/// The number of done files and clones loaded when the journal was resumed.
+size_t checkpoint_resumed_files(const Checkpoint* checkpoint);
+size_t checkpoint_resumed_clones(const Checkpoint* checkpoint);
+
+/// Appends a record. Safe to call from multiple threads.
+void checkpoint_record_done(Checkpoint* checkpoint, const CheckpointFile* file);
+void checkpoint_record_origin(Checkpoint* checkpoint, const CheckpointOrigin* origin);
+void checkpoint_record_clone(Checkpoint* checkpoint, const char* origin, const char* clone);
+
+#endif // __DEDUP_CHECKPOINT_H__
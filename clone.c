@@ -36,6 +36,8 @@
 
 #include <err.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <libgen.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -43,6 +45,8 @@
 #include <unistd.h>
 
 #include "clone.h"
+#include "file_handle.h"
+#include "metrics.h"
 
 int find_zero_file(const char* restrict path) {
     if (access(path, W_OK)) {
@@ -164,10 +168,12 @@ int replace_with_clone(const char* src, const char* dst) {
         return check;
     }
 
+    uint64_t metadata_start = stage_clock();
     result = copyfile(dst,
                       path,
                       NULL,
                       COPYFILE_METADATA | (1<<31));
+    stage_record(STAGE_METADATA, metadata_start);
     if (result) {
         perror("could not copy metadata");
         unlink(path);
@@ -197,16 +203,189 @@ int replace_with_clone(const char* src, const char* dst) {
     return 0;
 }
 
+// Like `find_zero_file`, for the staging file `name` in `dir_fd`, open as
+// `fd`.
+static int find_zero_file_at(int fd, int dir_fd, const char* name) {
+    if (faccessat(dir_fd, name, W_OK, 0)) {
+        return 1;
+    }
+
+    struct stat s = { 0 };
+    if (fstat(fd, &s)) {
+        fprintf(stderr, "Could not stat %s\n", name);
+        perror("fstat(2)");
+        return 2;
+    }
+
+    if (s.st_size == 0) {
+        return 3;
+    }
+
+    return 0;
+}
+
+int replace_with_clone_at(int src_fd, int dst_fd, int dir_fd, const char* name) {
+    char tmp[NAME_MAX + 1] = { 0 };
+    if (strlcpy(tmp, ".~.", sizeof(tmp)) >= sizeof(tmp) ||
+        strlcat(tmp, name, sizeof(tmp)) >= sizeof(tmp)) {
+        return ENAMETOOLONG;
+    }
+
+#if defined(__APPLE__)
+    errno = 0;
+    int result = fclonefileat(src_fd, dir_fd, tmp, 0);
+    if (result) {
+        if (errno == EEXIST) {
+            fprintf(stderr,
+                    "Staging file %s already exists. Remove it to replace %s with a clone\n",
+                    tmp,
+                    name);
+        } else {
+            perror("could not clonefile");
+        }
+        return result;
+    }
+
+    // the same checks as replace_with_clone, through the staging file's
+    // descriptor
+    int tmp_fd = openat(dir_fd, tmp, O_RDONLY | O_NOFOLLOW);
+    if (tmp_fd < 0) {
+        perror("could not open clone");
+        unlinkat(dir_fd, tmp, 0);
+        return -1;
+    }
+
+    if (find_zero_file_at(tmp_fd, dir_fd, tmp)) {
+        fprintf(stderr,
+                "invalid file created by clonefile(2)\n");
+        close(tmp_fd);
+        unlinkat(dir_fd, tmp, 0);
+        return ENOENT;
+    }
+
+    // the files were compared at the same size, a source that changed
+    // since then would replace dst with other data
+    struct stat src_st = { 0 }, dst_st = { 0 };
+    if (fstat(tmp_fd, &src_st) || fstat(dst_fd, &dst_st) || src_st.st_size != dst_st.st_size) {
+        fprintf(stderr, "%s changed since it was compared\n", name);
+        close(tmp_fd);
+        unlinkat(dir_fd, tmp, 0);
+        return ENOENT;
+    }
+
+    int check = fcopyfile(dst_fd, tmp_fd, NULL, COPYFILE_CHECK | COPYFILE_METADATA);
+    if (check & COPYFILE_DATA) {
+        perror("copyfile(3) should not copy data");
+        close(tmp_fd);
+        unlinkat(dir_fd, tmp, 0);
+        return check;
+    }
+
+    uint64_t metadata_start = stage_clock();
+    result = fcopyfile(dst_fd, tmp_fd, NULL, COPYFILE_METADATA | (1<<31));
+    stage_record(STAGE_METADATA, metadata_start);
+    if (result) {
+        perror("could not copy metadata");
+        close(tmp_fd);
+        unlinkat(dir_fd, tmp, 0);
+        return result;
+    }
+
+    if (find_zero_file_at(tmp_fd, dir_fd, tmp)) {
+        fprintf(stderr,
+                "invalid file created by copyfile(3)\n");
+        close(tmp_fd);
+        unlinkat(dir_fd, tmp, 0);
+        return ENOENT;
+    }
+    close(tmp_fd);
+#else
+#error Operating system not supported
+#endif
+
+    result = renameat(dir_fd, tmp, dir_fd, name);
+    if (result) {
+        perror("could not replace existing file");
+        unlinkat(dir_fd, tmp, 0);
+        return result;
+    }
+
+    return 0;
+}
+
+int replace_with_clone_cached(FileHandleCache* handles, const char* src, const char* dst, const DirHandle* dir) {
+    const char* name = strrchr(dst, '/');
+    int dir_fd = dir_handle_fd(dir);
+    if (dir) {
+        name = name ? name + 1 : dst;
+    } else if (name) {
+        char dir_path[PATH_MAX];
+        size_t len = name == dst ? 1 : (size_t)(name - dst);
+        memcpy(dir_path, dst, len);
+        dir_path[len] = '\0';
+        name++;
+        dir_fd = open(dir_path, O_RDONLY | O_DIRECTORY);
+        if (dir_fd < 0) {
+            return errno;
+        }
+    } else {
+        name = dst;
+    }
+
+    FileHandle* src_handle = file_handle_acquire(handles, src);
+    FileHandle* dst_handle = src_handle ? file_handle_acquire_at(handles, dir_fd, name, dst) : NULL;
+    int result = dst_handle ? replace_with_clone_at(src_handle->fd, dst_handle->fd, dir_fd, name) : ENOENT;
+    file_handle_release(handles, dst_handle);
+    file_handle_release(handles, src_handle);
+    if (!dir && dir_fd != AT_FDCWD) {
+        close(dir_fd);
+    }
+    return result;
+}
 
 int replace_with_link(const char* src, const char* dst) {
-    // TODO: should this atomically move a tmp file instead of
-    //       two step an unlink and link?
-    if (unlink(dst)) {
+    // the link is staged next to dst and moved over it, so dst is never
+    // missing, not even if the link can't be made
+    char path[PATH_MAX] = { 0 };
+    if (!tmp_name(dst, path, PATH_MAX)) {
+        return errno;
+    }
+
+    if (link(src, path)) {
+        warn("%s", path);
+        return errno;
+    }
+
+    if (rename(path, dst)) {
+        int errno_saved = errno;
         warn("%s", dst);
-        return 1;
+        unlink(path);
+        return errno_saved;
     }
 
-    return link(src, dst);
+    return 0;
+}
+
+int replace_with_link_at(int src_dir_fd, const char* src_name, int dir_fd, const char* name) {
+    char tmp[NAME_MAX + 1] = { 0 };
+    if (strlcpy(tmp, ".~.", sizeof(tmp)) >= sizeof(tmp) ||
+        strlcat(tmp, name, sizeof(tmp)) >= sizeof(tmp)) {
+        return ENAMETOOLONG;
+    }
+
+    if (linkat(src_dir_fd, src_name, dir_fd, tmp, 0)) {
+        warn("%s", tmp);
+        return errno;
+    }
+
+    if (renameat(dir_fd, tmp, dir_fd, name)) {
+        int errno_saved = errno;
+        warn("%s", name);
+        unlinkat(dir_fd, tmp, 0);
+        return errno_saved;
+    }
+
+    return 0;
 }
 
 // returns a relative path to dst from src
@@ -27,6 +27,9 @@
 #ifndef __DEDUP_CLONE_H__
 #define __DEDUP_CLONE_H__
 
+#include "dir_handle.h"
+#include "file_handle.h"
+
 /// replace_with_clone
 ///
 /// The `replace_with_clone` function causes the link named `dst` to be
@@ -53,7 +56,53 @@
 /// See also: `clonefile(2)`, `copyfile(2)`, or `rename(2)`
 int replace_with_clone(const char* src, const char* dst);
 
+/// replace_with_clone_at
+///
+/// Works like `replace_with_clone`, but from descriptors the caller already
+/// has open, so that no path is resolved more than once: `src_fd` is the
+/// clone source, `dst_fd` the file the metadata is copied from and `name`
+/// the link in the directory `dir_fd` that is replaced. The staging file is
+/// created next to it with `fclonefileat(2)`.
+///
+/// The staging file is checked like `replace_with_clone` checks it, through
+/// its descriptor: it must be writable and not empty after the clone and
+/// after the metadata is copied, the size of `dst_fd` after the clone, and
+/// `COPYFILE_CHECK` must not report any data to copy.
+///
+/// Returns 0 on success, ENAMETOOLONG if the name of the staging file is
+/// longer than `NAME_MAX`, ENOENT if the staging file fails a check, or
+/// whatever `fclonefileat(2)`, `fcopyfile(3)` or `renameat(2)` return.
+int replace_with_clone_at(int src_fd, int dst_fd, int dir_fd, const char* name);
+
+/// replace_with_clone_cached
+///
+/// Works like `replace_with_clone_at`, for files the caller only has the
+/// paths of. `src` and `dst` are opened through `handles`, which may be
+/// NULL, so a file that was compared just before isn't opened again. `dir`
+/// is the open directory of `dst` if the caller has one, otherwise the
+/// directory is opened for the call.
+int replace_with_clone_cached(FileHandleCache* handles, const char* src, const char* dst, const DirHandle* dir);
+
+/// replace_with_link
+///
+/// Replaces the link named `dst` with a hard link to `src`. The new link is
+/// made next to `dst` and renamed over it, `dst` names one of the two files
+/// at all times. `src` and `dst` must not already be links of the same file,
+/// `rename(2)` leaves both names in place then.
+///
+/// Returns 0 on success, otherwise the error `link(2)` or `rename(2)` failed
+/// with.
 int replace_with_link(const char* src, const char* dst);
+
+/// replace_with_link_at
+///
+/// Works like `replace_with_link`, with both links named within open
+/// directories, `AT_FDCWD` for a path. The new link is staged in `dir_fd`.
+///
+/// Returns 0 on success, ENAMETOOLONG if the name of the staging link is
+/// longer than `NAME_MAX`, or the error `linkat(2)` or `renameat(2)` failed
+/// with.
+int replace_with_link_at(int src_dir_fd, const char* src_name, int dir_fd, const char* name);
 int replace_with_symlink(const char* src, const char* dst);
 
 #endif // __DEDUP_CLONE_H__
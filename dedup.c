@@ -44,33 +44,76 @@ static char sccsid[] = "@(#)dedup.c)";
 #endif // 0
 #endif // lint
 
+#include <mach/mach.h>
 #include <sys/mount.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/sysctl.h>
 #include <sys/ioctl.h>
 
 #include <assert.h>
 #include <err.h>
-#include <fts.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <inttypes.h>
 #include <pthread.h>
 #include <semaphore.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "checkpoint.h"
 #include "clone.h"
-#include "map.h"
+#include "device_limit.h"
+#include "dir_handle.h"
+#include "file_handle.h"
+#include "group_verify.h"
+#include "link_cluster.h"
+#include "metrics.h"
 #include "progress.h"
 #include "queue.h"
 #include "output_format.h"
+#include "runtime_caps.h"
 #include "runtime_dispatch.h"
 #include "seen_set.h"
+#include "sig_cache.h"
 #include "signature.h"
 #include "sig_table.h"
+#include "size_gate.h"
+#include "spill.h"
+#include "summary.h"
 #include "utils.h"
+#include "visit_order.h"
+#include "walker.h"
+#include "watch.h"
+
+// Entries each queue buffers before the producer blocks. Large enough to ride
+// out bursts of tiny files, small enough to bound memory on huge trees.
+#define QUEUE_CAPACITY 16384
+
+// Readers keeping signature reads in flight ahead of the workers. A single
+// reader leaves an NVMe device idle between requests, it takes about 16
+// outstanding requests to reach its rated throughput.
+#define READ_AHEAD_DEPTH_DEFAULT 16
+
+// How much of a matched pair the readers ask the kernel to prefetch for its
+// compare. Larger files are read sequentially by the compare anyway.
+#define READ_AHEAD_VERIFY_MAX (8U * 1024U * 1024U)
+
+// How long a changed file must be left alone before --watch looks at it,
+// a file that is still being written would be replaced under its writer.
+#define WATCH_SETTLE_SECONDS 2
+
+// The status line is redrawn this many times a second, its rates are those
+// of the last RENDER_RATE_FRAMES frames.
+#define RENDER_HZ 10
+#define RENDER_RATE_FRAMES RENDER_HZ
 
 #define PROGRESS_LOCK(p, m, block) do { \
         if ((p)) { \
@@ -83,49 +126,6 @@ static char sccsid[] = "@(#)dedup.c)";
 // Forward declaration
 typedef struct DedupContext DedupContext;
 
-// Clone record streaming functions
-static FILE* clone_summary_stream = NULL;
-static pthread_mutex_t clone_summary_mutex = PTHREAD_MUTEX_INITIALIZER;
-static size_t clone_summary_count = 0;
-
-static void clone_summary_open(const char* filepath) {
-    pthread_mutex_lock(&clone_summary_mutex);
-    if (!clone_summary_stream) {
-        clone_summary_stream = fopen(filepath, "w");
-        if (clone_summary_stream) {
-            fprintf(clone_summary_stream, "DEDUP CLONING SUMMARY\n");
-            fprintf(clone_summary_stream, "=====================\n");
-            fprintf(clone_summary_stream, "\n");
-        }
-    }
-    pthread_mutex_unlock(&clone_summary_mutex);
-}
-
-static void clone_summary_write(const char* origin, const char* clone, size_t size) {
-    pthread_mutex_lock(&clone_summary_mutex);
-    if (clone_summary_stream) {
-        fprintf(clone_summary_stream, "  Origin: %s\n", origin);
-        fprintf(clone_summary_stream, "    Clone: %s (size: %zu bytes)\n", clone, size);
-        clone_summary_count++;
-        fflush(clone_summary_stream);
-    }
-    pthread_mutex_unlock(&clone_summary_mutex);
-}
-
-static void clone_summary_close() {
-    pthread_mutex_lock(&clone_summary_mutex);
-    if (clone_summary_stream) {
-        // Write count at the end
-        fprintf(clone_summary_stream, "\nTotal cloning operations: %zu\n", clone_summary_count);
-        fflush(clone_summary_stream);
-        
-        fclose(clone_summary_stream);
-        clone_summary_stream = NULL;
-        clone_summary_count = 0;
-    }
-    pthread_mutex_unlock(&clone_summary_mutex);
-}
-
 typedef enum ReplaceMode {
     DEDUP_CLONE    = 0,
     DEDUP_LINK     = 1,
@@ -134,36 +134,48 @@ typedef enum ReplaceMode {
 
 typedef struct DedupContext {
     Progress* progress;
-    FileEntryHead* queue;
-    FileEntryHead* raw_queue;
+    FileEntryQueue* queue;       // survivors of pruning, consumed by workers
+    FileEntryQueue* raw_queue;   // traversal output, consumed by the pruners
+    FileEntryQueue* ready_queue; // entries with signatures, consumed by workers,
+                                 // NULL without readers
+    atomic_int readers_running;  // the last reader out closes ready_queue
+    atomic_int pruners_running;  // the last pruner out closes queue
+    SeenSet* seen_inodes;        // shared by the pruners, see seen_set.h
+    SeenSet* seen_clones;
+    SeenSet* seen_versions;      // (inode, size, mtime) of every file, only with --watch
+    _Atomic uint64_t watch_sequence; // first sequence handed out by --watch
+    LinkClusters* link_clusters; // links of hardlinked files, NULL with -s
+    SizeGate* size_gate;
+    pthread_mutex_t size_gate_mutex; // the gate itself isn't synchronized
     SigTable* signatures;
-    size_t found;
-    size_t saved;
-    size_t already_saved;
-    size_t pruned;
-    size_t total_bytes;  // Accumulated bytes of all scanned files
-    size_t queued_count; // Entries in raw_queue + work_queue combined
+    SpillSet* spill;             // files past the table's limit, NULL without -M
+    size_t table_limit;          // bytes the table may use while spilling
+    SigCache* sig_cache;         // signatures of earlier runs, NULL if not used
+    Checkpoint* checkpoint;      // progress journal for --checkpoint, NULL if not used
+    FileHandleCache* handles;    // open files shared by the signature and compare stages
+    DeviceLimits* device_limits; // threads per device of the readers and workers, NULL with -t0
+    Metrics metrics;             // sharded counters, see metrics.h
     uint64_t next_file_sequence;
-    uint64_t next_visit_sequence;
-    uint8_t scan_done;
-    uint8_t prune_done;
+    VisitOrder* visit_order;     // per (device, size) ordering, NULL if unordered
     uint8_t thread_count;
+    uint8_t read_ahead_depth;    // reader threads, 0 leaves the reads to workers
     bool dry_run;
     uint8_t verbosity;
     bool force;
     ReplaceMode replace_mode;
     OutputFormat output_format;
     bool clone_converted;        // Whether to convert clones (true by default)
-    char* summary_file;          // File to write detailed summary to (NULL by default)
-    pthread_mutex_t metrics_mutex;
+    SummaryLog* summary;         // records replaced duplicates for -S (NULL by default)
     pthread_mutex_t progress_mutex;
-    pthread_mutex_t queue_mutex;
-    pthread_mutex_t raw_queue_mutex;
-    pthread_mutex_t signatures_mutex;
-    pthread_mutex_t scan_done_mutex;
-    pthread_mutex_t prune_done_mutex;
-    pthread_mutex_t visit_order_mutex;
-    pthread_cond_t visit_order_cond;
+    atomic_bool siginfo_done;    // tells siginfo_work to exit on the next SIGINFO
+
+    // the status line, drawn by render_work under progress_mutex
+    pthread_cond_t render_stop;  // wakes render_work once render_done is set
+    bool render_done;            // guarded by progress_mutex
+    atomic_bool resized;         // SIGWINCH arrived, see siginfo_work
+    atomic_bool status_wanted;   // render_work wants the path of the next file
+    pthread_mutex_t status_mutex;
+    char status_path[PATH_MAX];  // guarded by status_mutex
 } DedupContext;
 
 static int get_terminal_width(void) {
@@ -202,36 +214,24 @@ static void format_count(size_t count, char buf[5]) {
     }
 }
 
-static void display_status(DedupContext* ctx, const char* path) {
-    if (!isatty(STDOUT_FILENO)) {
-        return;
-    }
-    
+// Draws the status line for the last file noted, `walk_rate` and
+// `visit_rate` are in files per second. Callers hold progress_mutex.
+static void render_status(DedupContext* ctx, const char* path, int width, size_t walk_rate, size_t visit_rate) {
     static bool header_printed = false;
     if (!header_printed) {
-        fprintf(stderr, "%-4s %-4s %-4s %-5s %-20s %s\n",
-                "TOTL", "QUED", "SHRD", "DELTA", "PROGRESS", "PATH");
+        fprintf(stderr, "%-4s %-4s %-4s %-5s %-6s %-6s %-20s %s\n",
+                "TOTL", "QUED", "SHRD", "DELTA", "WALK/s", "VIST/s", "PROGRESS", "PATH");
         header_printed = true;
     }
 
-    int width = get_terminal_width();
     if (width < 80) width = 80;
     
-    pthread_mutex_lock(&ctx->metrics_mutex);
-    size_t total_bytes = ctx->total_bytes;
-    size_t queued = ctx->queued_count;
-    size_t shared = ctx->already_saved;
-    size_t delta = ctx->saved;
-    pthread_mutex_unlock(&ctx->metrics_mutex);
-    
-    size_t completed = 0;
-    size_t total = 0;
-    if (ctx->progress) {
-        PROGRESS_LOCK(ctx->progress, &ctx->progress_mutex, {
-            completed = ctx->progress->completedUnitCount;
-            total = ctx->progress->totalUnitCount;
-        });
-    }
+    size_t total_bytes = metrics_sum(&ctx->metrics, METRIC_TOTAL_BYTES);
+    size_t queued = metrics_sum(&ctx->metrics, METRIC_QUEUED);
+    size_t shared = metrics_sum(&ctx->metrics, METRIC_ALREADY_SAVED);
+    size_t delta = metrics_sum(&ctx->metrics, METRIC_SAVED);
+    size_t completed = metrics_sum(&ctx->metrics, METRIC_COMPLETED);
+    size_t total = metrics_sum(&ctx->metrics, METRIC_TOTAL_FILES);
     
     char total_bytes_str[5];
     char queued_str[5];
@@ -239,6 +239,8 @@ static void display_status(DedupContext* ctx, const char* path) {
     char delta_str[5];
     char done_str[5];
     char total_str[5];
+    char walk_str[5];
+    char visit_str[5];
     
     format_compact(total_bytes, total_bytes_str);
     format_compact(queued, queued_str);
@@ -246,6 +248,8 @@ static void display_status(DedupContext* ctx, const char* path) {
     format_compact(delta, delta_str);
     format_count(completed, done_str);
     format_count(total, total_str);
+    format_count(walk_rate, walk_str);
+    format_count(visit_rate, visit_str);
     
     char bar[12];
     bar[0] = '[';
@@ -267,7 +271,7 @@ static void display_status(DedupContext* ctx, const char* path) {
     char progress_str[21];
     snprintf(progress_str, sizeof(progress_str), "%s%s%s", done_str, bar, total_str);
     
-    int fixed_width = 41;
+    int fixed_width = 55;
     int path_max = width - fixed_width - 1;
     if (path_max < 10) path_max = 10;
     
@@ -293,7 +297,7 @@ static void display_status(DedupContext* ctx, const char* path) {
     }
     delta_display[5] = '\0';
     
-    int line_len = 4 + 1 + 4 + 1 + 4 + 1 + 5 + 1 + 20 + 1 + (int)strlen(truncated_path);
+    int line_len = 4 + 1 + 4 + 1 + 4 + 1 + 5 + 1 + 6 + 1 + 6 + 1 + 20 + 1 + (int)strlen(truncated_path);
     int padding = width - line_len;
     if (padding < 0) padding = 0;
     
@@ -305,243 +309,530 @@ static void display_status(DedupContext* ctx, const char* path) {
         padding_str[0] = '\0';
     }
     
-    fprintf(stderr, "\r%-4s %-4s %-4s %s %s %s%s\033[0m\033[K",
-            total_bytes_str, queued_str, shared_str, delta_display,
+    fprintf(stderr, "\r%-4s %-4s %-4s %s %4s/s %4s/s %s %s%s\033[0m\033[K",
+            total_bytes_str, queued_str, shared_str, delta_display, walk_str, visit_str,
             progress_str, truncated_path, padding_str);
     fflush(stderr);
 }
 
-static void visit_order_begin(DedupContext* ctx, uint64_t sequence) {
-    if (!ctx || ctx->thread_count == 0) {
+// Offers the path of the file being worked on to render_work. That's all
+// the status line costs the threads doing the work, the path is only
+// copied once a frame, by whoever comes by first.
+static void display_status(DedupContext* ctx, const char* path) {
+    if (!atomic_load_explicit(&ctx->status_wanted, memory_order_relaxed) ||
+        !atomic_exchange_explicit(&ctx->status_wanted, false, memory_order_relaxed)) {
         return;
     }
+    pthread_mutex_lock(&ctx->status_mutex);
+    strlcpy(ctx->status_path, path, sizeof(ctx->status_path));
+    pthread_mutex_unlock(&ctx->status_mutex);
+}
+
+typedef struct RenderSample {
+    double seconds;
+    size_t walked;
+    size_t visited;
+} RenderSample;
 
-    pthread_mutex_lock(&ctx->visit_order_mutex);
-    while (sequence != ctx->next_visit_sequence) {
-        pthread_cond_wait(&ctx->visit_order_cond, &ctx->visit_order_mutex);
+static double render_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+// Redraws the status line RENDER_HZ times a second from the counters, so
+// terminal output never waits on, or slows down, the threads doing the
+// work. The terminal width is only asked for again after a SIGWINCH.
+static void* render_work(void* ctx) {
+    DedupContext* c = ctx;
+    int width = get_terminal_width();
+    RenderSample samples[RENDER_RATE_FRAMES] = {0};
+    size_t frame = 0;
+    char path[PATH_MAX] = "";
+
+    pthread_mutex_lock(&c->progress_mutex);
+    while (!c->render_done) {
+        // the condition variable waits on the wall clock
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += 1000000000L / RENDER_HZ;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        if (pthread_cond_timedwait(&c->render_stop, &c->progress_mutex, &deadline) != ETIMEDOUT) {
+            continue;
+        }
+
+        if (atomic_exchange(&c->resized, false)) {
+            width = get_terminal_width();
+        }
+        pthread_mutex_lock(&c->status_mutex);
+        if (c->status_path[0]) {
+            strlcpy(path, c->status_path, sizeof(path));
+        }
+        pthread_mutex_unlock(&c->status_mutex);
+        atomic_store_explicit(&c->status_wanted, true, memory_order_relaxed);
+
+        // rates over the frames since the oldest sample kept
+        RenderSample now = {
+            .seconds = render_seconds(),
+            .walked = metrics_sum(&c->metrics, METRIC_TOTAL_FILES),
+            .visited = metrics_sum(&c->metrics, METRIC_COMPLETED),
+        };
+        const RenderSample* oldest = &samples[frame % RENDER_RATE_FRAMES];
+        double elapsed = frame >= RENDER_RATE_FRAMES ? now.seconds - oldest->seconds : 0.0;
+        size_t walk_rate = elapsed > 0.0 ? (size_t)((double)(now.walked - oldest->walked) / elapsed) : 0;
+        size_t visit_rate = elapsed > 0.0 ? (size_t)((double)(now.visited - oldest->visited) / elapsed) : 0;
+        samples[frame % RENDER_RATE_FRAMES] = now;
+        frame++;
+
+        render_status(c, path, width, walk_rate, visit_rate);
     }
-    pthread_mutex_unlock(&ctx->visit_order_mutex);
+    pthread_mutex_unlock(&c->progress_mutex);
+    return NULL;
+}
+
+// Called once a worker is done with an entry, whether it was deduplicated,
+// skipped, or unreadable.
+static void finish_entry(FileEntry* fe, DedupContext* ctx) {
+    metrics_add(&ctx->metrics, METRIC_COMPLETED, 1);
+
+    // Show worker progress (entry processed)
+    display_status(ctx, fe->path);
+    file_entry_free(fe);
+}
+
+// The walker reads clone ids in bulk where the file system supports it,
+// otherwise the clone id is looked up once and cached on the entry.
+static uint64_t entry_clone_id(FileEntry* fe) {
+    if (!fe->has_clone_id) {
+        uint64_t start = stage_clock();
+        fe->clone_id = get_clone_id_at(dir_handle_fd(fe->dir), fe->name);
+        fe->has_clone_id = true;
+        stage_record(STAGE_CLONE_ID, start);
+    }
+    return fe->clone_id;
 }
 
-static void visit_order_end(DedupContext* ctx) {
-    if (!ctx || ctx->thread_count == 0) {
+// Journals `fe` as done, a resumed run skips it while it's unchanged.
+static void checkpoint_entry(const FileEntry* fe, DedupContext* ctx) {
+    if (!ctx->checkpoint) {
         return;
     }
+    CheckpointFile file = {
+        .device = fe->device,
+        .inode = fe->inode,
+        .size = fe->size,
+        .mtime = fe->mtime,
+    };
+    checkpoint_record_done(ctx->checkpoint, &file);
+}
+
+// Replaces the duplicate at `path` with `origin` the way the user asked for.
+// `dir` is the open directory of `path`, if there is one.
+static int replace_duplicate(const DedupContext* ctx, const char* origin, const char* path, const DirHandle* dir) {
+    uint64_t start = stage_clock();
+    int result = 0;
+    switch (ctx->replace_mode) {
+    case DEDUP_CLONE:
+        // through the handles the compare left in the cache,
+        // replace_with_clone would resolve both paths again several times
+        result = replace_with_clone_cached(ctx->handles, origin, path, dir);
+        break;
+    case DEDUP_LINK:
+        result = replace_with_link(origin, path);
+        break;
+    case DEDUP_SYMLINK:
+        result = replace_with_symlink(origin, path);
+        break;
+    }
+    stage_record(STAGE_REPLACE, start);
+    return result;
+}
 
-    pthread_mutex_lock(&ctx->visit_order_mutex);
-    ctx->next_visit_sequence++;
-    pthread_cond_broadcast(&ctx->visit_order_cond);
-    pthread_mutex_unlock(&ctx->visit_order_mutex);
+// Reads the signature of an entry. The handle stays in the cache for the
+// compares that follow if the signature has a candidate.
+static FileSignature* read_signature(FileEntry* fe, DedupContext* ctx) {
+    uint64_t start = stage_clock();
+    FileHandle* handle = file_handle_acquire_at(ctx->handles, dir_handle_fd(fe->dir), fe->name, fe->path);
+    FileSignature* sig = compute_signature_handle(handle, fe->device, fe->size);
+    file_handle_release(ctx->handles, handle);
+    stage_record(STAGE_SIGNATURE, start);
+    return sig;
 }
 
-void visit_entry(FileEntry* fe, Progress* p, DedupContext* ctx) {
-    if (!fe || !ctx) {
-        return;
+// Uses the signature recorded by an earlier run if the file is unchanged,
+// otherwise reads the file and records the result for the next run.
+static FileSignature* entry_signature(FileEntry* fe, DedupContext* ctx) {
+    if (!ctx->sig_cache) {
+        return read_signature(fe, ctx);
     }
 
-    FileSignature* sig = compute_signature(fe->path, fe->device, fe->size);
-    visit_order_begin(ctx, fe->sequence);
+    SigCacheKey key = {
+        .device = fe->device,
+        .inode = fe->inode,
+        .size = fe->size,
+        .mtime = fe->mtime,
+        .clone_id = entry_clone_id(fe),
+    };
+    FileSignature* sig = sig_cache_lookup(ctx->sig_cache, &key);
     if (!sig) {
-        // Silently skip files we can't read (locked, slow FUSE mounts, etc)
-        visit_order_end(ctx);
+        sig = read_signature(fe, ctx);
+        if (sig) {
+            sig_cache_store(ctx->sig_cache, &key, sig);
+        }
+    }
+    return sig;
+}
+
+// Replaces `fe` with `origin`, a file with the same content, unless the two
+// already share their blocks or `fe` must be left alone.
+static void replace_entry(FileEntry* fe, const char* origin, uint64_t origin_clone_id, ino_t origin_inode,
+                          DedupContext* ctx) {
+    // the origin itself, seen again by --watch after another change
+    if (fe->inode == origin_inode && fe->nlink <= 1) {
         return;
     }
 
-    // Insert into signature table and check for duplicates
-    if (!ctx->signatures) {
-        PROGRESS_LOCK(ctx->progress, &ctx->progress_mutex, {
-            clear_progress();
-            fprintf(stderr, "signature table not initialized for %s\n", fe->path);
-        });
-        free_signature(sig);
-        visit_order_end(ctx);
+    // Check if already deduplicated
+    if ((ctx->replace_mode == DEDUP_CLONE && entry_clone_id(fe) == origin_clone_id) ||
+        (ctx->replace_mode == DEDUP_LINK && fe->inode == origin_inode)) {
+        metrics_add(&ctx->metrics, METRIC_ALREADY_SAVED, fe->size);
         return;
     }
 
-    pthread_mutex_lock(&ctx->signatures_mutex);
-    size_t table_size_before = sig_table_size(ctx->signatures);
-    SigTableEntry* existing = sig_table_insert(ctx->signatures, sig, fe->path, get_clone_id(fe->path));
-    size_t table_size_after = sig_table_size(ctx->signatures);
-    pthread_mutex_unlock(&ctx->signatures_mutex);
+    // Skip if hardlinked and not forcing, unless all of its links can be
+    // replaced together once the traversal is done
+    if (!ctx->force && fe->nlink > 1) {
+        if (link_clusters_defer(ctx->link_clusters, fe->device, fe->inode, origin, fe->signature->quick_hash)) {
+            return;
+        }
+        if (ctx->verbosity) {
+            PROGRESS_LOCK(ctx->progress, &ctx->progress_mutex, {
+                clear_progress();
+                printf("skipping %s, hardlinked\n", fe->path);
+            });
+        }
+        metrics_add(&ctx->metrics, METRIC_ALREADY_SAVED, fe->size);
+        return;
+    }
 
-    // Safety check: table size should only increase by 0 or 1
-    if (table_size_after > table_size_before + 1) {
+    // Skip if immutable or read-only
+    if (fe->flags & UF_IMMUTABLE || fe->flags & SF_IMMUTABLE ||
+        (faccessat(dir_handle_fd(fe->dir), fe->name, W_OK, 0) != 0)) {
+        metrics_add(&ctx->metrics, METRIC_ALREADY_SAVED, fe->size);
+        return;
+    }
+
+    // Perform deduplication
+    if (ctx->dry_run) {
+        if (ctx->verbosity) {
+            PROGRESS_LOCK(ctx->progress, &ctx->progress_mutex, {
+                clear_progress();
+                printf("would deduplicate %s to %s\n", fe->path, origin);
+            });
+        }
+        metrics_add(&ctx->metrics, METRIC_SAVED, fe->size);
+        metrics_add(&ctx->metrics, METRIC_FOUND, 1);
+        return;
+    }
+
+    // Check if clone conversion is disabled
+    if (ctx->replace_mode == DEDUP_CLONE && !ctx->clone_converted) {
+        // Skip clone conversion, just count as already saved
+        metrics_add(&ctx->metrics, METRIC_ALREADY_SAVED, fe->size);
+        return;
+    }
+
+    uint64_t replace_start = stage_clock();
+    int result = replace_duplicate(ctx, origin, fe->path, fe->dir);
+    uint64_t replace_ticks = stage_clock() - replace_start;
+    // the path may now name a different file
+    file_handle_forget(ctx->handles, fe->path);
+
+    if (result) {
+        // Silently skip clone failures (permissions, filesystem issues, etc)
+        return;
+    }
+
+    if (ctx->verbosity) {
         PROGRESS_LOCK(ctx->progress, &ctx->progress_mutex, {
             clear_progress();
-            fprintf(stderr, "warning: signature table size increased by %zu (expected 0 or 1)\n",
-                    table_size_after - table_size_before);
+            printf("deduplicated %s\n", fe->path);
         });
     }
 
-    bool table_took_ownership = (table_size_after > table_size_before);
-
-    if (existing) {
-        // Found a duplicate
-        display_status(ctx, fe->path);
-
-        // Check if already deduplicated
-        uint64_t current_clone_id = get_clone_id(fe->path);
-        if ((ctx->replace_mode == DEDUP_CLONE && current_clone_id == existing->clone_id) ||
-            (ctx->replace_mode == DEDUP_LINK && fe->inode == get_inode(existing->path))) {
-            pthread_mutex_lock(&ctx->metrics_mutex);
-            ctx->already_saved += fe->size;
-            pthread_mutex_unlock(&ctx->metrics_mutex);
-            free_signature(sig);
-            visit_order_end(ctx);
-            return;
+    // Verify clone worked if using clone mode
+    if (ctx->replace_mode == DEDUP_CLONE) {
+        uint64_t new_clone_id = get_clone_id_at(dir_handle_fd(fe->dir), fe->name);
+        if (new_clone_id != origin_clone_id) {
+            if (private_size_at(dir_handle_fd(fe->dir), fe->name) != 0) {
+                result = -1; // Mark as failed
+            }
+            // Else: clone_id mismatch but no private data = success
         }
+    }
 
-        // Skip if hardlinked and not forcing
-        if (!ctx->force && fe->nlink > 1) {
-            if (ctx->verbosity) {
-                PROGRESS_LOCK(ctx->progress, &ctx->progress_mutex, {
-                    clear_progress();
-                    printf("skipping %s, hardlinked\n", fe->path);
-                });
+    if (result == 0) {
+        metrics_add(&ctx->metrics, METRIC_SAVED, fe->size);
+        metrics_add(&ctx->metrics, METRIC_FOUND, 1);
+
+        if (ctx->checkpoint) {
+            // the path names the replacement now, journal that file as done
+            struct stat st;
+            if (fstatat(dir_handle_fd(fe->dir), fe->name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+                fe->inode = st.st_ino;
+                fe->mtime = st.st_mtimespec;
             }
-            pthread_mutex_lock(&ctx->metrics_mutex);
-            ctx->already_saved += fe->size;
-            pthread_mutex_unlock(&ctx->metrics_mutex);
-            free_signature(sig);
-            visit_order_end(ctx);
-            return;
+            checkpoint_record_clone(ctx->checkpoint, origin, fe->path);
         }
 
-        // Skip if immutable or read-only
-        if (fe->flags & UF_IMMUTABLE || fe->flags & SF_IMMUTABLE ||
-            (access(fe->path, W_OK) != 0)) {
-            pthread_mutex_lock(&ctx->metrics_mutex);
-            ctx->already_saved += fe->size;
-            pthread_mutex_unlock(&ctx->metrics_mutex);
-            free_signature(sig);
-            visit_order_end(ctx);
-            return;
+        if (ctx->summary) {
+            SummaryRecord record = {
+                .origin = origin,
+                .clone = fe->path,
+                .size = fe->size,
+                .quick_hash = fe->signature->quick_hash,
+                .replace_ns = stage_ticks_to_ns(replace_ticks),
+            };
+            summary_log_record(ctx->summary, &record);
         }
+    } else {
+        metrics_add(&ctx->metrics, METRIC_ALREADY_SAVED, fe->size); // Count as already saved to avoid double counting
+    }
+}
 
-        // Perform deduplication
-        if (ctx->dry_run) {
-            if (ctx->verbosity) {
-                PROGRESS_LOCK(ctx->progress, &ctx->progress_mutex, {
-                    clear_progress();
-                    printf("would deduplicate %s to %s\n", fe->path, existing->path);
-                });
-            }
-            pthread_mutex_lock(&ctx->metrics_mutex);
-            ctx->saved += fe->size;
-            ctx->found++;
-            pthread_mutex_unlock(&ctx->metrics_mutex);
-        } else {
-            // Check if clone conversion is disabled
-            if (ctx->replace_mode == DEDUP_CLONE && !ctx->clone_converted) {
-                // Skip clone conversion, just count as already saved
-                pthread_mutex_lock(&ctx->metrics_mutex);
-                ctx->already_saved += fe->size;
-                pthread_mutex_unlock(&ctx->metrics_mutex);
-                free_signature(sig);
-                visit_order_end(ctx);
-                return;
-            }
-            
-            int result = 0;
-            switch (ctx->replace_mode) {
-            case DEDUP_CLONE:
-                result = replace_with_clone(existing->path, fe->path);
-                break;
-            case DEDUP_LINK:
-                result = replace_with_link(existing->path, fe->path);
-                break;
-            case DEDUP_SYMLINK:
-                result = replace_with_symlink(existing->path, fe->path);
-                break;
-            }
+// Hands an entry the full table has no match for to the merge after the
+// traversal.
+static void spill_entry(FileEntry* fe, DedupContext* ctx) {
+    SpillRecord record = {
+        .signature = *fe->signature,
+        .sequence = fe->sequence,
+        .clone_id = entry_clone_id(fe),
+        .inode = fe->inode,
+        .nlink = (uint32_t)fe->nlink,
+        .flags = fe->flags,
+        .path = fe->path,
+    };
+    if (!spill_set_add(ctx->spill, &record)) {
+        PROGRESS_LOCK(ctx->progress, &ctx->progress_mutex, {
+            clear_progress();
+            fprintf(stderr, "failed to spill signature for %s\n", fe->path);
+        });
+    }
+}
 
-            if (result) {
-                // Silently skip clone failures (permissions, filesystem issues, etc)
-                free_signature(sig);
-                visit_order_end(ctx);
-                return;
-            } else {
-                if (ctx->verbosity) {
-                    PROGRESS_LOCK(ctx->progress, &ctx->progress_mutex, {
-                        clear_progress();
-                        printf("deduplicated %s\n", fe->path);
-                    });
-                }
+// Matches an entry whose signature has been computed against the signature
+// table and replaces it if a duplicate is found. Entries of the same
+// (device, size) group reach this point one at a time, in traversal order.
+// Once the table has used up the memory limit, entries without a match are
+// spilled rather than added.
+//
+// Returns the next entry of the group released by `visit_order_end`, if any.
+static FileEntry* visit_signature(FileEntry* fe, const GroupVerdict* verdict, DedupContext* ctx) {
+    // Insert into signature table and check for duplicates
+    if (!ctx->signatures) {
+        PROGRESS_LOCK(ctx->progress, &ctx->progress_mutex, {
+            clear_progress();
+            fprintf(stderr, "signature table not initialized for %s\n", fe->path);
+        });
+        return visit_order_end(ctx->visit_order, fe);
+    }
 
-                // Verify clone worked if using clone mode
-                if (ctx->replace_mode == DEDUP_CLONE) {
-                    uint64_t new_clone_id = get_clone_id(fe->path);
-                    if (new_clone_id != existing->clone_id) {
-                        if (private_size(fe->path) != 0) {
-                            result = -1; // Mark as failed
-                        }
-                        // Else: clone_id mismatch but no private data = success
-                    }
-                }
+    FileSignature* sig = fe->signature;
 
-                if (result == 0) {
-                    pthread_mutex_lock(&ctx->metrics_mutex);
-                    ctx->saved += fe->size;
-                    ctx->found++;
-                    pthread_mutex_unlock(&ctx->metrics_mutex);
-                    
-                    // Write clone operation to summary file (streamed)
-                    if (ctx->summary_file) {
-                        clone_summary_write(existing->path, fe->path, fe->size);
-                    }
-                } else {
-                    pthread_mutex_lock(&ctx->metrics_mutex);
-                    ctx->already_saved += fe->size; // Count as already saved to avoid double counting
-                    pthread_mutex_unlock(&ctx->metrics_mutex);
-                }
-            }
-        }
+    bool spilling = ctx->spill && sig_table_bytes(ctx->signatures) >= ctx->table_limit;
+    bool stored = false;
+    SigTableEntry* existing = spilling
+        ? sig_table_find(ctx->signatures, sig, fe->path, verdict)
+        : sig_table_insert(ctx->signatures, sig, fe->path, fe->dir, entry_clone_id(fe), fe->inode, verdict, &stored);
+
+    // the origin for this group has been decided, later entries of the
+    // group no longer need to wait on the rest of this visit
+    FileEntry* successor = visit_order_end(ctx->visit_order, fe);
+
+    char origin[PATH_MAX];
+    if (existing && !sig_table_entry_path(existing, origin, sizeof(origin))) {
+        // too long to be passed to the system either
+        return successor;
+    }
 
-        free_signature(sig);
+    if (existing) {
+        // Found a duplicate
+        display_status(ctx, fe->path);
+        replace_entry(fe, origin, existing->clone_id, existing->inode, ctx);
+        checkpoint_entry(fe, ctx);
+    } else if (spilling) {
+        spill_entry(fe, ctx);
     } else {
         // First instance of this signature
-        if (table_took_ownership) {
+        if (stored) {
             display_status(ctx, fe->path);
+            if (ctx->checkpoint) {
+                CheckpointOrigin record = {
+                    .signature = *sig,
+                    .clone_id = entry_clone_id(fe),
+                    .inode = fe->inode,
+                    .path = fe->path,
+                };
+                checkpoint_record_origin(ctx->checkpoint, &record);
+                checkpoint_entry(fe, ctx);
+            }
         } else {
-            // Table failed to take ownership (allocation failure)
+            // Table failed to store the signature (allocation failure)
             PROGRESS_LOCK(ctx->progress, &ctx->progress_mutex, {
                 clear_progress();
                 fprintf(stderr, "failed to store signature for %s: memory allocation failed\n", fe->path);
             });
-            free_signature(sig);
         }
     }
 
-    visit_order_end(ctx);
+    return successor;
+}
+
+// Reads the members of a batch that share the signature of its first entry
+// together with the table entries they could match, if that saves reading
+// any of them more than once. Returns NULL if pairwise compares will do.
+static GroupVerdict* verify_batch(FileEntry* const* batch, size_t count, DedupContext* ctx) {
+    const FileSignature* sig = batch[0]->signature;
+    const SigTableEntry* candidates[GROUP_VERIFY_MAX_MEMBERS];
+    const char* paths[GROUP_VERIFY_MAX_MEMBERS];
+    size_t candidate_count = sig_table_candidates(ctx->signatures, sig, candidates, GROUP_VERIFY_MAX_MEMBERS - 1);
+    size_t members = candidate_count;
+    for (size_t i = 0; i < count && members < GROUP_VERIFY_MAX_MEMBERS; i++) {
+        if (signatures_match(batch[i]->signature, sig)) {
+            paths[members++] = batch[i]->path;
+        }
+    }
+
+    // with a single candidate and a single arrival there is nothing to share
+    if (members < 3) {
+        return NULL;
+    }
+
+    // table entries only keep their name next to a shared directory
+    char (*candidate_paths)[PATH_MAX] = malloc(candidate_count * sizeof(*candidate_paths));
+    if (candidate_count > 0 && !candidate_paths) {
+        return NULL;
+    }
+    for (size_t i = 0; i < candidate_count; i++) {
+        if (!sig_table_entry_path(candidates[i], candidate_paths[i], sizeof(candidate_paths[i]))) {
+            free(candidate_paths);
+            return NULL;
+        }
+        paths[i] = candidate_paths[i];
+    }
+
+    // the verdict keeps copies of the paths
+    GroupVerdict* verdict = new_group_verdict(ctx->handles, paths, members, batch[0]->size);
+    free(candidate_paths);
+    return verdict;
+}
+
+static void visit_runnable(FileEntry* fe, DedupContext* ctx);
+
+// Visits `fe` along with the entries parked directly behind it, reading
+// their signature group once for all of them.
+//
+// Returns the next entry of the group released by `visit_order_end`, if any.
+static FileEntry* visit_batch(FileEntry* fe, DedupContext* ctx) {
+    FileEntry* batch[GROUP_VERIFY_MAX_MEMBERS];
+    batch[0] = fe;
+    size_t count = 1 + visit_order_take_parked(ctx->visit_order, fe, batch + 1, GROUP_VERIFY_MAX_MEMBERS - 1);
+
+    GroupVerdict* verdict = ctx->signatures ? verify_batch(batch, count, ctx) : NULL;
+    FileEntry* successor = NULL;
+    for (size_t i = 0; i < count; i++) {
+        successor = visit_signature(batch[i], verdict, ctx);
+        finish_entry(batch[i], ctx);
+        if (successor && i + 1 < count) {
+            // only happens once the group has given up on ordering
+            visit_runnable(successor, ctx);
+            successor = NULL;
+        }
+    }
+    free_group_verdict(verdict);
+
+    return successor;
+}
+
+// Visits an entry that holds its group's turn, and whatever its group
+// releases after it. Takes ownership of `fe`.
+static void visit_runnable(FileEntry* fe, DedupContext* ctx) {
+    while (fe) {
+        fe = visit_batch(fe, ctx);
+    }
+}
+
+// Visits an entry and any entries of its group that were parked behind it.
+// Takes ownership of `fe`.
+void visit_entry(FileEntry* fe, Progress* p, DedupContext* ctx) {
+    if (!fe || !ctx) {
+        return;
+    }
+
+    if (!fe->signature) {
+        fe->signature = entry_signature(fe, ctx);
+    }
+
+    if (!fe->signature) {
+        // Silently skip files we can't read (locked, slow FUSE mounts, etc)
+        FileEntry* successor = visit_order_end(ctx->visit_order, fe);
+        finish_entry(fe, ctx);
+        fe = successor;
+    } else if (!visit_order_begin(ctx->visit_order, fe)) {
+        // an earlier entry with the same device and size is still being
+        // visited, whoever finishes it will continue with this one
+        return;
+    }
+
+    visit_runnable(fe, ctx);
+}
+
+static inline uint64_t version_mix(uint64_t h) {
+    h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+    return h ^ (h >> 31);
+}
+
+// Whether --watch hands out a file that changed since it was last looked
+// at. Its inode and clone id are seen already, but a file written in place
+// keeps both and has to be looked at again.
+static bool entry_changed(const FileEntry* fe, const DedupContext* c) {
+    if (!c->seen_versions) {
+        return false;
+    }
+
+    uint64_t high = version_mix((uint64_t)fe->device ^ version_mix(fe->size));
+    uint64_t low = version_mix((uint64_t)fe->inode ^
+                               version_mix((uint64_t)fe->mtime.tv_sec ^ version_mix((uint64_t)fe->mtime.tv_nsec)));
+    bool seen = seen_set_insert(c->seen_versions, high, low);
+    return !seen && fe->sequence >= atomic_load_explicit(&c->watch_sequence, memory_order_relaxed);
 }
 
 // Returns true if the entry was pruned (caller should free it), false if it survived.
-static bool prune_entry(FileEntry* fe, SeenSet* seen_inodes, SeenSet* seen_clones, DedupContext* c) {
+static bool prune_entry(FileEntry* fe, DedupContext* c) {
+    // a changed file is still recorded, so that its other links and clones
+    // in the same batch are pruned
+    bool changed = entry_changed(fe, c);
     if (fe->nlink > 1) {
-        uint64_t key = (uint64_t)fe->device << 32 | (uint64_t)(fe->inode & 0xFFFFFFFF);
-        if (seen_set_insert(seen_inodes, key)) {
-            pthread_mutex_lock(&c->metrics_mutex);
-            c->already_saved += fe->size;
-            c->pruned++;
-            pthread_mutex_unlock(&c->metrics_mutex);
-            PROGRESS_LOCK(c->progress, &c->progress_mutex, {
-                c->progress->completedUnitCount++;
-            });
+        if (seen_set_insert(c->seen_inodes, (uint64_t)fe->device, (uint64_t)fe->inode) && !changed) {
+            metrics_add(&c->metrics, METRIC_ALREADY_SAVED, fe->size);
+            metrics_add(&c->metrics, METRIC_PRUNED, 1);
+            metrics_add(&c->metrics, METRIC_COMPLETED, 1);
             display_status(c, fe->path);
             return true;
         }
     }
 
-    uint64_t clone_id = get_clone_id(fe->path);
+    uint64_t clone_id = entry_clone_id(fe);
     if (clone_id != 0) {
-        if (seen_set_insert(seen_clones, clone_id)) {
-            pthread_mutex_lock(&c->metrics_mutex);
-            c->already_saved += fe->size;
-            c->pruned++;
-            pthread_mutex_unlock(&c->metrics_mutex);
-            PROGRESS_LOCK(c->progress, &c->progress_mutex, {
-                c->progress->completedUnitCount++;
-            });
+        // clone ids are only unique within a volume
+        if (seen_set_insert(c->seen_clones, (uint64_t)fe->device, clone_id) && !changed) {
+            metrics_add(&c->metrics, METRIC_ALREADY_SAVED, fe->size);
+            metrics_add(&c->metrics, METRIC_PRUNED, 1);
+            metrics_add(&c->metrics, METRIC_COMPLETED, 1);
             display_status(c, fe->path);
             return true;
         }
@@ -550,285 +841,399 @@ static bool prune_entry(FileEntry* fe, SeenSet* seen_inodes, SeenSet* seen_clone
     return false;
 }
 
-void* prune_work(void* ctx) {
-    DedupContext* c = ctx;
-    SeenSet* seen_inodes = new_seen_set(4096);
-    SeenSet* seen_clones = new_seen_set(4096);
+// Finishes an entry the size gate held back until the end of the traversal.
+// No other file shares its size, so it is never read.
+//
+// Returns the next entry of its group released by `visit_order_end`, if any.
+static FileEntry* finish_unique(FileEntry* fe, DedupContext* c) {
+    FileEntry* successor = visit_order_end(c->visit_order, fe);
+    metrics_add(&c->metrics, METRIC_COMPLETED, 1);
+    display_status(c, fe->path);
+    file_entry_free(fe);
+    return successor;
+}
 
-    for (;;) {
-        pthread_mutex_lock(&c->raw_queue_mutex);
-        FileEntry* fe = file_entry_next(c->raw_queue);
-        pthread_mutex_unlock(&c->raw_queue_mutex);
+// Pushes the successor a pruned or unique entry released, or drops the
+// entry from the queued count if there is none.
+static void pass_successor(FileEntry* successor, DedupContext* c) {
+    if (successor) {
+        // the successor re-enters the work queue, so the queued
+        // count carries over from the entry it replaces
+        file_entry_queue_push(c->queue, successor);
+    } else {
+        metrics_add(&c->metrics, METRIC_QUEUED, -1);
+    }
+}
 
-        if (!fe) {
-            pthread_mutex_lock(&c->scan_done_mutex);
-            uint8_t done = c->scan_done;
-            pthread_mutex_unlock(&c->scan_done_mutex);
-            if (done) {
-                // Drain remaining entries
-                pthread_mutex_lock(&c->raw_queue_mutex);
-                fe = file_entry_next(c->raw_queue);
-                pthread_mutex_unlock(&c->raw_queue_mutex);
-                if (!fe) break;
-            } else {
-                usleep(100);
-                continue;
-            }
+// Prints the stage timings whenever SIGINFO (^T) arrives, the way the BSD
+// tools report their progress, and tells render_work about SIGWINCH. The
+// signals are blocked in every other thread, so neither has to be async
+// signal safe.
+static void* siginfo_work(void* ctx) {
+    DedupContext* c = ctx;
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGINFO);
+    sigaddset(&set, SIGWINCH);
+
+    int sig = 0;
+    while (sigwait(&set, &sig) == 0 && !atomic_load(&c->siginfo_done)) {
+        if (sig == SIGWINCH) {
+            atomic_store(&c->resized, true);
+            continue;
         }
+        pthread_mutex_lock(&c->progress_mutex);
+        if (c->progress) {
+            clear_progress();
+        }
+        stage_print(stderr);
+        pthread_mutex_unlock(&c->progress_mutex);
+    }
+    return NULL;
+}
 
-        // Decrement queued_count for raw_queue pop
-        pthread_mutex_lock(&c->metrics_mutex);
-        c->queued_count--;
-        pthread_mutex_unlock(&c->metrics_mutex);
+// Several pruners run side by side, the seen sets are safe to share and
+// the size gate is used under its mutex. Which link or clone of a file
+// survives then depends on which pruner gets to it first.
+void* prune_work(void* ctx) {
+    DedupContext* c = ctx;
 
-        if (prune_entry(fe, seen_inodes, seen_clones, c)) {
+    FileEntry* fe = NULL;
+    while ((fe = file_entry_queue_pop(c->raw_queue)) != NULL) {
+        if (prune_entry(fe, c)) {
+            // a pruned entry may have been the one its group was waiting on
+            pass_successor(visit_order_end(c->visit_order, fe), c);
             file_entry_free(fe);
             continue;
         }
 
-        // Survivor: pass to work queue
-        // queued_count stays the same (file moves between queues)
-        pthread_mutex_lock(&c->queue_mutex);
-        file_entry_queue_append(c->queue,
-                                fe->path,
-                                fe->device,
-                                fe->inode,
-                                fe->nlink,
-                                fe->flags,
-                                fe->size,
-                                fe->sequence,
-                                fe->level);
-        pthread_mutex_unlock(&c->queue_mutex);
-        
         // Show pruner progress (survivor passes through)
         display_status(c, fe->path);
-        file_entry_free(fe);
+
+        // Survivor: pass to work queue once another file of its size has
+        // shown up, the workers own it from here on
+        // queued count stays the same (file moves between queues)
+        FileEntry* runnable[2];
+        pthread_mutex_lock(&c->size_gate_mutex);
+        size_t runnable_count = size_gate_offer(c->size_gate, fe, runnable);
+        if (runnable_count == 0) {
+            // most sizes are unique, held entries that kept their directory
+            // open would use up the directories the others could have had
+            file_entry_drop_dir(fe);
+        }
+        pthread_mutex_unlock(&c->size_gate_mutex);
+        for (size_t i = 0; i < runnable_count; i++) {
+            file_entry_queue_push(c->queue, runnable[i]);
+        }
     }
 
-    free_seen_set(seen_inodes);
-    free_seen_set(seen_clones);
+    if (atomic_fetch_sub(&c->pruners_running, 1) != 1) {
+        return NULL;
+    }
+
+    // the last pruner out has the gate to itself, whatever it still holds
+    // has a unique size
+    while ((fe = size_gate_drain(c->size_gate)) != NULL) {
+        pass_successor(finish_unique(fe, c), c);
+    }
+
+    // no more survivors, let the workers drain and exit
+    file_entry_queue_close(c->queue);
     return NULL;
 }
 
-void* dedup_work(void* ctx) {
-    DedupContext* c = ctx;
-    uint8_t done = c->prune_done;
+// Asks the kernel to start reading the head of `fe` and of the first entry
+// its signature matches, the compare of the pair will need both.
+static void advise_verification(FileEntry* fe, DedupContext* c) {
+    const SigTableEntry* candidate = NULL;
+    char candidate_path[PATH_MAX];
+    if (fe->size == 0 || sig_table_candidates(c->signatures, fe->signature, &candidate, 1) == 0 ||
+        !sig_table_entry_path(candidate, candidate_path, sizeof(candidate_path))) {
+        return;
+    }
 
-    while (!done) {
-        pthread_mutex_lock(&c->queue_mutex);
-        FileEntry* fe = file_entry_next(c->queue);
-        pthread_mutex_unlock(&c->queue_mutex);
+    size_t len = fe->size < READ_AHEAD_VERIFY_MAX ? (size_t)fe->size : READ_AHEAD_VERIFY_MAX;
+    const char* paths[] = { fe->path, candidate_path };
+    for (size_t i = 0; i < 2; i++) {
+        FileHandle* handle = i == 0 ? file_handle_acquire_at(c->handles, dir_handle_fd(fe->dir), fe->name, fe->path) :
+                                      file_handle_acquire(c->handles, paths[i]);
+        file_handle_advise(handle, 0, len);
+        file_handle_release(c->handles, handle);
+    }
+}
 
-        if (!fe) {
-            pthread_mutex_lock(&c->prune_done_mutex);
-            done = c->prune_done;
-            pthread_mutex_unlock(&c->prune_done_mutex);
-            if (done) {
-                break;
-            }
-            usleep(100);
+// Reads the signatures of the pruner's survivors ahead of the workers, so
+// `read_ahead_depth` reads are in flight while the workers compare and
+// clone. Entries whose signature already matches get the reads of their
+// compare started as well.
+void* read_ahead_work(void* ctx) {
+    DedupContext* c = ctx;
+
+    FileEntry* fe = NULL;
+    while ((fe = file_entry_queue_pop(c->queue)) != NULL) {
+        if (!device_limits_enter(c->device_limits, DEVICE_LANE_READ, fe)) {
+            // the reader leaving the device next reads it
             continue;
         }
 
-        // Decrement queued_count for work_queue pop
-        pthread_mutex_lock(&c->metrics_mutex);
-        c->queued_count--;
-        pthread_mutex_unlock(&c->metrics_mutex);
-
-        // Visit the entry (worker processes the file)
-        visit_entry(fe, c->progress, c);
-
-        PROGRESS_LOCK(c->progress, &c->progress_mutex, {
-            c->progress->completedUnitCount++;
-        });
-        
-        // Show worker progress (entry processed)
-        display_status(c, fe->path);
-        file_entry_free(fe);
+        dev_t device = fe->device;
+        for (; fe; fe = device_limits_leave(c->device_limits, DEVICE_LANE_READ, device)) {
+            // successors released by visit_order_end were read before they
+            // were parked
+            if (!fe->signature) {
+                fe->signature = entry_signature(fe, c);
+                if (fe->signature) {
+                    advise_verification(fe, c);
+                }
+            }
 
-        if (c->thread_count == 0) {
-            break;
+            // queued count stays the same (file moves between queues)
+            file_entry_queue_push(c->ready_queue, fe);
         }
     }
 
+    if (atomic_fetch_sub(&c->readers_running, 1) == 1) {
+        // no more signatures, let the workers drain and exit
+        file_entry_queue_close(c->ready_queue);
+    }
     return NULL;
 }
 
-size_t deduplicate(AList* metadata_set, DedupContext* ctx) {
-    FileMetadata* origin = NULL;
-    char* reason = NULL;
-    // if there is a file with more than one hard link, use that as the
-    // source candidate (optimally a hardlink with the most links)
-    for (size_t i = 0; i < alist_size(metadata_set); i++) {
-        FileMetadata* fm = alist_get(metadata_set, i);
-        if (fm->nlink > 1 && (!origin || origin->nlink < fm->nlink)) {
-            origin = fm;
-            reason = "most hardlinks";
-        }
-    }
-
-    // otherwise, use the file with the most clones.
-    if (!origin) {
-        rb_tree_t* clone_counts = new_clone_id_counts();
-        for (size_t i = 0; i < alist_size(metadata_set); i++) {
-            FileMetadata* fm = alist_get(metadata_set, i);
-            clone_id_tree_increment(clone_counts, fm);
-        }
-
-        if (rb_tree_count(clone_counts) == 1) {
-            origin = alist_get(metadata_set, 0);
-            ctx->already_saved += origin->size * (alist_size(metadata_set) - 1);
-            if (ctx->verbosity) {
-                printf("%s is already cloned to\n",
-                       origin->path);
-                for (size_t i = 1; i < alist_size(metadata_set); i++) {
-                    FileMetadata* fm = alist_get(metadata_set, i);
-                    printf("\t%s\n", fm->path);
-                }
-            }
-            free_clone_id_counts(clone_counts);
-            clone_counts = NULL;
-            return 0;
-        }
-
-        // none of the files are cloned (they all of a clone count of 1)
-        if (rb_tree_count(clone_counts) == alist_size(metadata_set)) {
-            // find the first file that is not compressed
-            //
-            // n.b.! transparently compressed files will have the UF_COMPRESSED
-            //       flag set, compressed data in the resource fork, and an
-            //       xattr named `com.apple.decmpfs`. since the data for the
-            //       file is actually stored in metadata, these files cannot
-            //       share data blocks, so they are worthless for using as
-            //       clone origins.
-            for (size_t i = 0; i < alist_size(metadata_set); i++) {
-                FileMetadata* fm = alist_get(metadata_set, i);
-                if (fm->flags & UF_COMPRESSED) {
-                    if (ctx->verbosity > 1) {
-                        printf("found a compressed file: %s\n", fm->path);
-                    }
-                    continue;
-                }
-                origin = fm;
-                reason = "first seen";
-                break;
-            }
+void* dedup_work(void* ctx) {
+    DedupContext* c = ctx;
+    FileEntryQueue* work_queue = c->ready_queue ? c->ready_queue : c->queue;
 
-            if (!origin) {
-                if (ctx->verbosity) {
-                    printf("All files in this set use HFS compression. Remove HFS compression from at least one to "
-                           "replace with clones:\n");
-                    for (size_t i = 0; i < alist_size(metadata_set); i++) {
-                        FileMetadata* fm = alist_get(metadata_set, i);
-                        printf("\t%s\n", fm->path);
-                    }
-                }
-                free_clone_id_counts(clone_counts);
-                return 0;
-            }
-        } else {
-            origin = clone_id_tree_max(clone_counts);
-            reason = "most clones";
+    FileEntry* fe = NULL;
+    while ((fe = file_entry_queue_pop(work_queue)) != NULL) {
+        // Decrement queued_count for work_queue pop
+        metrics_add(&c->metrics, METRIC_QUEUED, -1);
+
+        if (!device_limits_enter(c->device_limits, DEVICE_LANE_VISIT, fe)) {
+            // the worker leaving the device next visits it
+            continue;
+        }
+
+        // Visit the entry (worker processes the file), the whole visit is
+        // on its device
+        dev_t device = fe->device;
+        for (; fe; fe = device_limits_leave(c->device_limits, DEVICE_LANE_VISIT, device)) {
+            visit_entry(fe, c->progress, c);
         }
-        free_clone_id_counts(clone_counts);
-        clone_counts = NULL;
     }
 
-    printf("using %s as the clone origin (%s)\n",
-           origin->path,
-           reason);
+    return NULL;
+}
 
-    uint64_t origin_clone_id = get_clone_id(origin->path);
+// Distinct contents a group of spilled files is matched against. Files
+// with the same signature but different content are rare, past this the
+// remaining contents of a group are left alone.
+#define SPILL_ORIGINS_MAX 8
+
+typedef struct SpillOrigin {
+    uint64_t clone_id;
+    ino_t inode;
+    char path[PATH_MAX];
+} SpillOrigin;
+
+typedef struct SpillMerge {
+    DedupContext* ctx;
+    SpillOrigin origins[SPILL_ORIGINS_MAX];
+    size_t origin_count;
+} SpillMerge;
+
+static bool spilled_files_match(DedupContext* ctx, const char* a, const char* b, uint64_t size) {
+    FileHandle* first = file_handle_acquire(ctx->handles, a);
+    FileHandle* second = first ? file_handle_acquire(ctx->handles, b) : NULL;
+    bool matches = second &&
+                   dedup_runtime_witness_compare_handles(first, second, size) &&
+                   dedup_runtime_exact_compare_handles(first, second, size);
+    file_handle_release(ctx->handles, second);
+    file_handle_release(ctx->handles, first);
+    return matches;
+}
 
-    for (size_t i = 0; i < alist_size(metadata_set); i++) {
-        FileMetadata* fm = alist_get(metadata_set, i);
+// Matches a group of spilled files with the same signature among
+// themselves. Groups come in traversal order, so the origin of every
+// content is the first file seen with it, as in the table.
+static void visit_spilled_group(const SpillRecord* records, size_t count, bool continued, void* context) {
+    SpillMerge* merge = context;
+    DedupContext* ctx = merge->ctx;
+    if (!continued) {
+        merge->origin_count = 0;
+    }
 
-        if (fm == origin) {
+    for (size_t i = 0; i < count; i++) {
+        const SpillRecord* record = &records[i];
+        FileEntry* fe = new_file_entry(record->path, record->signature.device, (ino_t)record->inode, record->nlink,
+                                       record->flags, record->signature.size, record->sequence, 0, 0);
+        FileSignature* sig = fe ? malloc(sizeof(FileSignature)) : NULL;
+        if (!sig) {
+            file_entry_free(fe);
             continue;
         }
-
-        if (!ctx->force && fm->nlink > 1) {
-            printf("\tskipping %s, hardlinked\n",
-                   fm->path);
-            ctx->already_saved += fm->size;
-            continue;
+        *sig = record->signature;
+        fe->signature = sig;
+        fe->clone_id = record->clone_id;
+        fe->has_clone_id = true;
+
+        size_t j = 0;
+        while (j < merge->origin_count && !spilled_files_match(ctx, merge->origins[j].path, fe->path, fe->size)) {
+            j++;
         }
-
-        if ((ctx->replace_mode == DEDUP_CLONE && fm->clone_id == origin->clone_id) ||
-            (ctx->replace_mode == DEDUP_LINK && fm->inode == origin->inode)) {
-            printf("\tskipping %s, already cloned\n",
-                   fm->path);
-            ctx->already_saved += fm->size;
-            continue;
+        if (j < merge->origin_count) {
+            display_status(ctx, fe->path);
+            replace_entry(fe, merge->origins[j].path, merge->origins[j].clone_id, merge->origins[j].inode, ctx);
+        } else if (merge->origin_count < SPILL_ORIGINS_MAX) {
+            SpillOrigin* origin = &merge->origins[merge->origin_count++];
+            origin->clone_id = record->clone_id;
+            origin->inode = (ino_t)record->inode;
+            strlcpy(origin->path, record->path, sizeof(origin->path));
         }
+        file_entry_free(fe);
+    }
+}
 
-        if (fm->flags & UF_IMMUTABLE ||
-            fm->flags & SF_IMMUTABLE) {
-            printf("\tskipping %s, immutable\n",
-                   fm->path);
-            continue;
-        }
+// Finds the duplicates among the files spilled during the traversal, once
+// every worker is done.
+static void merge_spilled(DedupContext* ctx) {
+    size_t spilled = spill_set_count(ctx->spill);
+    if (spilled > 0 && ctx->verbosity) {
+        PROGRESS_LOCK(ctx->progress, &ctx->progress_mutex, {
+            clear_progress();
+            printf("matching %zu spilled files\n", spilled);
+        });
+    }
 
-        if (ctx->dry_run) {
-            printf("\tcloning to %s\n",
-                   fm->path);
+    SpillMerge* merge = calloc(1, sizeof(SpillMerge));
+    if (merge) {
+        merge->ctx = ctx;
+    }
+    if (!merge || !spill_set_merge(ctx->spill, visit_spilled_group, merge)) {
+        PROGRESS_LOCK(ctx->progress, &ctx->progress_mutex, {
+            clear_progress();
+            fprintf(stderr, "spilled signatures could not be read back, duplicates may remain\n");
+        });
+    }
+    free(merge);
+}
 
-            ctx->saved += fm->size;
-            continue;
+// Replaces all links of a hardlinked duplicate `replace_entry` deferred,
+// once the traversal has found them. The first link is replaced with the
+// origin, the others are linked to the replacement, so the file keeps its
+// links and its blocks are freed with the last of them.
+static void replace_cluster(const LinkCluster* cluster, void* context) {
+    DedupContext* ctx = context;
+    const LinkClusterLink* first = &cluster->links[0];
+
+    // a link may have been added, removed or replaced since the walk, the
+    // links are looked up in the directories the walk had open, so that a
+    // directory renamed since can't redirect the checks
+    bool complete = link_cluster_complete(cluster);
+    for (size_t i = 0; complete && i < cluster->count; i++) {
+        const LinkClusterLink* link = &cluster->links[i];
+        struct stat st;
+        complete = fstatat(dir_handle_fd(link->dir), link->name, &st, AT_SYMLINK_NOFOLLOW) == 0 &&
+                   st.st_dev == cluster->device && st.st_ino == cluster->inode && st.st_nlink == cluster->nlink;
+    }
+    if (!complete) {
+        if (ctx->verbosity) {
+            PROGRESS_LOCK(ctx->progress, &ctx->progress_mutex, {
+                clear_progress();
+                printf("skipping %s, hardlinked\n", first->path);
+            });
         }
+        metrics_add(&ctx->metrics, METRIC_ALREADY_SAVED, cluster->size);
+        return;
+    }
 
-        int result = 0;
-        switch (ctx->replace_mode) {
-        case DEDUP_CLONE:
-            result = replace_with_clone(origin->path,
-                                        fm->path);
-            break;
-        case DEDUP_LINK:
-            result = replace_with_link(origin->path,
-                                       fm->path);
-            break;
-        case DEDUP_SYMLINK:
-            result = replace_with_symlink(origin->path,
-                                          fm->path);
-            break;
+    // Skip if immutable or read-only
+    if (cluster->flags & UF_IMMUTABLE || cluster->flags & SF_IMMUTABLE ||
+        faccessat(dir_handle_fd(first->dir), first->name, W_OK, 0) != 0) {
+        metrics_add(&ctx->metrics, METRIC_ALREADY_SAVED, cluster->size);
+        return;
+    }
+
+    if (ctx->dry_run) {
+        if (ctx->verbosity) {
+            PROGRESS_LOCK(ctx->progress, &ctx->progress_mutex, {
+                clear_progress();
+                for (size_t i = 0; i < cluster->count; i++) {
+                    printf("would deduplicate %s to %s\n", cluster->links[i].path, cluster->origin);
+                }
+            });
         }
+        metrics_add(&ctx->metrics, METRIC_SAVED, cluster->size);
+        metrics_add(&ctx->metrics, METRIC_FOUND, 1);
+        return;
+    }
 
-        if (result) {
-            perror("clone failed");
-            fprintf(stderr,
-                    "\tcould not clone %s\n",
-                    fm->path);
-            continue;
+    uint64_t replace_start = stage_clock();
+    int result = replace_duplicate(ctx, cluster->origin, first->path, first->dir);
+    file_handle_forget(ctx->handles, first->path);
+    size_t relinked = result == 0 ? 1 : 0;
+    for (size_t i = 1; relinked == i && i < cluster->count; i++) {
+        const LinkClusterLink* link = &cluster->links[i];
+        if (replace_with_link_at(dir_handle_fd(first->dir), first->name,
+                                 dir_handle_fd(link->dir), link->name) == 0) {
+            relinked++;
         }
+        file_handle_forget(ctx->handles, cluster->links[i].path);
+    }
+    uint64_t replace_ticks = stage_clock() - replace_start;
 
-        printf("\tcloned to %s\n",
-               fm->path);
+    // the links not relinked keep the old blocks
+    if (relinked < cluster->count) {
+        if (relinked > 0) {
+            PROGRESS_LOCK(ctx->progress, &ctx->progress_mutex, {
+                clear_progress();
+                warnx("%s: only %zu of its %zu links were replaced", first->path, relinked, cluster->count);
+            });
+        }
+        metrics_add(&ctx->metrics, METRIC_ALREADY_SAVED, cluster->size);
+        return;
+    }
 
-        if (ctx->replace_mode == DEDUP_CLONE && origin_clone_id != get_clone_id(fm->path)) {
-            if (private_size(fm->path) == 0) {
-                fprintf(stderr,
-                        "\t\tclonefile(2) did not clone %s as expected, but it is a clone\n",
-                        fm->path);
-                ctx->already_saved += fm->size;
-                continue;
-            } else {
-                fprintf(stderr,
-                        "\t\tclonefile(2) did not clone %s as expected, did not report an error\n",
-                        fm->path);
-                continue;
+    if (ctx->verbosity) {
+        PROGRESS_LOCK(ctx->progress, &ctx->progress_mutex, {
+            clear_progress();
+            for (size_t i = 0; i < cluster->count; i++) {
+                printf("deduplicated %s\n", cluster->links[i].path);
             }
-        }
+        });
+    }
+    metrics_add(&ctx->metrics, METRIC_SAVED, cluster->size);
+    metrics_add(&ctx->metrics, METRIC_FOUND, 1);
 
-        ctx->saved += fm->size;
+    if (ctx->checkpoint) {
+        checkpoint_record_clone(ctx->checkpoint, cluster->origin, first->path);
+    }
+    if (ctx->summary) {
+        SummaryRecord record = {
+            .origin = cluster->origin,
+            .clone = first->path,
+            .size = cluster->size,
+            .quick_hash = cluster->quick_hash,
+            .replace_ns = stage_ticks_to_ns(replace_ticks),
+        };
+        summary_log_record(ctx->summary, &record);
     }
+}
 
-    return 0;
+// Puts an origin journaled by an interrupted run back into the table, and
+// lets the files sharing its size through the gate, they have a file to be
+// matched against even though it is never offered again.
+static void resume_origin(const CheckpointOrigin* origin, void* context) {
+    DedupContext* ctx = context;
+    FileSignature sig = origin->signature;
+    bool stored = false;
+    sig_table_insert(ctx->signatures, &sig, origin->path, NULL, origin->clone_id, origin->inode, NULL, &stored);
+    size_gate_open(ctx->size_gate, sig.device, sig.size);
 }
 
 __attribute__((noreturn))
 static void usage(char* pgm, DedupContext* ctx) {
     fprintf(stderr,
-            "%s\nusage: %s [-I pattern] [-t n] [-PVcnvx] [-d n] [file ...]\n\n"
+            "%s\nusage: %s [-I pattern] [-t n] [-PVcnvx] [-d n] [-k file] [file ...]\n\n"
                 "Options:\n"
                 // "  --ignore, -I pattern     Exclude a pattern from being used as a clone\n"
                 // "                           source or being replaced by a clone. This option\n"
@@ -836,30 +1241,75 @@ static void usage(char* pgm, DedupContext* ctx) {
                 "  --dry-run, -n            Don't replace file content, just print what \n"
                 "                           would have happend.\n"
                 "  --depth, -d depth        Don't descend further than the specified depth.\n"
+                "  --device-threads list    The threads each stage may use on one device by\n"
+                "                           its kind, e.g. hdd=1,network=8. 0 is no limit.\n"
+                "                           Default: ssd=0,hdd=2,network=4\n"
                 "  --format, -F format      Output format for byte sizes. See --help formats.\n"
+                "  --io-depth, -Q n         The number of file reads kept in flight ahead of\n"
+                "                           the threads comparing files. Default: %d\n"
+                "  --inline-size size       Keep the content of files up to size bytes with\n"
+                "                           their signature and compare them in memory.\n"
+                "                           0 disables it. Default: 4K, at most 64K\n"
                 "  --one-file-system, -x    Don't evaluate directories on a different device\n"
                 "                           than the starting paths.\n"
+                "  --cache, -k file         Keep file signatures in file and reuse them for\n"
+                "                           unchanged files on the next run.\n"
+                "  --checkpoint file        Journal the progress of the run in file.\n"
                 "  --link, -l               Use hardlinks instead of clones.\n"
+                "  --memory-limit, -M size  Keep the signatures in about size bytes of\n"
+                "                           memory, files past that are sorted on disk in\n"
+                "                           $TMPDIR and matched once the traversal is done.\n"
+                "                           Not covered, and still growing with the tree:\n"
+                "                           the files waiting for another of their size,\n"
+                "                           the hard links collected and the inodes and\n"
+                "                           clones seen.\n"
                 "  --symlink, -s            Use symlinks instead of clones.\n"
                 // "  --color, -c              Enabled colored output.\n"
                 "  --no-progress, -P        Do not display a progress bar.\n"
                 "  --no-clone-conversion    Do not convert clones (skip clone mode)\n"
+                "  --resume                 Continue the run journaled by --checkpoint,\n"
+                "                           skipping the files it finished.\n"
+                "  --recalibrate            Measure the speed of the hash and compare\n"
+                "                           backends again, update the calibration cache\n"
+                "                           and exit.\n"
                 "  --summary, -S file       Write detailed cloning summary to file\n"
                 "                           (itemized by directory hierarchy)\n"
+                "  --summary-format format  Format of the summary, text or jsonl.\n"
+                "                           Default: text\n"
                 "  --threads, -t n          The number of threads to use for file building\n"
                 "                           lookup tables and replacing clones. Default: %d\n"
+                "  --unordered, -U          Don't keep the first file seen as the clone\n"
+                "                           origin when using multiple threads.\n"
                 "  --verbose, -v            Increase verbosity. May be used multiple times.\n"
+                "  --watch                  Keep running after the traversal and deduplicate\n"
+                "                           files as they are added, until interrupted.\n"
                 "  --version, -V            Print the version and exit\n"
                 // "  --force, -f              Don't preserve existing hardlinks.\n"
                 "  -h                       Human readable output.\n"
                 "  --help                   Show this help.\n",
             version,
             pgm,
+            ctx->read_ahead_depth,
             ctx->thread_count);
 
     exit(1);
 }
 
+// Prints what the run cost in the terms test/bench reports, the kernel
+// counts system calls per task and ru_maxrss is in bytes on macOS.
+static void print_resource_usage(void) {
+    uint64_t syscalls = 0;
+    task_events_info_data_t events;
+    mach_msg_type_number_t count = TASK_EVENTS_INFO_COUNT;
+    if (task_info(mach_task_self(), TASK_EVENTS_INFO, (task_info_t)&events, &count) == KERN_SUCCESS) {
+        syscalls = (uint64_t)(uint32_t)events.syscalls_unix + (uint64_t)(uint32_t)events.syscalls_mach;
+    }
+
+    struct rusage usage = {0};
+    getrusage(RUSAGE_SELF, &usage);
+    printf("resources: %" PRIu64 " system calls, %ld bytes peak memory\n", syscalls, (long)usage.ru_maxrss);
+}
+
 __attribute__((const))
 int32_t cpu_count() {
     int32_t c = 0;
@@ -869,7 +1319,7 @@ int32_t cpu_count() {
 }
 
 __attribute__((const))
-bool is_vol_cap_supported(char* path, int vol_cap) {
+bool is_vol_cap_supported(const char* path, int vol_cap) {
     struct VolAttrsBuf {
         u_int32_t length;
         vol_capabilities_attr_t capabilities;
@@ -912,7 +1362,7 @@ bool is_vol_cap_supported(char* path, int vol_cap) {
 }
 
 __attribute__((const))
-bool is_clonefile_supported(char* path) {
+bool is_clonefile_supported(const char* path) {
     return is_vol_cap_supported(path, VOL_CAP_INT_CLONE);
 }
 
@@ -922,46 +1372,259 @@ bool are_acls_supported(char* path) {
     return is_vol_cap_supported(path, VOL_CAP_INT_RENAME_SWAP);
 }
 
+// The soft limit on descriptors defaults to 256 on macOS. The handle cache
+// and the open directories each get a share of it, so it's raised as far
+// as the system allows before either is sized.
+static void raise_descriptor_limit(void) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0) {
+        return;
+    }
+    rlim_t wanted = limit.rlim_max < OPEN_MAX ? limit.rlim_max : OPEN_MAX;
+    if (limit.rlim_cur < wanted) {
+        limit.rlim_cur = wanted;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+// Hands the regular files of a walk that may have a duplicate to the
+// pipeline. Without pruner threads they are pruned and visited inline.
+static void admit_walk(Walker* walker, bool one_file_system, DedupContext* ctx) {
+    dev_t current_dev = -1;
+    dev_t limits_dev = -1;
+    bool clonefile_supported = false;
+    WalkEntry walk_entry;
+    const WalkEntry* entry = &walk_entry;
+    // the increment runs on `continue` too, so every entry is timed
+    for (uint64_t walk_start = stage_clock(); walker_next(walker, &walk_entry); walk_start = stage_clock()) {
+        stage_record(STAGE_WALK, walk_start);
+        if (entry->error) {
+            char* e = strerror(entry->error);
+            PROGRESS_LOCK(ctx->progress, &ctx->progress_mutex, {
+                clear_progress();
+                warnx("%s: error (%d): %s",
+                      entry->path,
+                      entry->error,
+                      e);
+            });
+            display_status(ctx, entry->path);
+            continue;
+        }
+
+        // a device is set up before any of its files reach the readers
+        if (ctx->device_limits && limits_dev != entry->stat->st_dev) {
+            limits_dev = entry->stat->st_dev;
+            DeviceKind kind = DEVICE_SOLID_STATE;
+            if (device_limits_add(ctx->device_limits, limits_dev, entry->path, &kind) &&
+                kind != DEVICE_SOLID_STATE && ctx->verbosity) {
+                PROGRESS_LOCK(ctx->progress, &ctx->progress_mutex, {
+                    clear_progress();
+                    printf("%s is on a %s device\n", entry->path, device_kind_name(kind));
+                });
+            }
+        }
+
+        if (ctx->replace_mode == DEDUP_CLONE &&
+            current_dev != entry->stat->st_dev) {
+            current_dev = entry->stat->st_dev;
+            clonefile_supported = is_clonefile_supported(entry->path);
+
+            if (!clonefile_supported) {
+                warnx("Skipping %s: cloning not supported", entry->path);
+
+                // with -x set, we can't accidentally cross into a volume
+                // that does support clonefile, so skip everything else
+                if (one_file_system) {
+                    walker_skip(walker);
+                    continue;
+                }
+            }
+        }
+
+        if (ctx->replace_mode == DEDUP_CLONE &&
+            !clonefile_supported) {
+            continue;
+        }
+
+        // the file cannot be a directory
+        if (entry->info == WALK_DIR ||
+            entry->info == WALK_DIR_CYCLE) {
+            continue;
+        }
+
+        // make sure named pipes (fifo), character special,
+        // block special, symlinks, whiteout, etc.
+        if (entry->info != WALK_FILE) {
+            continue;
+        }
+
+        // the file cannot be empty
+        if (entry->stat->st_size == 0) {
+            continue;
+        }
+
+        // the file looks like a previously failed clone
+        if (strnlen(entry->path, PATH_MAX) > 3 &&
+            entry->path[0] == '.' &&
+            entry->path[1] == '~' &&
+            entry->path[2] == '.') {
+            continue;
+        }
+
+        // skip .padding files (browser cache files that are often locked)
+        const char* basename = strrchr(entry->path, '/');
+        if (basename && strcmp(basename + 1, ".padding") == 0) {
+            continue;
+        }
+
+        // skip cloud storage mounts (GoogleDrive, Dropbox, iCloud, OneDrive)
+        if (strstr(entry->path, "/Library/CloudStorage/")) {
+            continue;
+        }
+
+        // skip iOS simulator cache files (often locked)
+        if (strstr(entry->path, "/PhotoData/Caches/")) {
+            continue;
+        }
+
+        // the stat at hand tells whether every link of a hardlinked file
+        // is within the scan, replace_clusters needs all of them
+        if (entry->stat->st_nlink > 1) {
+            link_clusters_add(ctx->link_clusters, entry->stat, entry->path, entry->dir, entry->name);
+        }
+
+        // at this point we have a regular file
+        metrics_add(&ctx->metrics, METRIC_TOTAL_BYTES, entry->stat->st_size);
+        metrics_add(&ctx->metrics, METRIC_TOTAL_FILES, 1);
+        display_status(ctx, entry->path);
+
+        if (ctx->checkpoint) {
+            CheckpointFile file = {
+                .device = entry->stat->st_dev,
+                .inode = entry->stat->st_ino,
+                .size = (uint64_t)entry->stat->st_size,
+                .mtime = entry->stat->st_mtimespec,
+            };
+            if (checkpoint_is_done(ctx->checkpoint, &file)) {
+                metrics_add(&ctx->metrics, METRIC_COMPLETED, 1);
+                continue;
+            }
+        }
+
+        FileEntry* fe = new_file_entry(entry->path,
+                                       entry->stat->st_dev,
+                                       entry->stat->st_ino,
+                                       entry->stat->st_nlink,
+                                       entry->stat->st_flags,
+                                       entry->stat->st_size,
+                                       0,
+                                       0,
+                                       entry->level);
+        if (!fe) {
+            PROGRESS_LOCK(ctx->progress, &ctx->progress_mutex, {
+                clear_progress();
+                warnx("%s: out of memory", entry->path);
+            });
+            continue;
+        }
+        if (entry->dir) {
+            fe->dir = dir_handle_retain(entry->dir);
+            fe->name = fe->path + (entry->name - entry->path);
+        }
+        fe->clone_id = entry->clone_id;
+        fe->has_clone_id = entry->extended;
+        fe->mtime = entry->stat->st_mtimespec;
+
+        // only files that made it into the pipeline take a ticket, a ticket
+        // that is never ended would stall its group
+        fe->sequence = ctx->next_file_sequence++;
+        fe->group_ticket = visit_order_ticket(ctx->visit_order, fe->device, fe->size);
+
+        if (ctx->thread_count == 0) {
+            // Single-threaded: prune and process inline
+            if (prune_entry(fe, ctx)) {
+                file_entry_free(fe);
+            } else {
+                FileEntry* runnable[2];
+                size_t runnable_count = size_gate_offer(ctx->size_gate, fe, runnable);
+                for (size_t i = 0; i < runnable_count; i++) {
+                    visit_entry(runnable[i], ctx->progress, ctx);
+                }
+            }
+        } else {
+            // Track queued count (increment for raw_queue entry)
+            metrics_add(&ctx->metrics, METRIC_QUEUED, 1);
+
+            // blocks while the pruners are behind
+            file_entry_queue_push(ctx->raw_queue, fe);
+        }
+    }
+}
+
+typedef struct WatchRun {
+    DedupContext* ctx;
+    bool one_file_system;
+} WatchRun;
+
+// Walks the files and directories --watch hands out. -d only limits the
+// traversal, a changed directory is walked in full.
+static void watch_changes(char* const* paths, size_t count, void* context) {
+    WatchRun* run = context;
+    DedupContext* ctx = run->ctx;
+    if (ctx->verbosity > 1) {
+        PROGRESS_LOCK(ctx->progress, &ctx->progress_mutex, {
+            clear_progress();
+            printf("%zu paths changed\n", count);
+        });
+    }
+
+    WalkerOptions options = {
+        .max_depth = UINT16_MAX,
+        .one_file_system = run->one_file_system,
+    };
+    Walker* walker = new_walker(paths, &options);
+    if (!walker) {
+        PROGRESS_LOCK(ctx->progress, &ctx->progress_mutex, {
+            clear_progress();
+            warnx("could not walk %zu changed paths", count);
+        });
+        return;
+    }
+    admit_walk(walker, run->one_file_system, ctx);
+    free_walker(walker);
+}
+
 int main(int argc, char* argv[]) {
+    raise_descriptor_limit();
 
-    FileEntryHead* queue = new_file_entry_queue();
-    FileEntryHead* raw_queue = new_file_entry_queue();
+    FileEntryQueue* queue = new_file_entry_priority_queue(QUEUE_CAPACITY);
+    FileEntryQueue* raw_queue = new_file_entry_queue(QUEUE_CAPACITY);
+    FileHandleCache* handles = new_file_handle_cache(0);
     Progress p = { 0 };
     uint16_t max_depth = UINT16_MAX;
-    int user_fts_options = 0;
+    bool one_file_system = false;
 
     DedupContext dc = {
         .progress = &p,
         .queue = queue,
         .raw_queue = raw_queue,
-        .signatures = new_sig_table(65536),
-        .found = 0,
-        .saved = 0,
-        .already_saved = 0,
-        .pruned = 0,
-        .total_bytes = 0,
-        .queued_count = 0,
+        .signatures = new_sig_table(65536, handles),
+        .handles = handles,
         .next_file_sequence = 0,
-        .next_visit_sequence = 0,
-        .scan_done = 0,
-        .prune_done = 0,
+        .watch_sequence = UINT64_MAX,
+        .visit_order = NULL,
         .dry_run = false,
         .verbosity = 0,
         .force = 0,
         .replace_mode = DEDUP_CLONE,
         .output_format = OUTPUT_SI_HUMAN,
         .clone_converted = true,
-        .summary_file = NULL,
+        .summary = NULL,
         .thread_count = cpu_count(),
-        .metrics_mutex = PTHREAD_MUTEX_INITIALIZER,
+        .read_ahead_depth = READ_AHEAD_DEPTH_DEFAULT,
         .progress_mutex = PTHREAD_MUTEX_INITIALIZER,
-        .queue_mutex = PTHREAD_MUTEX_INITIALIZER,
-        .raw_queue_mutex = PTHREAD_MUTEX_INITIALIZER,
-        .signatures_mutex = PTHREAD_MUTEX_INITIALIZER,
-        .scan_done_mutex = PTHREAD_MUTEX_INITIALIZER,
-        .prune_done_mutex = PTHREAD_MUTEX_INITIALIZER,
-        .visit_order_mutex = PTHREAD_MUTEX_INITIALIZER,
-        .visit_order_cond = PTHREAD_COND_INITIALIZER,
+        .render_stop = PTHREAD_COND_INITIALIZER,
+        .status_mutex = PTHREAD_MUTEX_INITIALIZER,
     };
 
     // Validate signature table was created successfully
@@ -970,14 +1633,26 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
+    if (!dc.queue || !dc.raw_queue) {
+        fprintf(stderr, "failed to create work queues\n");
+        return 1;
+    }
+
     static const struct option options[] = {
         { "ignore",          required_argument, NULL, 'I' },
         { "no-progress",     no_argument,       NULL, 'P' },
         { "version",         no_argument,       NULL, 'V' },
         { "color",           optional_argument, NULL, 'c' },
         { "depth",           required_argument, NULL, 'd' },
+        { "device-threads",  required_argument, NULL, 'L' },
         { "format",          required_argument, NULL, 'F' },
+        { "io-depth",        required_argument, NULL, 'Q' },
+        { "inline-size",     required_argument, NULL, 'B' },
+        { "cache",           required_argument, NULL, 'k' },
+        { "checkpoint",      required_argument, NULL, 'K' },
+        { "resume",          no_argument,       NULL, 'E' },
         { "link",            no_argument,       NULL, 'l' },
+        { "memory-limit",    required_argument, NULL, 'M' },
         { "dry-run",         no_argument,       NULL, 'n' },
         { "symlink",         no_argument,       NULL, 's' },
         { "threads",         required_argument, NULL, 't' },
@@ -985,16 +1660,30 @@ int main(int argc, char* argv[]) {
         { "one-file-system", no_argument,       NULL, 'x' },
         // { "force",           no_argument,       NULL, 'f' },
         { "no-clone-conversion", no_argument,   NULL, 'C' },
+        { "recalibrate",     no_argument,       NULL, 'R' },
         { "summary",         required_argument, NULL, 'S' },
+        { "summary-format",  required_argument, NULL, 'J' },
+        { "unordered",       no_argument,       NULL, 'U' },
+        { "watch",           no_argument,       NULL, 'W' },
         { "help",            no_argument,       NULL, '?' },
         { NULL, 0, NULL, 0 },
     };
 
     bool human_readable = true;
+    bool unordered = false;
+    bool watch = false;
+    DeviceLimitConfig device_config = device_limit_defaults();
+    const char* cache_path = NULL;
+    const char* checkpoint_path = NULL;
+    bool resume = false;
+    const char* summary_path = NULL;
+    SummaryFormat summary_format = SUMMARY_TEXT;
+    uint64_t memory_limit = 0;
+    uint64_t inline_size = SIG_TABLE_INLINE_DEFAULT;
 
     int ch = -1, t;
     short d;
-    while ((ch = getopt_long(argc, argv, "I:PVc::d:F:hlnst:vxCS:", options, NULL)) != -1) {
+    while ((ch = getopt_long(argc, argv, "I:PVQ:c::d:F:hk:lM:nst:vxCS:U", options, NULL)) != -1) {
         switch (ch) {
             case 'I':
                 fprintf(stderr, "-I is unimplemented\n");
@@ -1005,6 +1694,30 @@ int main(int argc, char* argv[]) {
             case 'V':
                 fprintf(stderr, "%s\n", version);
                 return 1;
+            case 'R':
+                if (!dedup_runtime_caps_recalibrate()) {
+                    warnx("calibration cache could not be written");
+                    return 1;
+                }
+                return 0;
+            case 'Q':
+                t = atoi(optarg);
+                if (t < 0 || t > UINT8_MAX) {
+                    fprintf(stderr,
+                            "I/O depth must be between 0 and %d: %s\n",
+                            UINT8_MAX,
+                            optarg);
+                    usage(argv[0], &dc);
+                }
+                dc.read_ahead_depth = t;
+                break;
+            case 'B':
+                if (!parse_byte_count(optarg, &inline_size) || inline_size > SIG_TABLE_INLINE_LIMIT) {
+                    fprintf(stderr, "Inline size must be at most %uK: %s\n", SIG_TABLE_INLINE_LIMIT / 1024, optarg);
+                    usage(argv[0], &dc);
+                }
+                dc.signatures->inline_max = (size_t)inline_size;
+                break;
             case 'c':
                 fprintf(stderr, "-c is unimplemented\n");
                 break;
@@ -1017,15 +1730,36 @@ int main(int argc, char* argv[]) {
                 }
                 max_depth = d;
                 break;
+            case 'L':
+                if (!device_limit_parse(optarg, &device_config)) {
+                    fprintf(stderr, "Device threads must be a list of ssd, hdd or network=n: %s\n", optarg);
+                    usage(argv[0], &dc);
+                }
+                break;
             case 'F':
                 dc.output_format = parse_output_format(optarg);
                 break;
             case 'h':
                 human_readable = true;
                 break;
+            case 'k':
+                cache_path = optarg;
+                break;
+            case 'K':
+                checkpoint_path = optarg;
+                break;
+            case 'E':
+                resume = true;
+                break;
             case 'l':
                 dc.replace_mode = DEDUP_LINK;
                 break;
+            case 'M':
+                if (!parse_byte_count(optarg, &memory_limit) || memory_limit == 0) {
+                    fprintf(stderr, "Memory limit must be a positive size: %s\n", optarg);
+                    usage(argv[0], &dc);
+                }
+                break;
             case 'n':
                 dc.dry_run = true;
                 break;
@@ -1046,19 +1780,36 @@ int main(int argc, char* argv[]) {
                 dc.verbosity++;
                 break;
             case 'x':
-                user_fts_options |= FTS_XDEV;
+                one_file_system = true;
                 break;
             case 'C':
                 dc.clone_converted = false;
                 break;
             case 'S':
-                dc.summary_file = strdup(optarg);
+                summary_path = optarg;
+                break;
+            case 'J':
+                if (!summary_format_parse(optarg, &summary_format)) {
+                    fprintf(stderr, "Summary format must be text or jsonl: %s\n", optarg);
+                    usage(argv[0], &dc);
+                }
+                break;
+            case 'U':
+                unordered = true;
+                break;
+            case 'W':
+                watch = true;
                 break;
             case '?':
             default:
                 usage(argv[0], &dc);
         }
     }
+    if (resume && !checkpoint_path) {
+        fprintf(stderr, "--resume needs a journal, see --checkpoint\n");
+        usage(argv[0], &dc);
+    }
+
     argc -= optind;
     argv += optind;
 
@@ -1066,9 +1817,30 @@ int main(int argc, char* argv[]) {
         dc.progress = NULL;
     }
     
-    // Open summary file if requested
-    if (dc.summary_file) {
-        clone_summary_open(dc.summary_file);
+    if (summary_path) {
+        dc.summary = open_summary_log(summary_path, summary_format);
+        if (!dc.summary) {
+            warn("%s: summary unavailable, continuing without it", summary_path);
+        }
+    }
+
+    if (memory_limit > 0) {
+        // a quarter of the limit gathers spilled files before they're
+        // sorted, the larger the runs the fewer there are to merge
+        size_t run_bytes = (size_t)(memory_limit / 4);
+        const char* tmpdir = getenv("TMPDIR");
+        dc.spill = new_spill_set(tmpdir && *tmpdir ? tmpdir : "/tmp", run_bytes);
+        dc.table_limit = (size_t)(memory_limit - run_bytes);
+        if (!dc.spill) {
+            warnx("memory limit unavailable, continuing without it");
+        }
+    }
+
+    if (cache_path) {
+        dc.sig_cache = open_sig_cache(cache_path, dedup_runtime_dispatch_get()->fast_hash_name);
+        if (!dc.sig_cache) {
+            warnx("%s: signature cache unavailable, continuing without it", cache_path);
+        }
     }
 
     static const char* const DEFAULT_PATHS[] = {
@@ -1088,14 +1860,33 @@ int main(int argc, char* argv[]) {
         }
     }
 
-    FTS* traversal = fts_open(paths,
-                              FTS_NOCHDIR | FTS_PHYSICAL | user_fts_options,
-                              NULL);
+    WalkerOptions walker_options = {
+        .thread_count = dc.thread_count,
+        .max_depth = max_depth,
+        .one_file_system = one_file_system,
+    };
+    // threads inherit the mask, so only siginfo_work takes SIGINFO and
+    // SIGWINCH
+    sigset_t siginfo_set;
+    sigemptyset(&siginfo_set);
+    sigaddset(&siginfo_set, SIGINFO);
+    sigaddset(&siginfo_set, SIGWINCH);
+    // --watch stops on these, and finishes the run like any other
+    sigset_t stop_set;
+    sigemptyset(&stop_set);
+    if (watch) {
+        sigaddset(&stop_set, SIGINT);
+        sigaddset(&stop_set, SIGTERM);
+        sigaddset(&siginfo_set, SIGINT);
+        sigaddset(&siginfo_set, SIGTERM);
+    }
+    pthread_sigmask(SIG_BLOCK, &siginfo_set, NULL);
+
+    // changes made during the traversal are handed out once it's done
+    uint64_t watch_since = watch ? watch_current_event() : 0;
+
+    Walker* traversal = new_walker(paths, &walker_options);
 
-    // n.b! as of Libc-1244.1.7 fts_open will only fail if it cannot
-    //      allocate memory. this makes this check extremely unlikely
-    //      to ever fail, but if it does fail, `traversal` will be
-    //      invalid.
     // LCOV_EXCL_START
     if (!traversal) {
         perror("Could not open starting directories");
@@ -1103,14 +1894,92 @@ int main(int argc, char* argv[]) {
     }
     // LCOV_EXCL_STOP
 
-    pthread_t pruner_thread = NULL;
+    pthread_t siginfo_thread = NULL;
+    if (pthread_create(&siginfo_thread, NULL, siginfo_work, &dc)) {
+        siginfo_thread = NULL;
+    }
+    pthread_t render_thread = NULL;
+    if (dc.progress && pthread_create(&render_thread, NULL, render_work, &dc)) {
+        render_thread = NULL;
+    }
+
+    dc.seen_inodes = new_seen_set(4096);
+    dc.seen_clones = new_seen_set(4096);
+    if (watch) {
+        dc.seen_versions = new_seen_set(4096);
+    }
+    // a symlink in place of one link would leave the others with the blocks
+    if (!dc.force && dc.replace_mode != DEDUP_SYMLINK && (dc.replace_mode != DEDUP_CLONE || dc.clone_converted)) {
+        dc.link_clusters = new_link_clusters(0);
+    }
+    dc.size_gate = new_size_gate();
+    pthread_mutex_init(&dc.size_gate_mutex, NULL);
+
+    if (checkpoint_path) {
+        // a journal of another mode would skip files this run has to replace
+        uint32_t mode = (uint32_t)dc.replace_mode | (uint32_t)dc.dry_run << 8 | (uint32_t)!dc.clone_converted << 9;
+        dc.checkpoint = open_checkpoint(checkpoint_path, dedup_runtime_dispatch_get()->fast_hash_name, mode, resume,
+                                        resume_origin, &dc);
+        if (!dc.checkpoint) {
+            warn("%s: checkpoint unavailable, continuing without it", checkpoint_path);
+        } else if (resume && dc.verbosity) {
+            printf("resuming after %zu files and %zu replaced duplicates\n",
+                   checkpoint_resumed_files(dc.checkpoint), checkpoint_resumed_clones(dc.checkpoint));
+        }
+    }
+
+    // limits only matter with threads to hold back
     if (dc.thread_count > 0) {
-        int r = pthread_create(&pruner_thread, NULL, prune_work, &dc);
-        if (r) {
-            warn("Could not create pruner thread: error %i", r);
-            pruner_thread = NULL;
+        dc.device_limits = new_device_limits(&device_config);
+    }
+
+    // pruning costs a getattrlist per file, on trees that are mostly
+    // links and clones already it's most of the work, so it gets as many
+    // threads as the workers
+    pthread_t* pruners = dc.thread_count > 0 ? calloc(dc.thread_count, sizeof(pthread_t)) : NULL;
+    int pruner_count = 0;
+    if (pruners) {
+        // raw_queue isn't closed before the traversal ends, no pruner can
+        // exit while the rest are started
+        atomic_store(&dc.pruners_running, dc.thread_count);
+        for (; pruner_count < dc.thread_count; pruner_count++) {
+            int r = pthread_create(&pruners[pruner_count], NULL, prune_work, &dc);
+            if (r) {
+                warn("Could not create pruner threads: error %i", r);
+                atomic_fetch_sub(&dc.pruners_running, dc.thread_count - pruner_count);
+                break;
+            }
+        }
+    }
+    if (pruner_count == 0 && dc.thread_count > 0) {
+        warnx("Running single threaded.");
+        dc.thread_count = 0;
+    }
+
+    // readers only pay off next to workers, alone they'd serialize the
+    // reads the walker does itself
+    pthread_t* readers = NULL;
+    int reader_count = 0;
+    if (dc.thread_count > 0 && dc.read_ahead_depth > 0) {
+        dc.ready_queue = new_file_entry_priority_queue(QUEUE_CAPACITY);
+        readers = calloc(dc.read_ahead_depth, sizeof(pthread_t));
+    }
+    if (dc.ready_queue && readers) {
+        // queue isn't closed before the traversal ends, no reader can
+        // exit while the rest are started
+        atomic_store(&dc.readers_running, dc.read_ahead_depth);
+        for (; reader_count < dc.read_ahead_depth; reader_count++) {
+            int r = pthread_create(&readers[reader_count], NULL, read_ahead_work, &dc);
+            if (r) {
+                warn("Could not create reader threads: error %i", r);
+                atomic_fetch_sub(&dc.readers_running, dc.read_ahead_depth - reader_count);
+                break;
+            }
         }
     }
+    if (reader_count == 0) {
+        free_file_entry_queue(dc.ready_queue); dc.ready_queue = NULL;
+    }
 
     pthread_t* threads = calloc(dc.thread_count, sizeof(pthread_t));
     for (int i = 0; i < dc.thread_count; i++) {
@@ -1123,185 +1992,75 @@ int main(int argc, char* argv[]) {
         }
     }
 
-    // Single-threaded seen sets (only used when thread_count == 0)
-    SeenSet* st_seen_inodes = NULL;
-    SeenSet* st_seen_clones = NULL;
-    if (dc.thread_count == 0) {
-        st_seen_inodes = new_seen_set(4096);
-        st_seen_clones = new_seen_set(4096);
-    }
-
-    dev_t current_dev = -1;
-    bool clonefile_supported = false;
-    FTSENT* entry = NULL;
-    while ((entry = fts_read(traversal)) != NULL) {
-        if (entry->fts_errno) {
-            char* e = strerror(entry->fts_errno);
-            PROGRESS_LOCK(dc.progress, &dc.progress_mutex, {
-                clear_progress();
-                warnx("%s: error (%d): %s",
-                      entry->fts_path,
-                      entry->fts_errno,
-                      e);
-            });
-            display_status(&dc, entry->fts_path);
-            continue;
-        }
+    // a huge pair verified last would otherwise leave the other workers
+    // idle until it's done
+    dedup_runtime_set_split_threads(dc.thread_count);
 
-        if (entry->fts_level > (max_depth + 1)) {
-            fts_set(traversal, entry, FTS_SKIP);
-            continue;
+    // with a single thread files are visited in traversal order anyway
+    if (dc.thread_count > 0 && !unordered) {
+        dc.visit_order = new_visit_order();
+        if (!dc.visit_order) {
+            fprintf(stderr, "failed to create visit order, origins may vary between runs\n");
         }
+    }
 
-        if (dc.replace_mode == DEDUP_CLONE &&
-            current_dev != entry->fts_statp->st_dev) {
-            current_dev = entry->fts_statp->st_dev;
-            clonefile_supported = is_clonefile_supported(entry->fts_path);
+    admit_walk(traversal, one_file_system, &dc);
 
-            if (!clonefile_supported) {
-                warnx("Skipping %s: cloning not supported", entry->fts_path);
+    free_walker(traversal); traversal = NULL;
 
-                // if FTS_XDEV is set, we can't accidentally cross into a
-                // volume that does support clonefile, so skip everything else
-                if (user_fts_options & FTS_XDEV) {
-                    fts_set(traversal, entry, FTS_SKIP);
-                    continue;
-                }
+    // the tables and the files the size gate holds stay as they are, new
+    // files are matched against everything seen so far
+    if (watch) {
+        // the files walked from here on were handed out as changed
+        atomic_store(&dc.watch_sequence, dc.next_file_sequence);
+        WatchRun run = { .ctx = &dc, .one_file_system = one_file_system };
+        Watcher* watcher = new_watcher(paths, watch_since, WATCH_SETTLE_SECONDS, watch_changes, &run);
+        if (!watcher) {
+            warnx("could not watch for changes");
+        } else {
+            if (dc.verbosity) {
+                PROGRESS_LOCK(dc.progress, &dc.progress_mutex, {
+                    clear_progress();
+                    printf("watching for changes\n");
+                });
             }
+            int sig = 0;
+            sigwait(&stop_set, &sig);
+            free_watcher(watcher);
         }
+    }
 
-        if (dc.replace_mode == DEDUP_CLONE &&
-            !clonefile_supported) {
-            continue;
-        }
-
-        // the file cannot be a directory
-        if (entry->fts_info == FTS_D ||
-            entry->fts_info == FTS_DC ||
-            entry->fts_info == FTS_DNR ||
-            entry->fts_info == FTS_DOT ||
-            entry->fts_info == FTS_DP) {
-            continue;
-        }
-
-        // make sure named pipes (fifo), character special,
-        // block special, symlinks, whiteout, etc.
-        if (entry->fts_info != FTS_F) {
-            continue;
-        }
-
-        // the file cannot be empty
-        if (entry->fts_statp->st_size == 0) {
-            continue;
-        }
-
-        // the file looks like a previously failed clone
-        if (strnlen(entry->fts_path, PATH_MAX) > 3 &&
-            entry->fts_path[0] == '.' &&
-            entry->fts_path[1] == '~' &&
-            entry->fts_path[2] == '.') {
-            continue;
-        }
-
-        // skip .padding files (browser cache files that are often locked)
-        const char* basename = strrchr(entry->fts_path, '/');
-        if (basename && strcmp(basename + 1, ".padding") == 0) {
-            continue;
-        }
-
-        // skip cloud storage mounts (GoogleDrive, Dropbox, iCloud, OneDrive)
-        if (strstr(entry->fts_path, "/Library/CloudStorage/")) {
-            continue;
-        }
-
-        // skip iOS simulator cache files (often locked)
-        if (strstr(entry->fts_path, "/PhotoData/Caches/")) {
-            continue;
+    if (pruner_count == 0) {
+        FileEntry* unique = NULL;
+        while ((unique = size_gate_drain(dc.size_gate)) != NULL) {
+            finish_unique(unique, &dc);
         }
+    }
 
-        // at this point we have a regular file
-        // that only has one link
-        pthread_mutex_lock(&dc.metrics_mutex);
-        dc.total_bytes += entry->fts_statp->st_size;
-        pthread_mutex_unlock(&dc.metrics_mutex);
-        PROGRESS_LOCK(dc.progress, &dc.progress_mutex, {
-            dc.progress->totalUnitCount++;
-        });
-        display_status(&dc, entry->fts_path);
-
-        // Track queued count (increment for raw_queue entry)
-        pthread_mutex_lock(&dc.metrics_mutex);
-        dc.queued_count++;
-        pthread_mutex_unlock(&dc.metrics_mutex);
-
-        uint64_t sequence = dc.next_file_sequence++;
+    // Signal scan complete to the pruners, the last of them closes the
+    // work queue once raw_queue is drained
+    file_entry_queue_close(raw_queue);
 
-        if (dc.thread_count == 0) {
-            // Single-threaded: prune and process inline
-            file_entry_queue_append(raw_queue,
-                                    entry->fts_path,
-                                    entry->fts_statp->st_dev,
-                                    entry->fts_statp->st_ino,
-                                    entry->fts_statp->st_nlink,
-                                    entry->fts_statp->st_flags,
-                                    entry->fts_statp->st_size,
-                                    sequence,
-                                    entry->fts_level);
-            FileEntry* fe = file_entry_next(raw_queue);
-            // Decrement queued_count since we're processing it immediately
-            pthread_mutex_lock(&dc.metrics_mutex);
-            dc.queued_count--;
-            pthread_mutex_unlock(&dc.metrics_mutex);
-            
-            if (prune_entry(fe, st_seen_inodes, st_seen_clones, &dc)) {
-                file_entry_free(fe);
-            } else {
-                // Survivor goes to work_queue (already counted in queued_count)
-                file_entry_queue_append(queue,
-                                        fe->path,
-                                        fe->device,
-                                        fe->inode,
-                                        fe->nlink,
-                                        fe->flags,
-                                        fe->size,
-                                        fe->sequence,
-                                        fe->level);
-                file_entry_free(fe);
-                dedup_work(&dc);
-            }
-        } else {
-            pthread_mutex_lock(&dc.raw_queue_mutex);
-            file_entry_queue_append(raw_queue,
-                                    entry->fts_path,
-                                    entry->fts_statp->st_dev,
-                                    entry->fts_statp->st_ino,
-                                    entry->fts_statp->st_nlink,
-                                    entry->fts_statp->st_flags,
-                                    entry->fts_statp->st_size,
-                                    sequence,
-                                    entry->fts_level);
-            pthread_mutex_unlock(&dc.raw_queue_mutex);
+    for (int i = 0; i < pruner_count; i++) {
+        assert(pruners[i] != NULL);
+        if (pthread_join(pruners[i], NULL)) {
+            fprintf(stderr, "Failed to wait for pruner %i\n", i);
         }
     }
+    free(pruners); pruners = NULL;
 
-    fts_close(traversal);
-
-    // Signal FTS scan complete to pruner
-    pthread_mutex_lock(&dc.scan_done_mutex);
-    dc.scan_done = 1;
-    pthread_mutex_unlock(&dc.scan_done_mutex);
+    // without a pruner nothing else will close the work queue
+    if (pruner_count == 0) {
+        file_entry_queue_close(queue);
+    }
 
-    // Wait for pruner to drain raw_queue
-    if (pruner_thread) {
-        if (pthread_join(pruner_thread, NULL)) {
-            fprintf(stderr, "Failed to wait for pruner thread\n");
+    for (int i = 0; i < reader_count; i++) {
+        assert(readers[i] != NULL);
+        if (pthread_join(readers[i], NULL)) {
+            fprintf(stderr, "Failed to wait for reader %i\n", i);
         }
     }
-
-    // Signal pruner complete to workers
-    pthread_mutex_lock(&dc.prune_done_mutex);
-    dc.prune_done = 1;
-    pthread_mutex_unlock(&dc.prune_done_mutex);
+    free(readers); readers = NULL;
 
     for (int i = 0; i < dc.thread_count; i++) {
         // clang-analyzer thinks threads[i] can be NULL, but `pthread_t`
@@ -1316,45 +2075,105 @@ int main(int argc, char* argv[]) {
     }
     free(threads); threads = NULL;
 
-    free_seen_set(st_seen_inodes);
-    free_seen_set(st_seen_clones);
+    // the table is done with, only what was spilled is left to match
+    SigTableProbeStats probe_stats = {0};
+    if (dc.verbosity > 1) {
+        sig_table_collisions(dc.signatures, &probe_stats);
+    }
+    free_sig_table(dc.signatures); dc.signatures = NULL;
+    if (dc.spill) {
+        merge_spilled(&dc);
+        free_spill_set(dc.spill); dc.spill = NULL;
+    }
+    if (dc.link_clusters) {
+        link_clusters_each_deferred(dc.link_clusters, replace_cluster, &dc);
+        free_link_clusters(dc.link_clusters); dc.link_clusters = NULL;
+    }
+
+    if (siginfo_thread) {
+        atomic_store(&dc.siginfo_done, true);
+        pthread_kill(siginfo_thread, SIGINFO);
+        pthread_join(siginfo_thread, NULL);
+    }
+    if (render_thread) {
+        pthread_mutex_lock(&dc.progress_mutex);
+        dc.render_done = true;
+        pthread_cond_signal(&dc.render_stop);
+        pthread_mutex_unlock(&dc.progress_mutex);
+        pthread_join(render_thread, NULL);
+    }
+
+    free_seen_set(dc.seen_inodes); dc.seen_inodes = NULL;
+    free_seen_set(dc.seen_clones); dc.seen_clones = NULL;
+    free_seen_set(dc.seen_versions); dc.seen_versions = NULL;
+    free_size_gate(dc.size_gate); dc.size_gate = NULL;
+    pthread_mutex_destroy(&dc.size_gate_mutex);
     free_file_entry_queue(raw_queue); raw_queue = NULL;
     free_file_entry_queue(queue); queue = NULL;
-    free_sig_table(dc.signatures); dc.signatures = NULL;
+    free_file_entry_queue(dc.ready_queue); dc.ready_queue = NULL;
+    close_sig_cache(dc.sig_cache); dc.sig_cache = NULL;
+    if (dc.checkpoint && !close_checkpoint(dc.checkpoint)) {
+        warnx("%s: checkpoint is incomplete", checkpoint_path);
+    }
+    dc.checkpoint = NULL;
+    free_file_handle_cache(dc.handles); dc.handles = NULL;
+    free_visit_order(dc.visit_order); dc.visit_order = NULL;
+    free_device_limits(dc.device_limits); dc.device_limits = NULL;
 
     if (dc.progress) {
         clear_progress();
     }
-    printf("duplicates found: %zu\n", dc.found);
-    printf("entries pruned: %zu\n", dc.pruned);
+    // every thread has been joined, so the sums are exact
+    size_t found = metrics_sum(&dc.metrics, METRIC_FOUND);
+    size_t pruned = metrics_sum(&dc.metrics, METRIC_PRUNED);
+    size_t saved = metrics_sum(&dc.metrics, METRIC_SAVED);
+    size_t already_saved = metrics_sum(&dc.metrics, METRIC_ALREADY_SAVED);
+
+    printf("duplicates found: %zu\n", found);
+    printf("entries pruned: %zu\n", pruned);
 
     // Fast dedup processes files immediately during traversal
     // No additional deduplication step needed
 
     printf("bytes saved: ");
     if (human_readable) {
-        printf("%s", format_bytes(dc.saved, dc.output_format));
+        printf("%s", format_bytes(saved, dc.output_format));
     } else {
-        printf("%zu", dc.saved);
+        printf("%zu", saved);
     }
     putchar('\n');
 
     printf("already saved: ");
     if (human_readable) {
-        printf("%s", format_bytes(dc.already_saved, dc.output_format));
+        printf("%s", format_bytes(already_saved, dc.output_format));
     } else {
-        printf("%zu", dc.already_saved);
+        printf("%zu", already_saved);
     }
     putchar('\n');
 
+    if (dc.verbosity > 1) {
+        DedupVerifierStats verifier = {0};
+        dedup_runtime_verifier_stats(&verifier);
+        printf("candidates rejected: %" PRIu64 " metadata, %" PRIu64 " edges, %" PRIu64 " probes, "
+               "%" PRIu64 " of %" PRIu64 " exact\n",
+               verifier.rejected[DEDUP_VERIFY_METADATA], verifier.rejected[DEDUP_VERIFY_EDGES],
+               verifier.rejected[DEDUP_VERIFY_PROBES], verifier.rejected[DEDUP_VERIFY_EXACT], verifier.compared);
+        printf("signatures by probe length:");
+        for (size_t i = 0; i < SIG_TABLE_PROBE_BUCKETS; i++) {
+            printf(" %zu%s:%zu", i + 1, i + 1 < SIG_TABLE_PROBE_BUCKETS ? "" : "+", probe_stats.groups[i]);
+        }
+        printf(" (longest %zu)\n", probe_stats.max_groups);
+        print_resource_usage();
+        stage_print(stdout);
+    }
+
     // Clear status line
     if (isatty(STDOUT_FILENO)) {
         fprintf(stderr, "\r\033[K\n");
     }
     
-    // Close summary file if it was opened
-    if (dc.summary_file) {
-        clone_summary_close();
+    if (summary_path && !close_summary_log(dc.summary)) {
+        warnx("%s: summary is incomplete", summary_path);
     }
 
     return 0;
@@ -0,0 +1,291 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include "device_limit.h"
+
+#include <CoreFoundation/CoreFoundation.h>
+#include <IOKit/IOKitLib.h>
+#include <IOKit/storage/IOStorageDeviceCharacteristics.h>
+#include <sys/mount.h>
+#include <sys/param.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct LaneState {
+    unsigned active;        // threads working on the device's entries
+    FileEntry** parked;     // a ring of DEVICE_PARKED_MAX, allocated once needed
+    size_t head;
+    size_t count;
+} LaneState;
+
+typedef struct DeviceSlot {
+    dev_t device;
+    unsigned limit;         // 0 for none
+    LaneState lanes[DEVICE_LANE_COUNT];
+} DeviceSlot;
+
+struct DeviceLimits {
+    DeviceLimitConfig config;
+    pthread_mutex_t mutex;  // guards the slots
+    pthread_cond_t room;    // a lane's ring or its threads went below the limit
+    DeviceSlot** slots;     // few, devices are looked up linearly
+    size_t count;
+    size_t capacity;
+    atomic_bool limited;    // whether any device has a limit
+};
+
+static const char* const KIND_NAMES[DEVICE_KIND_COUNT] = {
+    [DEVICE_SOLID_STATE] = "ssd",
+    [DEVICE_ROTATIONAL] = "hdd",
+    [DEVICE_NETWORK] = "network",
+};
+
+DeviceLimitConfig device_limit_defaults(void) {
+    return (DeviceLimitConfig) {
+        .threads = {
+            [DEVICE_SOLID_STATE] = 0,
+            // one reading while the other waits on its seek
+            [DEVICE_ROTATIONAL] = 2,
+            // enough to cover the round trips, without saturating the link
+            [DEVICE_NETWORK] = 4,
+        },
+    };
+}
+
+bool device_limit_parse(const char* spec, DeviceLimitConfig* config) {
+    if (!spec || !config || !*spec) {
+        return false;
+    }
+
+    DeviceLimitConfig parsed = *config;
+    const char* p = spec;
+    while (*p) {
+        const char* equals = strchr(p, '=');
+        if (!equals) {
+            return false;
+        }
+        size_t name_length = (size_t)(equals - p);
+        DeviceKind kind = DEVICE_KIND_COUNT;
+        for (DeviceKind k = 0; k < DEVICE_KIND_COUNT; k++) {
+            if (strlen(KIND_NAMES[k]) == name_length && strncmp(KIND_NAMES[k], p, name_length) == 0) {
+                kind = k;
+            }
+        }
+
+        char* end = NULL;
+        unsigned long threads = strtoul(equals + 1, &end, 10);
+        if (kind == DEVICE_KIND_COUNT || end == equals + 1 || threads > UINT8_MAX || (*end && *end != ',')) {
+            return false;
+        }
+        parsed.threads[kind] = (unsigned)threads;
+        p = *end ? end + 1 : end;
+    }
+
+    *config = parsed;
+    return true;
+}
+
+const char* device_kind_name(DeviceKind kind) {
+    return kind < DEVICE_KIND_COUNT ? KIND_NAMES[kind] : "unknown";
+}
+
+DeviceKind device_kind(const char* path) {
+    struct statfs st;
+    if (!path || statfs(path, &st) != 0) {
+        return DEVICE_SOLID_STATE;
+    }
+    if (!(st.f_flags & MNT_LOCAL)) {
+        return DEVICE_NETWORK;
+    }
+    if (strncmp(st.f_mntfromname, "/dev/", 5) != 0) {
+        return DEVICE_SOLID_STATE;
+    }
+
+    // the characteristics are on the physical device, an APFS volume is a
+    // few levels of containers above it
+    io_service_t media = IOServiceGetMatchingService(MACH_PORT_NULL,
+                                                     IOBSDNameMatching(MACH_PORT_NULL, 0, st.f_mntfromname + 5));
+    if (!media) {
+        return DEVICE_SOLID_STATE;
+    }
+    CFTypeRef characteristics = IORegistryEntrySearchCFProperty(media, kIOServicePlane,
+                                                                CFSTR(kIOPropertyDeviceCharacteristicsKey),
+                                                                kCFAllocatorDefault,
+                                                                kIORegistryIterateRecursively |
+                                                                kIORegistryIterateParents);
+    IOObjectRelease(media);
+    if (!characteristics) {
+        return DEVICE_SOLID_STATE;
+    }
+
+    DeviceKind kind = DEVICE_SOLID_STATE;
+    if (CFGetTypeID(characteristics) == CFDictionaryGetTypeID()) {
+        CFTypeRef medium = CFDictionaryGetValue(characteristics, CFSTR(kIOPropertyMediumTypeKey));
+        if (medium && CFGetTypeID(medium) == CFStringGetTypeID() &&
+            CFStringCompare(medium, CFSTR(kIOPropertyMediumTypeRotationalKey), 0) == kCFCompareEqualTo) {
+            kind = DEVICE_ROTATIONAL;
+        }
+    }
+    CFRelease(characteristics);
+    return kind;
+}
+
+DeviceLimits* new_device_limits(const DeviceLimitConfig* config) {
+    DeviceLimits* limits = calloc(1, sizeof(DeviceLimits));
+    if (!limits) {
+        return NULL;
+    }
+    limits->config = config ? *config : device_limit_defaults();
+    pthread_mutex_init(&limits->mutex, NULL);
+    pthread_cond_init(&limits->room, NULL);
+    return limits;
+}
+
+void free_device_limits(DeviceLimits* limits) {
+    if (!limits) {
+        return;
+    }
+
+    for (size_t i = 0; i < limits->count; i++) {
+        DeviceSlot* slot = limits->slots[i];
+        for (size_t l = 0; l < DEVICE_LANE_COUNT; l++) {
+            LaneState* lane = &slot->lanes[l];
+            for (size_t k = 0; k < lane->count; k++) {
+                file_entry_free(lane->parked[(lane->head + k) % DEVICE_PARKED_MAX]);
+            }
+            free(lane->parked);
+        }
+        free(slot);
+    }
+    free(limits->slots);
+    pthread_cond_destroy(&limits->room);
+    pthread_mutex_destroy(&limits->mutex);
+    free(limits);
+}
+
+// Callers hold the mutex.
+static DeviceSlot* find_slot(const DeviceLimits* limits, dev_t device) {
+    for (size_t i = 0; i < limits->count; i++) {
+        if (limits->slots[i]->device == device) {
+            return limits->slots[i];
+        }
+    }
+    return NULL;
+}
+
+bool device_limits_add(DeviceLimits* limits, dev_t device, const char* path, DeviceKind* kind) {
+    if (!limits) {
+        return false;
+    }
+
+    pthread_mutex_lock(&limits->mutex);
+    bool known = find_slot(limits, device) != NULL;
+    pthread_mutex_unlock(&limits->mutex);
+    if (known) {
+        return false;
+    }
+
+    // IOKit is slow enough to be kept out of the lock
+    DeviceKind found = device_kind(path);
+    DeviceSlot* slot = calloc(1, sizeof(DeviceSlot));
+    if (!slot) {
+        return false;
+    }
+    slot->device = device;
+    slot->limit = limits->config.threads[found];
+
+    pthread_mutex_lock(&limits->mutex);
+    bool added = false;
+    if (!find_slot(limits, device)) {
+        if (limits->count == limits->capacity) {
+            size_t capacity = limits->capacity ? limits->capacity * 2 : 4;
+            DeviceSlot** slots = realloc(limits->slots, capacity * sizeof(DeviceSlot*));
+            if (slots) {
+                limits->slots = slots;
+                limits->capacity = capacity;
+            }
+        }
+        if (limits->count < limits->capacity) {
+            limits->slots[limits->count++] = slot;
+            added = true;
+            if (slot->limit > 0) {
+                atomic_store(&limits->limited, true);
+            }
+        }
+    }
+    pthread_mutex_unlock(&limits->mutex);
+
+    if (!added) {
+        free(slot);
+        return false;
+    }
+    if (kind) {
+        *kind = found;
+    }
+    return true;
+}
+
+bool device_limits_enter(DeviceLimits* limits, DeviceLane lane_id, FileEntry* fe) {
+    if (!limits || !fe || !atomic_load_explicit(&limits->limited, memory_order_relaxed)) {
+        return true;
+    }
+
+    pthread_mutex_lock(&limits->mutex);
+    // slots are never removed, the pointer stays valid while waiting
+    DeviceSlot* slot = find_slot(limits, fe->device);
+    if (!slot || slot->limit == 0) {
+        pthread_mutex_unlock(&limits->mutex);
+        return true;
+    }
+
+    LaneState* lane = &slot->lanes[lane_id];
+    if (!lane->parked && lane->active >= slot->limit) {
+        lane->parked = malloc(DEVICE_PARKED_MAX * sizeof(FileEntry*));
+    }
+    while (lane->active >= slot->limit && lane->parked && lane->count == DEVICE_PARKED_MAX) {
+        pthread_cond_wait(&limits->room, &limits->mutex);
+    }
+
+    // without a ring, going over the limit beats losing the entry
+    if (lane->active < slot->limit || !lane->parked) {
+        lane->active++;
+        pthread_mutex_unlock(&limits->mutex);
+        return true;
+    }
+
+    lane->parked[(lane->head + lane->count) % DEVICE_PARKED_MAX] = fe;
+    lane->count++;
+    pthread_mutex_unlock(&limits->mutex);
+    return false;
+}
+
+FileEntry* device_limits_leave(DeviceLimits* limits, DeviceLane lane_id, dev_t device) {
+    if (!limits || !atomic_load_explicit(&limits->limited, memory_order_relaxed)) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&limits->mutex);
+    DeviceSlot* slot = find_slot(limits, device);
+    if (!slot || slot->limit == 0) {
+        pthread_mutex_unlock(&limits->mutex);
+        return NULL;
+    }
+
+    // the caller's turn passes on to the parked entry
+    LaneState* lane = &slot->lanes[lane_id];
+    FileEntry* next = NULL;
+    if (lane->count > 0) {
+        next = lane->parked[lane->head];
+        lane->head = (lane->head + 1) % DEVICE_PARKED_MAX;
+        lane->count--;
+    } else if (lane->active > 0) {
+        lane->active--;
+    }
+    pthread_cond_broadcast(&limits->room);
+    pthread_mutex_unlock(&limits->mutex);
+    return next;
+}
@@ -0,0 +1,85 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#ifndef __DEDUP_DEVICE_LIMIT_H__
+#define __DEDUP_DEVICE_LIMIT_H__
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "queue.h"
+
+/// Device Limits
+///
+/// `-t` and `-Q` size the stages for the fastest device, a hard disk
+/// visited by as many threads seeks between their files the whole time.
+/// Each device is therefore given a limit on the threads of a stage that
+/// may work on its files at once, by the kind of device it is: solid state
+/// devices are not limited by default, hard disks and network volumes are.
+///
+/// A thread that finds its device at the limit doesn't wait, `enter` parks
+/// the entry and the thread moves on to the next one, likely on another
+/// device. Whoever leaves the device next continues with the parked entry,
+/// the way `visit_order_end` hands out the next entry of a group. Only once
+/// a device has `DEVICE_PARKED_MAX` entries parked does `enter` wait, which
+/// keeps the backlog of a slow device from growing without bound.
+///
+/// The readers and the workers are limited separately, each is a lane.
+typedef struct DeviceLimits DeviceLimits;
+
+typedef enum DeviceKind {
+    DEVICE_SOLID_STATE,
+    DEVICE_ROTATIONAL,
+    DEVICE_NETWORK,
+    DEVICE_KIND_COUNT,
+} DeviceKind;
+
+typedef enum DeviceLane {
+    DEVICE_LANE_READ,
+    DEVICE_LANE_VISIT,
+    DEVICE_LANE_COUNT,
+} DeviceLane;
+
+#define DEVICE_PARKED_MAX 1024
+
+/// Threads per lane by kind of device, 0 for no limit.
+typedef struct DeviceLimitConfig {
+    unsigned threads[DEVICE_KIND_COUNT];
+} DeviceLimitConfig;
+
+/// The defaults: no limit for solid state, 2 threads for hard disks and 4
+/// for network volumes.
+DeviceLimitConfig device_limit_defaults(void);
+
+/// Parses a comma separated list of `kind=n`, with kind one of `ssd`, `hdd`
+/// or `network`, into `config`. Kinds that aren't listed keep their value.
+bool device_limit_parse(const char* spec, DeviceLimitConfig* config);
+
+const char* device_kind_name(DeviceKind kind);
+
+/// Tells hard disks from solid state devices by the medium type IOKit
+/// reports for the device `path` is on, and volumes that aren't local from
+/// both. Devices that can't be told are taken to be solid state.
+DeviceKind device_kind(const char* path);
+
+DeviceLimits* new_device_limits(const DeviceLimitConfig* config);
+
+/// Frees the limits along with any entries still parked.
+void free_device_limits(DeviceLimits* limits);
+
+/// Sets up `device` by the kind of device `path` is on, unless it is known
+/// already. Returns true and stores its kind in `kind` the first time.
+bool device_limits_add(DeviceLimits* limits, dev_t device, const char* path, DeviceKind* kind);
+
+/// Returns true if the caller may work on `fe` in `lane` now. Otherwise
+/// `fe` is parked, ownership passes to the limits, and false is returned.
+bool device_limits_enter(DeviceLimits* limits, DeviceLane lane, FileEntry* fe);
+
+/// Ends the work on an entry of `device` in `lane`. Returns the next parked
+/// entry of the device, which the caller continues with as if it had
+/// entered, or NULL.
+FileEntry* device_limits_leave(DeviceLimits* limits, DeviceLane lane, dev_t device);
+
+#endif // __DEDUP_DEVICE_LIMIT_H__
@@ -0,0 +1,78 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include "dir_handle.h"
+
+#include <sys/resource.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// A quarter of RLIMIT_NOFILE, like the file handle cache, the directories
+// of the entries in flight rarely need more.
+#define DIR_HANDLE_MIN_OPEN 8
+#define DIR_HANDLE_MAX_OPEN 4096
+
+static atomic_size_t g_open_count;
+static atomic_size_t g_limit;
+
+static size_t default_limit(void) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur == RLIM_INFINITY) {
+        return 256;
+    }
+
+    size_t max_open = (size_t)limit.rlim_cur / 4;
+    if (max_open < DIR_HANDLE_MIN_OPEN) {
+        return DIR_HANDLE_MIN_OPEN;
+    }
+    return max_open > DIR_HANDLE_MAX_OPEN ? DIR_HANDLE_MAX_OPEN : max_open;
+}
+
+void dir_handle_set_limit(size_t limit) {
+    atomic_store(&g_limit, limit ? limit : default_limit());
+}
+
+size_t dir_handle_limit(void) {
+    size_t limit = atomic_load_explicit(&g_limit, memory_order_relaxed);
+    if (limit == 0) {
+        // racing here only computes the same default twice
+        limit = default_limit();
+        atomic_store(&g_limit, limit);
+    }
+    return limit;
+}
+
+DirHandle* new_dir_handle(int dir_fd) {
+    if (atomic_fetch_add(&g_open_count, 1) >= dir_handle_limit()) {
+        atomic_fetch_sub(&g_open_count, 1);
+        return NULL;
+    }
+
+    DirHandle* dir = malloc(sizeof(DirHandle));
+    int fd = dir ? fcntl(dir_fd, F_DUPFD_CLOEXEC, 0) : -1;
+    if (fd < 0) {
+        free(dir);
+        atomic_fetch_sub(&g_open_count, 1);
+        return NULL;
+    }
+    dir->fd = fd;
+    atomic_init(&dir->refs, 1);
+    return dir;
+}
+
+DirHandle* dir_handle_retain(DirHandle* dir) {
+    if (dir) {
+        atomic_fetch_add_explicit(&dir->refs, 1, memory_order_relaxed);
+    }
+    return dir;
+}
+
+void dir_handle_release(DirHandle* dir) {
+    if (!dir || atomic_fetch_sub_explicit(&dir->refs, 1, memory_order_acq_rel) != 1) {
+        return;
+    }
+    close(dir->fd);
+    free(dir);
+    atomic_fetch_sub(&g_open_count, 1);
+}
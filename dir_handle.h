@@ -0,0 +1,52 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#ifndef __DEDUP_DIR_HANDLE_H__
+#define __DEDUP_DIR_HANDLE_H__
+
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+/// Directory Handles
+///
+/// Every stage after the traversal used to reach a file by its full path,
+/// which the kernel resolves one component at a time from the root. A
+/// directory handle keeps a directory the walker read open, so the stages
+/// can reach its files by name with the *at() calls instead.
+///
+/// Handles are shared by the walker and every entry read from the same
+/// directory and closed once the last of them lets go. At most
+/// `dir_handle_limit` directories are kept open at a time, past that no
+/// handle is created and the full path is used as before.
+///
+/// All functions accept a NULL handle.
+typedef struct DirHandle {
+    int fd;
+    atomic_size_t refs;
+} DirHandle;
+
+/// Keeps the directory open as `dir_fd` is open now, the caller keeps
+/// `dir_fd`. Returns NULL if the limit has been reached or the descriptor
+/// can't be duplicated.
+DirHandle* new_dir_handle(int dir_fd);
+
+DirHandle* dir_handle_retain(DirHandle* dir);
+void dir_handle_release(DirHandle* dir);
+
+/// The descriptor to pass to the *at() calls, AT_FDCWD for a NULL handle.
+static inline int dir_handle_fd(const DirHandle* dir) {
+    return dir ? dir->fd : AT_FDCWD;
+}
+
+/// The number of directories kept open at most. 0 derives the limit from
+/// RLIMIT_NOFILE, leaving room for the descriptors the rest of the program
+/// needs.
+void dir_handle_set_limit(size_t limit);
+
+/// The number of directories kept open at most, for others that hold on to
+/// handles and leave room for the ones in flight.
+size_t dir_handle_limit(void);
+
+#endif // __DEDUP_DIR_HANDLE_H__
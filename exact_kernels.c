@@ -0,0 +1,143 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include "exact_kernels.h"
+
+#include <string.h>
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define EXACT_HAVE_NEON_UNROLLED 1
+#endif
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define EXACT_HAVE_AVX2_UNROLLED 1
+#endif
+
+// Bytes per unrolled iteration, and how many of them run between checks
+#define EXACT_STEP 128U
+#define EXACT_STEPS_PER_CHECK 8U
+
+bool exact_kernel_memcmp(const unsigned char* a, const unsigned char* b, size_t len) {
+    return memcmp(a, b, len) == 0;
+}
+
+bool exact_kernel_xor_or(const unsigned char* a, const unsigned char* b, size_t len) {
+    size_t i = 0;
+#ifdef __ARM_NEON
+    uint8x16_t diff_acc = vdupq_n_u8(0);
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t va = vld1q_u8(a + i);
+        uint8x16_t vb = vld1q_u8(b + i);
+        diff_acc = vorrq_u8(diff_acc, veorq_u8(va, vb));
+    }
+    if (vmaxvq_u8(diff_acc) != 0) {
+        return false;
+    }
+#endif
+    unsigned char diff = 0;
+    for (; i < len; i++) {
+        diff |= (unsigned char)(a[i] ^ b[i]);
+    }
+    return diff == 0;
+}
+
+// Compares whatever the unrolled loop left over
+static bool tail_equal(const unsigned char* a, const unsigned char* b, size_t len) {
+    return len == 0 || memcmp(a, b, len) == 0;
+}
+
+#if defined(EXACT_HAVE_NEON_UNROLLED)
+
+bool exact_kernel_neon_unrolled_supported(void) {
+    return true;
+}
+
+bool exact_kernel_neon_unrolled(const unsigned char* a, const unsigned char* b, size_t len) {
+    size_t i = 0;
+    while (len - i >= EXACT_STEP) {
+        uint8x16_t acc0 = vdupq_n_u8(0);
+        uint8x16_t acc1 = vdupq_n_u8(0);
+        uint8x16_t acc2 = vdupq_n_u8(0);
+        uint8x16_t acc3 = vdupq_n_u8(0);
+
+        for (size_t step = 0; step < EXACT_STEPS_PER_CHECK && len - i >= EXACT_STEP; step++, i += EXACT_STEP) {
+            uint8x16x4_t va0 = vld1q_u8_x4(a + i);
+            uint8x16x4_t vb0 = vld1q_u8_x4(b + i);
+            uint8x16x4_t va1 = vld1q_u8_x4(a + i + 64);
+            uint8x16x4_t vb1 = vld1q_u8_x4(b + i + 64);
+            acc0 = vorrq_u8(acc0, vorrq_u8(veorq_u8(va0.val[0], vb0.val[0]), veorq_u8(va1.val[0], vb1.val[0])));
+            acc1 = vorrq_u8(acc1, vorrq_u8(veorq_u8(va0.val[1], vb0.val[1]), veorq_u8(va1.val[1], vb1.val[1])));
+            acc2 = vorrq_u8(acc2, vorrq_u8(veorq_u8(va0.val[2], vb0.val[2]), veorq_u8(va1.val[2], vb1.val[2])));
+            acc3 = vorrq_u8(acc3, vorrq_u8(veorq_u8(va0.val[3], vb0.val[3]), veorq_u8(va1.val[3], vb1.val[3])));
+        }
+
+        uint8x16_t acc = vorrq_u8(vorrq_u8(acc0, acc1), vorrq_u8(acc2, acc3));
+        if (vmaxvq_u8(acc) != 0) {
+            return false;
+        }
+    }
+    return tail_equal(a + i, b + i, len - i);
+}
+
+#else
+
+bool exact_kernel_neon_unrolled_supported(void) {
+    return false;
+}
+
+bool exact_kernel_neon_unrolled(const unsigned char* a, const unsigned char* b, size_t len) {
+    return exact_kernel_xor_or(a, b, len);
+}
+
+#endif // EXACT_HAVE_NEON_UNROLLED
+
+#if defined(EXACT_HAVE_AVX2_UNROLLED)
+
+bool exact_kernel_avx2_unrolled_supported(void) {
+    return __builtin_cpu_supports("avx2");
+}
+
+__attribute__((target("avx2")))
+static bool avx2_unrolled(const unsigned char* a, const unsigned char* b, size_t len) {
+    size_t i = 0;
+    while (len - i >= EXACT_STEP) {
+        __m256i acc0 = _mm256_setzero_si256();
+        __m256i acc1 = _mm256_setzero_si256();
+
+        for (size_t step = 0; step < EXACT_STEPS_PER_CHECK && len - i >= EXACT_STEP; step++, i += EXACT_STEP) {
+            const __m256i* pa = (const __m256i*)(const void*)(a + i);
+            const __m256i* pb = (const __m256i*)(const void*)(b + i);
+            __m256i x0 = _mm256_xor_si256(_mm256_loadu_si256(pa + 0), _mm256_loadu_si256(pb + 0));
+            __m256i x1 = _mm256_xor_si256(_mm256_loadu_si256(pa + 1), _mm256_loadu_si256(pb + 1));
+            __m256i x2 = _mm256_xor_si256(_mm256_loadu_si256(pa + 2), _mm256_loadu_si256(pb + 2));
+            __m256i x3 = _mm256_xor_si256(_mm256_loadu_si256(pa + 3), _mm256_loadu_si256(pb + 3));
+            acc0 = _mm256_or_si256(acc0, _mm256_or_si256(x0, x2));
+            acc1 = _mm256_or_si256(acc1, _mm256_or_si256(x1, x3));
+        }
+
+        __m256i acc = _mm256_or_si256(acc0, acc1);
+        if (!_mm256_testz_si256(acc, acc)) {
+            return false;
+        }
+    }
+    return tail_equal(a + i, b + i, len - i);
+}
+
+bool exact_kernel_avx2_unrolled(const unsigned char* a, const unsigned char* b, size_t len) {
+    return avx2_unrolled(a, b, len);
+}
+
+#else
+
+bool exact_kernel_avx2_unrolled_supported(void) {
+    return false;
+}
+
+bool exact_kernel_avx2_unrolled(const unsigned char* a, const unsigned char* b, size_t len) {
+    return exact_kernel_xor_or(a, b, len);
+}
+
+#endif // EXACT_HAVE_AVX2_UNROLLED
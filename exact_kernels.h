@@ -0,0 +1,33 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#ifndef __DEDUP_EXACT_KERNELS_H__
+#define __DEDUP_EXACT_KERNELS_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/// Exact Compare Kernels
+///
+/// Buffer comparisons behind the exact compare backends, shared with the
+/// calibration benchmarks so that what is measured is what runs.
+///
+/// The unrolled kernels compare 128 bytes per iteration into several
+/// independent accumulators and only test for a difference once per
+/// kilobyte. They are only available where the build and the CPU support
+/// them, check the `_supported` function before calling one.
+typedef bool (*exact_kernel_fn)(const unsigned char* a, const unsigned char* b, size_t len);
+
+bool exact_kernel_memcmp(const unsigned char* a, const unsigned char* b, size_t len);
+
+/// XOR/OR reduction, one 16 byte vector at a time where NEON is available.
+bool exact_kernel_xor_or(const unsigned char* a, const unsigned char* b, size_t len);
+
+bool exact_kernel_neon_unrolled_supported(void);
+bool exact_kernel_neon_unrolled(const unsigned char* a, const unsigned char* b, size_t len);
+
+bool exact_kernel_avx2_unrolled_supported(void);
+bool exact_kernel_avx2_unrolled(const unsigned char* a, const unsigned char* b, size_t len);
+
+#endif // __DEDUP_EXACT_KERNELS_H__
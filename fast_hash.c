@@ -0,0 +1,258 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include "fast_hash.h"
+
+#include <string.h>
+
+__extension__ typedef unsigned __int128 u128;
+
+// Both hashes read little endian words, which is what both of our targets
+// use natively
+static inline uint64_t read64(const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void mul128(uint64_t a, uint64_t b, uint64_t* lo, uint64_t* hi) {
+    u128 r = (u128)a * b;
+    *lo = (uint64_t)r;
+    *hi = (uint64_t)(r >> 64);
+}
+
+// MARK: rapidhash
+
+#define RAPID_SEED 0xbdd89aa982704029ULL
+
+static const uint64_t rapid_secret[3] = {
+    0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL, 0x4b33a62ed433d4a3ULL,
+};
+
+static inline void rapid_mum(uint64_t* a, uint64_t* b) {
+    mul128(*a, *b, a, b);
+}
+
+static inline uint64_t rapid_mix(uint64_t a, uint64_t b) {
+    rapid_mum(&a, &b);
+    return a ^ b;
+}
+
+static inline uint64_t rapid_read_small(const uint8_t* p, size_t k) {
+    return ((uint64_t)p[0] << 56) | ((uint64_t)p[k >> 1] << 32) | p[k - 1];
+}
+
+uint64_t fast_hash_rapidhash(const void* data, size_t len) {
+    const uint8_t* p = data;
+    const uint64_t* secret = rapid_secret;
+    uint64_t seed = RAPID_SEED;
+    seed ^= rapid_mix(seed ^ secret[0], secret[1]) ^ len;
+
+    uint64_t a = 0;
+    uint64_t b = 0;
+    if (len <= 16) {
+        if (len >= 4) {
+            const uint8_t* plast = p + len - 4;
+            a = (read32(p) << 32) | read32(plast);
+            const uint64_t delta = (len & 24) >> (len >> 3);
+            b = (read32(p + delta) << 32) | read32(plast - delta);
+        } else if (len > 0) {
+            a = rapid_read_small(p, len);
+        }
+    } else {
+        size_t i = len;
+        if (i > 48) {
+            uint64_t see1 = seed;
+            uint64_t see2 = seed;
+            while (i >= 96) {
+                seed = rapid_mix(read64(p) ^ secret[0], read64(p + 8) ^ seed);
+                see1 = rapid_mix(read64(p + 16) ^ secret[1], read64(p + 24) ^ see1);
+                see2 = rapid_mix(read64(p + 32) ^ secret[2], read64(p + 40) ^ see2);
+                seed = rapid_mix(read64(p + 48) ^ secret[0], read64(p + 56) ^ seed);
+                see1 = rapid_mix(read64(p + 64) ^ secret[1], read64(p + 72) ^ see1);
+                see2 = rapid_mix(read64(p + 80) ^ secret[2], read64(p + 88) ^ see2);
+                p += 96;
+                i -= 96;
+            }
+            if (i >= 48) {
+                seed = rapid_mix(read64(p) ^ secret[0], read64(p + 8) ^ seed);
+                see1 = rapid_mix(read64(p + 16) ^ secret[1], read64(p + 24) ^ see1);
+                see2 = rapid_mix(read64(p + 32) ^ secret[2], read64(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            }
+            seed ^= see1 ^ see2;
+        }
+        if (i > 16) {
+            seed = rapid_mix(read64(p) ^ secret[2], read64(p + 8) ^ seed ^ secret[1]);
+            if (i > 32) {
+                seed = rapid_mix(read64(p + 16) ^ secret[2], read64(p + 24) ^ seed);
+            }
+        }
+        // the last 16 bytes, which may overlap what was already mixed
+        a = read64(p + i - 16);
+        b = read64(p + i - 8);
+    }
+
+    a ^= secret[1];
+    b ^= seed;
+    rapid_mum(&a, &b);
+    return rapid_mix(a ^ secret[0] ^ len, b ^ secret[1]);
+}
+
+// MARK: komihash
+
+// Loads the final 0-7 bytes of a message padded with a 1 bit. `_l3` may read
+// up to 3 bytes before `p`, `_l4` up to 4, `_nz` never reads outside of
+// [p, p + len) and requires len > 0.
+static inline uint64_t komi_pad_l3(const uint8_t* p, size_t len) {
+    const int ml8 = (int)(len * 8);
+    if (len < 4) {
+        const uint8_t* p3 = p + len - 3;
+        const uint64_t m = (uint64_t)p3[0] | (uint64_t)p3[1] << 8 | (uint64_t)p3[2] << 16;
+        return (uint64_t)1 << ml8 | m >> (24 - ml8);
+    }
+    const uint64_t mh = read32(p + len - 4);
+    const uint64_t ml = read32(p);
+    return (uint64_t)1 << ml8 | ml | (mh >> (64 - ml8)) << 32;
+}
+
+static inline uint64_t komi_pad_nz(const uint8_t* p, size_t len) {
+    const int ml8 = (int)(len * 8);
+    if (len < 4) {
+        uint64_t m = p[0];
+        if (len > 1) {
+            m |= (uint64_t)p[1] << 8;
+            if (len > 2) {
+                m |= (uint64_t)p[2] << 16;
+            }
+        }
+        return (uint64_t)1 << ml8 | m;
+    }
+    const uint64_t mh = read32(p + len - 4);
+    const uint64_t ml = read32(p);
+    return (uint64_t)1 << ml8 | ml | (mh >> (64 - ml8)) << 32;
+}
+
+static inline uint64_t komi_pad_l4(const uint8_t* p, size_t len) {
+    const int ml8 = (int)(len * 8);
+    if (len < 5) {
+        const uint64_t m = read32(p + len - 4);
+        return (uint64_t)1 << ml8 | m >> (32 - ml8);
+    }
+    const uint64_t m = read64(p + len - 8);
+    return (uint64_t)1 << ml8 | m >> (64 - ml8);
+}
+
+#define KOMI_ROUND() do { \
+        mul128(seed1, seed5, &seed1, &r1h); \
+        seed5 += r1h; \
+        seed1 ^= seed5; \
+    } while (0)
+
+#define KOMI_HASH16(m) do { \
+        mul128(seed1 ^ read64(m), seed5 ^ read64((m) + 8), &seed1, &r1h); \
+        seed5 += r1h; \
+        seed1 ^= seed5; \
+    } while (0)
+
+#define KOMI_FINISH() do { \
+        mul128(r1h, r2h, &seed1, &r1h); \
+        seed5 += r1h; \
+        seed1 ^= seed5; \
+        KOMI_ROUND(); \
+        return seed1; \
+    } while (0)
+
+uint64_t fast_hash_komihash(const void* data, size_t len) {
+    const uint8_t* p = data;
+    uint64_t seed1 = 0x243F6A8885A308D3ULL;
+    uint64_t seed5 = 0x452821E638D01377ULL;
+    uint64_t r1h = 0;
+    uint64_t r2h = 0;
+
+    KOMI_ROUND();
+
+    if (len < 16) {
+        r1h = seed1;
+        r2h = seed5;
+        if (len > 7) {
+            r2h ^= komi_pad_l3(p + 8, len - 8);
+            r1h ^= read64(p);
+        } else if (len != 0) {
+            r1h ^= komi_pad_nz(p, len);
+        }
+        KOMI_FINISH();
+    }
+
+    if (len < 32) {
+        KOMI_HASH16(p);
+        if (len > 23) {
+            r2h = seed5 ^ komi_pad_l4(p + 24, len - 24);
+            r1h = seed1 ^ read64(p + 16);
+        } else {
+            r1h = seed1 ^ komi_pad_l4(p + 16, len - 16);
+            r2h = seed5;
+        }
+        KOMI_FINISH();
+    }
+
+    if (len > 63) {
+        uint64_t seed2 = 0x13198A2E03707344ULL ^ seed1;
+        uint64_t seed3 = 0xA4093822299F31D0ULL ^ seed1;
+        uint64_t seed4 = 0x082EFA98EC4E6C89ULL ^ seed1;
+        uint64_t seed6 = 0xBE5466CF34E90C6CULL ^ seed5;
+        uint64_t seed7 = 0xC0AC29B7C97C50DDULL ^ seed5;
+        uint64_t seed8 = 0x3F84D5B5B5470917ULL ^ seed5;
+        uint64_t r3h = 0;
+        uint64_t r4h = 0;
+
+        do {
+            mul128(seed1 ^ read64(p), seed5 ^ read64(p + 32), &seed1, &r1h);
+            mul128(seed2 ^ read64(p + 8), seed6 ^ read64(p + 40), &seed2, &r2h);
+            mul128(seed3 ^ read64(p + 16), seed7 ^ read64(p + 48), &seed3, &r3h);
+            mul128(seed4 ^ read64(p + 24), seed8 ^ read64(p + 56), &seed4, &r4h);
+            p += 64;
+            len -= 64;
+            seed5 += r1h;
+            seed6 += r2h;
+            seed7 += r3h;
+            seed8 += r4h;
+            seed2 ^= seed5;
+            seed3 ^= seed6;
+            seed4 ^= seed7;
+            seed1 ^= seed8;
+        } while (len > 63);
+
+        seed5 ^= seed6 ^ seed7 ^ seed8;
+        seed1 ^= seed2 ^ seed3 ^ seed4;
+    }
+
+    if (len > 31) {
+        KOMI_HASH16(p);
+        KOMI_HASH16(p + 16);
+        p += 32;
+        len -= 32;
+    }
+    if (len > 15) {
+        KOMI_HASH16(p);
+        p += 16;
+        len -= 16;
+    }
+
+    if (len > 7) {
+        r2h = seed5 ^ komi_pad_l4(p + 8, len - 8);
+        r1h = seed1 ^ read64(p);
+    } else {
+        r1h = seed1 ^ komi_pad_l4(p, len);
+        r2h = seed5;
+    }
+    KOMI_FINISH();
+}
@@ -0,0 +1,27 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#ifndef __DEDUP_FAST_HASH_H__
+#define __DEDUP_FAST_HASH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// Fast Candidate Hashes
+///
+/// Alternatives to the xxHash64 that signatures use for their first 4 KiB,
+/// selected by the runtime dispatch (`DEDUP_FORCE_FAST_HASH` or startup
+/// calibration). Both are built around a 64x64->128 bit multiply, which is a
+/// single instruction pair on arm64 and x86_64, and are used unseeded.
+///
+/// Since the value ends up in signatures and in the signature cache, a
+/// backend must produce the same value for the same bytes on every host.
+
+/// rapidhash, after Nicolas De Carli's construction (v1).
+uint64_t fast_hash_rapidhash(const void* data, size_t len);
+
+/// komihash 5, after Aleksey Vaneev's construction.
+uint64_t fast_hash_komihash(const void* data, size_t len);
+
+#endif // __DEDUP_FAST_HASH_H__
@@ -0,0 +1,337 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include "file_handle.h"
+
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Limits for the derived descriptor budget. A quarter of RLIMIT_NOFILE is
+// left to the cache, the rest belongs to the walker and everything else.
+#define FILE_HANDLE_MIN_OPEN 8
+#define FILE_HANDLE_MAX_OPEN 4096
+
+struct FileHandleCache {
+    pthread_mutex_t mutex;
+    FileHandle** buckets;
+    size_t bucket_count;    // always a power of 2
+    FileHandle* lru_head;   // idle, least recently used first
+    FileHandle* lru_tail;
+    size_t open_count;      // cached handles, idle or in use
+    size_t max_open;
+};
+
+static uint64_t path_hash(const char* path) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (const unsigned char* p = (const unsigned char*)path; *p; p++) {
+        h = (h ^ *p) * 0x100000001b3ULL;
+    }
+    return h ^ (h >> 29);
+}
+
+static size_t default_max_open(void) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur == RLIM_INFINITY) {
+        return 256;
+    }
+
+    size_t max_open = (size_t)limit.rlim_cur / 4;
+    if (max_open < FILE_HANDLE_MIN_OPEN) {
+        return FILE_HANDLE_MIN_OPEN;
+    }
+    return max_open > FILE_HANDLE_MAX_OPEN ? FILE_HANDLE_MAX_OPEN : max_open;
+}
+
+FileHandle* file_handle_open(const char* path) {
+    return file_handle_open_at(AT_FDCWD, path, path);
+}
+
+FileHandle* file_handle_open_at(int dir_fd, const char* name, const char* path) {
+    if (!name || !path) {
+        return NULL;
+    }
+
+    // O_NONBLOCK keeps the open itself from hanging on locked files
+    int fd = openat(dir_fd, name, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    // Clear O_NONBLOCK for actual I/O operations
+    int flags = fcntl(fd, F_GETFL);
+    if (flags >= 0) {
+        fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+    }
+
+    FileHandle* handle = calloc(1, sizeof(FileHandle));
+    if (!handle || fstat(fd, &handle->stat) != 0 || !(handle->path = strdup(path))) {
+        free(handle);
+        close(fd);
+        return NULL;
+    }
+    handle->fd = fd;
+    return handle;
+}
+
+void file_handle_close(FileHandle* handle) {
+    if (!handle) {
+        return;
+    }
+    close(handle->fd);
+    free(handle->path);
+    free(handle);
+}
+
+FileHandleCache* new_file_handle_cache(size_t max_open) {
+    FileHandleCache* cache = calloc(1, sizeof(FileHandleCache));
+    if (!cache) {
+        return NULL;
+    }
+
+    cache->max_open = max_open ? max_open : default_max_open();
+    cache->bucket_count = 64;
+    while (cache->bucket_count < cache->max_open * 2) {
+        cache->bucket_count *= 2;
+    }
+    cache->buckets = calloc(cache->bucket_count, sizeof(FileHandle*));
+    if (!cache->buckets) {
+        free(cache);
+        return NULL;
+    }
+    pthread_mutex_init(&cache->mutex, NULL);
+
+    return cache;
+}
+
+void free_file_handle_cache(FileHandleCache* cache) {
+    if (!cache) {
+        return;
+    }
+
+    for (size_t i = 0; i < cache->bucket_count; i++) {
+        FileHandle* h = cache->buckets[i];
+        while (h) {
+            FileHandle* next = h->hash_next;
+            file_handle_close(h);
+            h = next;
+        }
+    }
+    free(cache->buckets);
+    pthread_mutex_destroy(&cache->mutex);
+    free(cache);
+}
+
+static FileHandle** bucket_for(FileHandleCache* cache, const char* path) {
+    return &cache->buckets[path_hash(path) & (cache->bucket_count - 1)];
+}
+
+static FileHandle* cache_find(FileHandleCache* cache, const char* path) {
+    for (FileHandle* h = *bucket_for(cache, path); h; h = h->hash_next) {
+        if (strcmp(h->path, path) == 0) {
+            return h;
+        }
+    }
+    return NULL;
+}
+
+static void cache_unlink(FileHandleCache* cache, FileHandle* handle) {
+    FileHandle** link = bucket_for(cache, handle->path);
+    while (*link != handle) {
+        link = &(*link)->hash_next;
+    }
+    *link = handle->hash_next;
+    handle->hash_next = NULL;
+}
+
+static void lru_remove(FileHandleCache* cache, FileHandle* handle) {
+    if (handle->lru_prev) {
+        handle->lru_prev->lru_next = handle->lru_next;
+    } else {
+        cache->lru_head = handle->lru_next;
+    }
+    if (handle->lru_next) {
+        handle->lru_next->lru_prev = handle->lru_prev;
+    } else {
+        cache->lru_tail = handle->lru_prev;
+    }
+    handle->lru_prev = handle->lru_next = NULL;
+}
+
+static void lru_append(FileHandleCache* cache, FileHandle* handle) {
+    handle->lru_prev = cache->lru_tail;
+    handle->lru_next = NULL;
+    if (cache->lru_tail) {
+        cache->lru_tail->lru_next = handle;
+    } else {
+        cache->lru_head = handle;
+    }
+    cache->lru_tail = handle;
+}
+
+// Detaches idle handles until the cache is back within its limit. They are
+// returned as a list so they can be closed without holding the lock.
+static FileHandle* cache_evict(FileHandleCache* cache) {
+    FileHandle* evicted = NULL;
+    while (cache->open_count > cache->max_open && cache->lru_head) {
+        FileHandle* victim = cache->lru_head;
+        lru_remove(cache, victim);
+        cache_unlink(cache, victim);
+        cache->open_count--;
+        victim->hash_next = evicted;
+        evicted = victim;
+    }
+    return evicted;
+}
+
+static void close_list(FileHandle* list) {
+    while (list) {
+        FileHandle* next = list->hash_next;
+        file_handle_close(list);
+        list = next;
+    }
+}
+
+static bool stat_unchanged(const struct stat* a, const struct stat* b) {
+    return a->st_dev == b->st_dev && a->st_ino == b->st_ino && a->st_size == b->st_size &&
+           a->st_mtimespec.tv_sec == b->st_mtimespec.tv_sec && a->st_mtimespec.tv_nsec == b->st_mtimespec.tv_nsec &&
+           a->st_ctimespec.tv_sec == b->st_ctimespec.tv_sec && a->st_ctimespec.tv_nsec == b->st_ctimespec.tv_nsec;
+}
+
+FileHandle* file_handle_acquire(FileHandleCache* cache, const char* path) {
+    return file_handle_acquire_at(cache, AT_FDCWD, path, path);
+}
+
+FileHandle* file_handle_acquire_at(FileHandleCache* cache, int dir_fd, const char* name, const char* path) {
+    if (!cache) {
+        return file_handle_open_at(dir_fd, name, path);
+    }
+    if (!name || !path) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&cache->mutex);
+    FileHandle* h = cache_find(cache, path);
+    if (h && h->refs++ == 0) {
+        lru_remove(cache, h);
+    }
+    pthread_mutex_unlock(&cache->mutex);
+
+    if (h) {
+        // compares trust the size the handle carries, a file that changed
+        // or was replaced since it was opened is opened again
+        struct stat st;
+        if (fstatat(dir_fd, name, &st, 0) == 0 && stat_unchanged(&h->stat, &st)) {
+            return h;
+        }
+        pthread_mutex_lock(&cache->mutex);
+        if (cache_find(cache, path) == h) {
+            cache_unlink(cache, h);
+            h->stale = true;
+        }
+        pthread_mutex_unlock(&cache->mutex);
+        file_handle_release(cache, h);
+    }
+
+    // opening can be slow, don't hold up other threads while it happens
+    FileHandle* fresh = file_handle_open_at(dir_fd, name, path);
+    if (!fresh) {
+        return NULL;
+    }
+
+    FileHandle* evicted = NULL;
+    pthread_mutex_lock(&cache->mutex);
+    h = cache_find(cache, path);
+    if (h) {
+        // another thread opened it in the meantime
+        if (h->refs++ == 0) {
+            lru_remove(cache, h);
+        }
+    } else {
+        h = fresh;
+        fresh = NULL;
+        h->cached = true;
+        h->refs = 1;
+        FileHandle** bucket = bucket_for(cache, path);
+        h->hash_next = *bucket;
+        *bucket = h;
+        cache->open_count++;
+        evicted = cache_evict(cache);
+    }
+    pthread_mutex_unlock(&cache->mutex);
+
+    file_handle_close(fresh);
+    close_list(evicted);
+    return h;
+}
+
+void file_handle_release(FileHandleCache* cache, FileHandle* handle) {
+    if (!handle) {
+        return;
+    }
+    if (!cache || !handle->cached) {
+        file_handle_close(handle);
+        return;
+    }
+
+    FileHandle* evicted = NULL;
+    pthread_mutex_lock(&cache->mutex);
+    if (--handle->refs == 0) {
+        if (handle->stale) {
+            cache->open_count--;
+            evicted = handle;
+        } else {
+            lru_append(cache, handle);
+            evicted = cache_evict(cache);
+        }
+    }
+    pthread_mutex_unlock(&cache->mutex);
+
+    close_list(evicted);
+}
+
+void file_handle_advise(const FileHandle* handle, off_t offset, size_t len) {
+    if (!handle || len == 0) {
+        return;
+    }
+#if defined(F_RDADVISE)
+    struct radvisory advisory = {
+        .ra_offset = offset,
+        .ra_count = len > INT32_MAX ? INT32_MAX : (int)len,
+    };
+    (void)fcntl(handle->fd, F_RDADVISE, &advisory);
+#elif defined(POSIX_FADV_WILLNEED)
+    (void)posix_fadvise(handle->fd, offset, (off_t)len, POSIX_FADV_WILLNEED);
+#else
+    (void)offset;
+#endif
+}
+
+void file_handle_forget(FileHandleCache* cache, const char* path) {
+    if (!cache || !path) {
+        return;
+    }
+
+    FileHandle* evicted = NULL;
+    pthread_mutex_lock(&cache->mutex);
+    FileHandle* h = cache_find(cache, path);
+    if (h) {
+        cache_unlink(cache, h);
+        if (h->refs == 0) {
+            lru_remove(cache, h);
+            cache->open_count--;
+            evicted = h;
+        } else {
+            // closed by the last release
+            h->stale = true;
+        }
+    }
+    pthread_mutex_unlock(&cache->mutex);
+
+    close_list(evicted);
+}
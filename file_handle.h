@@ -0,0 +1,81 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#ifndef __DEDUP_FILE_HANDLE_H__
+#define __DEDUP_FILE_HANDLE_H__
+
+#include <sys/stat.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/// File Handles
+///
+/// A candidate pair is read by several stages: the signature, the witness
+/// and the exact compare. Each used to open the files again, which costs
+/// milliseconds per open on network and FUSE volumes. A handle carries the
+/// descriptor and its `fstat` result from one stage to the next.
+///
+/// The cache keeps handles open by path after they are released so the next
+/// stage, or the next duplicate of the same origin, can reuse them. A
+/// reused handle is checked with a stat of its path first: if the file was
+/// replaced, or its size, mtime or ctime changed, it is opened again. Idle
+/// handles are closed in least recently used order once `max_open` are
+/// open. Handles in use are never closed, so the limit may be exceeded by
+/// the handles the workers hold at the same time.
+///
+/// All reads through a handle are positional, handles may be shared between
+/// threads. All functions accept a NULL cache, in which case every acquire
+/// opens the file and every release closes it.
+typedef struct FileHandle {
+    char* path;
+    int fd;
+    struct stat stat;
+
+    // owned by the cache
+    size_t refs;
+    bool cached;
+    bool stale;                     // forgotten while in use
+    struct FileHandle* hash_next;
+    struct FileHandle* lru_prev;
+    struct FileHandle* lru_next;
+} FileHandle;
+
+typedef struct FileHandleCache FileHandleCache;
+
+/// Creates a cache that keeps at most `max_open` idle descriptors. 0 derives
+/// the limit from RLIMIT_NOFILE, leaving room for the descriptors the rest
+/// of the program needs.
+FileHandleCache* new_file_handle_cache(size_t max_open);
+void free_file_handle_cache(FileHandleCache* cache);
+
+/// Opens `path` read-only outside of any cache. Returns NULL on error.
+FileHandle* file_handle_open(const char* path);
+/// Opens `name` relative to the directory `dir_fd`, which may be AT_FDCWD.
+/// `path` is the full path of the file, kept with the handle.
+FileHandle* file_handle_open_at(int dir_fd, const char* name, const char* path);
+void file_handle_close(FileHandle* handle);
+
+/// Returns an open handle for `path`, reusing a cached one if possible.
+/// Returns NULL if the file can't be opened.
+FileHandle* file_handle_acquire(FileHandleCache* cache, const char* path);
+
+/// Like `file_handle_acquire`, but a file that isn't cached is opened as
+/// `name` relative to the directory `dir_fd`. Handles are still cached by
+/// `path`.
+FileHandle* file_handle_acquire_at(FileHandleCache* cache, int dir_fd, const char* name, const char* path);
+
+/// Returns a handle obtained from `file_handle_acquire`.
+void file_handle_release(FileHandleCache* cache, FileHandle* handle);
+
+/// Starts reading a range the caller is about to ask for, so that several
+/// scattered reads are queued at once instead of one seek at a time. Does
+/// not wait for the data.
+void file_handle_advise(const FileHandle* handle, off_t offset, size_t len);
+
+/// Drops the cached handle of `path`, if any. Must be called after the file
+/// at `path` has been replaced, a cached handle would still read the old
+/// file.
+void file_handle_forget(FileHandleCache* cache, const char* path);
+
+#endif // __DEDUP_FILE_HANDLE_H__
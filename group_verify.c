@@ -0,0 +1,213 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include "group_verify.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "runtime_dispatch.h"
+
+// Tile bounds, large tiles for small groups, never so small that the
+// per-tile syscall overhead dominates
+#define GROUP_VERIFY_MAX_TILE (1024U * 1024U)
+#define GROUP_VERIFY_MIN_TILE (64U * 1024U)
+
+struct GroupVerdict {
+    size_t count;
+    char** paths;
+    size_t* class_of;   // lowest member index with identical content
+};
+
+static bool read_tile(int fd, unsigned char* buf, size_t len, uint64_t offset) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pread(fd, buf + done, len - done, (off_t)(offset + done));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        done += (size_t)n;
+    }
+    return true;
+}
+
+// Splits `members` into classes of identical content. On return members i
+// and j are identical if and only if class_of[i] == class_of[j]. A member
+// that can't be read is its own class.
+//
+// With a strong hash configured every tile is hashed first, and a member is
+// only compared against representatives with the same digest. That turns a
+// group with many distinct contents from a memcmp per class into one per
+// member, equality is still decided by the memcmp.
+static bool group_partition(FileHandle* const* members, size_t count, uint64_t size, size_t* class_of,
+                            dedup_fast_hash_fn strong_hash) {
+    size_t tile = GROUP_VERIFY_BUDGET / count;
+    tile = tile > GROUP_VERIFY_MAX_TILE ? GROUP_VERIFY_MAX_TILE : tile;
+    tile = tile < GROUP_VERIFY_MIN_TILE ? GROUP_VERIFY_MIN_TILE : tile;
+    if (size < tile) {
+        tile = (size_t)size;
+    }
+
+    unsigned char* buf = malloc(count * tile + 1);
+    bool* live = calloc(count, sizeof(bool));
+    size_t* next_class = calloc(count, sizeof(size_t));
+    size_t* class_size = calloc(count, sizeof(size_t));
+    uint64_t* digest = calloc(count, sizeof(uint64_t));
+    if (!buf || !live || !next_class || !class_size || !digest) {
+        free(buf);
+        free(live);
+        free(next_class);
+        free(class_size);
+        free(digest);
+        return false;
+    }
+
+    // every readable member starts out in one class
+    size_t first = count;
+    for (size_t i = 0; i < count; i++) {
+        class_of[i] = i;
+        if (members[i] && (uint64_t)members[i]->stat.st_size == size) {
+            first = first < count ? first : i;
+            class_of[i] = first;
+            live[i] = true;
+        }
+    }
+
+    size_t live_count = 0;
+    for (size_t i = 0; i < count; i++) {
+        live_count += live[i];
+    }
+
+    for (uint64_t offset = 0; offset < size && live_count > 1; offset += tile) {
+        size_t len = size - offset < tile ? (size_t)(size - offset) : tile;
+
+        for (size_t i = 0; i < count; i++) {
+            if (live[i] && !read_tile(members[i]->fd, buf + i * tile, len, offset)) {
+                class_of[i] = i;
+                live[i] = false;
+            } else if (live[i] && strong_hash) {
+                digest[i] = strong_hash(buf + i * tile, len);
+            }
+        }
+
+        // the lowest member of each new class represents it, later members
+        // only need to be compared against the representatives of their
+        // previous class
+        for (size_t i = 0; i < count; i++) {
+            if (!live[i]) {
+                continue;
+            }
+            next_class[i] = i;
+            for (size_t j = 0; j < i; j++) {
+                if (live[j] && next_class[j] == j && class_of[j] == class_of[i] &&
+                    (!strong_hash || digest[j] == digest[i]) &&
+                    memcmp(buf + j * tile, buf + i * tile, len) == 0) {
+                    next_class[i] = j;
+                    break;
+                }
+            }
+        }
+
+        memset(class_size, 0, count * sizeof(size_t));
+        for (size_t i = 0; i < count; i++) {
+            if (live[i]) {
+                class_of[i] = next_class[i];
+                class_size[class_of[i]]++;
+            }
+        }
+
+        // a member without peers is settled and isn't read any further
+        live_count = 0;
+        for (size_t i = 0; i < count; i++) {
+            live[i] = live[i] && class_size[class_of[i]] > 1;
+            live_count += live[i];
+        }
+    }
+
+    free(buf);
+    free(live);
+    free(next_class);
+    free(class_size);
+    free(digest);
+    return true;
+}
+
+GroupVerdict* new_group_verdict(FileHandleCache* handles, const char* const* paths, size_t count, uint64_t size) {
+    if (!paths || count == 0 || count > GROUP_VERIFY_MAX_MEMBERS) {
+        return NULL;
+    }
+
+    GroupVerdict* verdict = calloc(1, sizeof(GroupVerdict));
+    if (!verdict) {
+        return NULL;
+    }
+    verdict->paths = calloc(count, sizeof(char*));
+    verdict->class_of = calloc(count, sizeof(size_t));
+    if (!verdict->paths || !verdict->class_of) {
+        free_group_verdict(verdict);
+        return NULL;
+    }
+    for (size_t i = 0; i < count; i++) {
+        verdict->paths[i] = strdup(paths[i]);
+        if (!verdict->paths[i]) {
+            free_group_verdict(verdict);
+            return NULL;
+        }
+        verdict->count++;
+    }
+
+    FileHandle* members[GROUP_VERIFY_MAX_MEMBERS];
+    for (size_t i = 0; i < count; i++) {
+        members[i] = file_handle_acquire(handles, paths[i]);
+    }
+    bool partitioned = group_partition(members, count, size, verdict->class_of,
+                                       dedup_runtime_dispatch_get()->strong_hash);
+    for (size_t i = 0; i < count; i++) {
+        file_handle_release(handles, members[i]);
+    }
+
+    if (!partitioned) {
+        free_group_verdict(verdict);
+        return NULL;
+    }
+    return verdict;
+}
+
+void free_group_verdict(GroupVerdict* verdict) {
+    if (!verdict) {
+        return;
+    }
+    for (size_t i = 0; i < verdict->count; i++) {
+        free(verdict->paths[i]);
+    }
+    free(verdict->paths);
+    free(verdict->class_of);
+    free(verdict);
+}
+
+static bool verdict_find(const GroupVerdict* verdict, const char* path, size_t* index) {
+    for (size_t i = 0; i < verdict->count; i++) {
+        if (strcmp(verdict->paths[i], path) == 0) {
+            *index = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool group_verdict_lookup(const GroupVerdict* verdict, const char* a, const char* b, bool* equal) {
+    size_t ia = 0;
+    size_t ib = 0;
+    if (!verdict || !a || !b || !verdict_find(verdict, a, &ia) || !verdict_find(verdict, b, &ib)) {
+        return false;
+    }
+
+    *equal = verdict->class_of[ia] == verdict->class_of[ib];
+    return true;
+}
@@ -0,0 +1,47 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#ifndef __DEDUP_GROUP_VERIFY_H__
+#define __DEDUP_GROUP_VERIFY_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "file_handle.h"
+
+/// Group Verification
+///
+/// Verifying a signature group pair by pair re-reads the group's origin once
+/// for every copy and re-reads a near duplicate every time it loses. Instead
+/// all members of a group are read side by side, one tile at a time, and
+/// split into classes of identical content after every tile. Each file is
+/// read at most once, and a member stops being read as soon as no other
+/// member still matches it. If the runtime dispatch has a strong hash
+/// (`DEDUP_FORCE_STRONG_HASH`), tiles are bucketed by their digest before
+/// they are compared.
+///
+/// Memory is bounded per group: tiles shrink as the group grows so that
+/// `count` tiles never exceed GROUP_VERIFY_BUDGET, and groups are capped at
+/// GROUP_VERIFY_MAX_MEMBERS.
+#define GROUP_VERIFY_MAX_MEMBERS 64
+#define GROUP_VERIFY_BUDGET (16U * 1024U * 1024U)
+
+typedef struct GroupVerdict GroupVerdict;
+
+/// Reads the `count` files at `paths`, all expected to be `size` bytes, and
+/// records which of them are identical. Handles come from `handles`, which
+/// may be NULL. Files that can't be read or no longer have the expected size
+/// match nothing.
+///
+/// Returns NULL if `count` is out of range or memory runs out, callers are
+/// expected to fall back to pairwise compares.
+GroupVerdict* new_group_verdict(FileHandleCache* handles, const char* const* paths, size_t count, uint64_t size);
+void free_group_verdict(GroupVerdict* verdict);
+
+/// Returns true and sets `equal` if both `a` and `b` were members of the
+/// verdict. Returns false if either is unknown, including for a NULL verdict.
+bool group_verdict_lookup(const GroupVerdict* verdict, const char* a, const char* b, bool* equal);
+
+#endif // __DEDUP_GROUP_VERIFY_H__
@@ -0,0 +1,162 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include "libdedup.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "clone.h"
+#include "file_handle.h"
+#include "queue.h"
+#include "runtime_dispatch.h"
+#include "seen_set.h"
+#include "sig_table.h"
+#include "signature.h"
+#include "size_gate.h"
+#include "utils.h"
+
+#define DEDUP_SCAN_CAPACITY 65536
+
+struct DedupScan {
+    DedupScanOptions options;
+    FileHandleCache* handles;
+    SigTable* signatures;
+    SeenSet* seen_inodes;
+    pthread_mutex_t mutex;      // guards the gate and the sequence
+    SizeGate* size_gate;
+    uint64_t next_sequence;
+};
+
+DedupScan* new_dedup_scan(const DedupScanOptions* options) {
+    DedupScan* scan = calloc(1, sizeof(DedupScan));
+    if (!scan) {
+        return NULL;
+    }
+    if (options) {
+        scan->options = *options;
+    }
+
+    size_t capacity = scan->options.capacity ? scan->options.capacity : DEDUP_SCAN_CAPACITY;
+    scan->handles = new_file_handle_cache(0);
+    scan->signatures = scan->handles ? new_sig_table(capacity, scan->handles) : NULL;
+    scan->seen_inodes = new_seen_set(4096);
+    scan->size_gate = new_size_gate();
+    pthread_mutex_init(&scan->mutex, NULL);
+    if (!scan->signatures || !scan->seen_inodes || !scan->size_gate) {
+        free_dedup_scan(scan);
+        return NULL;
+    }
+
+    // picks the backends now rather than in whichever add runs first
+    dedup_runtime_dispatch_get();
+    return scan;
+}
+
+void free_dedup_scan(DedupScan* scan) {
+    if (!scan) {
+        return;
+    }
+
+    free_size_gate(scan->size_gate);
+    free_seen_set(scan->seen_inodes);
+    free_sig_table(scan->signatures);
+    free_file_handle_cache(scan->handles);
+    pthread_mutex_destroy(&scan->mutex);
+    free(scan);
+}
+
+static void emit(const DedupScan* scan, DedupScanEventKind kind, const FileEntry* fe, const char* origin,
+                 int error) {
+    if (!scan->options.fn) {
+        return;
+    }
+    DedupScanEvent event = {
+        .kind = kind,
+        .path = fe->path,
+        .origin = origin,
+        .size = fe->size,
+        .error = error,
+    };
+    scan->options.fn(&event, scan->options.context);
+}
+
+// Matches a file released by the size gate against the files stored so
+// far, and stores it if it is the first with its content.
+static bool scan_entry(DedupScan* scan, FileEntry* fe) {
+    char origin[PATH_MAX];
+    uint64_t clone_id = get_clone_id(fe->path);
+    const SigTableEntry* shared = clone_id ? sig_table_find_clone_id(scan->signatures, fe->device, clone_id) : NULL;
+    if (shared) {
+        if (sig_table_entry_path(shared, origin, sizeof(origin))) {
+            emit(scan, DEDUP_SCAN_SHARED, fe, origin, 0);
+        }
+        return true;
+    }
+
+    FileHandle* handle = file_handle_acquire(scan->handles, fe->path);
+    FileSignature* sig = compute_signature_handle(handle, fe->device, fe->size);
+    file_handle_release(scan->handles, handle);
+    if (!sig) {
+        return false;
+    }
+
+    bool inserted = false;
+    SigTableEntry* existing = sig_table_insert(scan->signatures, sig, fe->path, fe->dir, clone_id, fe->inode, NULL, &inserted);
+    free_signature(sig);
+    if (!existing) {
+        return inserted;
+    }
+    if (!sig_table_entry_path(existing, origin, sizeof(origin))) {
+        return false;
+    }
+
+    int error = 0;
+    DedupScanEventKind kind = DEDUP_SCAN_DUPLICATE;
+    if (scan->options.replace) {
+        // the other links would keep the old blocks
+        error = fe->nlink > 1 ? EMLINK : replace_with_clone_cached(scan->handles, origin, fe->path, NULL);
+        if (error < 0) {
+            error = errno ? errno : EIO;
+        }
+        // the path may now name a different file
+        file_handle_forget(scan->handles, fe->path);
+        if (error == 0) {
+            kind = DEDUP_SCAN_CLONED;
+        }
+    }
+    emit(scan, kind, fe, origin, error);
+    return true;
+}
+
+bool dedup_scan_add(DedupScan* scan, const char* path, const struct stat* st) {
+    if (!scan || !path || !st) {
+        return false;
+    }
+    if (!S_ISREG(st->st_mode) || st->st_size == 0) {
+        return true;
+    }
+    if (st->st_nlink > 1 && seen_set_insert(scan->seen_inodes, (uint64_t)st->st_dev, (uint64_t)st->st_ino)) {
+        return true;
+    }
+
+    pthread_mutex_lock(&scan->mutex);
+    FileEntry* fe = new_file_entry(path, st->st_dev, st->st_ino, st->st_nlink, st->st_flags, (size_t)st->st_size,
+                                   scan->next_sequence++, 0, 0);
+    FileEntry* released[2] = { NULL, NULL };
+    size_t count = fe ? size_gate_offer(scan->size_gate, fe, released) : 0;
+    pthread_mutex_unlock(&scan->mutex);
+    if (!fe) {
+        return false;
+    }
+
+    bool ok = true;
+    for (size_t i = 0; i < count; i++) {
+        ok = scan_entry(scan, released[i]) && ok;
+        file_entry_free(released[i]);
+    }
+    return ok;
+}
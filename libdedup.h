@@ -0,0 +1,73 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#ifndef __DEDUP_LIBDEDUP_H__
+#define __DEDUP_LIBDEDUP_H__
+
+#include <sys/stat.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// libdedup
+///
+/// The signature, table, compare and clone layers of `dedup`, for programs
+/// that already know which files they have. Instead of walking a tree, a
+/// scan is fed one (path, stat) record at a time, in the order the caller
+/// enumerates them, and reports what it finds through a callback.
+///
+/// Records are filtered and screened the way the walk of `dedup` does it:
+/// only regular, non-empty files are looked at, hard links of a file seen
+/// before are skipped, and a file is only read once another file of its
+/// size on its device has come up. The first file with some content is
+/// its origin, later files with the same content are its duplicates.
+///
+/// `dedup_scan_add` may be called from several threads at once, events are
+/// delivered on the thread of the call that decided them. A file held
+/// back for its size is decided by the call that adds the second file of
+/// its size. With several threads, the origin of a content is whichever of
+/// its files is stored first.
+///
+/// libdedup.a is built with `-fvisibility=hidden` and prelinked against
+/// `libdedup.exports`, only the functions marked `DEDUP_EXPORT` are global
+/// in it. The rest of dedup can't clash with the program's own symbols.
+typedef struct DedupScan DedupScan;
+
+#define DEDUP_EXPORT __attribute__((visibility("default")))
+
+typedef enum DedupScanEventKind {
+    DEDUP_SCAN_DUPLICATE,   // `path` has the content of `origin`, left as is
+    DEDUP_SCAN_CLONED,      // `path` was replaced with a clone of `origin`
+    DEDUP_SCAN_SHARED,      // `path` already shares its blocks with `origin`
+} DedupScanEventKind;
+
+typedef struct DedupScanEvent {
+    DedupScanEventKind kind;
+    const char* path;
+    const char* origin;
+    uint64_t size;
+    int error;              // why a duplicate wasn't replaced, 0 if not asked to
+} DedupScanEvent;
+
+/// The event and its paths are only valid during the call.
+typedef void (*DedupScanFn)(const DedupScanEvent* event, void* context);
+
+typedef struct DedupScanOptions {
+    bool replace;           // replace duplicates with clones of their origin
+    size_t capacity;        // files expected, 0 for a default
+    DedupScanFn fn;         // may be NULL
+    void* context;
+} DedupScanOptions;
+
+DEDUP_EXPORT DedupScan* new_dedup_scan(const DedupScanOptions* options);
+
+/// Frees the scan. Files that were held back for their size had no
+/// duplicate and are dropped without an event.
+DEDUP_EXPORT void free_dedup_scan(DedupScan* scan);
+
+/// Adds the file at `path`, described by `st`, to the scan. Returns false
+/// if it, or a file it released, couldn't be read or memory ran out.
+DEDUP_EXPORT bool dedup_scan_add(DedupScan* scan, const char* path, const struct stat* st);
+
+#endif // __DEDUP_LIBDEDUP_H__
@@ -0,0 +1,213 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include "link_cluster.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct LinkClusters {
+    pthread_mutex_t mutex;   // guards everything below
+    LinkCluster** slots;     // NULL for a free slot
+    size_t capacity;         // always a power of 2
+    size_t count;
+};
+
+static inline uint64_t cluster_hash(dev_t device, ino_t inode) {
+    uint64_t h = (uint64_t)inode * 0x9E3779B97F4A7C15ULL;
+    h ^= (uint64_t)device + 0x7F4A7C159E3779B9ULL + (h << 6) + (h >> 2);
+    return h ^ (h >> 31);
+}
+
+LinkClusters* new_link_clusters(size_t capacity) {
+    LinkClusters* clusters = calloc(1, sizeof(LinkClusters));
+    if (!clusters) {
+        return NULL;
+    }
+
+    clusters->capacity = 64;
+    while (clusters->capacity < capacity) {
+        clusters->capacity *= 2;
+    }
+    clusters->slots = calloc(clusters->capacity, sizeof(LinkCluster*));
+    if (!clusters->slots) {
+        free(clusters);
+        return NULL;
+    }
+    pthread_mutex_init(&clusters->mutex, NULL);
+    return clusters;
+}
+
+static void free_cluster(LinkCluster* cluster) {
+    for (size_t i = 0; i < cluster->count; i++) {
+        free(cluster->links[i].path);
+        dir_handle_release(cluster->links[i].dir);
+    }
+    free(cluster->links);
+    free(cluster->origin);
+    free(cluster);
+}
+
+void free_link_clusters(LinkClusters* clusters) {
+    if (!clusters) {
+        return;
+    }
+
+    for (size_t i = 0; i < clusters->capacity; i++) {
+        if (clusters->slots[i]) {
+            free_cluster(clusters->slots[i]);
+        }
+    }
+    free(clusters->slots);
+    pthread_mutex_destroy(&clusters->mutex);
+    free(clusters);
+}
+
+// Callers hold the mutex. Returns the slot of (device, inode), or the free
+// slot it would go in.
+static LinkCluster** find_slot(const LinkClusters* clusters, dev_t device, ino_t inode) {
+    size_t mask = clusters->capacity - 1;
+    size_t idx = (size_t)cluster_hash(device, inode) & mask;
+    while (clusters->slots[idx] &&
+           (clusters->slots[idx]->device != device || clusters->slots[idx]->inode != inode)) {
+        idx = (idx + 1) & mask;
+    }
+    return &clusters->slots[idx];
+}
+
+// Callers hold the mutex.
+static bool clusters_grow(LinkClusters* clusters) {
+    size_t capacity = clusters->capacity * 2;
+    LinkCluster** slots = calloc(capacity, sizeof(LinkCluster*));
+    if (!slots) {
+        return false;
+    }
+
+    size_t mask = capacity - 1;
+    for (size_t i = 0; i < clusters->capacity; i++) {
+        LinkCluster* cluster = clusters->slots[i];
+        if (!cluster) {
+            continue;
+        }
+        size_t idx = (size_t)cluster_hash(cluster->device, cluster->inode) & mask;
+        while (slots[idx]) {
+            idx = (idx + 1) & mask;
+        }
+        slots[idx] = cluster;
+    }
+
+    free(clusters->slots);
+    clusters->slots = slots;
+    clusters->capacity = capacity;
+    return true;
+}
+
+// Callers hold the mutex.
+static bool cluster_add_link(LinkCluster* cluster, const char* path, DirHandle* dir, const char* name) {
+    for (size_t i = 0; i < cluster->count; i++) {
+        // --watch walks a changed directory again
+        if (strcmp(cluster->links[i].path, path) == 0) {
+            return true;
+        }
+    }
+    if (cluster->count == cluster->nlink) {
+        // a link was added since, the cluster can't be complete anymore
+        cluster->nlink = 0;
+    }
+    if (cluster->nlink == 0) {
+        return false;
+    }
+
+    char* copy = strdup(path);
+    if (!copy) {
+        return false;
+    }
+    LinkClusterLink* link = &cluster->links[cluster->count++];
+    link->path = copy;
+    link->name = name && dir ? copy + (name - path) : copy;
+    link->dir = dir ? dir_handle_retain(dir) : NULL;
+    return true;
+}
+
+bool link_clusters_add(LinkClusters* clusters, const struct stat* st, const char* path, DirHandle* dir,
+                       const char* name) {
+    if (!clusters || !st || !path || st->st_nlink <= 1 || st->st_nlink > LINK_CLUSTER_LINKS_MAX) {
+        return false;
+    }
+
+    pthread_mutex_lock(&clusters->mutex);
+    LinkCluster** slot = find_slot(clusters, st->st_dev, st->st_ino);
+    if (!*slot) {
+        if ((clusters->count + 1) * 4 > clusters->capacity * 3) {
+            if (!clusters_grow(clusters)) {
+                pthread_mutex_unlock(&clusters->mutex);
+                return false;
+            }
+            slot = find_slot(clusters, st->st_dev, st->st_ino);
+        }
+
+        LinkCluster* cluster = calloc(1, sizeof(LinkCluster));
+        LinkClusterLink* links = cluster ? calloc(st->st_nlink, sizeof(LinkClusterLink)) : NULL;
+        if (!links) {
+            free(cluster);
+            pthread_mutex_unlock(&clusters->mutex);
+            return false;
+        }
+        cluster->device = st->st_dev;
+        cluster->inode = st->st_ino;
+        cluster->nlink = st->st_nlink;
+        cluster->flags = st->st_flags;
+        cluster->size = (size_t)st->st_size;
+        cluster->links = links;
+        *slot = cluster;
+        clusters->count++;
+    }
+
+    if ((*slot)->nlink != st->st_nlink) {
+        (*slot)->nlink = 0;
+    }
+    bool added = cluster_add_link(*slot, path, dir, name);
+    pthread_mutex_unlock(&clusters->mutex);
+    return added;
+}
+
+bool link_clusters_defer(LinkClusters* clusters, dev_t device, ino_t inode, const char* origin,
+                         uint64_t quick_hash) {
+    if (!clusters || !origin) {
+        return false;
+    }
+
+    pthread_mutex_lock(&clusters->mutex);
+    LinkCluster* cluster = *find_slot(clusters, device, inode);
+    bool deferred = cluster != NULL;
+    if (cluster && !cluster->origin) {
+        cluster->origin = strdup(origin);
+        cluster->quick_hash = quick_hash;
+        deferred = cluster->origin != NULL;
+    }
+    pthread_mutex_unlock(&clusters->mutex);
+    return deferred;
+}
+
+bool link_cluster_complete(const LinkCluster* cluster) {
+    return cluster && cluster->nlink > 1 && cluster->count == cluster->nlink;
+}
+
+size_t link_clusters_each_deferred(LinkClusters* clusters, LinkClusterFn fn, void* context) {
+    if (!clusters || !fn) {
+        return 0;
+    }
+
+    size_t count = 0;
+    pthread_mutex_lock(&clusters->mutex);
+    for (size_t i = 0; i < clusters->capacity; i++) {
+        if (clusters->slots[i] && clusters->slots[i]->origin) {
+            fn(clusters->slots[i], context);
+            count++;
+        }
+    }
+    pthread_mutex_unlock(&clusters->mutex);
+    return count;
+}
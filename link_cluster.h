@@ -0,0 +1,80 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#ifndef __DEDUP_LINK_CLUSTER_H__
+#define __DEDUP_LINK_CLUSTER_H__
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dir_handle.h"
+
+/// Link Clusters
+///
+/// A file with several hard links can't be replaced one link at a time,
+/// the links left behind keep its blocks and nothing is saved. Once every
+/// link of the file is known, all of them can be replaced together and
+/// stay links of each other, of the replacement.
+///
+/// While walking, the links of each file with more than one are collected
+/// from the stat the walk already has, into a cluster keyed by (device,
+/// inode). When the file turns out to be a duplicate, its cluster is
+/// deferred with the origin it matched. After the traversal the deferred
+/// clusters are handed out, a cluster with as many links as the file had
+/// is entirely within the scan.
+///
+/// Files with more than `LINK_CLUSTER_LINKS_MAX` links aren't collected.
+/// The table is guarded by a mutex, only files with several links reach it.
+typedef struct LinkClusters LinkClusters;
+
+#define LINK_CLUSTER_LINKS_MAX 64
+
+/// A link of the file, reached through `dir` by `name` like the entries of
+/// the walk. Without a directory handle `name` is the full path.
+typedef struct LinkClusterLink {
+    char* path;
+    const char* name;       // within `path`
+    DirHandle* dir;         // retained, may be NULL
+} LinkClusterLink;
+
+typedef struct LinkCluster {
+    dev_t device;
+    ino_t inode;
+    nlink_t nlink;          // links the file had during the walk, 0 if that changed
+    uint32_t flags;
+    size_t size;
+    size_t count;           // links found by the walk
+    LinkClusterLink* links;
+    char* origin;           // what the links are replaced with, NULL until deferred
+    uint64_t quick_hash;    // of the signature that matched the origin
+} LinkCluster;
+
+typedef void (*LinkClusterFn)(const LinkCluster* cluster, void* context);
+
+LinkClusters* new_link_clusters(size_t capacity);
+void free_link_clusters(LinkClusters* clusters);
+
+/// Adds `path`, a link of the file `st` describes, named `name` in the
+/// directory `dir`, which is retained. `name` points into `path`, `dir` may
+/// be NULL. A path that was added before is ignored. Returns false if the
+/// file has a single link, too many to be collected, or memory ran out.
+bool link_clusters_add(LinkClusters* clusters, const struct stat* st, const char* path, DirHandle* dir,
+                       const char* name);
+
+/// Marks the cluster of (device, inode) to be replaced with `origin`. The
+/// first origin is kept. Returns false if the file has no cluster.
+bool link_clusters_defer(LinkClusters* clusters, dev_t device, ino_t inode, const char* origin,
+                         uint64_t quick_hash);
+
+/// Whether the walk found every link of the file.
+bool link_cluster_complete(const LinkCluster* cluster);
+
+/// Calls `fn` with each deferred cluster, in no particular order. Returns
+/// the number of clusters.
+size_t link_clusters_each_deferred(LinkClusters* clusters, LinkClusterFn fn, void* context);
+
+#endif // __DEDUP_LINK_CLUSTER_H__
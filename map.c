@@ -26,17 +26,21 @@
 
 #include "map.h"
 
-#include <sys/mman.h>
-
 #include <CommonCrypto/CommonDigest.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
 static const char EMPTY_SHA256[32] =  { 0 };
 
+// Files are hashed through a window of this size instead of being mapped
+// whole, a huge file would otherwise claim its size in address space.
+#define SHA256_WINDOW (1U << 20)
+
 void free_metadata(FileMetadata* fm) {
     free(fm->path);
     free(fm);
@@ -252,20 +256,14 @@ int populate_sha256_if_empty(FileMetadata* fm) {
 
     int fd = open(fm->path, O_RDONLY);
     if (fd < 0) {
-        fprintf(stderr, "failed to mmap %s\n", fm->path);
+        fprintf(stderr, "failed to open %s\n", fm->path);
         perror("open");
         return 2;
     }
 
-    char* buffer = mmap((caddr_t) 0,
-                        fm->size,
-                        PROT_READ,
-                        MAP_PRIVATE,
-                        fd,
-                        0);
-    if (buffer == MAP_FAILED) {
-        fprintf(stderr, "failed to mmap %s\n", fm->path);
-        perror("mmap");
+    unsigned char* window = malloc(SHA256_WINDOW);
+    if (!window) {
+        close(fd);
         return 2;
     }
 
@@ -275,15 +273,32 @@ int populate_sha256_if_empty(FileMetadata* fm) {
 
     CC_SHA256_CTX c = { 0 };
     CC_SHA256_Init(&c);
-    int err = CC_SHA256_Update(&c, buffer, fm->size);
-    if (err != 1) {
-        fprintf(stderr, "error: %d\n", err);
-        perror("CC_SHA256_Update");
-        return 3;
+    int result = 0;
+    size_t offset = 0;
+    while (offset < fm->size) {
+        size_t want = fm->size - offset < SHA256_WINDOW ? fm->size - offset : SHA256_WINDOW;
+        ssize_t n = pread(fd, window, want, (off_t)offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            // a file that shrank since it was seen can't match anything
+            fprintf(stderr, "failed to read %s\n", fm->path);
+            if (n < 0) {
+                perror("pread");
+            }
+            result = 2;
+            break;
+        }
+        CC_SHA256_Update(&c, window, (CC_LONG)n);
+        offset += (size_t)n;
     }
 
-    munmap(buffer, fm->size);
+    free(window);
     close(fd);
+    if (result) {
+        return result;
+    }
 
     int r = CC_SHA256_Final(fm->sha256, &c);
     return !r;
@@ -305,7 +320,7 @@ FileMetadata* visited_tree_insert(rb_tree_t* tree, FileMetadata* fm) {
                 fprintf(stderr,
                         "Could not compute SHA-256 for %s\n",
                         last_node->fm->path);
-                free(last_node->fm);
+                free_metadata(last_node->fm);
                 last_node->fm = metadata_dup(fm);
                 return NULL;
 
@@ -0,0 +1,174 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include "metrics.h"
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <string.h>
+
+static atomic_size_t next_shard = 0;
+static _Thread_local size_t thread_shard = SIZE_MAX;
+
+static inline size_t current_shard(void) {
+    if (thread_shard == SIZE_MAX) {
+        thread_shard = atomic_fetch_add_explicit(&next_shard, 1, memory_order_relaxed) % METRICS_SHARDS;
+    }
+    return thread_shard;
+}
+
+void metrics_add(Metrics* metrics, MetricId id, int64_t delta) {
+    atomic_fetch_add_explicit(&metrics->shards[current_shard()].values[id], delta, memory_order_relaxed);
+}
+
+uint64_t metrics_sum(const Metrics* metrics, MetricId id) {
+    int64_t sum = 0;
+    for (size_t i = 0; i < METRICS_SHARDS; i++) {
+        sum += atomic_load_explicit(&metrics->shards[i].values[id], memory_order_relaxed);
+    }
+    return sum > 0 ? (uint64_t)sum : 0;
+}
+
+typedef struct StageShard {
+    _Alignas(METRICS_SHARD_ALIGN) _Atomic uint64_t calls[STAGE_COUNT];
+    _Atomic uint64_t ticks[STAGE_COUNT];
+    _Atomic uint64_t buckets[STAGE_COUNT][STAGE_BUCKETS];
+} StageShard;
+
+static StageShard stage_shards[METRICS_SHARDS];
+
+static const char* const stage_names[STAGE_COUNT] = {
+    [STAGE_WALK] = "walk",
+    [STAGE_CLONE_ID] = "clone id",
+    [STAGE_SIGNATURE] = "signature",
+    [STAGE_WITNESS] = "witness",
+    [STAGE_EXACT] = "exact compare",
+    [STAGE_REPLACE] = "replace",
+    [STAGE_METADATA] = "metadata copy",
+    [STAGE_TABLE_LOCK] = "table lock wait",
+    [STAGE_ORDER_LOCK] = "order lock wait",
+    [STAGE_QUEUE_EMPTY] = "queue empty wait",
+    [STAGE_QUEUE_FULL] = "queue full wait",
+};
+
+void stage_record(StageId id, uint64_t start) {
+    uint64_t elapsed = stage_clock() - start;
+    // bucket b holds durations below 2^b ticks
+    size_t bucket = elapsed ? 64 - (size_t)__builtin_clzll(elapsed) : 0;
+    if (bucket >= STAGE_BUCKETS) {
+        bucket = STAGE_BUCKETS - 1;
+    }
+
+    StageShard* shard = &stage_shards[current_shard()];
+    atomic_fetch_add_explicit(&shard->calls[id], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&shard->ticks[id], elapsed, memory_order_relaxed);
+    atomic_fetch_add_explicit(&shard->buckets[id][bucket], 1, memory_order_relaxed);
+}
+
+void stage_lock(pthread_mutex_t* mutex, StageId id) {
+    // an uncontended lock isn't worth a clock read
+    if (pthread_mutex_trylock(mutex) == 0) {
+        return;
+    }
+    uint64_t start = stage_clock();
+    pthread_mutex_lock(mutex);
+    stage_record(id, start);
+}
+
+const char* stage_name(StageId id) {
+    return id < STAGE_COUNT ? stage_names[id] : "unknown";
+}
+
+#if defined(__APPLE__)
+static mach_timebase_info_data_t timebase;
+static pthread_once_t timebase_once = PTHREAD_ONCE_INIT;
+
+static void read_timebase(void) {
+    mach_timebase_info(&timebase);
+}
+#endif
+
+uint64_t stage_ticks_to_ns(uint64_t ticks) {
+#if defined(__APPLE__)
+    pthread_once(&timebase_once, read_timebase);
+    return (uint64_t)((double)ticks * timebase.numer / timebase.denom);
+#else
+    return ticks;
+#endif
+}
+
+static uint64_t bucket_limit_ns(size_t bucket) {
+    return stage_ticks_to_ns(1ULL << bucket);
+}
+
+void stage_report(StageId id, StageReport* report) {
+    uint64_t buckets[STAGE_BUCKETS] = {0};
+    uint64_t ticks = 0;
+    memset(report, 0, sizeof(*report));
+    for (size_t i = 0; i < METRICS_SHARDS; i++) {
+        const StageShard* shard = &stage_shards[i];
+        report->calls += atomic_load_explicit(&shard->calls[id], memory_order_relaxed);
+        ticks += atomic_load_explicit(&shard->ticks[id], memory_order_relaxed);
+        for (size_t b = 0; b < STAGE_BUCKETS; b++) {
+            buckets[b] += atomic_load_explicit(&shard->buckets[id][b], memory_order_relaxed);
+        }
+    }
+    report->total_ns = stage_ticks_to_ns(ticks);
+
+    // the calls and the buckets are read at slightly different times while
+    // threads are still running, so percentiles go by the buckets' own sum
+    uint64_t counted = 0;
+    for (size_t b = 0; b < STAGE_BUCKETS; b++) {
+        counted += buckets[b];
+    }
+    uint64_t seen = 0;
+    for (size_t b = 0; b < STAGE_BUCKETS; b++) {
+        if (buckets[b] == 0) {
+            continue;
+        }
+        seen += buckets[b];
+        if (report->p50_ns == 0 && seen * 2 >= counted) {
+            report->p50_ns = bucket_limit_ns(b);
+        }
+        if (report->p99_ns == 0 && seen * 100 >= counted * 99) {
+            report->p99_ns = bucket_limit_ns(b);
+        }
+        report->max_ns = bucket_limit_ns(b);
+    }
+}
+
+static void format_duration(uint64_t ns, char* buf, size_t size) {
+    if (ns < 1000U) {
+        snprintf(buf, size, "%" PRIu64 " ns", ns);
+    } else if (ns < 1000000U) {
+        snprintf(buf, size, "%.1f us", (double)ns / 1e3);
+    } else if (ns < 1000000000U) {
+        snprintf(buf, size, "%.1f ms", (double)ns / 1e6);
+    } else {
+        snprintf(buf, size, "%.2f s", (double)ns / 1e9);
+    }
+}
+
+void stage_print(FILE* stream) {
+    fprintf(stream, "stage timings (percentiles within 2x):\n");
+    for (StageId id = 0; id < STAGE_COUNT; id++) {
+        StageReport report;
+        stage_report(id, &report);
+        if (report.calls == 0) {
+            continue;
+        }
+
+        char total[16], p50[16], p99[16], max[16];
+        format_duration(report.total_ns, total, sizeof(total));
+        format_duration(report.p50_ns, p50, sizeof(p50));
+        format_duration(report.p99_ns, p99, sizeof(p99));
+        format_duration(report.max_ns, max, sizeof(max));
+        fprintf(stream, "  %-17s %10" PRIu64 " calls %10s total, p50 %s, p99 %s, max %s\n",
+                stage_name(id), report.calls, total, p50, p99, max);
+    }
+}
+
+void stage_reset_for_tests(void) {
+    memset(stage_shards, 0, sizeof(stage_shards));
+}
@@ -0,0 +1,121 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#ifndef __DEDUP_METRICS_H__
+#define __DEDUP_METRICS_H__
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#if defined(__APPLE__)
+#include <mach/mach_time.h>
+#endif
+
+/// Sharded Counters
+///
+/// Every thread bumps counters in its own cache line sized shard with a
+/// relaxed atomic add, so counting on the hot path neither takes a lock nor
+/// bounces a shared cache line between cores. Readers sum the shards when
+/// they need a value (status line, summary); a sum taken while workers are
+/// still running is a close approximation, a sum taken after they have been
+/// joined is exact.
+typedef enum MetricId {
+    METRIC_FOUND,          // duplicates found
+    METRIC_SAVED,          // bytes saved by this run
+    METRIC_ALREADY_SAVED,  // bytes already shared before this run
+    METRIC_PRUNED,         // entries dropped before visiting
+    METRIC_TOTAL_BYTES,    // bytes of all scanned files
+    METRIC_TOTAL_FILES,    // files handed to the pipeline
+    METRIC_COMPLETED,      // files the pipeline is done with
+    METRIC_QUEUED,         // entries waiting in raw_queue and the work queue
+    METRIC_COUNT,
+} MetricId;
+
+// Apple silicon uses 128 byte cache lines
+#define METRICS_SHARD_ALIGN 128
+#define METRICS_SHARDS 64
+
+typedef struct MetricsShard {
+    _Alignas(METRICS_SHARD_ALIGN) _Atomic int64_t values[METRIC_COUNT];
+} MetricsShard;
+
+typedef struct Metrics {
+    MetricsShard shards[METRICS_SHARDS];
+} Metrics;
+
+/// Adds `delta` to the calling thread's shard of `id`.
+void metrics_add(Metrics* metrics, MetricId id, int64_t delta);
+
+/// Sum of `id` across all shards, negative transients are clamped to 0.
+uint64_t metrics_sum(const Metrics* metrics, MetricId id);
+
+/// Stage Timings
+///
+/// Where the hot path spends its time, recorded the same way as the
+/// counters: every thread adds to its own shard, so timing a stage costs a
+/// clock read and three relaxed atomic adds. Each call is sorted into a
+/// histogram of power of 2 durations, which keeps reports cheap and their
+/// percentiles accurate to within a factor of 2.
+///
+/// The timings are global, like the verifier counters of the runtime
+/// dispatch, so that modules without a context can record their stages.
+typedef enum StageId {
+    STAGE_WALK,            // traversal, per entry the walker returns
+    STAGE_CLONE_ID,        // clone id lookups the walker couldn't do in bulk
+    STAGE_SIGNATURE,       // opening a file and computing its signature
+    STAGE_WITNESS,         // probing candidate pairs for early rejection
+    STAGE_EXACT,           // byte for byte compares
+    STAGE_REPLACE,         // replacing a duplicate, metadata included
+    STAGE_METADATA,        // copyfile(3) copying metadata onto a clone
+    STAGE_TABLE_LOCK,      // waits for a signature table shard
+    STAGE_ORDER_LOCK,      // waits for a visit order stripe
+    STAGE_QUEUE_EMPTY,     // waits for work on an empty queue
+    STAGE_QUEUE_FULL,      // waits for room in a full queue
+    STAGE_COUNT,
+} StageId;
+
+#define STAGE_BUCKETS 48
+
+typedef struct StageReport {
+    uint64_t calls;
+    uint64_t total_ns;
+    uint64_t p50_ns;       // upper bounds of the histogram buckets
+    uint64_t p99_ns;
+    uint64_t max_ns;
+} StageReport;
+
+/// Returns a timestamp to pass to `stage_record`, in clock ticks.
+static inline uint64_t stage_clock(void) {
+#if defined(__APPLE__)
+    return mach_absolute_time();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000U + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+/// Records a call of `id` that started at `start`.
+void stage_record(StageId id, uint64_t start);
+
+/// Converts a difference of `stage_clock` timestamps to nanoseconds.
+uint64_t stage_ticks_to_ns(uint64_t ticks);
+
+/// Locks `mutex`, recording the wait as a call of `id` if it was taken.
+void stage_lock(pthread_mutex_t* mutex, StageId id);
+
+const char* stage_name(StageId id);
+
+/// Summarizes the calls of `id` so far.
+void stage_report(StageId id, StageReport* report);
+
+/// Writes a line for every stage that was called to `stream`.
+void stage_print(FILE* stream);
+
+void stage_reset_for_tests(void);
+
+#endif // __DEDUP_METRICS_H__
@@ -0,0 +1,125 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include "progressive_witness.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "signature.h"
+
+#define PROGRESSIVE_WINDOW 4096U
+#define PROGRESSIVE_MAX_PROBES (DEDUP_WITNESS_MAX_WINDOWS - DEDUP_WITNESS_EDGE_WINDOWS)
+#define PROGRESSIVE_PROBE_SHARE 32U   // probes read at most 1/32 of a file
+
+static bool read_window(int fd, unsigned char* buf, size_t len, uint64_t offset) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pread(fd, buf + done, len - done, (off_t)(offset + done));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        done += (size_t)n;
+    }
+    return true;
+}
+
+static bool windows_match(const FileHandle* a, const FileHandle* b, uint64_t offset, size_t len) {
+    unsigned char a_buf[PROGRESSIVE_WINDOW];
+    unsigned char b_buf[PROGRESSIVE_WINDOW];
+    return read_window(a->fd, a_buf, len, offset) &&
+           read_window(b->fd, b_buf, len, offset) &&
+           memcmp(a_buf, b_buf, len) == 0;
+}
+
+static uint64_t reverse_bits(uint64_t value, unsigned bits) {
+    uint64_t reversed = 0;
+    for (unsigned i = 0; i < bits; i++) {
+        reversed = (reversed << 1) | ((value >> i) & 1);
+    }
+    return reversed;
+}
+
+void progressive_witness_windows(uint64_t size, DedupWitnessWindows* windows) {
+    windows->window = size < PROGRESSIVE_WINDOW ? (size_t)size : PROGRESSIVE_WINDOW;
+    windows->count = 0;
+    if (size == 0) {
+        return;
+    }
+
+    // appended or truncated-and-rewritten files tend to differ at the end
+    uint64_t last = size - windows->window;
+    windows->offsets[windows->count++] = last;
+    windows->offsets[windows->count++] = last / 2;
+
+    // the largest power of 2 within the probe budget, so that visiting the
+    // slots in bit reversed order refines the spacing evenly
+    uint64_t budget = size / ((uint64_t)PROGRESSIVE_WINDOW * PROGRESSIVE_PROBE_SHARE);
+    uint64_t slots = 1;
+    unsigned bits = 0;
+    while (slots * 2 <= budget && slots * 2 <= PROGRESSIVE_MAX_PROBES) {
+        slots *= 2;
+        bits++;
+    }
+    if (slots < 2) {
+        // a single slot would only probe the middle again
+        return;
+    }
+
+    // probing the middle of each slot keeps clear of the start, middle and
+    // end that the signature and the edges already covered
+    uint64_t half_slot = last / (2 * slots);
+    for (uint64_t i = 0; i < slots; i++) {
+        windows->offsets[windows->count++] = half_slot * (2 * reverse_bits(i, bits) + 1);
+    }
+}
+
+DedupVerifyStage progressive_witness_window_stage(size_t index) {
+    return index < DEDUP_WITNESS_EDGE_WINDOWS ? DEDUP_VERIFY_EDGES : DEDUP_VERIFY_PROBES;
+}
+
+DedupVerifyStage progressive_witness(const FileHandle* a, const FileHandle* b, uint64_t size) {
+    if (!a || !b || (uint64_t)a->stat.st_size != size || (uint64_t)b->stat.st_size != size) {
+        return DEDUP_VERIFY_METADATA;
+    }
+
+    DedupWitnessWindows windows;
+    progressive_witness_windows(size, &windows);
+    for (size_t i = 0; i < windows.count; i++) {
+        if (!windows_match(a, b, windows.offsets[i], windows.window)) {
+            return progressive_witness_window_stage(i);
+        }
+    }
+
+    return DEDUP_VERIFY_EXACT;
+}
+
+bool progressive_witness_digest(const FileHandle* handle, uint64_t size, uint64_t* digest) {
+    if (!handle || !digest || (uint64_t)handle->stat.st_size != size) {
+        return false;
+    }
+
+    DedupWitnessWindows windows;
+    progressive_witness_windows(size, &windows);
+    size_t count = windows.count < DEDUP_WITNESS_DIGEST_WINDOWS ? windows.count : DEDUP_WITNESS_DIGEST_WINDOWS;
+
+    unsigned char buf[PROGRESSIVE_WINDOW];
+    uint64_t h = size;
+    for (size_t i = 0; i < count; i++) {
+        if (!read_window(handle->fd, buf, windows.window, windows.offsets[i])) {
+            return false;
+        }
+        // order matters, the same windows at other offsets are another file
+        h = (h ^ signature_fast_hash_bytes(buf, windows.window)) * 0x9e3779b97f4a7c15ULL;
+    }
+
+    // 0 is left to mean that no digest was taken
+    *digest = h ? h : 1;
+    return true;
+}
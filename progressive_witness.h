@@ -0,0 +1,75 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#ifndef __DEDUP_PROGRESSIVE_WITNESS_H__
+#define __DEDUP_PROGRESSIVE_WITNESS_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "file_handle.h"
+
+/// Progressive Witness
+///
+/// Screens a candidate pair that shares a signature before the exact
+/// compare reads all of both files (see
+/// docs/plans/2026-04-22-progressive-tiled-verifier.md). The signature
+/// already covers the first 4 KiB and a few samples, so the stages probe
+/// where it is blind, cheapest and most likely to differ first:
+///
+///   0. metadata, both files must still have the expected size
+///   1. edges, the tail and the middle window
+///   2. probes, windows spread over the file coarse to fine, each pass
+///      halving the distance between the windows already read
+///   3. exact, the full coverage compare run by the caller
+///
+/// Every window is compared byte for byte and a pair is rejected at the
+/// first window that differs. Probes read at most 1/32 of a file and never
+/// more than 256 KiB, so a near duplicate is usually rejected after reading
+/// kilobytes. Stages 0-2 can only reject, equality is still only authorized
+/// by the exact compare. I/O errors reject.
+typedef enum DedupVerifyStage {
+    DEDUP_VERIFY_METADATA,
+    DEDUP_VERIFY_EDGES,
+    DEDUP_VERIFY_PROBES,
+    DEDUP_VERIFY_EXACT,
+    DEDUP_VERIFY_STAGE_COUNT,
+} DedupVerifyStage;
+
+/// The windows stages 1-2 compare for a file of some size, in the order they
+/// are read. The first DEDUP_WITNESS_EDGE_WINDOWS are the edges, the rest
+/// are probes.
+#define DEDUP_WITNESS_EDGE_WINDOWS 2
+#define DEDUP_WITNESS_MAX_WINDOWS (DEDUP_WITNESS_EDGE_WINDOWS + 64)
+
+typedef struct DedupWitnessWindows {
+    size_t window;   // bytes per window
+    size_t count;
+    uint64_t offsets[DEDUP_WITNESS_MAX_WINDOWS];
+} DedupWitnessWindows;
+
+void progressive_witness_windows(uint64_t size, DedupWitnessWindows* windows);
+
+/// The stage that rejects a pair whose first differing window is `index`.
+DedupVerifyStage progressive_witness_window_stage(size_t index);
+
+/// Runs stages 0-2 on `a` and `b`, expected to be `size` bytes. Returns the
+/// stage that rejected the pair, or DEDUP_VERIFY_EXACT if the pair has to
+/// go on to the exact compare.
+DedupVerifyStage progressive_witness(const FileHandle* a, const FileHandle* b, uint64_t size);
+
+/// The windows `progressive_witness_digest` hashes: the edges and the
+/// coarsest probes.
+#define DEDUP_WITNESS_DIGEST_WINDOWS (DEDUP_WITNESS_EDGE_WINDOWS + 6)
+
+/// Hashes the first DEDUP_WITNESS_DIGEST_WINDOWS windows of `handle`,
+/// expected to be `size` bytes, into `digest`, which is never 0. Files
+/// whose digests differ differ in one of the windows, so a digest computed
+/// once per file can stand in for the pairwise compares of those windows
+/// in a group of files that keep sharing a signature. Returns false on I/O
+/// errors.
+bool progressive_witness_digest(const FileHandle* handle, uint64_t size, uint64_t* digest);
+
+#endif // __DEDUP_PROGRESSIVE_WITNESS_H__
@@ -27,54 +27,195 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "metrics.h"
 #include "queue.h"
 
-FileEntryHead* new_file_entry_queue() {
-    FileEntryHead* head = malloc(sizeof(FileEntryHead));
-    STAILQ_INIT(head);
-
-    return head;
-}
-
-void free_file_entry_queue(FileEntryHead* queue) {
-    free(queue);
-}
-
-void file_entry_queue_append(FileEntryHead* queue,
-                             char* path,
-                             dev_t device,
-                             ino_t inode,
-                             nlink_t nlink,
-                             uint32_t flags,
-                             size_t size,
-                             uint64_t sequence,
-                             short level) {
-    FileEntry* e = malloc(sizeof(FileEntry));
+FileEntry* new_file_entry(const char* path,
+                          dev_t device,
+                          ino_t inode,
+                          nlink_t nlink,
+                          uint32_t flags,
+                          size_t size,
+                          uint64_t sequence,
+                          uint64_t group_ticket,
+                          short level) {
+    size_t path_size = strlen(path) + 1;
+    FileEntry* e = malloc(sizeof(FileEntry) + path_size);
+    if (!e) {
+        return NULL;
+    }
     *e = (FileEntry) {
-        .path = strdup(path),
+        .path = e->path_storage,
+        .name = e->path_storage,
         .device = device,
         .inode = inode,
         .nlink = nlink,
         .flags = flags,
         .size = size,
         .sequence = sequence,
+        .group_ticket = group_ticket,
         .level = level,
     };
-    STAILQ_INSERT_TAIL(queue, e, entries);
+    memcpy(e->path_storage, path, path_size);
+
+    return e;
+}
+
+void file_entry_free(FileEntry* fe) {
+    free_signature(fe->signature);
+    dir_handle_release(fe->dir);
+    free(fe);
 }
 
-FileEntry* file_entry_next(FileEntryHead* queue) {
-     if (STAILQ_EMPTY(queue)) {
-         return NULL;
-     }
+void file_entry_drop_dir(FileEntry* fe) {
+    dir_handle_release(fe->dir);
+    fe->dir = NULL;
+    fe->name = fe->path;
+}
 
-     FileEntry* e = STAILQ_FIRST(queue);
-     STAILQ_REMOVE(queue, e, FileEntry, entries);
+FileEntryQueue* new_file_entry_queue(size_t capacity) {
+    FileEntryQueue* queue = calloc(1, sizeof(FileEntryQueue));
+    if (!queue) {
+        return NULL;
+    }
 
-     return e;
+    queue->capacity = capacity > 0 ? capacity : 1;
+    queue->ring = calloc(queue->capacity, sizeof(FileEntry*));
+    if (!queue->ring) {
+        free(queue);
+        return NULL;
+    }
+    pthread_mutex_init(&queue->mutex, NULL);
+    pthread_cond_init(&queue->not_empty, NULL);
+    pthread_cond_init(&queue->not_full, NULL);
+
+    return queue;
 }
 
-void file_entry_free(FileEntry* fe) {
-    free(fe->path);
-    free(fe);
+FileEntryQueue* new_file_entry_priority_queue(size_t capacity) {
+    FileEntryQueue* queue = new_file_entry_queue(capacity);
+    if (queue) {
+        queue->largest_first = true;
+    }
+    return queue;
+}
+
+void free_file_entry_queue(FileEntryQueue* queue) {
+    if (!queue) {
+        return;
+    }
+
+    for (size_t i = 0; i < queue->count; i++) {
+        file_entry_free(queue->ring[(queue->head + i) % queue->capacity]);
+    }
+    pthread_cond_destroy(&queue->not_full);
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_mutex_destroy(&queue->mutex);
+    free(queue->ring);
+    free(queue);
+}
+
+// Whether `a` is handed out before `b` by a priority queue.
+static bool entry_before(const FileEntry* a, const FileEntry* b) {
+    return a->size != b->size ? a->size > b->size : a->sequence < b->sequence;
+}
+
+static void heap_push(FileEntryQueue* queue, FileEntry* fe) {
+    size_t i = queue->count;
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (!entry_before(fe, queue->ring[parent])) {
+            break;
+        }
+        queue->ring[i] = queue->ring[parent];
+        i = parent;
+    }
+    queue->ring[i] = fe;
+}
+
+static FileEntry* heap_pop(FileEntryQueue* queue) {
+    FileEntry* top = queue->ring[0];
+    FileEntry* last = queue->ring[queue->count - 1];
+    size_t count = queue->count - 1;
+    size_t i = 0;
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= count) {
+            break;
+        }
+        if (child + 1 < count && entry_before(queue->ring[child + 1], queue->ring[child])) {
+            child++;
+        }
+        if (!entry_before(queue->ring[child], last)) {
+            break;
+        }
+        queue->ring[i] = queue->ring[child];
+        i = child;
+    }
+    if (count > 0) {
+        queue->ring[i] = last;
+    }
+    return top;
+}
+
+bool file_entry_queue_push(FileEntryQueue* queue, FileEntry* fe) {
+    pthread_mutex_lock(&queue->mutex);
+    if (queue->count == queue->capacity && !queue->closed) {
+        uint64_t start = stage_clock();
+        while (queue->count == queue->capacity && !queue->closed) {
+            pthread_cond_wait(&queue->not_full, &queue->mutex);
+        }
+        stage_record(STAGE_QUEUE_FULL, start);
+    }
+    if (queue->closed) {
+        pthread_mutex_unlock(&queue->mutex);
+        return false;
+    }
+
+    if (queue->largest_first) {
+        heap_push(queue, fe);
+    } else {
+        queue->ring[(queue->head + queue->count) % queue->capacity] = fe;
+    }
+    queue->count++;
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->mutex);
+
+    return true;
+}
+
+FileEntry* file_entry_queue_pop(FileEntryQueue* queue) {
+    pthread_mutex_lock(&queue->mutex);
+    if (queue->count == 0 && !queue->closed) {
+        uint64_t start = stage_clock();
+        while (queue->count == 0 && !queue->closed) {
+            pthread_cond_wait(&queue->not_empty, &queue->mutex);
+        }
+        stage_record(STAGE_QUEUE_EMPTY, start);
+    }
+    if (queue->count == 0) {
+        pthread_mutex_unlock(&queue->mutex);
+        return NULL;
+    }
+
+    FileEntry* fe = NULL;
+    if (queue->largest_first) {
+        fe = heap_pop(queue);
+    } else {
+        fe = queue->ring[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+    }
+    queue->count--;
+    pthread_cond_signal(&queue->not_full);
+    pthread_mutex_unlock(&queue->mutex);
+
+    return fe;
+}
+
+void file_entry_queue_close(FileEntryQueue* queue) {
+    pthread_mutex_lock(&queue->mutex);
+    queue->closed = true;
+    pthread_cond_broadcast(&queue->not_empty);
+    pthread_cond_broadcast(&queue->not_full);
+    pthread_mutex_unlock(&queue->mutex);
 }
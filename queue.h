@@ -28,39 +28,81 @@
 #define __DEDUP_QUEUE_H__
 
 #include <sys/attr.h>
-#include <sys/queue.h>
+#include <pthread.h>
 #include <stdbool.h>
+#include <time.h>
 
-STAILQ_HEAD(FileEntryHead, FileEntry);
-
-typedef struct FileEntryHead FileEntryHead;
+#include "dir_handle.h"
+#include "signature.h"
 
 typedef struct FileEntry {
-    char* path;
+    char* path;                      // points into `path_storage`
+    DirHandle* dir;                  // the open parent directory, may be NULL
+    const char* name;                // `path` relative to `dir`
     dev_t device;
     ino_t inode;
     nlink_t nlink;
     uint32_t flags;
     size_t size;
+    struct timespec mtime;           // keys the signature cache
     uint64_t sequence;
+    uint64_t group_ticket;           // position within the (device, size) group
+    uint64_t clone_id;               // valid if `has_clone_id`
+    bool has_clone_id;               // read in bulk during traversal or looked up once
+    FileSignature* signature;        // computed by the worker, owned by the entry
     bool acls_supported;
     short level;
-    STAILQ_ENTRY(FileEntry) entries;    /* Tail queue. */
+    char path_storage[];             // allocated with the entry
 } FileEntry;
 
+// Bounded multi-producer/multi-consumer queue of FileEntry pointers.
+//
+// Entries are handed over without copying; ownership moves with the pointer.
+// Producers block while the queue is full, which keeps memory bounded and
+// throttles the traversal to the speed of the consumers. Consumers block while
+// it is empty until an entry arrives or the queue is closed.
+//
+// A queue created with `new_file_entry_priority_queue` hands out its largest
+// entry first, and entries of the same size in traversal order. A huge file
+// found late in the traversal then starts verifying as soon as it reaches
+// the queue, instead of being left to a single worker after everything
+// queued ahead of it.
+typedef struct FileEntryQueue {
+    FileEntry** ring;                // a binary heap if `largest_first`
+    size_t capacity;
+    size_t head;
+    size_t count;
+    bool closed;
+    bool largest_first;
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} FileEntryQueue;
 
-FileEntryHead* new_file_entry_queue();
-void free_file_entry_queue(FileEntryHead* queue);
-void file_entry_queue_append(FileEntryHead* queue,
-                             char* path,
-                             dev_t device,
-                             ino_t inode,
-                             nlink_t nlink,
-                             uint32_t flags,
-                             size_t size,
-                             uint64_t sequence,
-                             short level);
-FileEntry* file_entry_next(FileEntryHead* queue);
+FileEntry* new_file_entry(const char* path,
+                          dev_t device,
+                          ino_t inode,
+                          nlink_t nlink,
+                          uint32_t flags,
+                          size_t size,
+                          uint64_t sequence,
+                          uint64_t group_ticket,
+                          short level);
 void file_entry_free(FileEntry* fe);
+// Lets go of the entry's directory, it's reached by its full path from then on.
+void file_entry_drop_dir(FileEntry* fe);
+
+FileEntryQueue* new_file_entry_queue(size_t capacity);
+FileEntryQueue* new_file_entry_priority_queue(size_t capacity);
+// Frees the queue and any entries still in it.
+void free_file_entry_queue(FileEntryQueue* queue);
+// Blocks while the queue is full. Returns false if the queue has been closed,
+// in which case the caller still owns `fe`.
+bool file_entry_queue_push(FileEntryQueue* queue, FileEntry* fe);
+// Blocks while the queue is empty. Returns NULL once the queue is closed and
+// drained.
+FileEntry* file_entry_queue_pop(FileEntryQueue* queue);
+// No more entries will be pushed; wakes every waiting consumer.
+void file_entry_queue_close(FileEntryQueue* queue);
 
 #endif // __DEDUP_QUEUE_H__
@@ -4,19 +4,68 @@
 
 #include "runtime_caps.h"
 
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "exact_kernels.h"
+#include "fast_hash.h"
+#include "signature.h"
+#include "strong_hash.h"
+
 #if defined(__APPLE__)
 #include <sys/sysctl.h>
 #endif
 
+#ifndef VERSION
+#define VERSION 0.0.0
+#endif // VERSION
+#define STR(x) #x
+#define XSTR(x) STR(x)
+
+// Measurements depend on the machine and on the kernels being measured, a
+// cache written on another machine or for another set of kernels is
+// recalibrated.
+#define CALIBRATION_HEADER "dedup-calibration 2"
+#define CALIBRATION_CACHE_DIR "Library/Caches/dedup"
+
+#define CALIBRATION_FIELD(field) { #field, offsetof(DedupRuntimeCaps, field) }
+
+static const struct {
+    const char* name;
+    size_t offset;
+} calibration_fields[] = {
+    CALIBRATION_FIELD(memcmp_gib_s_4k),
+    CALIBRATION_FIELD(memcmp_gib_s_64k),
+    CALIBRATION_FIELD(memcmp_gib_s_1m),
+    CALIBRATION_FIELD(memcmp_gib_s_8m),
+    CALIBRATION_FIELD(exact_cpu_tiles_gib_s_1m),
+    CALIBRATION_FIELD(exact_neon_unrolled_gib_s_1m),
+    CALIBRATION_FIELD(exact_avx2_unrolled_gib_s_1m),
+    CALIBRATION_FIELD(fast_hash_xxhash_gib_s_4k),
+    CALIBRATION_FIELD(fast_hash_rapidhash_gib_s_4k),
+    CALIBRATION_FIELD(fast_hash_komihash_gib_s_4k),
+    CALIBRATION_FIELD(fast_hash_blake3_gib_s_4k),
+    CALIBRATION_FIELD(strong_hash_blake3_gib_s_64k),
+    CALIBRATION_FIELD(strong_hash_sha3_gib_s_64k),
+    CALIBRATION_FIELD(strong_hash_pmull_poly_gib_s_64k),
+};
+
+#define CALIBRATION_FIELD_COUNT (sizeof(calibration_fields) / sizeof(calibration_fields[0]))
+
 static DedupRuntimeCaps g_runtime_caps;
 static bool g_runtime_caps_initialized = false;
 static volatile int g_memcmp_bench_sink = 0;
 static volatile int g_exact_bench_sink = 0;
+static volatile uint64_t g_hash_bench_sink = 0;
 
 #if defined(__APPLE__)
 static bool have_sysctl_u32(const char* name) {
@@ -96,8 +145,10 @@ static double benchmark_memcmp_bucket(size_t size) {
     return total_bytes / elapsed / (1024.0 * 1024.0 * 1024.0);
 }
 
+// Runs `kernel` over the buffers the same way the exact compare backends do,
+// one chunk at a time
 static bool compare_exact_tile_buffers(const unsigned char* a, const unsigned char* b, size_t size,
-                                       size_t chunk_size, bool use_xor_or) {
+                                       size_t chunk_size, exact_kernel_fn kernel) {
     if (!a || !b || size == 0 || chunk_size == 0) {
         return false;
     }
@@ -108,15 +159,7 @@ static bool compare_exact_tile_buffers(const unsigned char* a, const unsigned ch
             to_read = chunk_size;
         }
 
-        if (use_xor_or) {
-            unsigned char diff = 0;
-            for (size_t i = 0; i < to_read; i++) {
-                diff |= (unsigned char)(a[offset + i] ^ b[offset + i]);
-            }
-            if (diff != 0) {
-                return false;
-            }
-        } else if (memcmp(a + offset, b + offset, to_read) != 0) {
+        if (!kernel(a + offset, b + offset, to_read)) {
             return false;
         }
     }
@@ -124,7 +167,7 @@ static bool compare_exact_tile_buffers(const unsigned char* a, const unsigned ch
     return true;
 }
 
-static double benchmark_exact_tile_bucket(size_t size, size_t chunk_size) {
+static double benchmark_exact_tile_bucket(size_t size, size_t chunk_size, exact_kernel_fn kernel) {
     if (size == 0 || chunk_size == 0) {
         return 0.0;
     }
@@ -149,12 +192,12 @@ static double benchmark_exact_tile_bucket(size_t size, size_t chunk_size) {
     }
 
     for (size_t i = 0; i < 4; i++) {
-        g_exact_bench_sink |= compare_exact_tile_buffers(a, b, size, chunk_size, true);
+        g_exact_bench_sink |= compare_exact_tile_buffers(a, b, size, chunk_size, kernel);
     }
 
     double start = monotonic_seconds();
     for (size_t i = 0; i < iterations; i++) {
-        g_exact_bench_sink |= compare_exact_tile_buffers(a, b, size, chunk_size, true);
+        g_exact_bench_sink |= compare_exact_tile_buffers(a, b, size, chunk_size, kernel);
     }
     double end = monotonic_seconds();
 
@@ -170,7 +213,47 @@ static double benchmark_exact_tile_bucket(size_t size, size_t chunk_size) {
     return total_bytes / elapsed / (1024.0 * 1024.0 * 1024.0);
 }
 
-static void populate_capabilities(DedupRuntimeCaps* caps) {
+// Hashes a few MiB in `size` pieces, enough to rank the hashes without
+// making start up noticeably slower
+static double benchmark_hash_bucket(size_t size, uint64_t (*hash)(const void* data, size_t len)) {
+    if (size == 0) {
+        return 0.0;
+    }
+
+    unsigned char* buf = malloc(size);
+    if (!buf) {
+        return 0.0;
+    }
+    for (size_t i = 0; i < size; i++) {
+        buf[i] = (unsigned char)(i * 131U + 7U);
+    }
+
+    size_t iterations = (4U * 1024U * 1024U) / size;
+    if (iterations < 8) {
+        iterations = 8;
+    }
+
+    g_hash_bench_sink ^= hash(buf, size);
+
+    double start = monotonic_seconds();
+    for (size_t i = 0; i < iterations; i++) {
+        buf[0] = (unsigned char)i;
+        g_hash_bench_sink ^= hash(buf, size);
+    }
+    double end = monotonic_seconds();
+
+    free(buf);
+
+    double elapsed = end - start;
+    if (elapsed <= 0.0) {
+        return 0.0;
+    }
+
+    double total_bytes = (double)size * (double)iterations;
+    return total_bytes / elapsed / (1024.0 * 1024.0 * 1024.0);
+}
+
+static void detect_features(DedupRuntimeCaps* caps) {
     memset(caps, 0, sizeof(*caps));
 
 #if defined(__APPLE__) && (defined(__aarch64__) || defined(__arm64__))
@@ -184,28 +267,238 @@ static void populate_capabilities(DedupRuntimeCaps* caps) {
     caps->sha3 = have_sysctl_u32("hw.optional.armv8_2_sha3");
 #endif
 
+    caps->avx2 = exact_kernel_avx2_unrolled_supported();
+#if defined(__x86_64__)
+    caps->pclmul = strong_hash_pmull_poly_clmul_supported();
+#endif
     caps->metal_available = detect_metal_available();
+}
 
-    if (env_is_enabled("DEDUP_DISABLE_BENCH")) {
-        return;
-    }
-
+static void run_benchmarks(DedupRuntimeCaps* caps) {
     caps->memcmp_gib_s_4k = benchmark_memcmp_bucket(4U * 1024U);
     caps->memcmp_gib_s_64k = benchmark_memcmp_bucket(64U * 1024U);
     caps->memcmp_gib_s_1m = benchmark_memcmp_bucket(1024U * 1024U);
     caps->memcmp_gib_s_8m = benchmark_memcmp_bucket(8U * 1024U * 1024U);
-    caps->exact_cpu_tiles_gib_s_1m = benchmark_exact_tile_bucket(1024U * 1024U, 1024U * 1024U);
+    caps->exact_cpu_tiles_gib_s_1m = benchmark_exact_tile_bucket(1024U * 1024U, 1024U * 1024U,
+                                                                 exact_kernel_xor_or);
+    if (exact_kernel_neon_unrolled_supported()) {
+        caps->exact_neon_unrolled_gib_s_1m = benchmark_exact_tile_bucket(1024U * 1024U, 1024U * 1024U,
+                                                                         exact_kernel_neon_unrolled);
+    }
+    if (exact_kernel_avx2_unrolled_supported()) {
+        caps->exact_avx2_unrolled_gib_s_1m = benchmark_exact_tile_bucket(1024U * 1024U, 1024U * 1024U,
+                                                                         exact_kernel_avx2_unrolled);
+    }
+
+    caps->fast_hash_xxhash_gib_s_4k = benchmark_hash_bucket(4U * 1024U, signature_fast_hash_bytes);
+    caps->fast_hash_rapidhash_gib_s_4k = benchmark_hash_bucket(4U * 1024U, fast_hash_rapidhash);
+    caps->fast_hash_komihash_gib_s_4k = benchmark_hash_bucket(4U * 1024U, fast_hash_komihash);
+    caps->fast_hash_blake3_gib_s_4k = benchmark_hash_bucket(4U * 1024U, strong_hash_blake3);
+    caps->strong_hash_blake3_gib_s_64k = benchmark_hash_bucket(64U * 1024U, strong_hash_blake3);
+    caps->strong_hash_sha3_gib_s_64k = benchmark_hash_bucket(64U * 1024U,
+                                                             caps->sha3 && strong_hash_sha3_arm_supported() ?
+                                                             strong_hash_sha3_arm : strong_hash_sha3);
+    caps->strong_hash_pmull_poly_gib_s_64k = benchmark_hash_bucket(64U * 1024U,
+                                                                   (caps->pmull || caps->pclmul) &&
+                                                                   strong_hash_pmull_poly_clmul_supported() ?
+                                                                   strong_hash_pmull_poly_clmul :
+                                                                   strong_hash_pmull_poly);
+}
+
+// Names the hardware the measurements were taken on, e.g.
+// "Mac14,2 Apple M2".
+static void machine_name(char* buf, size_t size) {
+    struct utsname name;
+    if (uname(&name) != 0) {
+        snprintf(buf, size, "unknown");
+    } else {
+        snprintf(buf, size, "%s", name.machine);
+    }
+#if defined(__APPLE__)
+    char model[128] = {0};
+    char brand[128] = {0};
+    size_t model_size = sizeof(model) - 1;
+    size_t brand_size = sizeof(brand) - 1;
+    if (sysctlbyname("hw.model", model, &model_size, NULL, 0) == 0 &&
+        sysctlbyname("machdep.cpu.brand_string", brand, &brand_size, NULL, 0) == 0) {
+        snprintf(buf, size, "%s %s", model, brand);
+    }
+#endif
+}
+
+// Identifies the kernels run_benchmarks measures on this machine: the
+// version and compiler they were built with and which of the optional ones
+// are enabled. Rebuilding the same sources keeps the measurements, a build
+// that enables another kernel measures again.
+static uint64_t kernel_set_hash(const DedupRuntimeCaps* caps) {
+    char set[512];
+    snprintf(set, sizeof(set), "%s %s neon=%d avx2=%d sha3=%d clmul=%d", XSTR(VERSION), __VERSION__,
+             exact_kernel_neon_unrolled_supported(), exact_kernel_avx2_unrolled_supported(),
+             caps->sha3 && strong_hash_sha3_arm_supported(),
+             (caps->pmull || caps->pclmul) && strong_hash_pmull_poly_clmul_supported());
+    return fast_hash_rapidhash(set, strlen(set));
+}
+
+static void kernel_set_name(const DedupRuntimeCaps* caps, char* buf, size_t size) {
+    snprintf(buf, size, "%016" PRIx64, kernel_set_hash(caps));
+}
+
+// The cache lives in the user's cache directory. DEDUP_CALIBRATION_CACHE
+// names another file, set to an empty string it disables the cache.
+static bool calibration_cache_path(char* buf, size_t size) {
+    const char* path = getenv("DEDUP_CALIBRATION_CACHE");
+    if (path) {
+        return path[0] && (size_t)snprintf(buf, size, "%s", path) < size;
+    }
+
+    const char* home = getenv("HOME");
+    if (!home || !home[0]) {
+        return false;
+    }
+    return (size_t)snprintf(buf, size, "%s/%s/calibration", home, CALIBRATION_CACHE_DIR) < size;
+}
+
+static bool read_line(FILE* f, char* buf, size_t size) {
+    if (!fgets(buf, (int)size, f)) {
+        return false;
+    }
+    size_t len = strlen(buf);
+    if (len == 0 || buf[len - 1] != '\n') {
+        return false;
+    }
+    buf[len - 1] = '\0';
+    return true;
+}
+
+static bool read_keyed_line(FILE* f, const char* key, char* buf, size_t size) {
+    char line[512];
+    size_t key_len = strlen(key);
+    if (!read_line(f, line, sizeof(line)) || strncmp(line, key, key_len) != 0 || line[key_len] != ' ') {
+        return false;
+    }
+    return (size_t)snprintf(buf, size, "%s", line + key_len + 1) < size;
+}
+
+// Fills in the measurements from the cache. Fails unless the cache was
+// written for these kernels on this machine and has every measurement.
+static bool load_calibration(DedupRuntimeCaps* caps, const char* path) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        return false;
+    }
+
+    char line[512];
+    char value[512];
+    char kernels[32];
+    kernel_set_name(caps, kernels, sizeof(kernels));
+    char machine[256];
+    machine_name(machine, sizeof(machine));
+    bool valid = read_line(f, line, sizeof(line)) && strcmp(line, CALIBRATION_HEADER) == 0 &&
+                 read_keyed_line(f, "kernels", value, sizeof(value)) && strcmp(value, kernels) == 0 &&
+                 read_keyed_line(f, "machine", value, sizeof(value)) && strcmp(value, machine) == 0;
+
+    DedupRuntimeCaps measured = *caps;
+    for (size_t i = 0; valid && i < CALIBRATION_FIELD_COUNT; i++) {
+        valid = read_keyed_line(f, calibration_fields[i].name, value, sizeof(value));
+        if (valid) {
+            char* end = NULL;
+            errno = 0;
+            double gib_s = strtod(value, &end);
+            valid = errno == 0 && end != value && *end == '\0' && isfinite(gib_s) && gib_s >= 0.0;
+            *(double*)((char*)&measured + calibration_fields[i].offset) = gib_s;
+        }
+    }
+    fclose(f);
+
+    if (valid) {
+        *caps = measured;
+    }
+    return valid;
+}
+
+// Writes the measurements next to the cache and renames them over it, so
+// that concurrent runs never see a partial file.
+static bool save_calibration(const DedupRuntimeCaps* caps, const char* path) {
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", path);
+    char* slash = strrchr(dir, '/');
+    if (slash && slash != dir) {
+        *slash = '\0';
+        // only the last component is created, the user's cache directory
+        // is expected to exist
+        if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+            return false;
+        }
+    }
+
+    char tmp_path[PATH_MAX];
+    if ((size_t)snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path) >= sizeof(tmp_path)) {
+        return false;
+    }
+    int fd = mkstemp(tmp_path);
+    if (fd < 0) {
+        return false;
+    }
+    FILE* f = fdopen(fd, "w");
+    if (!f) {
+        close(fd);
+        unlink(tmp_path);
+        return false;
+    }
+
+    char kernels[32];
+    kernel_set_name(caps, kernels, sizeof(kernels));
+    char machine[256];
+    machine_name(machine, sizeof(machine));
+    fprintf(f, "%s\nkernels %s\nmachine %s\n", CALIBRATION_HEADER, kernels, machine);
+    for (size_t i = 0; i < CALIBRATION_FIELD_COUNT; i++) {
+        fprintf(f, "%s %.17g\n", calibration_fields[i].name,
+                *(const double*)((const char*)caps + calibration_fields[i].offset));
+    }
+
+    bool written = !ferror(f);
+    written = fclose(f) == 0 && written;
+    if (!written || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return false;
+    }
+    return true;
+}
+
+// Returns false only if the benchmarks ran and their results couldn't be
+// cached.
+static bool populate_capabilities(DedupRuntimeCaps* caps, bool recalibrate) {
+    detect_features(caps);
+
+    if (env_is_enabled("DEDUP_DISABLE_BENCH")) {
+        return true;
+    }
+
+    char path[PATH_MAX];
+    bool cached = calibration_cache_path(path, sizeof(path));
+    if (cached && !recalibrate && load_calibration(caps, path)) {
+        return true;
+    }
+
+    run_benchmarks(caps);
+    return !cached || save_calibration(caps, path);
 }
 
 const DedupRuntimeCaps* dedup_runtime_caps_get(void) {
     if (!g_runtime_caps_initialized) {
-        populate_capabilities(&g_runtime_caps);
+        populate_capabilities(&g_runtime_caps, false);
         g_runtime_caps_initialized = true;
     }
 
     return &g_runtime_caps;
 }
 
+bool dedup_runtime_caps_recalibrate(void) {
+    bool saved = populate_capabilities(&g_runtime_caps, true);
+    g_runtime_caps_initialized = true;
+    return saved;
+}
+
 void dedup_runtime_caps_reset_for_tests(void) {
     memset(&g_runtime_caps, 0, sizeof(g_runtime_caps));
     g_runtime_caps_initialized = false;
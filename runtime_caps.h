@@ -17,6 +17,8 @@ typedef struct DedupRuntimeCaps {
     bool crc32;
     bool pmull;
     bool sha3;
+    bool avx2;
+    bool pclmul;
     bool unified_memory;
     bool metal_available;
 
@@ -25,9 +27,30 @@ typedef struct DedupRuntimeCaps {
     double memcmp_gib_s_1m;
     double memcmp_gib_s_8m;
     double exact_cpu_tiles_gib_s_1m;
+    double exact_neon_unrolled_gib_s_1m;  // 0 if not supported
+    double exact_avx2_unrolled_gib_s_1m;  // 0 if not supported
+
+    // the variant of each hash that the runtime dispatch would use
+    double fast_hash_xxhash_gib_s_4k;
+    double fast_hash_rapidhash_gib_s_4k;
+    double fast_hash_komihash_gib_s_4k;
+    double fast_hash_blake3_gib_s_4k;
+    double strong_hash_blake3_gib_s_64k;
+    double strong_hash_sha3_gib_s_64k;
+    double strong_hash_pmull_poly_gib_s_64k;
 } DedupRuntimeCaps;
 
+/// Returns the capabilities of this machine. Features are detected on
+/// every start, the benchmark results are kept in a calibration cache so
+/// that only the first run on a machine, or with another set of kernels,
+/// measures them.
+/// The cache is `~/Library/Caches/dedup/calibration` unless
+/// DEDUP_CALIBRATION_CACHE names another file; an empty value disables it.
 const DedupRuntimeCaps* dedup_runtime_caps_get(void);
+
+/// Runs the benchmarks again, whether or not they are cached, and rewrites
+/// the calibration cache. Returns false if the cache couldn't be written.
+bool dedup_runtime_caps_recalibrate(void);
 void dedup_runtime_caps_reset_for_tests(void);
 
 #endif // __DEDUP_RUNTIME_CAPS_H__
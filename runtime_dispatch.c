@@ -6,23 +6,39 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "exact_kernels.h"
+#include "fast_hash.h"
+#include "metrics.h"
 #include "runtime_caps.h"
+#include "runtime_metal_compare.h"
 #include "signature.h"
+#include "strong_hash.h"
 
 static DedupRuntimeDispatch g_runtime_dispatch;
 static bool g_runtime_dispatch_initialized = false;
 
+// threads very large compares may still start, see dedup_runtime_set_split_threads
+static _Atomic size_t g_split_threads;
+
+static _Atomic uint64_t g_verifier_compared;
+static _Atomic uint64_t g_verifier_rejected[DEDUP_VERIFY_STAGE_COUNT];
+
+static void count_rejection(DedupVerifyStage stage) {
+    atomic_fetch_add_explicit(&g_verifier_rejected[stage], 1, memory_order_relaxed);
+}
+
 static uint64_t fast_hash_xxhash_backend(const void* data, size_t len) {
     return signature_fast_hash_bytes(data, len);
 }
 
-static bool witness_none_backend(const char* a_path, const char* b_path, uint64_t size) {
-    (void)a_path;
-    (void)b_path;
+static bool witness_none_backend(const FileHandle* a, const FileHandle* b, uint64_t size) {
+    (void)a;
+    (void)b;
     (void)size;
     return true;
 }
@@ -67,26 +83,16 @@ static bool compare_sample32(int a_fd, int b_fd, off_t offset, uint64_t size) {
     return memcmp(a_raw, b_raw, sizeof(a_raw)) == 0;
 }
 
-static bool witness_cpu_backend(const char* a_path, const char* b_path, uint64_t size) {
-    if (!a_path || !b_path) {
+static bool witness_cpu_backend(const FileHandle* a, const FileHandle* b, uint64_t size) {
+    if (!a || !b) {
         return false;
     }
     if (size == 0) {
         return true;
     }
 
-    int a_fd = open(a_path, O_RDONLY);
-    if (a_fd < 0) {
-        return false;
-    }
-
-    int b_fd = open(b_path, O_RDONLY);
-    if (b_fd < 0) {
-        close(a_fd);
-        return false;
-    }
-
-    bool matches = true;
+    int a_fd = a->fd;
+    int b_fd = b->fd;
     size_t window_size = size < 4096U ? (size_t)size : 4096U;
     off_t offsets[3] = {
         0,
@@ -96,8 +102,7 @@ static bool witness_cpu_backend(const char* a_path, const char* b_path, uint64_t
 
     for (size_t i = 0; i < 3; i++) {
         if (!compare_window_hashes(a_fd, b_fd, offsets[i], window_size)) {
-            matches = false;
-            goto cleanup;
+            return false;
         }
     }
 
@@ -109,31 +114,68 @@ static bool witness_cpu_backend(const char* a_path, const char* b_path, uint64_t
     };
     for (size_t i = 0; i < 4; i++) {
         if (!compare_sample32(a_fd, b_fd, sample_positions[i], size)) {
-            matches = false;
-            goto cleanup;
+            return false;
         }
     }
 
-cleanup:
-    close(a_fd);
-    close(b_fd);
-    return matches;
+    return true;
+}
+
+static bool witness_cpu_counted_backend(const FileHandle* a, const FileHandle* b, uint64_t size) {
+    if (!witness_cpu_backend(a, b, size)) {
+        count_rejection(DEDUP_VERIFY_EDGES);
+        return false;
+    }
+    return true;
+}
+
+static bool witness_cpu_progressive_backend(const FileHandle* a, const FileHandle* b, uint64_t size) {
+    DedupVerifyStage stage = progressive_witness(a, b, size);
+    if (stage != DEDUP_VERIFY_EXACT) {
+        count_rejection(stage);
+        return false;
+    }
+    return true;
 }
 
-static bool exact_compare_memcmp_backend(const char* a_path, const char* b_path) {
-    return files_match_exact_memcmp(a_path, b_path);
+static bool exact_compare_memcmp_backend(const FileHandle* a, const FileHandle* b) {
+    return handles_match_exact_memcmp(a, b);
 }
 
-static bool exact_compare_cpu_xor_or_backend(const char* a_path, const char* b_path) {
-    return files_match_exact_xor_or(a_path, b_path);
+static bool exact_compare_cpu_xor_or_backend(const FileHandle* a, const FileHandle* b) {
+    return handles_match_exact_xor_or(a, b);
 }
 
-static bool exact_compare_cpu_tiles_backend(const char* a_path, const char* b_path) {
-    return files_match_exact_cpu_tiles(a_path, b_path);
+static bool exact_compare_cpu_tiles_backend(const FileHandle* a, const FileHandle* b) {
+    return handles_match_exact_cpu_tiles(a, b);
 }
 
-static bool exact_compare_gpu_exact_stream_backend(const char* a_path, const char* b_path) {
-    return files_match_exact_memcmp(a_path, b_path);
+static bool exact_compare_neon_unrolled_backend(const FileHandle* a, const FileHandle* b) {
+    return handles_match_exact_neon_unrolled(a, b);
+}
+
+static bool exact_compare_avx2_unrolled_backend(const FileHandle* a, const FileHandle* b) {
+    return handles_match_exact_avx2_unrolled(a, b);
+}
+
+static bool witness_gpu_stream_backend(const FileHandle* a, const FileHandle* b, uint64_t size) {
+    DedupVerifyStage stage = DEDUP_VERIFY_EXACT;
+    if (!dedup_metal_witness(a, b, size, &stage)) {
+        stage = progressive_witness(a, b, size);
+    }
+    if (stage != DEDUP_VERIFY_EXACT) {
+        count_rejection(stage);
+        return false;
+    }
+    return true;
+}
+
+static bool exact_compare_gpu_exact_stream_backend(const FileHandle* a, const FileHandle* b) {
+    bool equal = false;
+    if (a && b && dedup_metal_exact_compare(a, b, (uint64_t)a->stat.st_size, &equal)) {
+        return equal;
+    }
+    return handles_match_exact_memcmp(a, b);
 }
 
 static const char* pick_name_or_default(const char* value, const char* fallback,
@@ -177,15 +219,84 @@ static size_t parse_size_override(const char* env_name, size_t fallback) {
 }
 
 static dedup_fast_hash_fn fast_hash_backend_for_name(const char* name) {
-    if (strcmp(name, "xxhash") == 0) {
-        return fast_hash_xxhash_backend;
+    if (strcmp(name, "rapidhash") == 0) {
+        return fast_hash_rapidhash;
+    }
+    if (strcmp(name, "komihash") == 0) {
+        return fast_hash_komihash;
+    }
+    if (strcmp(name, "blake3") == 0) {
+        return strong_hash_blake3;
     }
     return fast_hash_xxhash_backend;
 }
 
+static dedup_fast_hash_fn strong_hash_backend_for_name(const char* name, const DedupRuntimeCaps* caps) {
+    if (strcmp(name, "blake3") == 0) {
+        return strong_hash_blake3;
+    }
+    if (strcmp(name, "sha3") == 0) {
+        return caps->sha3 && strong_hash_sha3_arm_supported() ? strong_hash_sha3_arm : strong_hash_sha3;
+    }
+    if (strcmp(name, "pmull_poly") == 0) {
+        return (caps->pmull || caps->pclmul) && strong_hash_pmull_poly_clmul_supported() ?
+               strong_hash_pmull_poly_clmul : strong_hash_pmull_poly;
+    }
+    return NULL;
+}
+
+// The fast hash ends up in the signature cache, which is dropped whenever
+// the backend changes, so another one has to be clearly faster rather than
+// win a close benchmark by noise
+static const char* calibrated_fast_hash_name(const DedupRuntimeCaps* caps) {
+    const struct {
+        const char* name;
+        double gib_s;
+    } candidates[] = {
+        { "rapidhash", caps->fast_hash_rapidhash_gib_s_4k },
+        { "komihash", caps->fast_hash_komihash_gib_s_4k },
+        { "blake3", caps->fast_hash_blake3_gib_s_4k },
+    };
+
+    const char* name = "xxhash";
+    double best_gib_s = caps->fast_hash_xxhash_gib_s_4k;
+    for (size_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); i++) {
+        if (candidates[i].gib_s > best_gib_s * 1.1) {
+            name = candidates[i].name;
+            best_gib_s = candidates[i].gib_s;
+        }
+    }
+    return name;
+}
+
+static const char* fastest_strong_hash_name(const DedupRuntimeCaps* caps) {
+    const char* name = "blake3";
+    double best_gib_s = caps->strong_hash_blake3_gib_s_64k;
+    if (caps->strong_hash_sha3_gib_s_64k > best_gib_s) {
+        name = "sha3";
+        best_gib_s = caps->strong_hash_sha3_gib_s_64k;
+    }
+    if (caps->strong_hash_pmull_poly_gib_s_64k > best_gib_s) {
+        name = "pmull_poly";
+    }
+    return name;
+}
+
+// Setting up Metal compiles the kernels, which is only worth it if a GPU
+// backend was asked for
+static bool metal_usable(const DedupRuntimeCaps* caps) {
+    return caps->metal_available && caps->unified_memory && dedup_metal_compare_available();
+}
+
 static dedup_pair_witness_fn witness_backend_for_name(const char* name) {
+    if (strcmp(name, "gpu_witness_stream") == 0) {
+        return witness_gpu_stream_backend;
+    }
+    if (strcmp(name, "cpu_progressive") == 0) {
+        return witness_cpu_progressive_backend;
+    }
     if (strcmp(name, "cpu_witness") == 0) {
-        return witness_cpu_backend;
+        return witness_cpu_counted_backend;
     }
     return witness_none_backend;
 }
@@ -197,49 +308,82 @@ static dedup_exact_compare_fn exact_backend_for_name(const char* name) {
     if (strcmp(name, "cpu_tiles") == 0) {
         return exact_compare_cpu_tiles_backend;
     }
+    if (strcmp(name, "neon_unrolled") == 0) {
+        return exact_compare_neon_unrolled_backend;
+    }
+    if (strcmp(name, "avx2_unrolled") == 0) {
+        return exact_compare_avx2_unrolled_backend;
+    }
     if (strcmp(name, "gpu_exact_stream") == 0) {
         return exact_compare_gpu_exact_stream_backend;
     }
     return exact_compare_memcmp_backend;
 }
 
+// The handles_match_exact_ variant behind a backend, which
+// handles_match_exact_split can compare in ranges. NULL for the GPU.
+static dedup_exact_compare_fn exact_split_for_name(const char* name) {
+    if (strcmp(name, "cpu_xor_or") == 0) {
+        return handles_match_exact_xor_or;
+    }
+    if (strcmp(name, "cpu_tiles") == 0) {
+        return handles_match_exact_cpu_tiles;
+    }
+    if (strcmp(name, "neon_unrolled") == 0) {
+        return handles_match_exact_neon_unrolled;
+    }
+    if (strcmp(name, "avx2_unrolled") == 0) {
+        return handles_match_exact_avx2_unrolled;
+    }
+    if (strcmp(name, "memcmp") == 0) {
+        return handles_match_exact_memcmp;
+    }
+    return NULL;
+}
+
 const DedupRuntimeDispatch* dedup_runtime_dispatch_get(void) {
     if (!g_runtime_dispatch_initialized) {
         static const char* const fast_hash_names[] = { "xxhash", "rapidhash", "komihash", "blake3" };
-        static const char* const strong_hash_names[] = { "none", "blake3", "sha3", "pmull_poly" };
-        static const char* const witness_names[] = { "none", "cpu_witness", "gpu_witness_stream" };
-        static const char* const exact_names[] = { "memcmp", "cpu_xor_or", "cpu_tiles", "gpu_exact_stream" };
+        static const char* const strong_hash_names[] = { "none", "auto", "blake3", "sha3", "pmull_poly" };
+        static const char* const witness_names[] = {
+            "none", "cpu_witness", "cpu_progressive", "gpu_witness_stream",
+        };
+        static const char* const exact_names[] = {
+            "memcmp", "cpu_xor_or", "cpu_tiles", "neon_unrolled", "avx2_unrolled", "gpu_exact_stream",
+        };
         const DedupRuntimeCaps* caps = dedup_runtime_caps_get();
 
         memset(&g_runtime_dispatch, 0, sizeof(g_runtime_dispatch));
 
         const char* fast_hash_name = pick_name_or_default(getenv("DEDUP_FORCE_FAST_HASH"),
-                                                          "xxhash",
+                                                          calibrated_fast_hash_name(caps),
                                                           fast_hash_names,
                                                           sizeof(fast_hash_names) / sizeof(fast_hash_names[0]));
-        if (strcmp(fast_hash_name, "xxhash") != 0) {
-            fast_hash_name = "xxhash";
-        }
         g_runtime_dispatch.fast_hash_name = fast_hash_name;
 
         const char* strong_hash_name = pick_name_or_default(getenv("DEDUP_FORCE_STRONG_HASH"),
                                                             "none",
                                                             strong_hash_names,
                                                             sizeof(strong_hash_names) / sizeof(strong_hash_names[0]));
-        if (strcmp(strong_hash_name, "none") != 0) {
-            strong_hash_name = "none";
+        // the strong hash stage is opt in, it only pays off for large groups
+        // with many distinct contents
+        if (strcmp(strong_hash_name, "auto") == 0) {
+            strong_hash_name = fastest_strong_hash_name(caps);
         }
         g_runtime_dispatch.strong_hash_name = strong_hash_name;
 
+        // the GPU only wins on batches of large files, so it's never picked
+        // unless asked for
+        const bool force_gpu = env_is_enabled("DEDUP_FORCE_GPU") && metal_usable(caps);
+
+        // the probes cost a few kilobytes per candidate pair, which a single
+        // early rejection of a large near duplicate pays back many times over
         const char* witness_name = pick_name_or_default(getenv("DEDUP_FORCE_WITNESS"),
-                                                        "none",
+                                                        force_gpu ? "gpu_witness_stream" : "cpu_progressive",
                                                         witness_names,
                                                         sizeof(witness_names) / sizeof(witness_names[0]));
-        if (strcmp(witness_name, "gpu_witness_stream") == 0 && !caps->metal_available) {
-            witness_name = "none";
-        }
-        if (strcmp(witness_name, "none") != 0 && strcmp(witness_name, "cpu_witness") != 0) {
-            witness_name = "none";
+        if (strcmp(witness_name, "gpu_witness_stream") == 0 && !metal_usable(caps)) {
+            witness_name = "cpu_progressive";
         }
         g_runtime_dispatch.witness_name = witness_name;
 
@@ -247,6 +391,16 @@ const DedupRuntimeDispatch* dedup_runtime_dispatch_get(void) {
                                     caps->exact_cpu_tiles_gib_s_1m >= caps->memcmp_gib_s_1m;
         const char* exact_small_name = "memcmp";
         const char* exact_large_name = cpu_tiles_wins ? "cpu_tiles" : "memcmp";
+        double exact_large_gib_s = cpu_tiles_wins ? caps->exact_cpu_tiles_gib_s_1m : caps->memcmp_gib_s_1m;
+        if (caps->exact_neon_unrolled_gib_s_1m > 0.0 && caps->exact_neon_unrolled_gib_s_1m >= exact_large_gib_s) {
+            exact_large_name = "neon_unrolled";
+            exact_large_gib_s = caps->exact_neon_unrolled_gib_s_1m;
+        }
+        if (caps->exact_avx2_unrolled_gib_s_1m > 0.0 && caps->exact_avx2_unrolled_gib_s_1m >= exact_large_gib_s) {
+            exact_large_name = "avx2_unrolled";
+            exact_large_gib_s = caps->exact_avx2_unrolled_gib_s_1m;
+        }
+        const bool exact_large_wins = strcmp(exact_large_name, "memcmp") != 0;
         const char* forced_exact_name = pick_name_or_default(getenv("DEDUP_FORCE_EXACT_COMPARE"),
                                                              NULL,
                                                              exact_names,
@@ -254,8 +408,12 @@ const DedupRuntimeDispatch* dedup_runtime_dispatch_get(void) {
         if (forced_exact_name) {
             exact_small_name = forced_exact_name;
             exact_large_name = forced_exact_name;
+        } else if (force_gpu) {
+            exact_large_name = "gpu_exact_stream";
         }
-        if (strcmp(exact_large_name, "gpu_exact_stream") == 0 && !caps->metal_available) {
+        if ((strcmp(exact_large_name, "gpu_exact_stream") == 0 && !metal_usable(caps)) ||
+            (strcmp(exact_large_name, "neon_unrolled") == 0 && !exact_kernel_neon_unrolled_supported()) ||
+            (strcmp(exact_large_name, "avx2_unrolled") == 0 && !exact_kernel_avx2_unrolled_supported())) {
             exact_small_name = "memcmp";
             exact_large_name = "memcmp";
         }
@@ -263,19 +421,26 @@ const DedupRuntimeDispatch* dedup_runtime_dispatch_get(void) {
         g_runtime_dispatch.exact_large_name = exact_large_name;
 
         g_runtime_dispatch.fast_hash = fast_hash_backend_for_name(g_runtime_dispatch.fast_hash_name);
-        g_runtime_dispatch.strong_hash = NULL;
+        g_runtime_dispatch.strong_hash = strong_hash_backend_for_name(g_runtime_dispatch.strong_hash_name, caps);
         g_runtime_dispatch.witness = witness_backend_for_name(g_runtime_dispatch.witness_name);
         g_runtime_dispatch.exact_small = exact_backend_for_name(g_runtime_dispatch.exact_small_name);
         g_runtime_dispatch.exact_large = exact_backend_for_name(g_runtime_dispatch.exact_large_name);
+        g_runtime_dispatch.exact_large_split = exact_split_for_name(g_runtime_dispatch.exact_large_name);
 
         g_runtime_dispatch.witness_threshold = parse_size_override("DEDUP_WITNESS_THRESHOLD_BYTES", 256U * 1024U);
+        size_t exact_large_threshold = exact_large_wins ? (1024U * 1024U) : (64U * 1024U);
+        if (strcmp(g_runtime_dispatch.exact_large_name, "gpu_exact_stream") == 0 && !forced_exact_name) {
+            exact_large_threshold = 8U * 1024U * 1024U;
+        }
         g_runtime_dispatch.exact_large_threshold = parse_size_override("DEDUP_EXACT_LARGE_THRESHOLD_BYTES",
-                                                                       cpu_tiles_wins ? (1024U * 1024U) : (64U * 1024U));
+                                                                       exact_large_threshold);
         g_runtime_dispatch.gpu_batch_threshold = parse_size_override("DEDUP_GPU_BATCH_THRESHOLD", 16U);
+        g_runtime_dispatch.exact_split_threshold = parse_size_override("DEDUP_EXACT_SPLIT_THRESHOLD_BYTES",
+                                                                       256U * 1024U * 1024U);
 
-        if (env_is_enabled("DEDUP_FORCE_GPU") && caps->metal_available &&
-            strcmp(g_runtime_dispatch.witness_name, "none") == 0) {
-            g_runtime_dispatch.witness_name = "gpu_witness_stream";
+        if (strcmp(g_runtime_dispatch.witness_name, "gpu_witness_stream") == 0 ||
+            strcmp(g_runtime_dispatch.exact_large_name, "gpu_exact_stream") == 0) {
+            dedup_metal_set_batch_threshold(g_runtime_dispatch.gpu_batch_threshold);
         }
 
         g_runtime_dispatch_initialized = true;
@@ -284,10 +449,10 @@ const DedupRuntimeDispatch* dedup_runtime_dispatch_get(void) {
     return &g_runtime_dispatch;
 }
 
-bool dedup_runtime_witness_compare(const char* a_path, const char* b_path, uint64_t size) {
+bool dedup_runtime_witness_compare_handles(const FileHandle* a, const FileHandle* b, uint64_t size) {
     const DedupRuntimeDispatch* dispatch = dedup_runtime_dispatch_get();
 
-    if (!dispatch || !a_path || !b_path) {
+    if (!dispatch || !a || !b) {
         return false;
     }
 
@@ -299,19 +464,92 @@ bool dedup_runtime_witness_compare(const char* a_path, const char* b_path, uint6
         return true;
     }
 
-    return dispatch->witness(a_path, b_path, size);
+    uint64_t start = stage_clock();
+    bool matches = dispatch->witness(a, b, size);
+    stage_record(STAGE_WITNESS, start);
+    return matches;
 }
 
-bool dedup_runtime_exact_compare(const char* a_path, const char* b_path, uint64_t size) {
+// Takes up to `want` of the threads left for splitting compares.
+static size_t claim_split_threads(size_t want) {
+    size_t available = atomic_load(&g_split_threads);
+    size_t claimed = 0;
+    do {
+        claimed = available < want ? available : want;
+    } while (claimed > 0 && !atomic_compare_exchange_weak(&g_split_threads, &available, available - claimed));
+    return claimed;
+}
+
+void dedup_runtime_set_split_threads(size_t threads) {
+    atomic_store(&g_split_threads, threads);
+}
+
+bool dedup_runtime_exact_compare_handles(const FileHandle* a, const FileHandle* b, uint64_t size) {
     const DedupRuntimeDispatch* dispatch = dedup_runtime_dispatch_get();
+    if (!dispatch || !a || !b) {
+        return false;
+    }
+
+    uint64_t start = stage_clock();
+    size_t helpers = size >= dispatch->exact_split_threshold && dispatch->exact_large_split ?
+                         claim_split_threads(EXACT_SPLIT_MAX_PARTS - 1) : 0;
+    bool matches = false;
+    if (helpers > 0) {
+        matches = handles_match_exact_split(a, b, helpers + 1, dispatch->exact_large_split);
+        atomic_fetch_add(&g_split_threads, helpers);
+    } else {
+        matches = size >= dispatch->exact_large_threshold ? dispatch->exact_large(a, b) :
+                                                             dispatch->exact_small(a, b);
+    }
+    stage_record(STAGE_EXACT, start);
+    atomic_fetch_add_explicit(&g_verifier_compared, 1, memory_order_relaxed);
+    if (!matches) {
+        count_rejection(DEDUP_VERIFY_EXACT);
+    }
+    return matches;
+}
+
+void dedup_runtime_verifier_stats(DedupVerifierStats* stats) {
+    if (!stats) {
+        return;
+    }
+    stats->compared = atomic_load_explicit(&g_verifier_compared, memory_order_relaxed);
+    for (size_t i = 0; i < DEDUP_VERIFY_STAGE_COUNT; i++) {
+        stats->rejected[i] = atomic_load_explicit(&g_verifier_rejected[i], memory_order_relaxed);
+    }
+}
+
+static bool compare_paths(const char* a_path, const char* b_path, uint64_t size,
+                          bool (*compare)(const FileHandle*, const FileHandle*, uint64_t)) {
+    if (!a_path || !b_path) {
+        return false;
+    }
+
+    FileHandle* a = file_handle_open(a_path);
+    FileHandle* b = a ? file_handle_open(b_path) : NULL;
+    bool matches = b && compare(a, b, size);
+    file_handle_close(a);
+    file_handle_close(b);
+    return matches;
+}
+
+bool dedup_runtime_witness_compare(const char* a_path, const char* b_path, uint64_t size) {
+    const DedupRuntimeDispatch* dispatch = dedup_runtime_dispatch_get();
+
     if (!dispatch || !a_path || !b_path) {
         return false;
     }
 
-    if (size >= dispatch->exact_large_threshold) {
-        return dispatch->exact_large(a_path, b_path);
+    // the files don't need to be opened if no witness will read them
+    if (strcmp(dispatch->witness_name, "none") == 0 || size < dispatch->witness_threshold) {
+        return true;
     }
-    return dispatch->exact_small(a_path, b_path);
+
+    return compare_paths(a_path, b_path, size, dedup_runtime_witness_compare_handles);
+}
+
+bool dedup_runtime_exact_compare(const char* a_path, const char* b_path, uint64_t size) {
+    return compare_paths(a_path, b_path, size, dedup_runtime_exact_compare_handles);
 }
 
 void dedup_runtime_dispatch_reset_for_tests(void) {
@@ -9,9 +9,12 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "file_handle.h"
+#include "progressive_witness.h"
+
 typedef uint64_t (*dedup_fast_hash_fn)(const void* data, size_t len);
-typedef bool (*dedup_pair_witness_fn)(const char* a_path, const char* b_path, uint64_t size);
-typedef bool (*dedup_exact_compare_fn)(const char* a_path, const char* b_path);
+typedef bool (*dedup_pair_witness_fn)(const FileHandle* a, const FileHandle* b, uint64_t size);
+typedef bool (*dedup_exact_compare_fn)(const FileHandle* a, const FileHandle* b);
 
 typedef struct DedupRuntimeDispatch {
     const char* fast_hash_name;
@@ -25,15 +28,34 @@ typedef struct DedupRuntimeDispatch {
     dedup_pair_witness_fn witness;
     dedup_exact_compare_fn exact_small;
     dedup_exact_compare_fn exact_large;
+    dedup_exact_compare_fn exact_large_split;  // exact_large in ranges, NULL if it can't be split
 
     size_t witness_threshold;
     size_t exact_large_threshold;
     size_t gpu_batch_threshold;
+    size_t exact_split_threshold;
 } DedupRuntimeDispatch;
 
+/// Candidate pairs rejected by each verification stage since start up.
+/// Stages that a backend doesn't have stay 0, the legacy cpu_witness counts
+/// as edges.
+typedef struct DedupVerifierStats {
+    uint64_t compared;   // pairs that reached the exact compare
+    uint64_t rejected[DEDUP_VERIFY_STAGE_COUNT];
+} DedupVerifierStats;
+
 const DedupRuntimeDispatch* dedup_runtime_dispatch_get(void);
+void dedup_runtime_verifier_stats(DedupVerifierStats* stats);
 bool dedup_runtime_witness_compare(const char* a_path, const char* b_path, uint64_t size);
 bool dedup_runtime_exact_compare(const char* a_path, const char* b_path, uint64_t size);
+bool dedup_runtime_witness_compare_handles(const FileHandle* a, const FileHandle* b, uint64_t size);
+bool dedup_runtime_exact_compare_handles(const FileHandle* a, const FileHandle* b, uint64_t size);
+
+/// Lets compares of pairs of at least `exact_split_threshold` bytes be split
+/// in ranges verified side by side, on at most `threads` threads started for
+/// them at a time on top of the caller's. 0, the default, keeps every compare
+/// on the calling thread.
+void dedup_runtime_set_split_threads(size_t threads);
 void dedup_runtime_dispatch_reset_for_tests(void);
 
 #endif // __DEDUP_RUNTIME_DISPATCH_H__
@@ -0,0 +1,46 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#ifndef __DEDUP_RUNTIME_METAL_COMPARE_H__
+#define __DEDUP_RUNTIME_METAL_COMPARE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "file_handle.h"
+#include "progressive_witness.h"
+
+/// Metal Compare Backends
+///
+/// The gpu_witness_stream and gpu_exact_stream backends of the runtime
+/// dispatch. Both files of a pair are mapped and wrapped in shared buffers
+/// without copying, which only pays off with unified memory, so the path
+/// is only available on Apple silicon.
+///
+/// Callers block while their pair is compared. Pairs submitted by all
+/// workers are collected into batches of up to the batch threshold, each
+/// batch is encoded into one command buffer, which leaves the CPU to the
+/// traversal and cloning while the GPU reads.
+///
+/// The exact kernel XORs both files 32 bytes at a time and ORs the results
+/// together, so "equal" is never probabilistic. The witness kernel compares
+/// the same windows as the progressive witness.
+///
+/// Every function returns false when the GPU couldn't answer, files too
+/// large for a Metal buffer, mapping failures or a failed command buffer,
+/// and callers fall back to the CPU backends.
+
+/// Sets up the device and the kernels the first time it's called.
+bool dedup_metal_compare_available(void);
+
+/// How many pairs a batch waits for, briefly, before it's submitted.
+void dedup_metal_set_batch_threshold(size_t pairs);
+
+bool dedup_metal_exact_compare(const FileHandle* a, const FileHandle* b, uint64_t size, bool* equal);
+
+/// Sets `stage` to the stage that rejects the pair, or DEDUP_VERIFY_EXACT.
+bool dedup_metal_witness(const FileHandle* a, const FileHandle* b, uint64_t size, DedupVerifyStage* stage);
+
+#endif // __DEDUP_RUNTIME_METAL_COMPARE_H__
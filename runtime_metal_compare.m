@@ -0,0 +1,386 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include "runtime_metal_compare.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#import <Foundation/Foundation.h>
+#import <Metal/Metal.h>
+
+#define METAL_MAX_BATCH 64
+#define METAL_BATCH_WAIT_NS (2L * 1000L * 1000L)   // a partial batch waits at most 2ms
+#define METAL_EXACT_MAX_THREADS (64U * 1024U)
+#define METAL_RESULT_SLOTS DEDUP_WITNESS_MAX_WINDOWS
+
+// Compiled when the device is set up, so that the build doesn't need the
+// Metal toolchain
+static const char* const metal_kernel_source =
+    "#include <metal_stdlib>\n"
+    "using namespace metal;\n"
+    "\n"
+    "kernel void dedup_exact_xor_or(device const ulong4* a [[buffer(0)]],\n"
+    "                               device const ulong4* b [[buffer(1)]],\n"
+    "                               constant ulong& words [[buffer(2)]],\n"
+    "                               device atomic_uint* mismatch [[buffer(3)]],\n"
+    "                               uint gid [[thread_position_in_grid]],\n"
+    "                               uint threads [[threads_per_grid]]) {\n"
+    "    ulong4 acc = ulong4(0);\n"
+    "    for (ulong i = gid; i < words; i += threads) {\n"
+    "        acc |= a[i] ^ b[i];\n"
+    "    }\n"
+    "    if (simd_any(any(acc != 0)) && simd_is_first()) {\n"
+    "        atomic_store_explicit(mismatch, 1u, memory_order_relaxed);\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "kernel void dedup_witness_windows(device const uchar* a [[buffer(0)]],\n"
+    "                                  device const uchar* b [[buffer(1)]],\n"
+    "                                  constant ulong* offsets [[buffer(2)]],\n"
+    "                                  constant uint& window [[buffer(3)]],\n"
+    "                                  device atomic_uint* mismatch [[buffer(4)]],\n"
+    "                                  uint tg [[threadgroup_position_in_grid]],\n"
+    "                                  uint lane [[thread_position_in_threadgroup]],\n"
+    "                                  uint lanes [[threads_per_threadgroup]]) {\n"
+    "    device const uchar* wa = a + offsets[tg];\n"
+    "    device const uchar* wb = b + offsets[tg];\n"
+    "    uint diff = 0;\n"
+    "    for (uint i = lane; i < window; i += lanes) {\n"
+    "        diff |= wa[i] ^ wb[i];\n"
+    "    }\n"
+    "    if (diff != 0) {\n"
+    "        atomic_store_explicit(&mismatch[tg], 1u, memory_order_relaxed);\n"
+    "    }\n"
+    "}\n";
+
+typedef enum MetalJobKind {
+    METAL_JOB_EXACT,
+    METAL_JOB_WITNESS,
+} MetalJobKind;
+
+typedef struct MetalJob {
+    MetalJobKind kind;
+    const FileHandle* a;
+    const FileHandle* b;
+    uint64_t size;
+    const DedupWitnessWindows* windows;   // witness jobs only
+
+    bool done;
+    bool ok;
+    bool equal;              // exact jobs
+    size_t first_mismatch;   // witness jobs, windows->count if none
+
+    struct MetalJob* next;
+} MetalJob;
+
+typedef struct MetalMapping {
+    void* addr;
+    size_t len;
+} MetalMapping;
+
+static pthread_once_t g_metal_once = PTHREAD_ONCE_INIT;
+static bool g_metal_available = false;
+static id<MTLDevice> g_device;
+static id<MTLCommandQueue> g_queue;
+static id<MTLComputePipelineState> g_exact_pipeline;
+static id<MTLComputePipelineState> g_witness_pipeline;
+
+static pthread_mutex_t g_jobs_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_jobs_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t g_jobs_done = PTHREAD_COND_INITIALIZER;
+static MetalJob* g_jobs_head = NULL;
+static MetalJob** g_jobs_tail = &g_jobs_head;
+static size_t g_jobs_pending = 0;
+static _Atomic size_t g_batch_threshold = 16;
+
+// The pages past the end of the file are zero filled in both mappings, so
+// the exact kernel may read whole words up to the page boundary
+static bool map_handle(const FileHandle* handle, uint64_t size, MetalMapping* mapping) {
+    struct stat st;
+    size_t page = (size_t)getpagesize();
+    if (!handle || size == 0 || size > SIZE_MAX - page ||
+        fstat(handle->fd, &st) != 0 || (uint64_t)st.st_size != size) {
+        return false;
+    }
+
+    mapping->len = (size_t)((size + page - 1) / page * page);
+    mapping->addr = mmap(NULL, mapping->len, PROT_READ, MAP_PRIVATE, handle->fd, 0);
+    if (mapping->addr == MAP_FAILED) {
+        mapping->addr = NULL;
+        return false;
+    }
+    madvise(mapping->addr, mapping->len, MADV_SEQUENTIAL);
+    return true;
+}
+
+static void unmap_handle(MetalMapping* mapping) {
+    if (mapping->addr) {
+        munmap(mapping->addr, mapping->len);
+        mapping->addr = NULL;
+    }
+}
+
+static bool encode_job(id<MTLComputeCommandEncoder> encoder, MetalJob* job, id<MTLBuffer> a, id<MTLBuffer> b,
+                       id<MTLBuffer> results, NSUInteger results_offset) {
+    if (job->kind == METAL_JOB_EXACT) {
+        uint64_t words = (job->size + 31) / 32;
+        NSUInteger width = g_exact_pipeline.maxTotalThreadsPerThreadgroup;
+        width = width > 256 ? 256 : width;
+        uint64_t threads = words < METAL_EXACT_MAX_THREADS ? words : METAL_EXACT_MAX_THREADS;
+
+        [encoder setComputePipelineState:g_exact_pipeline];
+        [encoder setBuffer:a offset:0 atIndex:0];
+        [encoder setBuffer:b offset:0 atIndex:1];
+        [encoder setBytes:&words length:sizeof(words) atIndex:2];
+        [encoder setBuffer:results offset:results_offset atIndex:3];
+        [encoder dispatchThreadgroups:MTLSizeMake((NSUInteger)((threads + width - 1) / width), 1, 1)
+                threadsPerThreadgroup:MTLSizeMake(width, 1, 1)];
+        return true;
+    }
+
+    const DedupWitnessWindows* windows = job->windows;
+    uint32_t window = (uint32_t)windows->window;
+    NSUInteger width = g_witness_pipeline.maxTotalThreadsPerThreadgroup;
+    width = width > 256 ? 256 : width;
+
+    [encoder setComputePipelineState:g_witness_pipeline];
+    [encoder setBuffer:a offset:0 atIndex:0];
+    [encoder setBuffer:b offset:0 atIndex:1];
+    [encoder setBytes:windows->offsets length:windows->count * sizeof(uint64_t) atIndex:2];
+    [encoder setBytes:&window length:sizeof(window) atIndex:3];
+    [encoder setBuffer:results offset:results_offset atIndex:4];
+    [encoder dispatchThreadgroups:MTLSizeMake(windows->count, 1, 1) threadsPerThreadgroup:MTLSizeMake(width, 1, 1)];
+    return true;
+}
+
+static void run_batch(MetalJob** jobs, size_t count) {
+    MetalMapping mappings[METAL_MAX_BATCH][2];
+    memset(mappings, 0, sizeof(mappings));
+
+    // the buffers have to be gone before the memory they wrap is unmapped
+    @autoreleasepool {
+        NSUInteger slot_size = METAL_RESULT_SLOTS * sizeof(uint32_t);
+        id<MTLBuffer> results = [g_device newBufferWithLength:count * slot_size
+                                                      options:MTLResourceStorageModeShared];
+        id<MTLCommandBuffer> command_buffer = [g_queue commandBuffer];
+        id<MTLComputeCommandEncoder> encoder = [command_buffer computeCommandEncoder];
+        if (!results || !command_buffer || !encoder) {
+            for (size_t i = 0; i < count; i++) {
+                jobs[i]->ok = false;
+            }
+            return;
+        }
+        memset(results.contents, 0, count * slot_size);
+
+        bool encoded[METAL_MAX_BATCH] = {false};
+        for (size_t i = 0; i < count; i++) {
+            MetalJob* job = jobs[i];
+            if (!map_handle(job->a, job->size, &mappings[i][0]) ||
+                !map_handle(job->b, job->size, &mappings[i][1])) {
+                continue;
+            }
+
+            // nil if the file is larger than the device's buffer limit
+            id<MTLBuffer> a = [g_device newBufferWithBytesNoCopy:mappings[i][0].addr
+                                                          length:mappings[i][0].len
+                                                         options:MTLResourceStorageModeShared
+                                                     deallocator:nil];
+            id<MTLBuffer> b = [g_device newBufferWithBytesNoCopy:mappings[i][1].addr
+                                                          length:mappings[i][1].len
+                                                         options:MTLResourceStorageModeShared
+                                                     deallocator:nil];
+            if (a && b) {
+                encoded[i] = encode_job(encoder, job, a, b, results, i * slot_size);
+            }
+        }
+        [encoder endEncoding];
+        [command_buffer commit];
+        [command_buffer waitUntilCompleted];
+
+        bool completed = command_buffer.status == MTLCommandBufferStatusCompleted;
+        const uint32_t* flags = results.contents;
+        for (size_t i = 0; i < count; i++) {
+            MetalJob* job = jobs[i];
+            const uint32_t* job_flags = flags + i * METAL_RESULT_SLOTS;
+            job->ok = completed && encoded[i];
+            if (!job->ok) {
+                continue;
+            }
+            if (job->kind == METAL_JOB_EXACT) {
+                job->equal = job_flags[0] == 0;
+            } else {
+                job->first_mismatch = job->windows->count;
+                for (size_t w = 0; w < job->windows->count; w++) {
+                    if (job_flags[w] != 0) {
+                        job->first_mismatch = w;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        unmap_handle(&mappings[i][0]);
+        unmap_handle(&mappings[i][1]);
+    }
+}
+
+static struct timespec deadline_after(long ns) {
+    struct timespec deadline = {0};
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += ns;
+    while (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    return deadline;
+}
+
+static void* metal_batch_thread(void* arg) {
+    (void)arg;
+    for (;;) {
+        pthread_mutex_lock(&g_jobs_lock);
+        while (!g_jobs_head) {
+            pthread_cond_wait(&g_jobs_ready, &g_jobs_lock);
+        }
+
+        // give the other workers a moment to fill the batch
+        struct timespec deadline = deadline_after(METAL_BATCH_WAIT_NS);
+        size_t threshold = atomic_load_explicit(&g_batch_threshold, memory_order_relaxed);
+        while (g_jobs_pending < threshold && g_jobs_pending < METAL_MAX_BATCH) {
+            if (pthread_cond_timedwait(&g_jobs_ready, &g_jobs_lock, &deadline) == ETIMEDOUT) {
+                break;
+            }
+        }
+
+        MetalJob* jobs[METAL_MAX_BATCH];
+        size_t count = 0;
+        while (g_jobs_head && count < METAL_MAX_BATCH) {
+            jobs[count++] = g_jobs_head;
+            g_jobs_head = g_jobs_head->next;
+            g_jobs_pending--;
+        }
+        if (!g_jobs_head) {
+            g_jobs_tail = &g_jobs_head;
+        }
+        pthread_mutex_unlock(&g_jobs_lock);
+
+        run_batch(jobs, count);
+
+        pthread_mutex_lock(&g_jobs_lock);
+        for (size_t i = 0; i < count; i++) {
+            jobs[i]->done = true;
+        }
+        pthread_cond_broadcast(&g_jobs_done);
+        pthread_mutex_unlock(&g_jobs_lock);
+    }
+    return NULL;
+}
+
+static void metal_setup(void) {
+    @autoreleasepool {
+        id<MTLDevice> device = MTLCreateSystemDefaultDevice();
+        if (!device || !device.hasUnifiedMemory) {
+            return;
+        }
+
+        NSError* error = nil;
+        NSString* source = [NSString stringWithUTF8String:metal_kernel_source];
+        id<MTLLibrary> library = [device newLibraryWithSource:source options:nil error:&error];
+        if (!library) {
+            return;
+        }
+
+        id<MTLFunction> exact = [library newFunctionWithName:@"dedup_exact_xor_or"];
+        id<MTLFunction> witness = [library newFunctionWithName:@"dedup_witness_windows"];
+        id<MTLComputePipelineState> exact_pipeline =
+            exact ? [device newComputePipelineStateWithFunction:exact error:&error] : nil;
+        id<MTLComputePipelineState> witness_pipeline =
+            witness ? [device newComputePipelineStateWithFunction:witness error:&error] : nil;
+        id<MTLCommandQueue> queue = [device newCommandQueue];
+        if (!exact_pipeline || !witness_pipeline || !queue) {
+            return;
+        }
+
+        g_device = device;
+        g_queue = queue;
+        g_exact_pipeline = exact_pipeline;
+        g_witness_pipeline = witness_pipeline;
+
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, metal_batch_thread, NULL) != 0) {
+            return;
+        }
+        pthread_detach(thread);
+        g_metal_available = true;
+    }
+}
+
+static void metal_submit(MetalJob* job) {
+    pthread_mutex_lock(&g_jobs_lock);
+    job->next = NULL;
+    *g_jobs_tail = job;
+    g_jobs_tail = &job->next;
+    g_jobs_pending++;
+    pthread_cond_signal(&g_jobs_ready);
+    while (!job->done) {
+        pthread_cond_wait(&g_jobs_done, &g_jobs_lock);
+    }
+    pthread_mutex_unlock(&g_jobs_lock);
+}
+
+bool dedup_metal_compare_available(void) {
+    pthread_once(&g_metal_once, metal_setup);
+    return g_metal_available;
+}
+
+void dedup_metal_set_batch_threshold(size_t pairs) {
+    atomic_store_explicit(&g_batch_threshold, pairs > 0 ? pairs : 1, memory_order_relaxed);
+}
+
+bool dedup_metal_exact_compare(const FileHandle* a, const FileHandle* b, uint64_t size, bool* equal) {
+    if (!a || !b || !equal || size == 0 || !dedup_metal_compare_available()) {
+        return false;
+    }
+
+    MetalJob job = { .kind = METAL_JOB_EXACT, .a = a, .b = b, .size = size };
+    metal_submit(&job);
+    if (job.ok) {
+        *equal = job.equal;
+    }
+    return job.ok;
+}
+
+bool dedup_metal_witness(const FileHandle* a, const FileHandle* b, uint64_t size, DedupVerifyStage* stage) {
+    if (!a || !b || !stage || !dedup_metal_compare_available()) {
+        return false;
+    }
+    if ((uint64_t)a->stat.st_size != size || (uint64_t)b->stat.st_size != size) {
+        *stage = DEDUP_VERIFY_METADATA;
+        return true;
+    }
+
+    DedupWitnessWindows windows;
+    progressive_witness_windows(size, &windows);
+    if (windows.count == 0) {
+        *stage = DEDUP_VERIFY_EXACT;
+        return true;
+    }
+
+    MetalJob job = { .kind = METAL_JOB_WITNESS, .a = a, .b = b, .size = size, .windows = &windows };
+    metal_submit(&job);
+    if (job.ok) {
+        *stage = job.first_mismatch < windows.count ? progressive_witness_window_stage(job.first_mismatch) :
+                                                      DEDUP_VERIFY_EXACT;
+    }
+    return job.ok;
+}
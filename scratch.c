@@ -0,0 +1,60 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include "scratch.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+typedef struct Scratch {
+    void* buffers[SCRATCH_SLOT_COUNT];
+    size_t sizes[SCRATCH_SLOT_COUNT];
+} Scratch;
+
+static pthread_key_t scratch_key;
+static pthread_once_t scratch_once = PTHREAD_ONCE_INIT;
+static int scratch_key_error = 0;
+
+static void free_scratch(void* value) {
+    Scratch* scratch = value;
+    for (size_t i = 0; i < SCRATCH_SLOT_COUNT; i++) {
+        free(scratch->buffers[i]);
+    }
+    free(scratch);
+}
+
+static void create_scratch_key(void) {
+    scratch_key_error = pthread_key_create(&scratch_key, free_scratch);
+}
+
+void* thread_scratch(ScratchSlot slot, size_t size) {
+    if (slot >= SCRATCH_SLOT_COUNT) {
+        return NULL;
+    }
+
+    pthread_once(&scratch_once, create_scratch_key);
+    if (scratch_key_error) {
+        return NULL;
+    }
+
+    Scratch* scratch = pthread_getspecific(scratch_key);
+    if (!scratch) {
+        scratch = calloc(1, sizeof(Scratch));
+        if (!scratch || pthread_setspecific(scratch_key, scratch) != 0) {
+            free(scratch);
+            return NULL;
+        }
+    }
+
+    if (size == 0) {
+        size = 1;
+    }
+    if (scratch->sizes[slot] < size) {
+        // the old content is never needed, no reason to copy it
+        free(scratch->buffers[slot]);
+        scratch->buffers[slot] = malloc(size);
+        scratch->sizes[slot] = scratch->buffers[slot] ? size : 0;
+    }
+    return scratch->buffers[slot];
+}
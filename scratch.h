@@ -0,0 +1,32 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#ifndef __DEDUP_SCRATCH_H__
+#define __DEDUP_SCRATCH_H__
+
+#include <stddef.h>
+
+/// Scratch Buffers
+///
+/// The signature, the exact compare and the signature table read into
+/// buffers that only live for one call, and allocating them on every call
+/// churns the allocator once per file. Each thread keeps one buffer per slot instead, grown to
+/// the largest size asked for and released when the thread exits.
+///
+/// A buffer is valid until the next call for the same slot on the same
+/// thread, so a function must not hand its slot to anything that may ask
+/// for it again.
+typedef enum ScratchSlot {
+    SCRATCH_SIGNATURE,
+    SCRATCH_COMPARE_A,
+    SCRATCH_COMPARE_B,
+    SCRATCH_CONTENT,
+    SCRATCH_SLOT_COUNT,
+} ScratchSlot;
+
+/// Returns the calling thread's buffer for `slot`, at least `size` bytes
+/// large. Its content is undefined. Returns NULL if memory runs out.
+void* thread_scratch(ScratchSlot slot, size_t size);
+
+#endif // __DEDUP_SCRATCH_H__
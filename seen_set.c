@@ -26,21 +26,33 @@
 
 #include "seen_set.h"
 
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
 
-#define EMPTY    0
-#define OCCUPIED 1
+// Tag of a slot whose key is still being written. Tags of stored keys never
+// have this bit set and are never 0, which marks a free slot.
+#define BUSY (1ULL << 63)
 
 typedef struct {
-    uint64_t key;
-    uint8_t  state;
+    _Atomic uint64_t tag;
+    uint64_t high;   // written before `tag` is published
+    uint64_t low;
 } Slot;
 
-struct SeenSet {
+typedef struct {
     Slot*  slots;
     size_t capacity; // always a power of 2
-    size_t count;
+    atomic_size_t count;
+} SeenTable;
+
+struct SeenSet {
+    _Atomic(SeenTable*) table;
+    atomic_size_t inserting;   // inserts working on `table`
+    atomic_bool growing;       // no insert may start on `table`
+    pthread_mutex_t grow_mutex;
 };
 
 static size_t next_power_of_2(size_t v) {
@@ -55,6 +67,27 @@ static size_t next_power_of_2(size_t v) {
     return v;
 }
 
+static SeenTable* new_seen_table(size_t capacity) {
+    SeenTable* table = malloc(sizeof(SeenTable));
+    if (!table) return NULL;
+
+    table->slots = calloc(capacity, sizeof(Slot));
+    if (!table->slots) {
+        free(table);
+        return NULL;
+    }
+
+    table->capacity = capacity;
+    atomic_init(&table->count, 0);
+    return table;
+}
+
+static void free_seen_table(SeenTable* table) {
+    if (!table) return;
+    free(table->slots);
+    free(table);
+}
+
 SeenSet* new_seen_set(size_t capacity) {
     if (capacity < 16) capacity = 16;
     capacity = next_power_of_2(capacity);
@@ -62,69 +95,167 @@ SeenSet* new_seen_set(size_t capacity) {
     SeenSet* set = malloc(sizeof(SeenSet));
     if (!set) return NULL;
 
-    set->slots = calloc(capacity, sizeof(Slot));
-    if (!set->slots) {
+    SeenTable* table = new_seen_table(capacity);
+    if (!table) {
         free(set);
         return NULL;
     }
 
-    set->capacity = capacity;
-    set->count = 0;
+    atomic_init(&set->table, table);
+    atomic_init(&set->inserting, 0);
+    atomic_init(&set->growing, false);
+    pthread_mutex_init(&set->grow_mutex, NULL);
     return set;
 }
 
 void free_seen_set(SeenSet* set) {
     if (!set) return;
-    free(set->slots);
+    free_seen_table(atomic_load(&set->table));
+    pthread_mutex_destroy(&set->grow_mutex);
     free(set);
 }
 
-// Fibonacci hashing for good distribution with power-of-2 tables
-static inline size_t hash_key(uint64_t key, size_t mask) {
-    return (size_t)((key * 11400714819323198485ULL) >> 32) & mask;
+static inline uint64_t mix64(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
 }
 
-static bool seen_set_grow(SeenSet* set) {
-    size_t new_cap = set->capacity * 2;
-    Slot* new_slots = calloc(new_cap, sizeof(Slot));
-    if (!new_slots) return false;
-
-    size_t mask = new_cap - 1;
-    for (size_t i = 0; i < set->capacity; i++) {
-        if (set->slots[i].state != OCCUPIED) continue;
-        uint64_t key = set->slots[i].key;
-        size_t idx = hash_key(key, mask);
-        while (new_slots[idx].state == OCCUPIED) {
-            idx = (idx + 1) & mask;
-        }
-        new_slots[idx].key = key;
-        new_slots[idx].state = OCCUPIED;
+// Both halves take part, keys of one device only differ in `low`
+static inline uint64_t hash_key(uint64_t high, uint64_t low) {
+    return mix64(low ^ mix64(high));
+}
+
+static inline uint64_t key_tag(uint64_t hash) {
+    return (hash & ~BUSY) | 1;
+}
+
+typedef enum {
+    INSERTED,
+    PRESENT,
+    FULL,
+} InsertResult;
+
+static uint64_t wait_published(Slot* slot) {
+    uint64_t tag = 0;
+    while ((tag = atomic_load_explicit(&slot->tag, memory_order_acquire)) & BUSY) {
+        sched_yield();
     }
+    return tag;
+}
 
-    free(set->slots);
-    set->slots = new_slots;
-    set->capacity = new_cap;
-    return true;
+static InsertResult table_insert(SeenTable* table, uint64_t high, uint64_t low) {
+    uint64_t hash = hash_key(high, low);
+    uint64_t tag = key_tag(hash);
+    size_t mask = table->capacity - 1;
+    size_t idx = (size_t)(hash >> 32) & mask;
+
+    for (size_t probes = 0; probes < table->capacity; probes++, idx = (idx + 1) & mask) {
+        Slot* slot = &table->slots[idx];
+        uint64_t current = atomic_load_explicit(&slot->tag, memory_order_acquire);
+        if (current == 0) {
+            if (atomic_compare_exchange_strong_explicit(&slot->tag, &current, tag | BUSY,
+                                                        memory_order_acquire, memory_order_acquire)) {
+                slot->high = high;
+                slot->low = low;
+                atomic_store_explicit(&slot->tag, tag, memory_order_release);
+                return INSERTED;
+            }
+            // lost the slot, `current` now holds the winner's tag
+        }
+
+        if ((current & ~BUSY) != tag) {
+            continue;
+        }
+        // same tag, the key decides once it has been written
+        if (current & BUSY) {
+            wait_published(slot);
+        }
+        if (slot->high == high && slot->low == low) {
+            return PRESENT;
+        }
+    }
+    return FULL;
 }
 
-bool seen_set_insert(SeenSet* set, uint64_t key) {
-    // Grow at 75% load
-    if (set->count * 4 >= set->capacity * 3) {
-        seen_set_grow(set);
+// Replaces `old` with a table twice its size. Inserts wait while this runs,
+// so every slot of `old` is published and nothing writes to it. `old` may
+// already have been replaced and freed, it is only compared.
+//
+// Returns false if `old` is still the current table.
+static bool seen_set_grow(SeenSet* set, SeenTable* old) {
+    pthread_mutex_lock(&set->grow_mutex);
+    if (atomic_load(&set->table) != old) {
+        // somebody else grew it first
+        pthread_mutex_unlock(&set->grow_mutex);
+        return true;
+    }
+
+    atomic_store(&set->growing, true);
+    while (atomic_load(&set->inserting) != 0) {
+        sched_yield();
     }
 
-    size_t mask = set->capacity - 1;
-    size_t idx = hash_key(key, mask);
+    SeenTable* table = new_seen_table(old->capacity * 2);
+    if (table) {
+        size_t mask = table->capacity - 1;
+        for (size_t i = 0; i < old->capacity; i++) {
+            Slot* from = &old->slots[i];
+            uint64_t tag = atomic_load_explicit(&from->tag, memory_order_relaxed);
+            if (tag == 0) continue;
 
-    while (set->slots[idx].state == OCCUPIED) {
-        if (set->slots[idx].key == key) {
-            return true; // already present
+            size_t idx = (size_t)(hash_key(from->high, from->low) >> 32) & mask;
+            while (atomic_load_explicit(&table->slots[idx].tag, memory_order_relaxed) != 0) {
+                idx = (idx + 1) & mask;
+            }
+            table->slots[idx].high = from->high;
+            table->slots[idx].low = from->low;
+            atomic_store_explicit(&table->slots[idx].tag, tag, memory_order_relaxed);
         }
-        idx = (idx + 1) & mask;
+        atomic_store_explicit(&table->count, atomic_load(&old->count), memory_order_relaxed);
+        atomic_store(&set->table, table);
+        free_seen_table(old);
     }
 
-    set->slots[idx].key = key;
-    set->slots[idx].state = OCCUPIED;
-    set->count++;
-    return false; // newly inserted
+    atomic_store(&set->growing, false);
+    pthread_mutex_unlock(&set->grow_mutex);
+    return table != NULL;
+}
+
+bool seen_set_insert(SeenSet* set, uint64_t high, uint64_t low) {
+    for (;;) {
+        // pairs with seen_set_grow: either it sees this insert, or this
+        // insert sees it growing
+        atomic_fetch_add(&set->inserting, 1);
+        if (atomic_load(&set->growing)) {
+            atomic_fetch_sub(&set->inserting, 1);
+            // held for as long as the growth takes
+            pthread_mutex_lock(&set->grow_mutex);
+            pthread_mutex_unlock(&set->grow_mutex);
+            continue;
+        }
+
+        SeenTable* table = atomic_load(&set->table);
+        InsertResult result = table_insert(table, high, low);
+        // Grow at 75% load
+        bool crowded = result == INSERTED && (atomic_fetch_add(&table->count, 1) + 1) * 4 >= table->capacity * 3;
+        // `table` may be freed by a growth from here on
+        atomic_fetch_sub(&set->inserting, 1);
+
+        if (result == FULL) {
+            if (!seen_set_grow(set, table)) {
+                // a key that can't be stored was never seen
+                return false;
+            }
+            continue;
+        }
+
+        if (crowded) {
+            seen_set_grow(set, table);
+        }
+        return result == PRESENT;
+    }
 }
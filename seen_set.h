@@ -31,6 +31,13 @@
 #include <stddef.h>
 #include <stdint.h>
 
+/// Seen Sets
+///
+/// Records which (device, inode) or (device, clone id) pairs have come up,
+/// both halves of the key are kept in full. Inserts may run on any number
+/// of threads at once. They claim a slot with a compare-and-swap and probe
+/// linearly without taking a lock. Once 3/4 of the slots are used the set
+/// doubles, inserts that arrive while it grows wait for the new table.
 typedef struct SeenSet SeenSet;
 
 SeenSet* new_seen_set(size_t capacity);
@@ -38,6 +45,6 @@ void free_seen_set(SeenSet* set);
 
 /// Insert a key into the set.
 /// Returns true if the key was already present (i.e., duplicate).
-bool seen_set_insert(SeenSet* set, uint64_t key);
+bool seen_set_insert(SeenSet* set, uint64_t high, uint64_t low);
 
 #endif // __DEDUP_SEEN_SET_H__
@@ -0,0 +1,443 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include "sig_cache.h"
+
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SIG_CACHE_MAGIC "DDUPSIGC"
+#define SIG_CACHE_VERSION 2
+
+// Superseded and expired records are only compacted away once there are at
+// least this many of them and they outnumber the live ones.
+#define SIG_CACHE_COMPACT_MIN 4096
+
+// Records no run used for this many runs have expired, their files are
+// likely gone or outside of what is scanned now. A record that is used is
+// renewed once it is half as old, so it never expires.
+#define SIG_CACHE_EXPIRE_RUNS 16
+
+// What this run did with a record, see `SigCache.marks`.
+enum {
+    SIG_CACHE_UNUSED = 0,
+    SIG_CACHE_HIT,          // looked up and still up to date
+    SIG_CACHE_SUPERSEDED,   // a pending record replaces it
+};
+
+typedef struct SigCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    char hash_name[16];
+    uint32_t generation;    // of the last run that closed the cache
+    uint32_t reserved;
+} SigCacheHeader;
+
+typedef struct SigCacheRecord {
+    uint64_t device;
+    uint64_t inode;
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t clone_id;
+    int32_t samples[4];
+    uint64_t quick_hash;
+    uint32_t generation;    // of the run that wrote or last renewed it
+    uint32_t reserved;
+} SigCacheRecord;
+
+struct SigCache {
+    int fd;
+    char* path;
+    char hash_name[16];
+    uint32_t generation;            // of this run
+
+    void* map;
+    size_t map_length;
+    const SigCacheRecord* records;  // inside `map`, after the header
+    size_t record_count;
+
+    // (device, inode) -> index of the newest record + 1, 0 if empty
+    uint32_t* index;
+    size_t index_capacity;          // always a power of 2
+    size_t live_count;
+    _Atomic uint8_t* marks;         // one per record, see SIG_CACHE_HIT
+
+    pthread_mutex_t mutex;
+    SigCacheRecord* pending;
+    size_t pending_count;
+    size_t pending_capacity;
+};
+
+static inline uint64_t key_hash(uint64_t device, uint64_t inode) {
+    uint64_t h = inode * 0x9E3779B97F4A7C15ULL;
+    h ^= device + 0x7F4A7C159E3779B9ULL + (h << 6) + (h >> 2);
+    return h ^ (h >> 31);
+}
+
+static bool write_all(int fd, const void* data, size_t length, off_t offset) {
+    const char* p = data;
+    while (length > 0) {
+        ssize_t n = pwrite(fd, p, length, offset);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        length -= (size_t)n;
+        offset += n;
+    }
+    return true;
+}
+
+static SigCacheHeader make_header(const char* hash_name) {
+    SigCacheHeader header = {
+        .version = SIG_CACHE_VERSION,
+        .record_size = sizeof(SigCacheRecord),
+    };
+    memcpy(header.magic, SIG_CACHE_MAGIC, sizeof(header.magic));
+    strncpy(header.hash_name, hash_name, sizeof(header.hash_name) - 1);
+    return header;
+}
+
+static bool header_matches(const SigCacheHeader* header, const char* hash_name) {
+    SigCacheHeader expected = make_header(hash_name);
+    expected.generation = header->generation;
+    return memcmp(header, &expected, sizeof(expected)) == 0;
+}
+
+// How many runs ago `record` was written or renewed.
+static inline uint32_t record_age(const SigCache* cache, const SigCacheRecord* record) {
+    return cache->generation - record->generation;
+}
+
+static bool build_index(SigCache* cache) {
+    size_t capacity = 1024;
+    while (capacity < cache->record_count * 2) {
+        capacity *= 2;
+    }
+    cache->index = calloc(capacity, sizeof(uint32_t));
+    if (!cache->index) {
+        return false;
+    }
+    cache->index_capacity = capacity;
+    if (cache->record_count > 0) {
+        cache->marks = calloc(cache->record_count, sizeof(*cache->marks));
+        if (!cache->marks) {
+            return false;
+        }
+    }
+
+    size_t mask = capacity - 1;
+    for (size_t i = 0; i < cache->record_count; i++) {
+        const SigCacheRecord* r = &cache->records[i];
+        size_t idx = (size_t)key_hash(r->device, r->inode) & mask;
+        for (;; idx = (idx + 1) & mask) {
+            uint32_t slot = cache->index[idx];
+            if (slot == 0) {
+                cache->index[idx] = (uint32_t)(i + 1);
+                cache->live_count++;
+                break;
+            }
+            const SigCacheRecord* o = &cache->records[slot - 1];
+            if (o->device == r->device && o->inode == r->inode) {
+                // later records supersede earlier ones
+                cache->index[idx] = (uint32_t)(i + 1);
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+SigCache* open_sig_cache(const char* path, const char* hash_name) {
+    if (!path || !hash_name) {
+        return NULL;
+    }
+
+    SigCache* cache = calloc(1, sizeof(SigCache));
+    if (!cache) {
+        return NULL;
+    }
+    pthread_mutex_init(&cache->mutex, NULL);
+    strncpy(cache->hash_name, hash_name, sizeof(cache->hash_name) - 1);
+    cache->path = strdup(path);
+    cache->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (!cache->path || cache->fd < 0) {
+        close_sig_cache(cache);
+        return NULL;
+    }
+
+    // one run at a time, a second one just goes without
+    if (flock(cache->fd, LOCK_EX | LOCK_NB) != 0) {
+        close_sig_cache(cache);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(cache->fd, &st) != 0) {
+        close_sig_cache(cache);
+        return NULL;
+    }
+
+    SigCacheHeader header = { 0 };
+    bool valid = (size_t)st.st_size >= sizeof(header) &&
+                 pread(cache->fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+                 header_matches(&header, hash_name);
+    size_t record_count = valid ? ((size_t)st.st_size - sizeof(header)) / sizeof(SigCacheRecord) : 0;
+    if (record_count >= UINT32_MAX) {
+        valid = false;
+        record_count = 0;
+    }
+
+    cache->generation = valid ? header.generation + 1 : 1;
+    if (!valid) {
+        // unknown format or a different hash backend, start over
+        header = make_header(hash_name);
+        if (ftruncate(cache->fd, 0) != 0 || !write_all(cache->fd, &header, sizeof(header), 0)) {
+            close_sig_cache(cache);
+            return NULL;
+        }
+    } else if ((size_t)st.st_size != sizeof(header) + record_count * sizeof(SigCacheRecord)) {
+        // drop a record torn by an interrupted write
+        if (ftruncate(cache->fd, (off_t)(sizeof(header) + record_count * sizeof(SigCacheRecord))) != 0) {
+            close_sig_cache(cache);
+            return NULL;
+        }
+    }
+
+    if (record_count > 0) {
+        cache->map_length = sizeof(header) + record_count * sizeof(SigCacheRecord);
+        cache->map = mmap(NULL, cache->map_length, PROT_READ, MAP_SHARED, cache->fd, 0);
+        if (cache->map == MAP_FAILED) {
+            cache->map = NULL;
+            close_sig_cache(cache);
+            return NULL;
+        }
+        cache->records = (const SigCacheRecord*)((const char*)cache->map + sizeof(header));
+        cache->record_count = record_count;
+    }
+
+    if (!build_index(cache)) {
+        close_sig_cache(cache);
+        return NULL;
+    }
+
+    return cache;
+}
+
+// Returns the index of the live record of (device, inode), or
+// `record_count` if there is none.
+static size_t find_record(const SigCache* cache, uint64_t device, uint64_t inode) {
+    size_t mask = cache->index_capacity - 1;
+    for (size_t idx = (size_t)key_hash(device, inode) & mask; cache->index[idx]; idx = (idx + 1) & mask) {
+        const SigCacheRecord* r = &cache->records[cache->index[idx] - 1];
+        if (r->device == device && r->inode == inode) {
+            return cache->index[idx] - 1;
+        }
+    }
+    return cache->record_count;
+}
+
+FileSignature* sig_cache_lookup(const SigCache* cache, const SigCacheKey* key) {
+    if (!cache || !key || cache->record_count == 0) {
+        return NULL;
+    }
+
+    size_t i = find_record(cache, (uint64_t)key->device, (uint64_t)key->inode);
+    const SigCacheRecord* r = i < cache->record_count ? &cache->records[i] : NULL;
+    if (!r ||
+        r->size != key->size ||
+        r->mtime_sec != (int64_t)key->mtime.tv_sec ||
+        r->mtime_nsec != (int64_t)key->mtime.tv_nsec ||
+        r->clone_id != key->clone_id) {
+        return NULL;
+    }
+
+    // kept by the next compaction, unless it is superseded after all
+    uint8_t unused = SIG_CACHE_UNUSED;
+    atomic_compare_exchange_strong_explicit(&cache->marks[i], &unused, SIG_CACHE_HIT, memory_order_relaxed,
+                                            memory_order_relaxed);
+
+    FileSignature* sig = calloc(1, sizeof(FileSignature));
+    if (!sig) {
+        return NULL;
+    }
+    sig->device = key->device;
+    sig->size = key->size;
+    memcpy(sig->samples, r->samples, sizeof(sig->samples));
+    sig->quick_hash = r->quick_hash;
+    return sig;
+}
+
+void sig_cache_store(SigCache* cache, const SigCacheKey* key, const FileSignature* sig) {
+    if (!cache || !key || !sig) {
+        return;
+    }
+
+    SigCacheRecord record = {
+        .device = (uint64_t)key->device,
+        .inode = (uint64_t)key->inode,
+        .size = key->size,
+        .mtime_sec = (int64_t)key->mtime.tv_sec,
+        .mtime_nsec = (int64_t)key->mtime.tv_nsec,
+        .clone_id = key->clone_id,
+        .quick_hash = sig->quick_hash,
+        .generation = cache->generation,
+    };
+    memcpy(record.samples, sig->samples, sizeof(record.samples));
+
+    pthread_mutex_lock(&cache->mutex);
+    if (cache->pending_count == cache->pending_capacity) {
+        size_t new_cap = cache->pending_capacity ? cache->pending_capacity * 2 : 1024;
+        SigCacheRecord* pending = realloc(cache->pending, new_cap * sizeof(SigCacheRecord));
+        if (!pending) {
+            pthread_mutex_unlock(&cache->mutex);
+            return;
+        }
+        cache->pending = pending;
+        cache->pending_capacity = new_cap;
+    }
+    cache->pending[cache->pending_count++] = record;
+    pthread_mutex_unlock(&cache->mutex);
+
+    // the record it replaces is dropped by the next compaction
+    size_t i = find_record(cache, record.device, record.inode);
+    if (i < cache->record_count) {
+        atomic_store_explicit(&cache->marks[i], SIG_CACHE_SUPERSEDED, memory_order_relaxed);
+    }
+}
+
+// Whether compaction keeps the live record `i`: not if a pending record
+// supersedes it, or if it expired without being used by this run.
+static bool record_kept(const SigCache* cache, size_t i) {
+    uint8_t mark = atomic_load_explicit(&cache->marks[i], memory_order_relaxed);
+    return mark == SIG_CACHE_HIT ||
+           (mark == SIG_CACHE_UNUSED && record_age(cache, &cache->records[i]) < SIG_CACHE_EXPIRE_RUNS);
+}
+
+// Writes the live records that are kept and the pending ones to a new file
+// that replaces the cache. Records this run used are renewed.
+static bool compact(SigCache* cache) {
+    size_t len = strlen(cache->path) + sizeof(".tmp");
+    char* tmp_path = malloc(len);
+    if (!tmp_path) {
+        return false;
+    }
+    snprintf(tmp_path, len, "%s.tmp", cache->path);
+
+    int fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        free(tmp_path);
+        return false;
+    }
+
+    SigCacheHeader header = make_header(cache->hash_name);
+    header.generation = cache->generation;
+    off_t offset = 0;
+    bool ok = write_all(fd, &header, sizeof(header), offset);
+    offset += sizeof(header);
+    for (size_t i = 0; ok && i < cache->index_capacity; i++) {
+        size_t r = cache->index[i];
+        if (r && record_kept(cache, r - 1)) {
+            SigCacheRecord record = cache->records[r - 1];
+            if (atomic_load_explicit(&cache->marks[r - 1], memory_order_relaxed) == SIG_CACHE_HIT) {
+                record.generation = cache->generation;
+            }
+            ok = write_all(fd, &record, sizeof(record), offset);
+            offset += sizeof(SigCacheRecord);
+        }
+    }
+    if (ok && cache->pending_count > 0) {
+        ok = write_all(fd, cache->pending, cache->pending_count * sizeof(SigCacheRecord), offset);
+    }
+    ok = close(fd) == 0 && ok;
+    ok = ok && rename(tmp_path, cache->path) == 0;
+    if (!ok) {
+        unlink(tmp_path);
+    }
+
+    free(tmp_path);
+    return ok;
+}
+
+// Without a compaction the records this run used are renewed in place once
+// they are half way to expiring, and the header takes the generation of
+// this run.
+static void renew_records(SigCache* cache) {
+    SigCacheHeader header = make_header(cache->hash_name);
+    header.generation = cache->generation;
+    bool ok = write_all(cache->fd, &header, sizeof(header), 0);
+    for (size_t i = 0; ok && i < cache->record_count; i++) {
+        if (atomic_load_explicit(&cache->marks[i], memory_order_relaxed) == SIG_CACHE_HIT &&
+            record_age(cache, &cache->records[i]) >= SIG_CACHE_EXPIRE_RUNS / 2) {
+            off_t offset = (off_t)(sizeof(header) + i * sizeof(SigCacheRecord) +
+                                   offsetof(SigCacheRecord, generation));
+            ok = write_all(cache->fd, &cache->generation, sizeof(cache->generation), offset);
+        }
+    }
+    if (!ok) {
+        perror("signature cache");
+    }
+}
+
+void close_sig_cache(SigCache* cache) {
+    if (!cache) {
+        return;
+    }
+
+    if (cache->fd >= 0 && cache->index) {
+        // superseded records, by newer records in the file or pending
+        // ones, and live records that expired unused are dropped
+        size_t dropped = cache->record_count - cache->live_count;
+        for (size_t i = 0; i < cache->index_capacity; i++) {
+            if (cache->index[i] && !record_kept(cache, cache->index[i] - 1)) {
+                dropped++;
+            }
+        }
+        size_t kept = cache->record_count - dropped;
+        bool compacted = dropped >= SIG_CACHE_COMPACT_MIN &&
+                         dropped > kept + cache->pending_count &&
+                         compact(cache);
+        if (!compacted) {
+            renew_records(cache);
+        }
+        if (!compacted && cache->pending_count > 0) {
+            off_t end = (off_t)(sizeof(SigCacheHeader) + cache->record_count * sizeof(SigCacheRecord));
+            if (!write_all(cache->fd, cache->pending, cache->pending_count * sizeof(SigCacheRecord), end)) {
+                // leave whole records only, the next open would drop a torn
+                // one anyway
+                if (ftruncate(cache->fd, end) != 0) {
+                    perror("signature cache");
+                }
+            }
+        }
+    }
+
+    if (cache->map) {
+        munmap(cache->map, cache->map_length);
+    }
+    if (cache->fd >= 0) {
+        close(cache->fd);
+    }
+    free(cache->index);
+    free(cache->marks);
+    free(cache->pending);
+    free(cache->path);
+    pthread_mutex_destroy(&cache->mutex);
+    free(cache);
+}
@@ -0,0 +1,60 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#ifndef __DEDUP_SIG_CACHE_H__
+#define __DEDUP_SIG_CACHE_H__
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "signature.h"
+
+/// Signature Cache
+///
+/// Keeps the signatures of previous runs in a file so that a rescan of an
+/// unchanged tree does not have to read file contents again. The file is a
+/// header followed by fixed size records and is only ever appended to; a
+/// newer record for the same (device, inode) supersedes older ones.
+///
+/// A record is only used if size, modification time and clone id of the
+/// file still match, so a changed file simply misses. Cached signatures only
+/// nominate candidates, every match is still verified byte for byte.
+///
+/// The existing records are mapped read-only and indexed when the cache is
+/// opened, lookups are lock free. New records are buffered and written when
+/// the cache is closed.
+///
+/// Each run marks the records it used, and the ones a new record replaces.
+/// A record no run used for 16 runs has expired. The file
+/// is rewritten without superseded and expired records once they outnumber
+/// the ones kept.
+typedef struct SigCache SigCache;
+
+typedef struct SigCacheKey {
+    dev_t device;
+    ino_t inode;
+    uint64_t size;
+    struct timespec mtime;
+    uint64_t clone_id;
+} SigCacheKey;
+
+/// Opens or creates the cache at `path`. `hash_name` names the backend that
+/// produced `quick_hash`; a cache written with a different backend is
+/// discarded. Returns NULL if the cache can't be used, e.g. because another
+/// process holds it.
+SigCache* open_sig_cache(const char* path, const char* hash_name);
+
+/// Writes new records and closes the cache.
+void close_sig_cache(SigCache* cache);
+
+/// Returns a new signature for `key` if an up to date record exists.
+FileSignature* sig_cache_lookup(const SigCache* cache, const SigCacheKey* key);
+
+/// Records the signature computed for `key`. Safe to call from multiple
+/// threads.
+void sig_cache_store(SigCache* cache, const SigCacheKey* key, const FileSignature* sig);
+
+#endif // __DEDUP_SIG_CACHE_H__
@@ -3,25 +3,362 @@
 // SPDX-License-Identifier: BSD-2-Clause
 
 #include "sig_table.h"
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdalign.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "metrics.h"
+#include "progressive_witness.h"
 #include "runtime_dispatch.h"
+#include "scratch.h"
+
+#define SIG_TABLE_SHARD_COUNT 256
+#define SIG_TABLE_CLONE_SHARD_COUNT 64
+#define SIG_TABLE_CLONE_INITIAL 64
+#define SIG_TABLE_ARENA_CHUNK (64U * 1024U)
+
+// Slots are probed a group at a time, groups never wrap around the end of
+// a shard.
+#define SIG_TABLE_GROUP 16
+
+// Control byte of a slot that was never used. Used slots hold 7 bits of
+// the hash, so they never have the high bit set.
+#define SIG_TABLE_EMPTY 0x80
+
+// Bits of a group match mask per slot.
+#if defined(__ARM_NEON) && !defined(__SSE2__)
+#define SIG_TABLE_MATCH_BITS 4
+#else
+#define SIG_TABLE_MATCH_BITS 1
+#endif
+
+typedef struct SigTableSlot {
+    FileSignature signature;
+    SigTableEntry* head;        // newest entry with this signature
+} SigTableSlot;
+
+struct SigTableShard {
+    pthread_mutex_t lock;
+    uint8_t* control;           // one byte per slot, see SIG_TABLE_EMPTY
+    SigTableSlot* slots;
+    size_t capacity;            // always a power of 2, at least one group
+    size_t used;
+    Arena* arena;               // entries, allocated under the lock
+};
+
+// Clone ids are only unique within a volume, the index is keyed by both.
+typedef struct SigTableCloneKey {
+    dev_t device;
+    uint64_t clone_id;
+} SigTableCloneKey;
+
+// (device, clone id) to entry, linear probing. Clone ids of 0 are never
+// stored, so 0 marks a free slot.
+struct SigTableCloneShard {
+    pthread_mutex_t lock;
+    SigTableCloneKey* keys;
+    SigTableEntry** entries;
+    size_t capacity;            // always a power of 2
+    size_t used;
+};
+
+// Directories held for the entries that keep content, which are stat'ed
+// through them. The set is sized once, a directory that doesn't fit isn't
+// held. Linear probing by pointer, handles never move while held.
+struct SigTableDirs {
+    pthread_mutex_t lock;
+    DirHandle** handles;        // NULL marks a free slot
+    size_t capacity;            // always a power of 2, over twice `max`
+    size_t count;
+    size_t max;
+};
+
+// What an entry costs besides its name: the entry, about two slots with
+// their control byte, as the slots are between 7/16 and 7/8 used, and two
+// slots of the clone id index.
+#define SIG_TABLE_ENTRY_BYTES \
+    (sizeof(SigTableEntry) + 2 * (sizeof(SigTableSlot) + 1) + 2 * (sizeof(SigTableCloneKey) + sizeof(SigTableEntry*)))
+
+// hash_signature leaves runs of similar signatures in neighbouring values,
+// the shard, group and control byte each take different bits, so all of
+// them need to be mixed.
+static uint64_t mix64(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static uint64_t slot_hash(const FileSignature* sig) {
+    return mix64(hash_signature(sig));
+}
+
+static inline size_t hash_shard(uint64_t hash) {
+    return (size_t)(hash % SIG_TABLE_SHARD_COUNT);
+}
+
+static inline size_t hash_group(uint64_t hash) {
+    return (size_t)(hash >> 8);
+}
+
+static inline uint8_t hash_control(uint64_t hash) {
+    return (uint8_t)(hash >> 57);
+}
+
+// Returns a mask with SIG_TABLE_MATCH_BITS per slot of the group, of which
+// the lowest is set for every slot whose control byte is `byte`.
+static inline uint64_t group_match(const uint8_t* control, uint8_t byte) {
+#if defined(__SSE2__)
+    __m128i group = _mm_loadu_si128((const __m128i*)control);
+    return (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)byte)));
+#elif defined(__ARM_NEON)
+    uint8x16_t equal = vceqq_u8(vld1q_u8(control), vdupq_n_u8(byte));
+    // narrows every byte to a nibble, there is no movemask
+    uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(equal), 4);
+    return vget_lane_u64(vreinterpret_u64_u8(nibbles), 0) & 0x1111111111111111ULL;
+#else
+    uint64_t mask = 0;
+    for (size_t i = 0; i < SIG_TABLE_GROUP; i++) {
+        mask |= (uint64_t)(control[i] == byte) << i;
+    }
+    return mask;
+#endif
+}
+
+static inline size_t match_slot(uint64_t mask) {
+    return (size_t)__builtin_ctzll(mask) / SIG_TABLE_MATCH_BITS;
+}
+
+// Probes `shard` for `sig`. Returns its slot, or NULL with `empty` set to
+// the slot it would be stored in. The shard's lock must be held.
+static SigTableSlot* shard_find(const SigTableShard* shard, const FileSignature* sig, uint64_t hash,
+                                size_t* empty) {
+    size_t group_mask = shard->capacity / SIG_TABLE_GROUP - 1;
+    uint8_t control = hash_control(hash);
+    size_t group = hash_group(hash) & group_mask;
+
+    // triangular steps visit every group of a power of 2 sized shard
+    for (size_t step = 1;; step++) {
+        const uint8_t* bytes = shard->control + group * SIG_TABLE_GROUP;
+        for (uint64_t mask = group_match(bytes, control); mask; mask &= mask - 1) {
+            SigTableSlot* slot = &shard->slots[group * SIG_TABLE_GROUP + match_slot(mask)];
+            if (signatures_match(&slot->signature, sig)) {
+                return slot;
+            }
+        }
+
+        // nothing is ever removed, an empty slot ends the probe
+        uint64_t free_mask = group_match(bytes, SIG_TABLE_EMPTY);
+        if (free_mask) {
+            if (empty) {
+                *empty = group * SIG_TABLE_GROUP + match_slot(free_mask);
+            }
+            return NULL;
+        }
+        group = (group + step) & group_mask;
+    }
+}
+
+static bool shard_alloc(SigTableShard* shard, size_t capacity) {
+    shard->control = malloc(capacity);
+    shard->slots = malloc(capacity * sizeof(SigTableSlot));
+    if (!shard->control || !shard->slots) {
+        free(shard->control);
+        free(shard->slots);
+        shard->control = NULL;
+        shard->slots = NULL;
+        return false;
+    }
+    memset(shard->control, SIG_TABLE_EMPTY, capacity);
+    shard->capacity = capacity;
+    return true;
+}
+
+// Doubles the slots of `shard`. The shard's lock must be held.
+static bool shard_grow(SigTableShard* shard) {
+    SigTableShard old = *shard;
+    if (!shard_alloc(shard, old.capacity * 2)) {
+        *shard = old;
+        return false;
+    }
+
+    for (size_t i = 0; i < old.capacity; i++) {
+        if (old.control[i] == SIG_TABLE_EMPTY) {
+            continue;
+        }
+        uint64_t hash = slot_hash(&old.slots[i].signature);
+        size_t empty = 0;
+        shard_find(shard, &old.slots[i].signature, hash, &empty);
+        shard->control[empty] = old.control[i];
+        shard->slots[empty] = old.slots[i];
+    }
+    free(old.control);
+    free(old.slots);
+    return true;
+}
+
+// Returns the newest entry with signature `sig`, or NULL.
+static SigTableEntry* shard_head(SigTableShard* shard, const FileSignature* sig, uint64_t hash) {
+    stage_lock(&shard->lock, STAGE_TABLE_LOCK);
+    SigTableSlot* slot = shard_find(shard, sig, hash, NULL);
+    SigTableEntry* head = slot ? slot->head : NULL;
+    pthread_mutex_unlock(&shard->lock);
+    return head;
+}
 
-SigTable* new_sig_table(size_t bucket_count) {
+static bool clone_shard_alloc(SigTableCloneShard* shard, size_t capacity) {
+    shard->keys = calloc(capacity, sizeof(SigTableCloneKey));
+    shard->entries = calloc(capacity, sizeof(SigTableEntry*));
+    if (!shard->keys || !shard->entries) {
+        free(shard->keys);
+        free(shard->entries);
+        shard->keys = NULL;
+        shard->entries = NULL;
+        return false;
+    }
+    shard->capacity = capacity;
+    return true;
+}
+
+static SigTableCloneShard* clone_shard(SigTable* table, uint64_t hash) {
+    return &table->clone_shards[hash % SIG_TABLE_CLONE_SHARD_COUNT];
+}
+
+static uint64_t clone_key_hash(SigTableCloneKey key) {
+    return mix64(key.clone_id ^ mix64((uint64_t)key.device));
+}
+
+// Returns the slot of `key`, or the free slot it would be stored in. The
+// shard's lock must be held.
+static size_t clone_shard_find(const SigTableCloneShard* shard, SigTableCloneKey key, uint64_t hash) {
+    size_t mask = shard->capacity - 1;
+    size_t i = (size_t)(hash / SIG_TABLE_CLONE_SHARD_COUNT) & mask;
+    while (shard->keys[i].clone_id != 0 &&
+           (shard->keys[i].clone_id != key.clone_id || shard->keys[i].device != key.device)) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+static bool clone_shard_grow(SigTableCloneShard* shard) {
+    SigTableCloneShard old = *shard;
+    if (!clone_shard_alloc(shard, old.capacity * 2)) {
+        *shard = old;
+        return false;
+    }
+
+    for (size_t i = 0; i < old.capacity; i++) {
+        if (old.keys[i].clone_id != 0) {
+            size_t slot = clone_shard_find(shard, old.keys[i], clone_key_hash(old.keys[i]));
+            shard->keys[slot] = old.keys[i];
+            shard->entries[slot] = old.entries[i];
+        }
+    }
+    free(old.keys);
+    free(old.entries);
+    return true;
+}
+
+// Remembers `entry`, stored on `device`, for its clone id unless an earlier
+// entry of the device has it. An index that can't grow only misses the
+// entry, lookups stay correct for everything stored before.
+static void clone_index_add(SigTable* table, SigTableEntry* entry, dev_t device) {
+    if (entry->clone_id == 0) {
+        return;
+    }
+
+    SigTableCloneKey key = { .device = device, .clone_id = entry->clone_id };
+    uint64_t hash = clone_key_hash(key);
+    SigTableCloneShard* shard = clone_shard(table, hash);
+    stage_lock(&shard->lock, STAGE_TABLE_LOCK);
+    size_t slot = clone_shard_find(shard, key, hash);
+    if (shard->keys[slot].clone_id == 0) {
+        // keep a quarter of the slots free, probes stay short
+        if ((shard->used + 1) * 4 > shard->capacity * 3) {
+            if (!clone_shard_grow(shard)) {
+                pthread_mutex_unlock(&shard->lock);
+                return;
+            }
+            slot = clone_shard_find(shard, key, hash);
+        }
+        shard->keys[slot] = key;
+        shard->entries[slot] = entry;
+        shard->used++;
+    }
+    pthread_mutex_unlock(&shard->lock);
+}
+
+SigTable* new_sig_table(size_t capacity, FileHandleCache* handles) {
     SigTable* table = calloc(1, sizeof(SigTable));
     if (!table) {
         return NULL;
     }
 
-    table->buckets = calloc(bucket_count, sizeof(SigTableEntry*));
-    if (!table->buckets) {
-        free(table);
+    table->shards = calloc(SIG_TABLE_SHARD_COUNT, sizeof(SigTableShard));
+    for (size_t i = 0; table->shards && i < SIG_TABLE_SHARD_COUNT; i++) {
+        pthread_mutex_init(&table->shards[i].lock, NULL);
+    }
+    table->clone_shards = calloc(SIG_TABLE_CLONE_SHARD_COUNT, sizeof(SigTableCloneShard));
+    for (size_t i = 0; table->clone_shards && i < SIG_TABLE_CLONE_SHARD_COUNT; i++) {
+        pthread_mutex_init(&table->clone_shards[i].lock, NULL);
+    }
+    table->dirs = new_string_pool();
+    table->parents = calloc(1, sizeof(SigTableDirs));
+    if (table->parents) {
+        pthread_mutex_init(&table->parents->lock, NULL);
+        // leaves the other half to the directories of the entries in flight
+        table->parents->max = dir_handle_limit() / 2;
+        table->parents->capacity = 16;
+        while (table->parents->capacity < table->parents->max * 2 + 1) {
+            table->parents->capacity *= 2;
+        }
+        table->parents->handles = calloc(table->parents->capacity, sizeof(DirHandle*));
+    }
+    if (!table->shards || !table->clone_shards || !table->dirs || !table->parents || !table->parents->handles) {
+        free_sig_table(table);
         return NULL;
     }
 
-    table->bucket_count = bucket_count;
-    table->entry_count = 0;
+    size_t shard_capacity = SIG_TABLE_GROUP;
+    while (shard_capacity * SIG_TABLE_SHARD_COUNT < capacity) {
+        shard_capacity *= 2;
+    }
+    for (size_t i = 0; i < SIG_TABLE_SHARD_COUNT; i++) {
+        SigTableShard* shard = &table->shards[i];
+        // arenas allocate their first chunk on first use, idle shards
+        // cost nothing but their slots
+        shard->arena = new_arena(SIG_TABLE_ARENA_CHUNK);
+        if (!shard->arena || !shard_alloc(shard, shard_capacity)) {
+            free_sig_table(table);
+            return NULL;
+        }
+    }
+
+    for (size_t i = 0; i < SIG_TABLE_CLONE_SHARD_COUNT; i++) {
+        if (!clone_shard_alloc(&table->clone_shards[i], SIG_TABLE_CLONE_INITIAL)) {
+            free_sig_table(table);
+            return NULL;
+        }
+    }
+
+    table->handles = handles;
+    table->inline_max = SIG_TABLE_INLINE_DEFAULT;
+    atomic_init(&table->entry_count, 0);
+    atomic_init(&table->bytes, 0);
 
     return table;
 }
@@ -31,97 +368,456 @@ void free_sig_table(SigTable* table) {
         return;
     }
 
-    for (size_t i = 0; i < table->bucket_count; i++) {
-        SigTableEntry* entry = table->buckets[i];
-        while (entry) {
-            SigTableEntry* next = entry->next;
-            free_signature(entry->signature);
-            free(entry->path);
-            free(entry);
-            entry = next;
+    // entries are released with the arenas
+    for (size_t i = 0; table->shards && i < SIG_TABLE_SHARD_COUNT; i++) {
+        SigTableShard* shard = &table->shards[i];
+        pthread_mutex_destroy(&shard->lock);
+        free_arena(shard->arena);
+        free(shard->control);
+        free(shard->slots);
+    }
+    free(table->shards);
+    for (size_t i = 0; table->clone_shards && i < SIG_TABLE_CLONE_SHARD_COUNT; i++) {
+        SigTableCloneShard* shard = &table->clone_shards[i];
+        pthread_mutex_destroy(&shard->lock);
+        free(shard->keys);
+        free(shard->entries);
+    }
+    free(table->clone_shards);
+    free_string_pool(table->dirs);
+    if (table->parents) {
+        for (size_t i = 0; table->parents->handles && i < table->parents->capacity; i++) {
+            dir_handle_release(table->parents->handles[i]);
         }
+        pthread_mutex_destroy(&table->parents->lock);
+        free(table->parents->handles);
+        free(table->parents);
     }
-
-    free(table->buckets);
     free(table);
 }
 
-SigTableEntry* sig_table_insert(SigTable* table, FileSignature* sig, const char* path, uint64_t clone_id) {
-    if (!table || !sig || !path) {
+// Holds `dir` for as long as the table lives, once. Returns `dir` if it is
+// held, NULL if it is NULL or there's no room for it.
+static DirHandle* hold_parent(SigTable* table, DirHandle* dir) {
+    SigTableDirs* parents = table->parents;
+    if (!dir) {
         return NULL;
     }
 
-    uint64_t hash = hash_signature(sig);
-    size_t bucket_idx = hash % table->bucket_count;
+    pthread_mutex_lock(&parents->lock);
+    size_t mask = parents->capacity - 1;
+    size_t idx = (size_t)(((uintptr_t)dir >> 4) * 0x9E3779B97F4A7C15ULL) & mask;
+    while (parents->handles[idx] && parents->handles[idx] != dir) {
+        idx = (idx + 1) & mask;
+    }
+    if (!parents->handles[idx]) {
+        if (parents->count == parents->max) {
+            dir = NULL;
+        } else {
+            parents->handles[idx] = dir_handle_retain(dir);
+            parents->count++;
+        }
+    }
+    pthread_mutex_unlock(&parents->lock);
+    return dir;
+}
+
+// The digest of `entry`, taken through `handle` the first time. Returns 0
+// if it can't be taken.
+static uint64_t entry_digest(SigTableEntry* entry, const FileHandle* handle, uint64_t size) {
+    uint64_t digest = atomic_load_explicit(&entry->digest, memory_order_relaxed);
+    if (digest == 0 && progressive_witness_digest(handle, size, &digest)) {
+        // threads that race here store the same value
+        atomic_store_explicit(&entry->digest, digest, memory_order_relaxed);
+    }
+    return digest;
+}
 
-    // Check for existing match in collision chain.
-    // SMHasher-style discipline: a fast hash/signature only nominates candidates;
-    // witness stages may reject quickly, but exact comparison is still required
-    // before treating files as equal.
-    SigTableEntry* entry = table->buckets[bucket_idx];
-    while (entry) {
-        if (signatures_match(entry->signature, sig) &&
-            dedup_runtime_witness_compare(entry->path, path, sig->size) &&
-            dedup_runtime_exact_compare(entry->path, path, sig->size)) {
-            return entry;
+// The file looked up, and what was read of it so far.
+typedef struct Subject {
+    const char* path;
+    DirHandle* dir;                 // of `path`, may be NULL
+    const char* name;               // within `dir`, or all of `path`
+    uint64_t size;
+    FileHandle* handle;             // acquired on first use
+    bool escalate;                  // compare by digest first
+    uint64_t digest;                // taken on first use if escalated
+    const unsigned char* content;   // read on first use if small, or NULL
+    struct timespec mtime;          // of `handle` when content was read
+    struct timespec ctime;
+    bool racy;                      // changed too recently to trust `mtime`
+    DirHandle* parent;              // `dir` once the table holds it
+} Subject;
+
+static FileHandle* subject_handle(SigTable* table, Subject* subject) {
+    if (!subject->handle) {
+        subject->handle = file_handle_acquire_at(table->handles, dir_handle_fd(subject->dir), subject->name,
+                                                 subject->path);
+    }
+    return subject->handle;
+}
+
+// Reads all of a small subject through the handle a compare opened. Returns
+// NULL if it isn't small, is empty, wasn't opened yet or can't be read. The
+// content lives in the thread's scratch buffer.
+static const unsigned char* subject_content(SigTable* table, Subject* subject) {
+    if (subject->content || subject->size == 0 || subject->size > table->inline_max || !subject->handle) {
+        return subject->content;
+    }
+
+    const FileHandle* handle = subject->handle;
+    unsigned char* buf = thread_scratch(SCRATCH_CONTENT, (size_t)subject->size);
+    size_t done = 0;
+    while (buf && done < subject->size) {
+        ssize_t n = pread(handle->fd, buf + done, (size_t)subject->size - done, (off_t)done);
+        if (n < 0 && errno == EINTR) {
+            continue;
         }
-        entry = entry->next;
+        if (n <= 0) {
+            return NULL;
+        }
+        done += (size_t)n;
+    }
+    if (buf && (uint64_t)handle->stat.st_size == subject->size) {
+        subject->content = buf;
+        subject->mtime = handle->stat.st_mtimespec;
+        subject->ctime = handle->stat.st_ctimespec;
+        // a write in the second the file was read in may leave its mtime
+        // as it is, file systems keep whole seconds at worst
+        struct timespec now;
+        subject->racy = clock_gettime(CLOCK_REALTIME, &now) != 0 || subject->mtime.tv_sec >= now.tv_sec;
+    }
+    return subject->content;
+}
+
+// Whether the file of `entry`, at `entry_path`, is still the one whose
+// content it holds. It is looked up in the directory the table holds for
+// it, if any.
+static bool content_current(const SigTableEntry* entry, const char* entry_path, uint64_t size) {
+    const SigTableContent* content = entry->content;
+    struct stat st;
+    return fstatat(dir_handle_fd(entry->parent), entry->parent ? entry->name : entry_path, &st,
+                   AT_SYMLINK_NOFOLLOW) == 0 &&
+           st.st_ino == entry->inode &&
+           (uint64_t)st.st_size == size &&
+           st.st_mtimespec.tv_sec == content->mtime.tv_sec &&
+           st.st_mtimespec.tv_nsec == content->mtime.tv_nsec &&
+           st.st_ctimespec.tv_sec == content->ctime.tv_sec &&
+           st.st_ctimespec.tv_nsec == content->ctime.tv_nsec;
+}
+
+// Compares the subject against a candidate, unless `verdict` already knows
+// the answer. Candidates that hold their content are compared in memory,
+// a match is only trusted while the candidate's file is unchanged. The
+// others are compared by digest if the subject is escalated, then by the
+// witness and the exact compare.
+static bool candidate_matches(SigTable* table, SigTableEntry* entry, Subject* subject,
+                              const GroupVerdict* verdict) {
+    char entry_path[PATH_MAX];
+    if (!sig_table_entry_path(entry, entry_path, sizeof(entry_path))) {
+        return false;
+    }
+
+    bool equal = false;
+    if (group_verdict_lookup(verdict, entry_path, subject->path, &equal)) {
+        return equal;
+    }
+
+    uint64_t size = subject->size;
+    if (entry->content && subject_handle(table, subject) && subject_content(table, subject)) {
+        if (memcmp(entry->content->bytes, subject->content, (size_t)size) != 0) {
+            return false;
+        }
+        if (content_current(entry, entry_path, size)) {
+            return true;
+        }
+        // changed since, the file has to be read after all
+    }
+
+    FileHandle* self = subject_handle(table, subject);
+    if (!self) {
+        return false;
     }
+    if (subject->escalate && subject->digest == 0 && !progressive_witness_digest(self, size, &subject->digest)) {
+        // left to the witness
+        subject->escalate = false;
+    }
+
+    FileHandle* other = file_handle_acquire(table->handles, entry_path);
+    bool matches = other != NULL;
+    if (matches && subject->escalate) {
+        uint64_t other_digest = entry_digest(entry, other, size);
+        matches = other_digest == 0 || other_digest == subject->digest;
+    }
+    matches = matches &&
+              dedup_runtime_witness_compare_handles(other, self, size) &&
+              dedup_runtime_exact_compare_handles(other, self, size);
+    file_handle_release(table->handles, other);
+    return matches;
+}
 
-    SigTableEntry* new_entry = calloc(1, sizeof(SigTableEntry));
-    if (!new_entry) {
+// Stores a new entry for `sig` unless another thread added one since
+// `head` was claimed. Returns NULL with `current` set to the newest entry
+// in that case, and with `current` set to `head` if memory ran out.
+static SigTableEntry* shard_publish(SigTableShard* shard, const FileSignature* sig, uint64_t hash, SigTableEntry* head,
+                          const SigTableEntry* prototype, const char* name, size_t name_size,
+                          const Subject* subject, SigTableEntry** current) {
+    stage_lock(&shard->lock, STAGE_TABLE_LOCK);
+    size_t empty = 0;
+    SigTableSlot* slot = shard_find(shard, sig, hash, &empty);
+    *current = slot ? slot->head : NULL;
+    if (*current != head) {
+        pthread_mutex_unlock(&shard->lock);
         return NULL;
     }
 
-    new_entry->signature = sig;  // Takes ownership
-    new_entry->path = strdup(path);
-    new_entry->clone_id = clone_id;
-    new_entry->next = table->buckets[bucket_idx];
+    // a new signature may need room first, which moves the slots
+    if (!slot && (shard->used + 1) * 8 > shard->capacity * 7) {
+        if (!shard_grow(shard)) {
+            pthread_mutex_unlock(&shard->lock);
+            return NULL;
+        }
+        shard_find(shard, sig, hash, &empty);
+    }
+
+    SigTableEntry* entry = arena_alloc(shard->arena, sizeof(SigTableEntry) + name_size, alignof(SigTableEntry));
+    if (!entry) {
+        pthread_mutex_unlock(&shard->lock);
+        return NULL;
+    }
+    *entry = *prototype;
+    entry->depth = head ? head->depth + 1 : 0;
+    entry->next = head;
+    memcpy(entry->name, name, name_size);
 
-    table->buckets[bucket_idx] = new_entry;
-    table->entry_count++;
+    // without room for the content, or with content read too soon after
+    // the file changed, the entry is compared by reading it
+    SigTableContent* content = subject->content && !subject->racy
+        ? arena_alloc(shard->arena, sizeof(SigTableContent) + (size_t)subject->size, alignof(SigTableContent))
+        : NULL;
+    if (content) {
+        content->mtime = subject->mtime;
+        content->ctime = subject->ctime;
+        memcpy(content->bytes, subject->content, (size_t)subject->size);
+        entry->content = content;
+        entry->parent = subject->parent;
+    }
 
-    return NULL;
+    if (slot) {
+        slot->head = entry;
+    } else {
+        shard->control[empty] = hash_control(hash);
+        shard->slots[empty] = (SigTableSlot) { .signature = *sig, .head = entry };
+        shard->used++;
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return entry;
 }
 
-bool sig_table_has_clone_id(const SigTable* table, uint64_t clone_id) {
-    if (!table || clone_id == 0) {
-        return false;
+SigTableEntry* sig_table_insert(SigTable* table, FileSignature* sig, const char* path, DirHandle* dir,
+                                uint64_t clone_id, ino_t inode, const GroupVerdict* verdict, bool* inserted) {
+    if (inserted) {
+        *inserted = false;
+    }
+    if (!table || !sig || !path) {
+        return NULL;
     }
 
-    for (size_t i = 0; i < table->bucket_count; i++) {
-        SigTableEntry* entry = table->buckets[i];
-        while (entry) {
-            if (entry->clone_id == clone_id) {
-                return true;
+    uint64_t hash = slot_hash(sig);
+    SigTableShard* shard = &table->shards[hash_shard(hash)];
+
+    const char* slash = strrchr(path, '/');
+    size_t dir_len = slash ? (size_t)(slash - path) + 1 : 0;
+    size_t name_size = strlen(path + dir_len) + 1;
+    SigTableEntry prototype = {
+        .clone_id = clone_id,
+        .inode = inode,
+    };
+
+    // Claim the newest entry with this signature. Published entries never
+    // change, so the older ones can be walked without the lock.
+    SigTableEntry* head = shard_head(shard, sig, hash);
+    SigTableEntry* verified = NULL;
+    Subject subject = { .path = path, .dir = dir, .name = dir ? path + dir_len : path, .size = sig->size };
+    size_t content_size = 0;
+
+    for (;;) {
+        subject.escalate = subject.escalate || (head && head->depth + 1 >= SIG_TABLE_ESCALATE_DEPTH);
+        // Check for existing match among the entries with this signature.
+        // SMHasher-style discipline: a fast hash/signature only nominates candidates;
+        // witness stages may reject quickly, but exact comparison is still required
+        // before treating files as equal.
+        for (SigTableEntry* entry = head; entry != verified; entry = entry->next) {
+            if (candidate_matches(table, entry, &subject, verdict)) {
+                file_handle_release(table->handles, subject.handle);
+                return entry;
+            }
+        }
+
+        // interned up front so nothing but the allocation and the slot
+        // update happen under the lock
+        if (!prototype.dir) {
+            prototype.dir = string_pool_intern(table->dirs, path, dir_len);
+            if (!prototype.dir) {
+                file_handle_release(table->handles, subject.handle);
+                return NULL;
             }
-            entry = entry->next;
         }
+
+        // later files of the signature compare against the digest taken
+        // and the content read. The content is only kept if a compare
+        // opened the file, the first file of a signature, like every file
+        // replayed from a checkpoint, isn't read just to be stored.
+        atomic_store_explicit(&prototype.digest, subject.digest, memory_order_relaxed);
+        if (subject_content(table, &subject) && !subject.racy && !subject.parent) {
+            subject.parent = hold_parent(table, dir);
+        }
+
+        // Publish only if nobody added an entry while we were comparing,
+        // otherwise go back and verify just the entries that were added.
+        SigTableEntry* current = NULL;
+        SigTableEntry* published = shard_publish(shard, sig, hash, head, &prototype, path + dir_len, name_size,
+                                                 &subject, &current);
+        if (published) {
+            clone_index_add(table, published, sig->device);
+            content_size = published->content ? (size_t)sig->size : 0;
+            break;
+        }
+        if (current == head) {
+            // out of memory
+            file_handle_release(table->handles, subject.handle);
+            return NULL;
+        }
+
+        verified = head;
+        head = current;
+    }
+    file_handle_release(table->handles, subject.handle);
+
+    atomic_fetch_add_explicit(&table->entry_count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&table->bytes, SIG_TABLE_ENTRY_BYTES + name_size + content_size,
+                              memory_order_relaxed);
+    if (inserted) {
+        *inserted = true;
+    }
+
+    return NULL;
+}
+
+SigTableEntry* sig_table_find(SigTable* table, const FileSignature* sig, const char* path,
+                              const GroupVerdict* verdict) {
+    if (!table || !sig || !path) {
+        return NULL;
+    }
+
+    uint64_t hash = slot_hash(sig);
+    SigTableShard* shard = &table->shards[hash_shard(hash)];
+    SigTableEntry* entry = shard_head(shard, sig, hash);
+    Subject subject = {
+        .path = path,
+        .name = path,
+        .size = sig->size,
+        .escalate = entry && entry->depth + 1 >= SIG_TABLE_ESCALATE_DEPTH,
+    };
+    while (entry && !candidate_matches(table, entry, &subject, verdict)) {
+        entry = entry->next;
+    }
+    file_handle_release(table->handles, subject.handle);
+    return entry;
+}
+
+size_t sig_table_candidates(SigTable* table, const FileSignature* sig, const SigTableEntry** entries, size_t max) {
+    if (!table || !sig || !entries) {
+        return 0;
     }
 
-    return false;
+    size_t count = 0;
+    uint64_t hash = slot_hash(sig);
+    SigTableShard* shard = &table->shards[hash_shard(hash)];
+    for (SigTableEntry* entry = shard_head(shard, sig, hash); entry && count < max; entry = entry->next) {
+        entries[count++] = entry;
+    }
+    return count;
+}
+
+bool sig_table_entry_path(const SigTableEntry* entry, char* buf, size_t size) {
+    if (!entry || !buf) {
+        return false;
+    }
+
+    int n = snprintf(buf, size, "%s%s", entry->dir, entry->name);
+    return n >= 0 && (size_t)n < size;
+}
+
+const SigTableEntry* sig_table_find_clone_id(SigTable* table, dev_t device, uint64_t clone_id) {
+    if (!table || clone_id == 0) {
+        return NULL;
+    }
+
+    SigTableCloneKey key = { .device = device, .clone_id = clone_id };
+    uint64_t hash = clone_key_hash(key);
+    SigTableCloneShard* shard = clone_shard(table, hash);
+    stage_lock(&shard->lock, STAGE_TABLE_LOCK);
+    SigTableEntry* entry = shard->entries[clone_shard_find(shard, key, hash)];
+    pthread_mutex_unlock(&shard->lock);
+    return entry;
+}
+
+bool sig_table_has_clone_id(SigTable* table, dev_t device, uint64_t clone_id) {
+    return sig_table_find_clone_id(table, device, clone_id) != NULL;
 }
 
 size_t sig_table_size(const SigTable* table) {
-    return table ? table->entry_count : 0;
+    return table ? atomic_load_explicit(&table->entry_count, memory_order_relaxed) : 0;
 }
 
-size_t sig_table_collisions(const SigTable* table) {
+size_t sig_table_bytes(const SigTable* table) {
+    return table ? atomic_load_explicit(&table->bytes, memory_order_relaxed) : 0;
+}
+
+// Returns how many groups were probed to reach slot `index` of `shard`.
+static size_t probe_length(const SigTableShard* shard, size_t index) {
+    size_t group_mask = shard->capacity / SIG_TABLE_GROUP - 1;
+    size_t group = hash_group(slot_hash(&shard->slots[index].signature)) & group_mask;
+    size_t target = index / SIG_TABLE_GROUP;
+
+    size_t groups = 1;
+    for (size_t step = 1; group != target; step++, groups++) {
+        group = (group + step) & group_mask;
+    }
+    return groups;
+}
+
+size_t sig_table_collisions(SigTable* table, SigTableProbeStats* stats) {
+    if (stats) {
+        *stats = (SigTableProbeStats) {0};
+    }
     if (!table) {
         return 0;
     }
 
     size_t collisions = 0;
-    for (size_t i = 0; i < table->bucket_count; i++) {
-        size_t chain_len = 0;
-        SigTableEntry* entry = table->buckets[i];
-        while (entry) {
-            chain_len++;
-            entry = entry->next;
-        }
-        if (chain_len > 1) {
-            collisions += chain_len - 1;
+    for (size_t i = 0; i < SIG_TABLE_SHARD_COUNT; i++) {
+        SigTableShard* shard = &table->shards[i];
+        stage_lock(&shard->lock, STAGE_TABLE_LOCK);
+        for (size_t j = 0; j < shard->capacity; j++) {
+            if (shard->control[j] == SIG_TABLE_EMPTY) {
+                continue;
+            }
+
+            size_t groups = probe_length(shard, j);
+            if (groups > 1) {
+                collisions++;
+            }
+            if (stats) {
+                size_t bucket = groups < SIG_TABLE_PROBE_BUCKETS ? groups - 1 : SIG_TABLE_PROBE_BUCKETS - 1;
+                stats->groups[bucket]++;
+                if (groups > stats->max_groups) {
+                    stats->max_groups = groups;
+                }
+            }
         }
+        pthread_mutex_unlock(&shard->lock);
     }
 
     return collisions;
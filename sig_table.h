@@ -5,42 +5,171 @@
 #ifndef __DEDUP_SIG_TABLE_H__
 #define __DEDUP_SIG_TABLE_H__
 
+#include "arena.h"
+#include "dir_handle.h"
+#include "file_handle.h"
+#include "group_verify.h"
 #include "signature.h"
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stddef.h>
+#include <time.h>
 
-// Entry in the signature hash table
+// Content of a small file, kept with its entry.
+typedef struct SigTableContent {
+    struct timespec mtime;       // of the file when it was read
+    struct timespec ctime;
+    unsigned char bytes[];       // as many as the signature's size
+} SigTableContent;
+
+// Entry in the signature hash table. Entries are immutable once published,
+// but for the digest they cache, and are never removed while the table is
+// alive.
+//
+// Entries live in the table's arenas, and the directory part of their path
+// is interned, every file of a directory shares one copy of it. Use
+// `sig_table_entry_path` for the full path. Their signature is stored once
+// in the table's slot for it.
 typedef struct SigTableEntry {
-    FileSignature* signature;
-    char* path;
+    const char* dir;             // up to and including the last '/', may be ""
     uint64_t clone_id;
-    struct SigTableEntry* next;  // Collision chain
+    ino_t inode;
+    uint32_t depth;              // older entries with the same signature
+    _Atomic uint64_t digest;     // see progressive_witness_digest, 0 until taken
+    const SigTableContent* content; // for files up to the table's inline_max, or NULL
+    DirHandle* parent;           // held by the table for entries with content, or NULL
+    struct SigTableEntry* next;  // older entry with the same signature
+    char name[];                 // the rest of the path
 } SigTableEntry;
 
-// Signature-based hash table for fast duplicate detection
+typedef struct SigTableShard SigTableShard;
+typedef struct SigTableCloneShard SigTableCloneShard;
+typedef struct SigTableDirs SigTableDirs;
+
+// Signature-based hash table for fast duplicate detection.
+//
+// The table is split into shards by hash, each an open-addressing table
+// with its own lock. A shard keeps one slot per distinct signature, holding
+// the signature inline and the newest entry that has it, and a byte per
+// slot with 7 bits of the hash. Lookups compare the bytes of 16 slots at a
+// time and only look at the slots whose byte matches. Shards grow on their
+// own once 7/8 of their slots are used, so a resize only ever rehashes a
+// small part of the table and only stalls the threads that need that shard.
+//
+// A second, sharded index maps (device, clone id) to the first entry stored
+// with them, it is updated by every insert.
+//
+// Locks are only held long enough to probe a shard or publish an entry.
+// Candidate verification (witness and exact compares) happens outside of
+// any lock so a long comparison never blocks unrelated lookups.
 typedef struct SigTable {
-    SigTableEntry** buckets;
-    size_t bucket_count;
-    size_t entry_count;
+    SigTableShard* shards;
+    SigTableCloneShard* clone_shards;
+    StringPool* dirs;
+    SigTableDirs* parents;      // directories held for entries with content
+    atomic_size_t entry_count;
+    atomic_size_t bytes;        // estimated, see sig_table_bytes
+    FileHandleCache* handles;   // used to verify candidates, not owned
+    size_t inline_max;          // see sig_table_insert, set before the first insert
 } SigTable;
 
-// Create a new signature table
-SigTable* new_sig_table(size_t bucket_count);
+// Files up to this size keep their content by default, which is about what
+// quick_hash covers.
+#define SIG_TABLE_INLINE_DEFAULT 4096U
+#define SIG_TABLE_INLINE_LIMIT (64U * 1024U)
+
+// Entries a signature needs before its candidates are compared by digest.
+#define SIG_TABLE_ESCALATE_DEPTH 4
+
+// Number of signatures by how many groups of 16 slots were probed to find
+// them, the last bucket counts longer probes as well.
+#define SIG_TABLE_PROBE_BUCKETS 8
+typedef struct SigTableProbeStats {
+    size_t groups[SIG_TABLE_PROBE_BUCKETS];
+    size_t max_groups;
+} SigTableProbeStats;
+
+// Create a new signature table with room for about `capacity` signatures
+// before it grows. Candidates are read through `handles`, which may be NULL.
+SigTable* new_sig_table(size_t capacity, FileHandleCache* handles);
 
 // Free signature table
 void free_sig_table(SigTable* table);
 
-// Insert or find matching signature
+// Insert or find matching signature. Safe to call from multiple threads.
+//
+// The newest entry with the same signature is claimed under the shard lock,
+// candidates are verified with the lock released, and the new entry is only
+// published if no other thread added one with the same signature in the
+// meantime. Otherwise the newly added entries are verified as well and
+// publishing is retried.
+//
+// Candidates that are members of `verdict`, which may be NULL, are decided
+// by it without reading either file again.
+//
+// Files with fixed headers, like disk images or uncompressed images of the
+// same size, can share a signature without sharing their content, and each
+// one added has to be rejected by every entry before it. Once a signature
+// has SIG_TABLE_ESCALATE_DEPTH entries, candidates are first compared by
+// their witness digest instead, taken once per file and kept on the entry,
+// and only those with the same digest are read again.
+//
+// Files of at most `inline_max` bytes that were compared against a
+// candidate keep their content in their entry, so later small files are
+// compared with them in memory. A matching candidate only costs a stat, to
+// make sure it hasn't changed since it was added. The first file of a
+// signature is never read just to keep its content.
+//
+// A file read within a second of its last change may still change without
+// its times telling, like racy-git entries. Its content isn't kept, it is
+// compared by reading it like a larger file.
+//
+// `dir` is the open directory of `path`, which may be NULL. The file is
+// opened through it, and the table holds it for the entry if the content
+// is kept, so the stat goes through it as well. The table holds at most
+// half of dir_handle_limit directories, the entries of any others are
+// looked up by path.
+//
+// The table stores a copy of `sig`, the caller keeps ownership of it.
+//
 // Returns:
-//   - Pointer to existing entry if match found (caller still owns sig)
-//   - NULL if successfully inserted new entry (table owns sig)
-//   - NULL if insertion failed (caller still owns sig, check table size)
-SigTableEntry* sig_table_insert(SigTable* table, FileSignature* sig, const char* path, uint64_t clone_id);
+//   - Pointer to existing entry if match found
+//   - NULL with `*inserted` set if successfully inserted
+//   - NULL with `*inserted` cleared if insertion failed
+SigTableEntry* sig_table_insert(SigTable* table, FileSignature* sig, const char* path, DirHandle* dir,
+                                uint64_t clone_id, ino_t inode, const GroupVerdict* verdict, bool* inserted);
+
+// Verifies `path` against the entries with the same signature like
+// sig_table_insert, but never adds it. Returns the matching entry or NULL.
+SigTableEntry* sig_table_find(SigTable* table, const FileSignature* sig, const char* path,
+                              const GroupVerdict* verdict);
 
-// Check if clone_id already seen
-bool sig_table_has_clone_id(const SigTable* table, uint64_t clone_id);
+// Collects up to `max` entries whose signature matches `sig`, most recently
+// inserted first. The entries stay valid for the lifetime of the table.
+// Returns the number of entries stored in `entries`.
+size_t sig_table_candidates(SigTable* table, const FileSignature* sig, const SigTableEntry** entries, size_t max);
+
+// Writes the path of `entry` to `buf`. Returns false if it doesn't fit in
+// `size` bytes.
+bool sig_table_entry_path(const SigTableEntry* entry, char* buf, size_t size);
+
+// Returns the first entry stored with `clone_id` on `device`, or NULL. Clone
+// ids are only unique within a volume. A clone id of 0 is never found.
+const SigTableEntry* sig_table_find_clone_id(SigTable* table, dev_t device, uint64_t clone_id);
+
+// Check if clone_id was already seen on `device`
+bool sig_table_has_clone_id(SigTable* table, dev_t device, uint64_t clone_id);
 
 // Get statistics
 size_t sig_table_size(const SigTable* table);
-size_t sig_table_collisions(const SigTable* table);
+
+// Memory held by the entries, their share of the slots and of the clone id
+// index. An estimate, the slots grow in powers of 2 and directories are
+// shared between entries.
+size_t sig_table_bytes(const SigTable* table);
+
+// Returns the number of signatures stored outside of their home group and,
+// if `stats` isn't NULL, fills in the distribution of probe lengths.
+size_t sig_table_collisions(SigTable* table, SigTableProbeStats* stats);
 
 #endif // __DEDUP_SIG_TABLE_H__
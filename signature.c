@@ -7,11 +7,15 @@
 #include <sys/stat.h>
 #include <sys/uio.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "exact_kernels.h"
 #include "runtime_dispatch.h"
+#include "scratch.h"
 
 #ifdef __ARM_NEON
 #include <arm_neon.h>
@@ -87,6 +91,21 @@ uint64_t signature_fast_hash_bytes(const void* data, size_t len) {
     return h64;
 }
 
+// Files up to this size are read with a single request
+#define SIGNATURE_SINGLE_READ_MAX (64U * 1024U)
+
+static bool read_full(int fd, void* buf, size_t len, off_t offset) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pread(fd, (unsigned char*)buf + done, len - done, offset + (off_t)done);
+        if (n <= 0) {
+            return false;
+        }
+        done += (size_t)n;
+    }
+    return true;
+}
+
 static bool read_sample_into(int fd, off_t position, uint64_t size, int32_t* out) {
     unsigned char raw[sizeof(int32_t)] = {0};
     size_t remaining = 0;
@@ -106,7 +125,11 @@ static bool read_sample_into(int fd, off_t position, uint64_t size, int32_t* out
     return true;
 }
 
-FileSignature* compute_signature(const char* path, dev_t device, uint64_t size) {
+FileSignature* compute_signature_handle(const FileHandle* handle, dev_t device, uint64_t size) {
+    if (!handle) {
+        return NULL;
+    }
+
     FileSignature* sig = calloc(1, sizeof(FileSignature));
     if (!sig) {
         return NULL;
@@ -115,21 +138,9 @@ FileSignature* compute_signature(const char* path, dev_t device, uint64_t size)
     sig->device = device;
     sig->size = size;
 
-    int fd = open(path, O_RDONLY | O_NONBLOCK);
-    if (fd < 0) {
-        free(sig);
-        return NULL;
-    }
-
-    // Clear O_NONBLOCK for actual I/O operations
-    int flags = fcntl(fd, F_GETFL);
-    if (flags >= 0) {
-        fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
-    }
-
+    int fd = handle->fd;
     if (size == 0) {
         sig->quick_hash = signature_fast_hash_bytes("", 0);
-        close(fd);
         return sig;
     }
 
@@ -141,56 +152,56 @@ FileSignature* compute_signature(const char* path, dev_t device, uint64_t size)
         (off_t)(size > 4 ? size - 4 : 0) // End (or start if file < 4 bytes)
     };
 
-#ifdef __ARM_NEON
-    if (size >= 16) {
-        char buf[16] __attribute__((aligned(16)));
-        for (int i = 0; i < 4; i++) {
-            if (pread(fd, &buf[i * 4], 4, positions[i]) != 4) {
-                close(fd);
-                free(sig);
-                return NULL;
-            }
-        }
-        int32x4_t samples_vec = vld1q_s32((int32_t*)buf);
-        vst1q_s32(sig->samples, samples_vec);
-    } else
-#endif
-    {
-        for (int i = 0; i < 4; i++) {
-            if (!read_sample_into(fd, positions[i], size, &sig->samples[i])) {
-                close(fd);
-                free(sig);
-                return NULL;
-            }
+    // Small files are read in one request that covers every sample, larger
+    // ones read the hashed header and the samples it doesn't cover.
+    size_t hash_size = size < 4096 ? (size_t)size : 4096U;
+    size_t read_size = size <= SIGNATURE_SINGLE_READ_MAX ? (size_t)size : hash_size;
+
+    // get the distant samples in flight before blocking on the header
+    for (int i = 1; i < 4; i++) {
+        if ((uint64_t)positions[i] + sizeof(int32_t) > read_size) {
+            file_handle_advise(handle, positions[i], sizeof(int32_t));
         }
     }
 
-    size_t hash_size = size < 4096 ? (size_t)size : 4096U;
-    char* buf = malloc(hash_size);
+    unsigned char* buf = thread_scratch(SCRATCH_SIGNATURE, read_size);
     if (!buf) {
-        close(fd);
         free(sig);
         return NULL;
     }
 
-    ssize_t n = pread(fd, buf, hash_size, 0);
-    if (n < 0 || (size_t)n != hash_size) {
-        free(buf);
-        close(fd);
+    if (!read_full(fd, buf, read_size, 0)) {
         free(sig);
         return NULL;
     }
 
+    for (int i = 0; i < 4; i++) {
+        size_t remaining = (size_t)(size - (uint64_t)positions[i]);
+        size_t to_read = remaining < sizeof(int32_t) ? remaining : sizeof(int32_t);
+        if ((size_t)positions[i] + to_read <= read_size) {
+            unsigned char raw[sizeof(int32_t)] = {0};
+            memcpy(raw, buf + positions[i], to_read);
+            memcpy(&sig->samples[i], raw, sizeof(raw));
+        } else if (!read_sample_into(fd, positions[i], size, &sig->samples[i])) {
+            free(sig);
+            return NULL;
+        }
+    }
+
     dedup_fast_hash_fn hash_fn = signature_fast_hash_bytes;
     const DedupRuntimeDispatch* dispatch = dedup_runtime_dispatch_get();
     if (dispatch && dispatch->fast_hash) {
         hash_fn = dispatch->fast_hash;
     }
-    sig->quick_hash = hash_fn(buf, (size_t)n);
+    sig->quick_hash = hash_fn(buf, hash_size);
 
-    free(buf);
-    close(fd);
+    return sig;
+}
 
+FileSignature* compute_signature(const char* path, dev_t device, uint64_t size) {
+    FileHandle* handle = file_handle_open(path);
+    FileSignature* sig = compute_signature_handle(handle, device, size);
+    file_handle_close(handle);
     return sig;
 }
 
@@ -218,105 +229,186 @@ bool signatures_match(const FileSignature* a, const FileSignature* b) {
 #endif
 }
 
-static bool files_match_exact_impl(const char* a_path, const char* b_path, size_t chunk_size, bool use_xor_or) {
-    if (!a_path || !b_path || chunk_size == 0) {
+// Compares [offset, end) of both files. Gives up early once `differ` is set
+// by a compare of another range of the same files.
+static bool match_exact_range(const FileHandle* a, const FileHandle* b, off_t offset, off_t end,
+                              size_t chunk_size, exact_kernel_fn kernel, atomic_bool* differ) {
+    unsigned char* a_buf = thread_scratch(SCRATCH_COMPARE_A, chunk_size);
+    unsigned char* b_buf = thread_scratch(SCRATCH_COMPARE_B, chunk_size);
+    if (!a_buf || !b_buf) {
         return false;
     }
 
-    int a_fd = open(a_path, O_RDONLY);
-    if (a_fd < 0) {
+    while (offset < end) {
+        if (differ && atomic_load_explicit(differ, memory_order_relaxed)) {
+            return false;
+        }
+
+        size_t remaining = (size_t)(end - offset);
+        size_t to_read = remaining < chunk_size ? remaining : chunk_size;
+        ssize_t a_read = pread(a->fd, a_buf, to_read, offset);
+        ssize_t b_read = pread(b->fd, b_buf, to_read, offset);
+        if (a_read < 0 || b_read < 0 || a_read != b_read || (size_t)a_read != to_read) {
+            return false;
+        }
+
+        if (!kernel(a_buf, b_buf, to_read)) {
+            return false;
+        }
+
+        offset += a_read;
+    }
+
+    return true;
+}
+
+static bool handles_match_exact_impl(const FileHandle* a, const FileHandle* b, size_t chunk_size,
+                                     exact_kernel_fn kernel) {
+    if (!a || !b || chunk_size == 0) {
         return false;
     }
 
-    int b_fd = open(b_path, O_RDONLY);
-    if (b_fd < 0) {
-        close(a_fd);
+    if (a->stat.st_size != b->stat.st_size) {
         return false;
     }
 
-    struct stat a_st = {0};
-    struct stat b_st = {0};
-    bool equal = false;
+#ifdef POSIX_FADV_SEQUENTIAL
+    (void)posix_fadvise(a->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    (void)posix_fadvise(b->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    return match_exact_range(a, b, 0, a->stat.st_size, chunk_size, kernel, NULL);
+}
+
+bool handles_match_exact_memcmp(const FileHandle* a, const FileHandle* b) {
+    return handles_match_exact_impl(a, b, 64U * 1024U, exact_kernel_memcmp);
+}
+
+bool handles_match_exact_xor_or(const FileHandle* a, const FileHandle* b) {
+    return handles_match_exact_impl(a, b, 64U * 1024U, exact_kernel_xor_or);
+}
+
+bool handles_match_exact_cpu_tiles(const FileHandle* a, const FileHandle* b) {
+    return handles_match_exact_impl(a, b, 1024U * 1024U, exact_kernel_xor_or);
+}
+
+bool handles_match_exact_neon_unrolled(const FileHandle* a, const FileHandle* b) {
+    return handles_match_exact_impl(a, b, 1024U * 1024U, exact_kernel_neon_unrolled);
+}
+
+bool handles_match_exact_avx2_unrolled(const FileHandle* a, const FileHandle* b) {
+    return handles_match_exact_impl(a, b, 1024U * 1024U, exact_kernel_avx2_unrolled);
+}
+
+// The read size and kernel behind each of the handles_match_exact_ variants.
+static bool exact_variant(bool (*match)(const FileHandle*, const FileHandle*), size_t* chunk_size,
+                          exact_kernel_fn* kernel) {
+    static const struct {
+        bool (*match)(const FileHandle*, const FileHandle*);
+        size_t chunk_size;
+        exact_kernel_fn kernel;
+    } variants[] = {
+        { handles_match_exact_memcmp, 64U * 1024U, exact_kernel_memcmp },
+        { handles_match_exact_xor_or, 64U * 1024U, exact_kernel_xor_or },
+        { handles_match_exact_cpu_tiles, 1024U * 1024U, exact_kernel_xor_or },
+        { handles_match_exact_neon_unrolled, 1024U * 1024U, exact_kernel_neon_unrolled },
+        { handles_match_exact_avx2_unrolled, 1024U * 1024U, exact_kernel_avx2_unrolled },
+    };
 
-    if (fstat(a_fd, &a_st) != 0 || fstat(b_fd, &b_st) != 0) {
-        goto cleanup;
+    for (size_t i = 0; i < sizeof(variants) / sizeof(variants[0]); i++) {
+        if (variants[i].match == match) {
+            *chunk_size = variants[i].chunk_size;
+            *kernel = variants[i].kernel;
+            return true;
+        }
     }
+    return false;
+}
 
-    if (a_st.st_size != b_st.st_size) {
-        goto cleanup;
+typedef struct ExactSplit {
+    const FileHandle* a;
+    const FileHandle* b;
+    off_t offset;
+    off_t end;
+    size_t chunk_size;
+    exact_kernel_fn kernel;
+    atomic_bool* differ;
+} ExactSplit;
+
+static void* match_exact_split_work(void* arg) {
+    ExactSplit* split = arg;
+    if (!match_exact_range(split->a, split->b, split->offset, split->end, split->chunk_size, split->kernel,
+                           split->differ)) {
+        atomic_store_explicit(split->differ, true, memory_order_relaxed);
     }
+    return NULL;
+}
 
-#ifdef POSIX_FADV_SEQUENTIAL
-    (void)posix_fadvise(a_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
-    (void)posix_fadvise(b_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
-#endif
+bool handles_match_exact_split(const FileHandle* a, const FileHandle* b, size_t parts,
+                               bool (*match)(const FileHandle*, const FileHandle*)) {
+    size_t chunk_size = 0;
+    exact_kernel_fn kernel = NULL;
+    if (parts < 2 || parts > EXACT_SPLIT_MAX_PARTS || !exact_variant(match, &chunk_size, &kernel)) {
+        return match(a, b);
+    }
 
-    unsigned char* a_buf = malloc(chunk_size);
-    unsigned char* b_buf = malloc(chunk_size);
-    if (!a_buf || !b_buf) {
-        free(a_buf);
-        free(b_buf);
-        goto cleanup;
+    if (!a || !b || a->stat.st_size != b->stat.st_size) {
+        return false;
     }
 
-    off_t offset = 0;
-    equal = true;
-    while (offset < a_st.st_size) {
-        size_t remaining = (size_t)(a_st.st_size - offset);
-        size_t to_read = remaining < chunk_size ? remaining : chunk_size;
-        ssize_t a_read = pread(a_fd, a_buf, to_read, offset);
-        ssize_t b_read = pread(b_fd, b_buf, to_read, offset);
-        if (a_read < 0 || b_read < 0 || a_read != b_read || (size_t)a_read != to_read) {
-            equal = false;
-            break;
+    // whole chunks per range, so the ranges read what a single compare would
+    off_t size = a->stat.st_size;
+    off_t chunks = (size + (off_t)chunk_size - 1) / (off_t)chunk_size;
+    off_t part_size = (chunks + (off_t)parts - 1) / (off_t)parts * (off_t)chunk_size;
+
+    atomic_bool differ = false;
+    ExactSplit splits[EXACT_SPLIT_MAX_PARTS];
+    pthread_t threads[EXACT_SPLIT_MAX_PARTS];
+    bool started[EXACT_SPLIT_MAX_PARTS] = { false };
+    for (size_t i = 0; i < parts; i++) {
+        off_t offset = (off_t)i * part_size;
+        off_t end = offset + part_size;
+        splits[i] = (ExactSplit) {
+            .a = a,
+            .b = b,
+            .offset = offset < size ? offset : size,
+            .end = end < size ? end : size,
+            .chunk_size = chunk_size,
+            .kernel = kernel,
+            .differ = &differ,
+        };
+        // the calling thread takes the first range
+        if (i > 0) {
+            started[i] = pthread_create(&threads[i], NULL, match_exact_split_work, &splits[i]) == 0;
         }
+    }
 
-        if (use_xor_or) {
-#ifdef __ARM_NEON
-            uint8x16_t diff_acc = vdupq_n_u8(0);
-            size_t i = 0;
-            for (; i + 16 <= to_read; i += 16) {
-                uint8x16_t va = vld1q_u8(a_buf + i);
-                uint8x16_t vb = vld1q_u8(b_buf + i);
-                diff_acc = vorrq_u8(diff_acc, veorq_u8(va, vb));
-            }
-            if (vmaxvq_u8(diff_acc) != 0) {
-                equal = false;
-                break;
-            }
-            for (; i < to_read; i++) {
-                if ((unsigned char)(a_buf[i] ^ b_buf[i]) != 0) {
-                    equal = false;
-                    break;
-                }
-            }
-            if (!equal) {
-                break;
-            }
-#else
-            unsigned char diff = 0;
-            for (size_t i = 0; i < to_read; i++) {
-                diff |= (unsigned char)(a_buf[i] ^ b_buf[i]);
-            }
-            if (diff != 0) {
-                equal = false;
-                break;
-            }
-#endif
-        } else if (memcmp(a_buf, b_buf, to_read) != 0) {
-            equal = false;
-            break;
+    // ranges that didn't get a thread are compared here
+    for (size_t i = 0; i < parts; i++) {
+        if (!started[i]) {
+            match_exact_split_work(&splits[i]);
+        }
+    }
+    for (size_t i = 1; i < parts; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
         }
-
-        offset += a_read;
     }
 
-    free(a_buf);
-    free(b_buf);
+    return !atomic_load(&differ);
+}
+
+static bool files_match_exact_impl(const char* a_path, const char* b_path,
+                                   bool (*match)(const FileHandle*, const FileHandle*)) {
+    if (!a_path || !b_path) {
+        return false;
+    }
 
-cleanup:
-    close(a_fd);
-    close(b_fd);
+    FileHandle* a = file_handle_open(a_path);
+    FileHandle* b = a ? file_handle_open(b_path) : NULL;
+    bool equal = b && match(a, b);
+    file_handle_close(a);
+    file_handle_close(b);
     return equal;
 }
 
@@ -325,15 +417,23 @@ bool files_match_exact(const char* a_path, const char* b_path) {
 }
 
 bool files_match_exact_memcmp(const char* a_path, const char* b_path) {
-    return files_match_exact_impl(a_path, b_path, 64U * 1024U, false);
+    return files_match_exact_impl(a_path, b_path, handles_match_exact_memcmp);
 }
 
 bool files_match_exact_xor_or(const char* a_path, const char* b_path) {
-    return files_match_exact_impl(a_path, b_path, 64U * 1024U, true);
+    return files_match_exact_impl(a_path, b_path, handles_match_exact_xor_or);
 }
 
 bool files_match_exact_cpu_tiles(const char* a_path, const char* b_path) {
-    return files_match_exact_impl(a_path, b_path, 1024U * 1024U, true);
+    return files_match_exact_impl(a_path, b_path, handles_match_exact_cpu_tiles);
+}
+
+bool files_match_exact_neon_unrolled(const char* a_path, const char* b_path) {
+    return files_match_exact_impl(a_path, b_path, handles_match_exact_neon_unrolled);
+}
+
+bool files_match_exact_avx2_unrolled(const char* a_path, const char* b_path) {
+    return files_match_exact_impl(a_path, b_path, handles_match_exact_avx2_unrolled);
 }
 
 uint64_t hash_signature(const FileSignature* sig) {
@@ -10,6 +10,8 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "file_handle.h"
+
 // Lightweight file signature using strategic sampling
 // Used as a fast candidate filter before exact byte-for-byte verification.
 typedef struct FileSignature {
@@ -23,6 +25,9 @@ typedef struct FileSignature {
 // Returns NULL on error
 FileSignature* compute_signature(const char* path, dev_t device, uint64_t size);
 
+// Compute signature reading through an open handle
+FileSignature* compute_signature_handle(const FileHandle* handle, dev_t device, uint64_t size);
+
 // Free signature
 void free_signature(FileSignature* sig);
 
@@ -43,6 +48,29 @@ bool files_match_exact_xor_or(const char* a_path, const char* b_path);
 // large Apple SoC files.
 bool files_match_exact_cpu_tiles(const char* a_path, const char* b_path);
 
+// Compare full file contents using the 128 byte unrolled NEON or AVX2
+// kernels. Only valid where `exact_kernel_*_supported` returns true.
+bool files_match_exact_neon_unrolled(const char* a_path, const char* b_path);
+bool files_match_exact_avx2_unrolled(const char* a_path, const char* b_path);
+
+// Variants of the exact compares above that read through open handles.
+// Files of different sizes never match.
+bool handles_match_exact_memcmp(const FileHandle* a, const FileHandle* b);
+bool handles_match_exact_xor_or(const FileHandle* a, const FileHandle* b);
+bool handles_match_exact_cpu_tiles(const FileHandle* a, const FileHandle* b);
+bool handles_match_exact_neon_unrolled(const FileHandle* a, const FileHandle* b);
+bool handles_match_exact_avx2_unrolled(const FileHandle* a, const FileHandle* b);
+
+#define EXACT_SPLIT_MAX_PARTS 8
+
+// Compares a very large pair as `parts` consecutive ranges side by side, the
+// calling thread takes the first and a thread is started for each of the
+// others. `match` is one of the handles_match_exact_ variants above, its
+// kernel and read size are used for every range, and every range stops once
+// one of them finds a difference. Any other `match` is called as is.
+bool handles_match_exact_split(const FileHandle* a, const FileHandle* b, size_t parts,
+                               bool (*match)(const FileHandle*, const FileHandle*));
+
 // Public fast-hash backend used by runtime dispatch.
 uint64_t signature_fast_hash_bytes(const void* data, size_t len);
 
@@ -0,0 +1,167 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include "size_gate.h"
+
+#include <stdlib.h>
+
+typedef struct SizeSlot {
+    dev_t device;
+    uint64_t size;
+    FileEntry* held;         // NULL once the group has a second file
+    bool used;
+} SizeSlot;
+
+struct SizeGate {
+    SizeSlot* slots;
+    size_t capacity;         // always a power of 2
+    size_t count;
+    size_t drain_cursor;
+};
+
+static inline uint64_t size_hash(dev_t device, uint64_t size) {
+    uint64_t h = size * 0x9E3779B97F4A7C15ULL;
+    h ^= (uint64_t)device + 0x7F4A7C159E3779B9ULL + (h << 6) + (h >> 2);
+    return h ^ (h >> 31);
+}
+
+SizeGate* new_size_gate(void) {
+    SizeGate* gate = calloc(1, sizeof(SizeGate));
+    if (!gate) {
+        return NULL;
+    }
+
+    gate->capacity = 4096;
+    gate->slots = calloc(gate->capacity, sizeof(SizeSlot));
+    if (!gate->slots) {
+        free(gate);
+        return NULL;
+    }
+
+    return gate;
+}
+
+void free_size_gate(SizeGate* gate) {
+    if (!gate) {
+        return;
+    }
+
+    for (size_t i = 0; i < gate->capacity; i++) {
+        if (gate->slots[i].held) {
+            file_entry_free(gate->slots[i].held);
+        }
+    }
+    free(gate->slots);
+    free(gate);
+}
+
+static bool gate_grow(SizeGate* gate) {
+    size_t new_cap = gate->capacity * 2;
+    SizeSlot* slots = calloc(new_cap, sizeof(SizeSlot));
+    if (!slots) {
+        return false;
+    }
+
+    size_t mask = new_cap - 1;
+    for (size_t i = 0; i < gate->capacity; i++) {
+        SizeSlot* s = &gate->slots[i];
+        if (!s->used) {
+            continue;
+        }
+        size_t idx = (size_t)size_hash(s->device, s->size) & mask;
+        while (slots[idx].used) {
+            idx = (idx + 1) & mask;
+        }
+        slots[idx] = *s;
+    }
+
+    free(gate->slots);
+    gate->slots = slots;
+    gate->capacity = new_cap;
+    return true;
+}
+
+size_t size_gate_offer(SizeGate* gate, FileEntry* fe, FileEntry* out[2]) {
+    if (!gate) {
+        out[0] = fe;
+        return 1;
+    }
+
+    if ((gate->count + 1) * 4 >= gate->capacity * 3 && !gate_grow(gate)) {
+        // a full table still finds existing groups, but a new one could
+        // never be released again
+        if (gate->count + 1 >= gate->capacity) {
+            out[0] = fe;
+            return 1;
+        }
+    }
+
+    size_t mask = gate->capacity - 1;
+    size_t idx = (size_t)size_hash(fe->device, fe->size) & mask;
+    for (; gate->slots[idx].used; idx = (idx + 1) & mask) {
+        SizeSlot* s = &gate->slots[idx];
+        if (s->device != fe->device || s->size != fe->size) {
+            continue;
+        }
+        if (!s->held) {
+            out[0] = fe;
+            return 1;
+        }
+        out[0] = s->held;
+        out[1] = fe;
+        s->held = NULL;
+        return 2;
+    }
+
+    gate->slots[idx] = (SizeSlot) {
+        .device = fe->device,
+        .size = fe->size,
+        .held = fe,
+        .used = true,
+    };
+    gate->count++;
+    return 0;
+}
+
+void size_gate_open(SizeGate* gate, dev_t device, uint64_t size) {
+    if (!gate) {
+        return;
+    }
+    if ((gate->count + 1) * 4 >= gate->capacity * 3 && !gate_grow(gate) && gate->count + 1 >= gate->capacity) {
+        return;
+    }
+
+    size_t mask = gate->capacity - 1;
+    size_t idx = (size_t)size_hash(device, size) & mask;
+    for (; gate->slots[idx].used; idx = (idx + 1) & mask) {
+        SizeSlot* s = &gate->slots[idx];
+        if (s->device == device && s->size == size) {
+            return;
+        }
+    }
+
+    gate->slots[idx] = (SizeSlot) {
+        .device = device,
+        .size = size,
+        .used = true,
+    };
+    gate->count++;
+}
+
+FileEntry* size_gate_drain(SizeGate* gate) {
+    if (!gate) {
+        return NULL;
+    }
+
+    for (; gate->drain_cursor < gate->capacity; gate->drain_cursor++) {
+        SizeSlot* s = &gate->slots[gate->drain_cursor];
+        if (s->held) {
+            FileEntry* fe = s->held;
+            s->held = NULL;
+            return fe;
+        }
+    }
+
+    return NULL;
+}
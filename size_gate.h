@@ -0,0 +1,48 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#ifndef __DEDUP_SIZE_GATE_H__
+#define __DEDUP_SIZE_GATE_H__
+
+#include <stddef.h>
+
+#include "queue.h"
+
+/// Size Gate
+///
+/// A file can only have a duplicate if another file on the same device has
+/// the same size, so there is no point in opening it before such a file shows
+/// up. The gate holds the first file of every (device, size) group without
+/// doing any I/O and releases it together with the second one. Every later
+/// file of the group passes straight through. Whatever is still held once the
+/// traversal is done has a unique size and never needs to be read.
+///
+/// The gate isn't synchronized, callers serialize access to it. dedup's
+/// pruners offer under `size_gate_mutex`, the last pruner out drains it alone
+/// once the others are done, and without threads the traversal offers and
+/// drains inline. Resuming opens groups before any pruner starts. libdedup
+/// offers under the scan's `mutex`.
+typedef struct SizeGate SizeGate;
+
+SizeGate* new_size_gate(void);
+
+/// Frees the gate along with any entries it still holds.
+void free_size_gate(SizeGate* gate);
+
+/// Offers `fe` to the gate, which takes ownership of it. Entries that may be
+/// visited now are written to `out` in traversal order and their number is
+/// returned. If the gate cannot track the group it lets `fe` through.
+size_t size_gate_offer(SizeGate* gate, FileEntry* fe, FileEntry* out[2]);
+
+/// Lets every file of the (device, size) group straight through, as if
+/// two of them had been offered already. Used for groups with a file
+/// resumed from a checkpoint, which is never offered again. A group that
+/// is holding a file keeps it, it is released by the next one.
+void size_gate_open(SizeGate* gate, dev_t device, uint64_t size);
+
+/// Removes and returns one of the entries still held, NULL once none are
+/// left.
+FileEntry* size_gate_drain(SizeGate* gate);
+
+#endif // __DEDUP_SIZE_GATE_H__
@@ -0,0 +1,414 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include "spill.h"
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Runs merged at once. Each keeps a stdio buffer and a path, more runs than
+// this are first merged into fewer, longer ones.
+#define SPILL_MERGE_FANIN 64
+
+// Smallest buffer accepted, leaves room for a record with the longest path.
+#define SPILL_RUN_MIN (64U * 1024U)
+
+// How a record is kept in the buffer and in the runs, followed by the
+// `path_len` bytes of its path. The runs are only ever read back by the
+// process that wrote them, so the layout doesn't need to be portable.
+typedef struct SpillHeader {
+    FileSignature signature;
+    uint64_t sequence;
+    uint64_t clone_id;
+    uint64_t inode;
+    uint32_t nlink;
+    uint32_t flags;
+    uint32_t path_len;
+    uint32_t reserved;
+} SpillHeader;
+
+struct SpillSet {
+    pthread_mutex_t mutex;      // guards everything but count
+    char* dir;
+    unsigned char* buffer;      // records of the run being gathered
+    size_t run_bytes;           // buffer and index together
+    size_t used;
+    SpillHeader** index;        // records of the buffer, sorted on flush
+    size_t index_count;
+    size_t index_capacity;
+    FILE** runs;
+    size_t run_count;
+    size_t run_capacity;
+    atomic_size_t count;
+    bool failed;                // a run couldn't be written, nothing is added from then on
+};
+
+static int compare_signatures(const FileSignature* a, const FileSignature* b) {
+    if (a->device != b->device) {
+        return a->device < b->device ? -1 : 1;
+    }
+    if (a->size != b->size) {
+        return a->size < b->size ? -1 : 1;
+    }
+    if (a->quick_hash != b->quick_hash) {
+        return a->quick_hash < b->quick_hash ? -1 : 1;
+    }
+    for (size_t i = 0; i < sizeof(a->samples) / sizeof(a->samples[0]); i++) {
+        if (a->samples[i] != b->samples[i]) {
+            return a->samples[i] < b->samples[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+static int compare_headers(const SpillHeader* a, const SpillHeader* b) {
+    int order = compare_signatures(&a->signature, &b->signature);
+    if (order != 0) {
+        return order;
+    }
+    return a->sequence < b->sequence ? -1 : a->sequence > b->sequence;
+}
+
+static int compare_index(const void* a, const void* b) {
+    return compare_headers(*(SpillHeader* const*)a, *(SpillHeader* const*)b);
+}
+
+static size_t record_size(size_t path_len) {
+    return (sizeof(SpillHeader) + path_len + 7) & ~(size_t)7;
+}
+
+SpillSet* new_spill_set(const char* dir, size_t run_bytes) {
+    SpillSet* set = calloc(1, sizeof(SpillSet));
+    if (!set) {
+        return NULL;
+    }
+
+    set->run_bytes = run_bytes < SPILL_RUN_MIN ? SPILL_RUN_MIN : run_bytes;
+    set->dir = strdup(dir ? dir : "/tmp");
+    set->buffer = malloc(set->run_bytes);
+    if (!set->dir || !set->buffer) {
+        free(set->dir);
+        free(set->buffer);
+        free(set);
+        return NULL;
+    }
+    pthread_mutex_init(&set->mutex, NULL);
+    atomic_init(&set->count, 0);
+    return set;
+}
+
+void free_spill_set(SpillSet* set) {
+    if (!set) {
+        return;
+    }
+
+    for (size_t i = 0; i < set->run_count; i++) {
+        fclose(set->runs[i]);
+    }
+    free(set->runs);
+    free(set->index);
+    free(set->buffer);
+    free(set->dir);
+    pthread_mutex_destroy(&set->mutex);
+    free(set);
+}
+
+// Creates an empty run that is already unlinked.
+static FILE* open_run(const SpillSet* set) {
+    char path[PATH_MAX];
+    int n = snprintf(path, sizeof(path), "%s/dedup-spill.XXXXXX", set->dir);
+    if (n < 0 || (size_t)n >= sizeof(path)) {
+        return NULL;
+    }
+
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        return NULL;
+    }
+    unlink(path);
+    FILE* run = fdopen(fd, "w+");
+    if (!run) {
+        close(fd);
+    }
+    return run;
+}
+
+static bool write_record(FILE* run, const SpillHeader* header, const char* path) {
+    return fwrite(header, sizeof(*header), 1, run) == 1 &&
+           fwrite(path, 1, header->path_len, run) == header->path_len;
+}
+
+static bool add_run(SpillSet* set, FILE* run) {
+    if (set->run_count == set->run_capacity) {
+        size_t capacity = set->run_capacity ? set->run_capacity * 2 : 16;
+        FILE** runs = realloc(set->runs, capacity * sizeof(FILE*));
+        if (!runs) {
+            return false;
+        }
+        set->runs = runs;
+        set->run_capacity = capacity;
+    }
+    set->runs[set->run_count++] = run;
+    return true;
+}
+
+// Writes the buffer out as a run. Callers hold the mutex.
+static bool flush_buffer(SpillSet* set) {
+    if (set->index_count == 0) {
+        return true;
+    }
+
+    qsort(set->index, set->index_count, sizeof(SpillHeader*), compare_index);
+    FILE* run = open_run(set);
+    bool ok = run != NULL;
+    for (size_t i = 0; ok && i < set->index_count; i++) {
+        const SpillHeader* header = set->index[i];
+        ok = write_record(run, header, (const char*)(header + 1));
+    }
+    ok = ok && fflush(run) == 0 && add_run(set, run);
+    if (!ok && run) {
+        fclose(run);
+    }
+
+    set->used = 0;
+    set->index_count = 0;
+    return ok;
+}
+
+bool spill_set_add(SpillSet* set, const SpillRecord* record) {
+    if (!set || !record || !record->path) {
+        return false;
+    }
+    size_t path_len = strlen(record->path);
+    if (path_len >= PATH_MAX) {
+        return false;
+    }
+    size_t size = record_size(path_len);
+
+    pthread_mutex_lock(&set->mutex);
+    if (!set->failed &&
+        set->used + size + (set->index_count + 1) * sizeof(SpillHeader*) > set->run_bytes) {
+        set->failed = !flush_buffer(set);
+    }
+    if (!set->failed && set->index_count == set->index_capacity) {
+        size_t capacity = set->index_capacity ? set->index_capacity * 2 : 1024;
+        SpillHeader** index = realloc(set->index, capacity * sizeof(SpillHeader*));
+        if (index) {
+            set->index = index;
+            set->index_capacity = capacity;
+        } else {
+            set->failed = true;
+        }
+    }
+    if (set->failed) {
+        pthread_mutex_unlock(&set->mutex);
+        return false;
+    }
+
+    SpillHeader* header = (SpillHeader*)(set->buffer + set->used);
+    *header = (SpillHeader) {
+        .signature = record->signature,
+        .sequence = record->sequence,
+        .clone_id = record->clone_id,
+        .inode = record->inode,
+        .nlink = record->nlink,
+        .flags = record->flags,
+        .path_len = (uint32_t)path_len,
+    };
+    memcpy(header + 1, record->path, path_len);
+    set->index[set->index_count++] = header;
+    set->used += size;
+    pthread_mutex_unlock(&set->mutex);
+
+    atomic_fetch_add_explicit(&set->count, 1, memory_order_relaxed);
+    return true;
+}
+
+size_t spill_set_count(const SpillSet* set) {
+    return set ? atomic_load_explicit(&set->count, memory_order_relaxed) : 0;
+}
+
+typedef struct RunReader {
+    FILE* run;
+    SpillHeader header;
+    char path[PATH_MAX];
+} RunReader;
+
+// Returns 1 with the next record read, 0 at the end of the run and -1 if
+// the run can't be read.
+static int read_next(RunReader* reader) {
+    size_t n = fread(&reader->header, sizeof(reader->header), 1, reader->run);
+    if (n != 1) {
+        return feof(reader->run) && !ferror(reader->run) ? 0 : -1;
+    }
+    size_t len = reader->header.path_len;
+    if (len >= sizeof(reader->path) || fread(reader->path, 1, len, reader->run) != len) {
+        return -1;
+    }
+    reader->path[len] = '\0';
+    return 1;
+}
+
+static void sift_down(RunReader** heap, size_t count, size_t i) {
+    for (;;) {
+        size_t smallest = i;
+        size_t left = 2 * i + 1;
+        size_t right = left + 1;
+        if (left < count && compare_headers(&heap[left]->header, &heap[smallest]->header) < 0) {
+            smallest = left;
+        }
+        if (right < count && compare_headers(&heap[right]->header, &heap[smallest]->header) < 0) {
+            smallest = right;
+        }
+        if (smallest == i) {
+            return;
+        }
+        RunReader* swap = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = swap;
+        i = smallest;
+    }
+}
+
+typedef bool (*MergeSink)(const RunReader* reader, void* context);
+
+// Hands the records of `runs` to `sink` in order.
+static bool merge_runs(FILE** runs, size_t count, MergeSink sink, void* context) {
+    if (count == 0) {
+        return true;
+    }
+
+    RunReader* readers = calloc(count, sizeof(RunReader));
+    RunReader** heap = calloc(count, sizeof(RunReader*));
+    bool ok = readers && heap;
+
+    size_t live = 0;
+    for (size_t i = 0; ok && i < count; i++) {
+        readers[i].run = runs[i];
+        ok = fflush(runs[i]) == 0 && fseeko(runs[i], 0, SEEK_SET) == 0;
+        int r = ok ? read_next(&readers[i]) : -1;
+        ok = r >= 0;
+        if (r > 0) {
+            heap[live++] = &readers[i];
+        }
+    }
+    for (size_t i = live / 2; ok && i-- > 0;) {
+        sift_down(heap, live, i);
+    }
+
+    while (ok && live > 0) {
+        ok = sink(heap[0], context);
+        int r = ok ? read_next(heap[0]) : -1;
+        if (r < 0) {
+            ok = false;
+        } else {
+            if (r == 0) {
+                heap[0] = heap[--live];
+            }
+            sift_down(heap, live, 0);
+        }
+    }
+
+    free(heap);
+    free(readers);
+    return ok;
+}
+
+static bool write_sink(const RunReader* reader, void* context) {
+    return write_record(context, &reader->header, reader->path);
+}
+
+typedef struct GroupSink {
+    SpillRecord records[SPILL_GROUP_MAX];
+    char (*paths)[PATH_MAX];
+    size_t count;
+    bool continued;             // part of the group has been handed out
+    SpillGroupFn fn;
+    void* context;
+} GroupSink;
+
+static void emit_group(GroupSink* group) {
+    // a lone record has nothing to match
+    if (group->count > 1 || (group->continued && group->count > 0)) {
+        group->fn(group->records, group->count, group->continued, group->context);
+    }
+}
+
+static bool group_sink(const RunReader* reader, void* context) {
+    GroupSink* group = context;
+    if (group->count > 0 && compare_signatures(&group->records[0].signature, &reader->header.signature) != 0) {
+        emit_group(group);
+        group->count = 0;
+        group->continued = false;
+    } else if (group->count == SPILL_GROUP_MAX) {
+        emit_group(group);
+        group->count = 0;
+        group->continued = true;
+    }
+
+    const SpillHeader* header = &reader->header;
+    char* path = group->paths[group->count];
+    memcpy(path, reader->path, header->path_len + 1);
+    group->records[group->count++] = (SpillRecord) {
+        .signature = header->signature,
+        .sequence = header->sequence,
+        .clone_id = header->clone_id,
+        .inode = header->inode,
+        .nlink = header->nlink,
+        .flags = header->flags,
+        .path = path,
+    };
+    return true;
+}
+
+bool spill_set_merge(SpillSet* set, SpillGroupFn fn, void* context) {
+    if (!set || !fn) {
+        return false;
+    }
+
+    pthread_mutex_lock(&set->mutex);
+    bool ok = !set->failed && flush_buffer(set);
+
+    // fold the oldest runs together until they can be merged at once
+    while (ok && set->run_count > SPILL_MERGE_FANIN) {
+        FILE* merged = open_run(set);
+        ok = merged && merge_runs(set->runs, SPILL_MERGE_FANIN, write_sink, merged);
+        if (!ok) {
+            if (merged) {
+                fclose(merged);
+            }
+            break;
+        }
+        for (size_t i = 0; i < SPILL_MERGE_FANIN; i++) {
+            fclose(set->runs[i]);
+        }
+        set->runs[0] = merged;
+        memmove(set->runs + 1, set->runs + SPILL_MERGE_FANIN,
+                (set->run_count - SPILL_MERGE_FANIN) * sizeof(FILE*));
+        set->run_count -= SPILL_MERGE_FANIN - 1;
+    }
+
+    GroupSink* group = ok ? calloc(1, sizeof(GroupSink)) : NULL;
+    if (group) {
+        group->paths = malloc(SPILL_GROUP_MAX * sizeof(*group->paths));
+        group->fn = fn;
+        group->context = context;
+    }
+    ok = group && group->paths && merge_runs(set->runs, set->run_count, group_sink, group);
+    if (ok) {
+        emit_group(group);
+    }
+    if (group) {
+        free(group->paths);
+        free(group);
+    }
+    set->failed = set->failed || !ok;
+    pthread_mutex_unlock(&set->mutex);
+    return ok;
+}
@@ -0,0 +1,63 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#ifndef __DEDUP_SPILL_H__
+#define __DEDUP_SPILL_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "signature.h"
+
+/// Spilled Signatures
+///
+/// With `-M` the signature table stops growing once it reaches its budget.
+/// Files whose signature isn't in the table by then are spilled here
+/// instead: records are gathered in a buffer of `run_bytes`, and every full
+/// buffer is sorted by signature and written to a temporary file, a run.
+/// Once the traversal is done the runs are merged, which hands out every
+/// group of spilled files with the same signature in traversal order. Only
+/// the runs' read buffers and one group are held in memory, however many
+/// files were spilled.
+///
+/// Runs are unlinked as soon as they are created, nothing is left behind
+/// if the process dies.
+typedef struct SpillSet SpillSet;
+
+typedef struct SpillRecord {
+    FileSignature signature;
+    uint64_t sequence;          // orders the records of a group
+    uint64_t clone_id;
+    uint64_t inode;
+    uint32_t nlink;
+    uint32_t flags;
+    const char* path;
+} SpillRecord;
+
+/// Records of one group handed out at a time. A larger group is handed out
+/// in parts, `continued` is set for every part after the first.
+#define SPILL_GROUP_MAX 256
+
+typedef void (*SpillGroupFn)(const SpillRecord* records, size_t count, bool continued, void* context);
+
+/// Creates a set writing its runs to `dir`. Returns NULL if `run_bytes`
+/// can't be allocated.
+SpillSet* new_spill_set(const char* dir, size_t run_bytes);
+
+/// Closes and frees the runs.
+void free_spill_set(SpillSet* set);
+
+/// Adds a copy of the record, may be called from any thread. Returns false
+/// if it couldn't be written.
+bool spill_set_add(SpillSet* set, const SpillRecord* record);
+
+size_t spill_set_count(const SpillSet* set);
+
+/// Merges the runs and calls `fn` for every group of two or more records
+/// with the same signature. Returns false if a run couldn't be read back,
+/// the groups handed out until then are complete.
+bool spill_set_merge(SpillSet* set, SpillGroupFn fn, void* context);
+
+#endif // __DEDUP_SPILL_H__
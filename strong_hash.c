@@ -0,0 +1,474 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include "strong_hash.h"
+
+#include <string.h>
+
+#if defined(__aarch64__) && (defined(__ARM_FEATURE_SHA3) || defined(__ARM_FEATURE_AES))
+#include <arm_neon.h>
+#elif defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+__extension__ typedef unsigned __int128 u128;
+
+static inline uint32_t read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t read64(const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t rotr32(uint32_t x, unsigned n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+static inline uint64_t rotl64(uint64_t x, unsigned n) {
+    return n == 0 ? x : (x << n) | (x >> (64 - n));
+}
+
+// MARK: BLAKE3
+
+#define BLAKE3_BLOCK_LEN 64U
+#define BLAKE3_CHUNK_LEN 1024U
+#define BLAKE3_MAX_DEPTH 54      // enough for 2^64 bytes of chunks
+
+enum {
+    BLAKE3_CHUNK_START = 1 << 0,
+    BLAKE3_CHUNK_END = 1 << 1,
+    BLAKE3_PARENT = 1 << 2,
+    BLAKE3_ROOT = 1 << 3,
+};
+
+static const uint32_t blake3_iv[8] = {
+    0x6A09E667U, 0xBB67AE85U, 0x3C6EF372U, 0xA54FF53AU,
+    0x510E527FU, 0x9B05688CU, 0x1F83D9ABU, 0x5BE0CD19U,
+};
+
+static const uint8_t blake3_permutation[16] = {
+    2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8,
+};
+
+// A node that hasn't been compressed yet, everything needed to compress it
+// either into a chaining value or, with ROOT, into the output
+typedef struct Blake3Output {
+    uint32_t cv[8];
+    uint32_t block[16];
+    uint64_t counter;
+    uint32_t block_len;
+    uint32_t flags;
+} Blake3Output;
+
+static inline void blake3_g(uint32_t* s, int a, int b, int c, int d, uint32_t mx, uint32_t my) {
+    s[a] = s[a] + s[b] + mx;
+    s[d] = rotr32(s[d] ^ s[a], 16);
+    s[c] = s[c] + s[d];
+    s[b] = rotr32(s[b] ^ s[c], 12);
+    s[a] = s[a] + s[b] + my;
+    s[d] = rotr32(s[d] ^ s[a], 8);
+    s[c] = s[c] + s[d];
+    s[b] = rotr32(s[b] ^ s[c], 7);
+}
+
+static void blake3_compress(const uint32_t cv[8], const uint32_t block[16], uint64_t counter,
+                            uint32_t block_len, uint32_t flags, uint32_t out[16]) {
+    uint32_t s[16] = {
+        cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+        blake3_iv[0], blake3_iv[1], blake3_iv[2], blake3_iv[3],
+        (uint32_t)counter, (uint32_t)(counter >> 32), block_len, flags,
+    };
+    uint32_t m[16];
+    memcpy(m, block, sizeof(m));
+
+    for (int round = 0; round < 7; round++) {
+        blake3_g(s, 0, 4, 8, 12, m[0], m[1]);
+        blake3_g(s, 1, 5, 9, 13, m[2], m[3]);
+        blake3_g(s, 2, 6, 10, 14, m[4], m[5]);
+        blake3_g(s, 3, 7, 11, 15, m[6], m[7]);
+        blake3_g(s, 0, 5, 10, 15, m[8], m[9]);
+        blake3_g(s, 1, 6, 11, 12, m[10], m[11]);
+        blake3_g(s, 2, 7, 8, 13, m[12], m[13]);
+        blake3_g(s, 3, 4, 9, 14, m[14], m[15]);
+
+        uint32_t permuted[16];
+        for (int i = 0; i < 16; i++) {
+            permuted[i] = m[blake3_permutation[i]];
+        }
+        memcpy(m, permuted, sizeof(m));
+    }
+
+    for (int i = 0; i < 8; i++) {
+        out[i] = s[i] ^ s[i + 8];
+        out[i + 8] = s[i + 8] ^ cv[i];
+    }
+}
+
+static void blake3_load_block(const uint8_t* p, size_t len, uint32_t block[16]) {
+    uint8_t buf[BLAKE3_BLOCK_LEN] = {0};
+    memcpy(buf, p, len);
+    for (int i = 0; i < 16; i++) {
+        block[i] = read32(buf + 4 * i);
+    }
+}
+
+static void blake3_output_cv(const Blake3Output* o, uint32_t cv[8]) {
+    uint32_t out[16];
+    blake3_compress(o->cv, o->block, o->counter, o->block_len, o->flags, out);
+    memcpy(cv, out, 8 * sizeof(uint32_t));
+}
+
+static Blake3Output blake3_chunk(const uint8_t* p, size_t len, uint64_t counter) {
+    Blake3Output o;
+    memcpy(o.cv, blake3_iv, sizeof(o.cv));
+
+    // the last block, even if empty or full, is left for the caller
+    size_t blocks = len == 0 ? 1 : (len + BLAKE3_BLOCK_LEN - 1) / BLAKE3_BLOCK_LEN;
+    for (size_t b = 0; b + 1 < blocks; b++) {
+        Blake3Output block = { .counter = counter, .block_len = BLAKE3_BLOCK_LEN,
+                               .flags = b == 0 ? BLAKE3_CHUNK_START : 0 };
+        memcpy(block.cv, o.cv, sizeof(block.cv));
+        blake3_load_block(p + b * BLAKE3_BLOCK_LEN, BLAKE3_BLOCK_LEN, block.block);
+        blake3_output_cv(&block, o.cv);
+    }
+
+    size_t last = len - (blocks - 1) * BLAKE3_BLOCK_LEN;
+    blake3_load_block(p + (blocks - 1) * BLAKE3_BLOCK_LEN, last, o.block);
+    o.counter = counter;
+    o.block_len = (uint32_t)last;
+    o.flags = BLAKE3_CHUNK_END | (blocks == 1 ? BLAKE3_CHUNK_START : 0);
+    return o;
+}
+
+static Blake3Output blake3_parent(const uint32_t left[8], const uint32_t right[8]) {
+    Blake3Output o = { .counter = 0, .block_len = BLAKE3_BLOCK_LEN, .flags = BLAKE3_PARENT };
+    memcpy(o.cv, blake3_iv, sizeof(o.cv));
+    memcpy(o.block, left, 8 * sizeof(uint32_t));
+    memcpy(o.block + 8, right, 8 * sizeof(uint32_t));
+    return o;
+}
+
+uint64_t strong_hash_blake3(const void* data, size_t len) {
+    const uint8_t* p = data;
+    uint32_t stack[BLAKE3_MAX_DEPTH][8];
+    size_t depth = 0;
+
+    // every completed chunk merges the subtrees it completes, which is one
+    // per trailing zero bit of the number of chunks so far
+    uint64_t chunks = len == 0 ? 1 : (len + BLAKE3_CHUNK_LEN - 1) / BLAKE3_CHUNK_LEN;
+    for (uint64_t i = 0; i + 1 < chunks; i++) {
+        Blake3Output chunk = blake3_chunk(p + i * BLAKE3_CHUNK_LEN, BLAKE3_CHUNK_LEN, i);
+        uint32_t cv[8];
+        blake3_output_cv(&chunk, cv);
+        for (uint64_t total = i + 1; (total & 1) == 0; total >>= 1) {
+            Blake3Output parent = blake3_parent(stack[--depth], cv);
+            blake3_output_cv(&parent, cv);
+        }
+        memcpy(stack[depth++], cv, sizeof(cv));
+    }
+
+    size_t consumed = (size_t)(chunks - 1) * BLAKE3_CHUNK_LEN;
+    Blake3Output o = blake3_chunk(p + consumed, len - consumed, chunks - 1);
+    while (depth > 0) {
+        uint32_t cv[8];
+        blake3_output_cv(&o, cv);
+        o = blake3_parent(stack[--depth], cv);
+    }
+
+    uint32_t out[16];
+    blake3_compress(o.cv, o.block, 0, o.block_len, o.flags | BLAKE3_ROOT, out);
+    return (uint64_t)out[0] | (uint64_t)out[1] << 32;
+}
+
+// MARK: SHA3-256
+
+#define SHA3_256_RATE 136U
+
+static const uint64_t keccak_round_constants[24] = {
+    0x0000000000000001ULL, 0x0000000000008082ULL, 0x800000000000808AULL, 0x8000000080008000ULL,
+    0x000000000000808BULL, 0x0000000080000001ULL, 0x8000000080008081ULL, 0x8000000000008009ULL,
+    0x000000000000008AULL, 0x0000000000000088ULL, 0x0000000080008009ULL, 0x000000008000000AULL,
+    0x000000008000808BULL, 0x800000000000008BULL, 0x8000000000008089ULL, 0x8000000000008003ULL,
+    0x8000000000008002ULL, 0x8000000000000080ULL, 0x000000000000800AULL, 0x800000008000000AULL,
+    0x8000000080008081ULL, 0x8000000000008080ULL, 0x0000000080000001ULL, 0x8000000080008008ULL,
+};
+
+// theta applied to lane src, rotated by rho and moved to its pi position,
+// for every lane
+#define KECCAK_RHO_PIS() do { \
+        KECCAK_RHO_PI( 0,  0,  0); \
+        KECCAK_RHO_PI( 1,  6, 44); \
+        KECCAK_RHO_PI( 2, 12, 43); \
+        KECCAK_RHO_PI( 3, 18, 21); \
+        KECCAK_RHO_PI( 4, 24, 14); \
+        KECCAK_RHO_PI( 5,  3, 28); \
+        KECCAK_RHO_PI( 6,  9, 20); \
+        KECCAK_RHO_PI( 7, 10,  3); \
+        KECCAK_RHO_PI( 8, 16, 45); \
+        KECCAK_RHO_PI( 9, 22, 61); \
+        KECCAK_RHO_PI(10,  1,  1); \
+        KECCAK_RHO_PI(11,  7,  6); \
+        KECCAK_RHO_PI(12, 13, 25); \
+        KECCAK_RHO_PI(13, 19,  8); \
+        KECCAK_RHO_PI(14, 20, 18); \
+        KECCAK_RHO_PI(15,  4, 27); \
+        KECCAK_RHO_PI(16,  5, 36); \
+        KECCAK_RHO_PI(17, 11, 10); \
+        KECCAK_RHO_PI(18, 17, 15); \
+        KECCAK_RHO_PI(19, 23, 56); \
+        KECCAK_RHO_PI(20,  2, 62); \
+        KECCAK_RHO_PI(21,  8, 55); \
+        KECCAK_RHO_PI(22, 14, 39); \
+        KECCAK_RHO_PI(23, 15, 41); \
+        KECCAK_RHO_PI(24, 21,  2); \
+    } while (0)
+
+#define KECCAK_RHO_PI(dst, src, r) b[dst] = rotl64(a[src] ^ d[(src) % 5], r)
+
+static void keccak_f1600(uint64_t a[25]) {
+    for (int round = 0; round < 24; round++) {
+        uint64_t c[5];
+        uint64_t d[5];
+        uint64_t b[25];
+
+        for (int x = 0; x < 5; x++) {
+            c[x] = a[x] ^ a[x + 5] ^ a[x + 10] ^ a[x + 15] ^ a[x + 20];
+        }
+        for (int x = 0; x < 5; x++) {
+            d[x] = c[(x + 4) % 5] ^ rotl64(c[(x + 1) % 5], 1);
+        }
+
+        KECCAK_RHO_PIS();
+
+        for (int y = 0; y < 25; y += 5) {
+            a[y + 0] = b[y + 0] ^ (~b[y + 1] & b[y + 2]);
+            a[y + 1] = b[y + 1] ^ (~b[y + 2] & b[y + 3]);
+            a[y + 2] = b[y + 2] ^ (~b[y + 3] & b[y + 4]);
+            a[y + 3] = b[y + 3] ^ (~b[y + 4] & b[y + 0]);
+            a[y + 4] = b[y + 4] ^ (~b[y + 0] & b[y + 1]);
+        }
+        a[0] ^= keccak_round_constants[round];
+    }
+}
+
+#undef KECCAK_RHO_PI
+
+static void sha3_absorb_block(uint64_t a[25], const uint8_t* p) {
+    for (size_t i = 0; i < SHA3_256_RATE / 8; i++) {
+        a[i] ^= read64(p + 8 * i);
+    }
+}
+
+// The first output lane holds the first 8 digest bytes, little endian
+static inline uint64_t sha3_256(const uint8_t* p, size_t len, void (*permute)(uint64_t a[25])) {
+    uint64_t a[25] = {0};
+    while (len >= SHA3_256_RATE) {
+        sha3_absorb_block(a, p);
+        permute(a);
+        p += SHA3_256_RATE;
+        len -= SHA3_256_RATE;
+    }
+
+    uint8_t last[SHA3_256_RATE] = {0};
+    memcpy(last, p, len);
+    last[len] ^= 0x06;
+    last[SHA3_256_RATE - 1] ^= 0x80;
+    sha3_absorb_block(a, last);
+    permute(a);
+    return a[0];
+}
+
+uint64_t strong_hash_sha3(const void* data, size_t len) {
+    return sha3_256(data, len, keccak_f1600);
+}
+
+#if defined(__aarch64__) && defined(__ARM_FEATURE_SHA3)
+
+// One state lane per vector, only lane 0 is used. EOR3 folds the column
+// parities, RAX1 the theta rotation, XAR theta and rho together and BCAX
+// is chi.
+#define KECCAK_RHO_PI(dst, src, r) b[dst] = vxarq_u64(a[src], d[(src) % 5], (64 - (r)) % 64)
+
+static void keccak_f1600_arm(uint64_t state[25]) {
+    uint64x2_t a[25];
+    for (int i = 0; i < 25; i++) {
+        a[i] = vdupq_n_u64(state[i]);
+    }
+
+    for (int round = 0; round < 24; round++) {
+        uint64x2_t c[5];
+        uint64x2_t d[5];
+        uint64x2_t b[25];
+
+        for (int x = 0; x < 5; x++) {
+            c[x] = veor3q_u64(veor3q_u64(a[x], a[x + 5], a[x + 10]), a[x + 15], a[x + 20]);
+        }
+        for (int x = 0; x < 5; x++) {
+            d[x] = vrax1q_u64(c[(x + 4) % 5], c[(x + 1) % 5]);
+        }
+
+        KECCAK_RHO_PIS();
+
+        for (int y = 0; y < 25; y += 5) {
+            for (int x = 0; x < 5; x++) {
+                a[x + y] = vbcaxq_u64(b[x + y], b[(x + 2) % 5 + y], b[(x + 1) % 5 + y]);
+            }
+        }
+        a[0] = veorq_u64(a[0], vdupq_n_u64(keccak_round_constants[round]));
+    }
+
+    for (int i = 0; i < 25; i++) {
+        state[i] = vgetq_lane_u64(a[i], 0);
+    }
+}
+
+#undef KECCAK_RHO_PI
+
+bool strong_hash_sha3_arm_supported(void) {
+    return true;
+}
+
+uint64_t strong_hash_sha3_arm(const void* data, size_t len) {
+    return sha3_256(data, len, keccak_f1600_arm);
+}
+
+#else
+
+bool strong_hash_sha3_arm_supported(void) {
+    return false;
+}
+
+uint64_t strong_hash_sha3_arm(const void* data, size_t len) {
+    return strong_hash_sha3(data, len);
+}
+
+#endif
+
+// MARK: Polynomial hash
+
+#define POLY_KEY 0x9E3779B97F4A7C15ULL
+#define POLY_REDUCTION 0x1BULL   // x^64 = x^4 + x^3 + x + 1
+
+typedef u128 (*clmul_fn)(uint64_t a, uint64_t b);
+
+// Carry-less a * b, a nibble of b at a time
+static u128 clmul_portable(uint64_t a, uint64_t b) {
+    u128 table[16];
+    table[0] = 0;
+    table[1] = a;
+    for (int j = 2; j < 16; j++) {
+        table[j] = (j & 1) ? table[j - 1] ^ a : table[j / 2] << 1;
+    }
+
+    u128 r = 0;
+    for (int i = 60; i >= 0; i -= 4) {
+        r = (r << 4) ^ table[(b >> i) & 15];
+    }
+    return r;
+}
+
+static inline __attribute__((always_inline)) uint64_t poly_reduce(u128 product, clmul_fn clmul) {
+    uint64_t lo = (uint64_t)product;
+    uint64_t hi = (uint64_t)(product >> 64);
+    // hi * x^64 folds into at most 69 bits, whose top 5 fold once more
+    u128 folded = clmul(hi, POLY_REDUCTION);
+    return lo ^ (uint64_t)folded ^ (uint64_t)clmul((uint64_t)(folded >> 64), POLY_REDUCTION);
+}
+
+static inline __attribute__((always_inline)) uint64_t poly_fmix64(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// Four words per step with K^4..K, so that the multiplies are independent
+// and only one reduction is on the critical path. The result is the same
+// as one word at a time.
+static inline __attribute__((always_inline)) uint64_t poly_hash(const uint8_t* p, size_t len,
+                                                                 clmul_fn clmul) {
+    const uint64_t k1 = POLY_KEY;
+    const uint64_t k2 = poly_reduce(clmul(k1, k1), clmul);
+    const uint64_t k3 = poly_reduce(clmul(k2, k1), clmul);
+    const uint64_t k4 = poly_reduce(clmul(k2, k2), clmul);
+
+    uint64_t h = 0;
+    size_t words = len / 8;
+    size_t i = 0;
+    for (; i + 4 <= words; i += 4) {
+        const uint8_t* w = p + 8 * i;
+        u128 acc = clmul(h ^ read64(w), k4) ^ clmul(read64(w + 8), k3) ^
+                   clmul(read64(w + 16), k2) ^ clmul(read64(w + 24), k1);
+        h = poly_reduce(acc, clmul);
+    }
+    for (; i < words; i++) {
+        h = poly_reduce(clmul(h ^ read64(p + 8 * i), k1), clmul);
+    }
+    if (len % 8 != 0) {
+        uint8_t last[8] = {0};
+        memcpy(last, p + 8 * words, len % 8);
+        h = poly_reduce(clmul(h ^ read64(last), k1), clmul);
+    }
+
+    // without the length, trailing zero words would be free
+    h = poly_reduce(clmul(h ^ (uint64_t)len, k1), clmul);
+    return poly_fmix64(h);
+}
+
+uint64_t strong_hash_pmull_poly(const void* data, size_t len) {
+    return poly_hash(data, len, clmul_portable);
+}
+
+#if defined(__aarch64__) && defined(__ARM_FEATURE_AES)
+
+static inline u128 clmul_pmull(uint64_t a, uint64_t b) {
+    uint64x2_t r = vreinterpretq_u64_p128(vmull_p64((poly64_t)a, (poly64_t)b));
+    return (u128)vgetq_lane_u64(r, 1) << 64 | vgetq_lane_u64(r, 0);
+}
+
+bool strong_hash_pmull_poly_clmul_supported(void) {
+    return true;
+}
+
+uint64_t strong_hash_pmull_poly_clmul(const void* data, size_t len) {
+    return poly_hash(data, len, clmul_pmull);
+}
+
+#elif defined(__x86_64__)
+
+__attribute__((target("pclmul,sse2")))
+static inline u128 clmul_pclmul(uint64_t a, uint64_t b) {
+    __m128i r = _mm_clmulepi64_si128(_mm_cvtsi64_si128((long long)a), _mm_cvtsi64_si128((long long)b), 0x00);
+    uint64_t lo = (uint64_t)_mm_cvtsi128_si64(r);
+    uint64_t hi = (uint64_t)_mm_cvtsi128_si64(_mm_unpackhi_epi64(r, r));
+    return (u128)hi << 64 | lo;
+}
+
+bool strong_hash_pmull_poly_clmul_supported(void) {
+    return __builtin_cpu_supports("pclmul");
+}
+
+__attribute__((target("pclmul,sse2")))
+uint64_t strong_hash_pmull_poly_clmul(const void* data, size_t len) {
+    return poly_hash(data, len, clmul_pclmul);
+}
+
+#else
+
+bool strong_hash_pmull_poly_clmul_supported(void) {
+    return false;
+}
+
+uint64_t strong_hash_pmull_poly_clmul(const void* data, size_t len) {
+    return strong_hash_pmull_poly(data, len);
+}
+
+#endif
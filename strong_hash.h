@@ -0,0 +1,42 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#ifndef __DEDUP_STRONG_HASH_H__
+#define __DEDUP_STRONG_HASH_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// Strong Staged Hashes
+///
+/// Digests for the optional strong hash stage of the runtime dispatch. Like
+/// every other stage before the exact compare they only nominate or reject
+/// candidates, so each returns the first 64 bits of its digest.
+///
+/// Hardware variants produce the same values as their portable versions and
+/// are only available where the build and the CPU support them, check the
+/// `_supported` function before calling one.
+
+/// BLAKE3, unkeyed, portable.
+uint64_t strong_hash_blake3(const void* data, size_t len);
+
+/// SHA3-256, portable Keccak-f[1600].
+uint64_t strong_hash_sha3(const void* data, size_t len);
+
+/// SHA3-256 using the ARMv8.2 SHA3 instructions (EOR3, RAX1, XAR, BCAX).
+bool strong_hash_sha3_arm_supported(void);
+uint64_t strong_hash_sha3_arm(const void* data, size_t len);
+
+/// Polynomial hash over GF(2^64) modulo x^64 + x^4 + x^3 + x + 1. The input
+/// is read as little endian 64 bit words m1..mn, the last one zero padded,
+/// and evaluated as m1*K^n + ... + mn*K with a fixed K, then the length is
+/// folded in and the result passed through a non-linear finalizer.
+uint64_t strong_hash_pmull_poly(const void* data, size_t len);
+
+/// The same polynomial hash using PMULL on arm64 or PCLMULQDQ on x86_64.
+bool strong_hash_pmull_poly_clmul_supported(void);
+uint64_t strong_hash_pmull_poly_clmul(const void* data, size_t len);
+
+#endif // __DEDUP_STRONG_HASH_H__
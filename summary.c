@@ -0,0 +1,347 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include "summary.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "metrics.h"
+
+// Large enough for a few hundred records, a record with two maximum
+// length paths that need escaping doesn't fit and is written on its own.
+#define SUMMARY_BUFFER_SIZE (64U * 1024U)
+
+typedef struct SummaryBuffer {
+    SummaryLog* log;
+    struct SummaryBuffer* prev;
+    struct SummaryBuffer* next;
+    size_t used;
+    char data[SUMMARY_BUFFER_SIZE];
+} SummaryBuffer;
+
+struct SummaryLog {
+    pthread_mutex_t mutex;  // guards stream, buffers and failed
+    FILE* stream;
+    SummaryFormat format;
+    pthread_key_t key;      // the calling thread's buffer
+    SummaryBuffer* buffers; // of all threads that recorded something
+    atomic_size_t count;
+    bool failed;
+};
+
+// Appends to a bounded buffer, remembering if anything didn't fit.
+typedef struct SummaryOut {
+    char* data;
+    size_t used;
+    size_t capacity;
+    bool overflow;
+} SummaryOut;
+
+static void out_bytes(SummaryOut* out, const char* s, size_t len) {
+    if (out->overflow || len > out->capacity - out->used) {
+        out->overflow = true;
+        return;
+    }
+    memcpy(out->data + out->used, s, len);
+    out->used += len;
+}
+
+static void out_str(SummaryOut* out, const char* s) {
+    out_bytes(out, s, strlen(s));
+}
+
+static void out_u64(SummaryOut* out, uint64_t value) {
+    char buf[24];
+    int len = snprintf(buf, sizeof(buf), "%" PRIu64, value);
+    out_bytes(out, buf, (size_t)len);
+}
+
+// Length of the well-formed UTF-8 sequence at `p`, 0 if there is none:
+// no overlong forms, surrogates or code points past U+10FFFF.
+static size_t utf8_sequence(const unsigned char* p) {
+    if (p[0] < 0x80) {
+        return 1;
+    }
+
+    size_t len = 0;
+    unsigned char min = 0x80, max = 0xBF;  // of the second byte
+    if (p[0] >= 0xC2 && p[0] <= 0xDF) {
+        len = 2;
+    } else if (p[0] >= 0xE0 && p[0] <= 0xEF) {
+        len = 3;
+        min = p[0] == 0xE0 ? 0xA0 : 0x80;
+        max = p[0] == 0xED ? 0x9F : 0xBF;
+    } else if (p[0] >= 0xF0 && p[0] <= 0xF4) {
+        len = 4;
+        min = p[0] == 0xF0 ? 0x90 : 0x80;
+        max = p[0] == 0xF4 ? 0x8F : 0xBF;
+    } else {
+        return 0;
+    }
+
+    if (p[1] < min || p[1] > max) {
+        return 0;
+    }
+    for (size_t i = 2; i < len; i++) {
+        if (p[i] < 0x80 || p[i] > 0xBF) {
+            return 0;
+        }
+    }
+    return len;
+}
+
+// Paths are bytes, JSON strings are Unicode. A byte that isn't part of
+// well-formed UTF-8 is written as the lone surrogate U+DC80 to U+DCFF, like
+// Python's surrogateescape, so the path can still be told apart and
+// restored.
+static void out_json_string(SummaryOut* out, const char* s) {
+    out_bytes(out, "\"", 1);
+    for (const unsigned char* p = (const unsigned char*)s; *p;) {
+        size_t len = utf8_sequence(p);
+        if (*p == '"' || *p == '\\') {
+            char escaped[2] = { '\\', (char)*p };
+            out_bytes(out, escaped, 2);
+        } else if (len == 0 || *p < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", len == 0 ? 0xDC00U | *p : *p);
+            out_bytes(out, escaped, 6);
+            len = 1;
+        } else {
+            out_bytes(out, (const char*)p, len);
+        }
+        p += len;
+    }
+    out_bytes(out, "\"", 1);
+}
+
+static void format_record(SummaryOut* out, SummaryFormat format, const SummaryRecord* record) {
+    if (format == SUMMARY_JSONL) {
+        char hash[20];
+        snprintf(hash, sizeof(hash), "%016" PRIx64, record->quick_hash);
+        out_str(out, "{\"type\":\"clone\",\"origin\":");
+        out_json_string(out, record->origin);
+        out_str(out, ",\"clone\":");
+        out_json_string(out, record->clone);
+        out_str(out, ",\"size\":");
+        out_u64(out, record->size);
+        out_str(out, ",\"quick_hash\":\"");
+        out_str(out, hash);
+        out_str(out, "\",\"replace_ns\":");
+        out_u64(out, record->replace_ns);
+        out_str(out, "}\n");
+    } else {
+        out_str(out, "  Origin: ");
+        out_str(out, record->origin);
+        out_str(out, "\n    Clone: ");
+        out_str(out, record->clone);
+        out_str(out, " (size: ");
+        out_u64(out, record->size);
+        out_str(out, " bytes)\n");
+    }
+}
+
+// Callers hold the log's mutex.
+static void write_locked(SummaryLog* log, const char* data, size_t len) {
+    if (len > 0 && fwrite(data, 1, len, log->stream) != len) {
+        log->failed = true;
+    }
+}
+
+static void flush_buffer(SummaryBuffer* buffer) {
+    SummaryLog* log = buffer->log;
+    pthread_mutex_lock(&log->mutex);
+    write_locked(log, buffer->data, buffer->used);
+    pthread_mutex_unlock(&log->mutex);
+    buffer->used = 0;
+}
+
+// Thread exit, hands the rest of the buffer to the log.
+static void release_buffer(void* value) {
+    SummaryBuffer* buffer = value;
+    SummaryLog* log = buffer->log;
+    pthread_mutex_lock(&log->mutex);
+    write_locked(log, buffer->data, buffer->used);
+    if (buffer->prev) {
+        buffer->prev->next = buffer->next;
+    } else {
+        log->buffers = buffer->next;
+    }
+    if (buffer->next) {
+        buffer->next->prev = buffer->prev;
+    }
+    pthread_mutex_unlock(&log->mutex);
+    free(buffer);
+}
+
+static SummaryBuffer* thread_buffer(SummaryLog* log) {
+    SummaryBuffer* buffer = pthread_getspecific(log->key);
+    if (buffer) {
+        return buffer;
+    }
+
+    buffer = malloc(sizeof(SummaryBuffer));
+    if (!buffer) {
+        return NULL;
+    }
+    buffer->log = log;
+    buffer->used = 0;
+    buffer->prev = NULL;
+    if (pthread_setspecific(log->key, buffer) != 0) {
+        free(buffer);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&log->mutex);
+    buffer->next = log->buffers;
+    if (log->buffers) {
+        log->buffers->prev = buffer;
+    }
+    log->buffers = buffer;
+    pthread_mutex_unlock(&log->mutex);
+    return buffer;
+}
+
+SummaryLog* open_summary_log(const char* path, SummaryFormat format) {
+    SummaryLog* log = calloc(1, sizeof(SummaryLog));
+    if (!log) {
+        return NULL;
+    }
+
+    log->stream = fopen(path, "w");
+    if (!log->stream || pthread_key_create(&log->key, release_buffer) != 0) {
+        if (log->stream) {
+            fclose(log->stream);
+        }
+        free(log);
+        return NULL;
+    }
+    pthread_mutex_init(&log->mutex, NULL);
+    log->format = format;
+
+    if (format == SUMMARY_TEXT) {
+        fprintf(log->stream, "DEDUP CLONING SUMMARY\n");
+        fprintf(log->stream, "=====================\n");
+        fprintf(log->stream, "\n");
+    }
+    return log;
+}
+
+static void write_stages(SummaryLog* log) {
+    if (log->format == SUMMARY_TEXT) {
+        fprintf(log->stream, "\n");
+        stage_print(log->stream);
+        return;
+    }
+
+    for (StageId id = 0; id < STAGE_COUNT; id++) {
+        StageReport report;
+        stage_report(id, &report);
+        if (report.calls == 0) {
+            continue;
+        }
+        fprintf(log->stream,
+                "{\"type\":\"stage\",\"name\":\"%s\",\"calls\":%" PRIu64 ",\"total_ns\":%" PRIu64
+                ",\"p50_ns\":%" PRIu64 ",\"p99_ns\":%" PRIu64 ",\"max_ns\":%" PRIu64 "}\n",
+                stage_name(id), report.calls, report.total_ns, report.p50_ns, report.p99_ns, report.max_ns);
+    }
+}
+
+bool close_summary_log(SummaryLog* log) {
+    if (!log) {
+        return true;
+    }
+
+    // every other thread that recorded has exited and flushed its buffer,
+    // deleting the key keeps destructors of threads exiting later away
+    pthread_key_delete(log->key);
+    SummaryBuffer* buffer = log->buffers;
+    while (buffer) {
+        SummaryBuffer* next = buffer->next;
+        write_locked(log, buffer->data, buffer->used);
+        free(buffer);
+        buffer = next;
+    }
+
+    size_t count = atomic_load(&log->count);
+    if (log->format == SUMMARY_JSONL) {
+        write_stages(log);
+        fprintf(log->stream, "{\"type\":\"total\",\"clones\":%zu}\n", count);
+    } else {
+        fprintf(log->stream, "\nTotal cloning operations: %zu\n", count);
+        write_stages(log);
+    }
+
+    bool ok = !log->failed && !ferror(log->stream);
+    ok = fclose(log->stream) == 0 && ok;
+    pthread_mutex_destroy(&log->mutex);
+    free(log);
+    return ok;
+}
+
+void summary_log_record(SummaryLog* log, const SummaryRecord* record) {
+    if (!log || !record) {
+        return;
+    }
+    atomic_fetch_add_explicit(&log->count, 1, memory_order_relaxed);
+
+    SummaryBuffer* buffer = thread_buffer(log);
+    for (int attempt = 0; buffer && attempt < 2; attempt++) {
+        SummaryOut out = {
+            .data = buffer->data + buffer->used,
+            .capacity = SUMMARY_BUFFER_SIZE - buffer->used,
+        };
+        format_record(&out, log->format, record);
+        if (!out.overflow) {
+            buffer->used += out.used;
+            return;
+        }
+        if (buffer->used == 0) {
+            break;
+        }
+        flush_buffer(buffer);
+    }
+
+    // too large for a buffer, or no buffer to be had
+    size_t capacity = 4 * SUMMARY_BUFFER_SIZE;
+    char* data = malloc(capacity);
+    if (!data) {
+        pthread_mutex_lock(&log->mutex);
+        log->failed = true;
+        pthread_mutex_unlock(&log->mutex);
+        return;
+    }
+    SummaryOut out = { .data = data, .capacity = capacity };
+    format_record(&out, log->format, record);
+
+    // keep the thread's earlier records ahead of this one
+    pthread_mutex_lock(&log->mutex);
+    if (buffer) {
+        write_locked(log, buffer->data, buffer->used);
+        buffer->used = 0;
+    }
+    if (out.overflow) {
+        log->failed = true;
+    } else {
+        write_locked(log, out.data, out.used);
+    }
+    pthread_mutex_unlock(&log->mutex);
+    free(data);
+}
+
+bool summary_format_parse(const char* name, SummaryFormat* format) {
+    if (strcmp(name, "text") == 0) {
+        *format = SUMMARY_TEXT;
+        return true;
+    }
+    if (strcmp(name, "jsonl") == 0) {
+        *format = SUMMARY_JSONL;
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,52 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#ifndef __DEDUP_SUMMARY_H__
+#define __DEDUP_SUMMARY_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/// Summary Log
+///
+/// Records every duplicate that was replaced in the file named by `-S`.
+/// Each thread formats its records into a buffer of its own and only takes
+/// the log's lock to write a full buffer, so threads replacing many small
+/// files don't wait on each other's stdio. Records of one thread stay in
+/// order, records of different threads interleave by buffer.
+///
+/// The text format is meant to be read, JSONL has one object per line for
+/// tools: a `"clone"` record per replaced file, then a `"stage"` record per
+/// timed stage (see metrics.h) and a final `"total"` record.
+typedef struct SummaryLog SummaryLog;
+
+typedef enum SummaryFormat {
+    SUMMARY_TEXT,
+    SUMMARY_JSONL,
+} SummaryFormat;
+
+typedef struct SummaryRecord {
+    const char* origin;
+    const char* clone;
+    uint64_t size;
+    uint64_t quick_hash;    // of the signature that matched the two
+    uint64_t replace_ns;    // time taken to replace the clone
+} SummaryRecord;
+
+/// Creates or truncates the log at `path`. Returns NULL if it can't be
+/// opened.
+SummaryLog* open_summary_log(const char* path, SummaryFormat format);
+
+/// Writes what is still buffered, the totals and closes the log. Every
+/// thread that recorded something other than the caller must have exited.
+/// Returns false if anything couldn't be written.
+bool close_summary_log(SummaryLog* log);
+
+/// Adds a record to the calling thread's buffer.
+void summary_log_record(SummaryLog* log, const SummaryRecord* record);
+
+/// Parses a format name, "text" or "jsonl".
+bool summary_format_parse(const char* name, SummaryFormat* format);
+
+#endif // __DEDUP_SUMMARY_H__
@@ -0,0 +1,54 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include <check.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../arena.h"
+
+START_TEST(arena_allocations_are_aligned_and_distinct) {
+    Arena* arena = new_arena(256);
+    ck_assert_ptr_nonnull(arena);
+
+    unsigned char* previous = NULL;
+    for (size_t i = 1; i < 200; i++) {
+        unsigned char* p = arena_alloc(arena, i, 16);
+        ck_assert_ptr_nonnull(p);
+        ck_assert_uint_eq(0, (uintptr_t)p % 16);
+        memset(p, (int)i, i);
+        if (previous) {
+            ck_assert_uint_eq(i - 1, previous[i - 2]);
+        }
+        previous = p;
+    }
+    // larger than a chunk
+    ck_assert_ptr_nonnull(arena_alloc(arena, 4096, 8));
+    free_arena(arena);
+
+    StringPool* pool = new_string_pool();
+    ck_assert_ptr_nonnull(pool);
+    char name[32];
+    const char* first[500];
+    for (int i = 0; i < 500; i++) {
+        snprintf(name, sizeof(name), "/dir/%d/", i);
+        first[i] = string_pool_intern(pool, name, strlen(name));
+        ck_assert_str_eq(name, first[i]);
+    }
+    for (int i = 0; i < 500; i++) {
+        snprintf(name, sizeof(name), "/dir/%d/ and more", i);
+        ck_assert_ptr_eq(first[i], string_pool_intern(pool, name, strlen(name) - strlen(" and more")));
+    }
+    free_string_pool(pool);
+} END_TEST
+
+Suite* arena_suite(void) {
+    TCase* tc = tcase_create("arena");
+    tcase_add_test(tc, arena_allocations_are_aligned_and_distinct);
+
+    Suite* s = suite_create("arena");
+    suite_add_tcase(s, tc);
+    return s;
+}
@@ -0,0 +1,527 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+/// Benchmarks
+///
+/// Generates synthetic trees that stress different parts of the pipeline
+/// and runs `dedup -nP -vv` over each of them once per dispatch backend and
+/// thread count. Every run is reported as one JSON object per line, so the
+/// output of two builds can be compared with any JSON tool.
+///
+///     bench [-d dir] [-s scale] [-t threads] [-b backends] [-T trees] dedup
+///
+/// The trees are generated in `dir` (default /tmp/dedup-bench) from a fixed
+/// seed and reused by later runs with the same scale. `-t`, `-b` and `-T`
+/// take comma separated lists that restrict what is run.
+///
+/// Runs are dry runs, so every run sees the same tree. The rates are taken
+/// over the wall time of the whole process, peak memory comes from the
+/// kernel's accounting of the child and system calls from dedup's own -vv
+/// summary.
+
+#include <sys/clonefile.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/sysctl.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include <err.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_DEFAULT_DIR "/tmp/dedup-bench"
+#define BENCH_FILES_PER_DIR 1000
+#define BENCH_OUTPUT_MAX (64U * 1024U)
+
+typedef struct BenchTree {
+    const char* name;
+    // creates the tree in `dir`, returns false on failure
+    bool (*generate)(const char* dir, unsigned scale);
+} BenchTree;
+
+typedef struct BenchBackend {
+    const char* name;
+    const char* variable;   // environment variable forcing the backend
+    const char* value;
+} BenchBackend;
+
+typedef struct BenchTotals {
+    uint64_t files;
+    uint64_t bytes;
+} BenchTotals;
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+// xorshift64*, fixed seed so that every tree is the same on every machine
+static uint64_t next_random(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static void fill_random(unsigned char* buf, size_t len) {
+    for (size_t i = 0; i < len; i += sizeof(uint64_t)) {
+        uint64_t r = next_random();
+        size_t n = len - i < sizeof(r) ? len - i : sizeof(r);
+        memcpy(buf + i, &r, n);
+    }
+}
+
+static bool write_file(const char* path, const void* data, size_t len) {
+    FILE* f = fopen(path, "wb");
+    if (!f) {
+        warn("%s", path);
+        return false;
+    }
+    bool ok = fwrite(data, 1, len, f) == len;
+    ok = fclose(f) == 0 && ok;
+    if (!ok) {
+        warn("%s", path);
+    }
+    return ok;
+}
+
+static bool make_dir(const char* path) {
+    if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+        warn("%s", path);
+        return false;
+    }
+    return true;
+}
+
+// Millions of tiny files is what most source trees and caches look like,
+// the cost is all in the traversal and per file system calls. A quarter of
+// the files repeat an earlier content.
+static bool generate_tiny(const char* dir, unsigned scale) {
+    const size_t count = 250000U * scale;
+    unsigned char contents[64][64];
+    fill_random(&contents[0][0], sizeof(contents));
+
+    char path[PATH_MAX];
+    for (size_t i = 0; i < count; i++) {
+        if (i % BENCH_FILES_PER_DIR == 0) {
+            snprintf(path, sizeof(path), "%s/%zu", dir, i / BENCH_FILES_PER_DIR);
+            if (!make_dir(path)) {
+                return false;
+            }
+        }
+        snprintf(path, sizeof(path), "%s/%zu/%zu", dir, i / BENCH_FILES_PER_DIR, i);
+
+        size_t len = 1 + next_random() % 64;
+        unsigned char unique[64];
+        const unsigned char* data = unique;
+        if (next_random() % 4 == 0) {
+            data = contents[next_random() % 64];
+        } else {
+            fill_random(unique, len);
+        }
+        if (!write_file(path, data, len)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// A few huge files that only differ in single bytes near the middle and
+// the end, which the signature can't tell apart and the verifier has to.
+static bool generate_huge(const char* dir, unsigned scale) {
+    const size_t size = 64U * 1024U * 1024U * scale;
+    unsigned char* data = malloc(size);
+    if (!data) {
+        warnx("out of memory");
+        return false;
+    }
+    fill_random(data, size);
+
+    char path[PATH_MAX];
+    bool ok = true;
+    for (int i = 0; ok && i < 4; i++) {
+        snprintf(path, sizeof(path), "%s/huge-%d", dir, i);
+        // 0 and 1 are identical, 2 differs in the middle, 3 at the end
+        if (i == 2) {
+            data[size / 2] ^= 0xFF;
+        } else if (i == 3) {
+            data[size / 2] ^= 0xFF;
+            data[size - 2] ^= 0xFF;
+        }
+        ok = write_file(path, data, size);
+    }
+    free(data);
+    return ok;
+}
+
+// Long chains of directories with a few files each, duplicates spread over
+// all levels.
+static bool generate_deep(const char* dir, unsigned scale) {
+    const size_t chains = 16U * scale;
+    const size_t depth = 128;
+    unsigned char contents[8][4096];
+    fill_random(&contents[0][0], sizeof(contents));
+
+    char path[PATH_MAX];
+    char file[PATH_MAX];
+    for (size_t c = 0; c < chains; c++) {
+        int len = snprintf(path, sizeof(path), "%s/%zu", dir, c);
+        for (size_t level = 0; level < depth; level++) {
+            if (!make_dir(path)) {
+                return false;
+            }
+            for (int i = 0; i < 4; i++) {
+                snprintf(file, sizeof(file), "%s/f%d", path, i);
+                if (!write_file(file, contents[next_random() % 8], 512 + next_random() % 3584)) {
+                    return false;
+                }
+            }
+            len += snprintf(path + len, sizeof(path) - (size_t)len, "/d");
+        }
+    }
+    return true;
+}
+
+// Files with many links each, which the pruners have to skip without
+// reading anything.
+static bool generate_hardlinks(const char* dir, unsigned scale) {
+    const size_t count = 20000U * scale;
+    unsigned char data[1024];
+
+    char path[PATH_MAX];
+    char link_path[PATH_MAX];
+    for (size_t i = 0; i < count; i++) {
+        if (i % BENCH_FILES_PER_DIR == 0) {
+            snprintf(path, sizeof(path), "%s/%zu", dir, i / BENCH_FILES_PER_DIR);
+            if (!make_dir(path)) {
+                return false;
+            }
+        }
+        snprintf(path, sizeof(path), "%s/%zu/%zu", dir, i / BENCH_FILES_PER_DIR, i);
+        fill_random(data, sizeof(data));
+        if (!write_file(path, data, 1 + next_random() % sizeof(data))) {
+            return false;
+        }
+        for (int l = 0; l < 15; l++) {
+            snprintf(link_path, sizeof(link_path), "%s.%d", path, l);
+            if (link(path, link_path) != 0) {
+                warn("%s", link_path);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Sets of clones that an earlier run already created, the second nightly
+// run over a tree looks like this.
+static bool generate_clones(const char* dir, unsigned scale) {
+    const size_t count = 20000U * scale;
+    unsigned char data[16384];
+
+    char path[PATH_MAX];
+    char clone_path[PATH_MAX];
+    for (size_t i = 0; i < count; i++) {
+        if (i % BENCH_FILES_PER_DIR == 0) {
+            snprintf(path, sizeof(path), "%s/%zu", dir, i / BENCH_FILES_PER_DIR);
+            if (!make_dir(path)) {
+                return false;
+            }
+        }
+        snprintf(path, sizeof(path), "%s/%zu/%zu", dir, i / BENCH_FILES_PER_DIR, i);
+        size_t len = 1 + next_random() % sizeof(data);
+        fill_random(data, len);
+        if (!write_file(path, data, len)) {
+            return false;
+        }
+        for (int c = 0; c < 7; c++) {
+            snprintf(clone_path, sizeof(clone_path), "%s.%d", path, c);
+            if (clonefile(path, clone_path, 0) != 0) {
+                warn("%s", clone_path);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static const BenchTree trees[] = {
+    { "tiny",      generate_tiny },
+    { "huge",      generate_huge },
+    { "deep",      generate_deep },
+    { "hardlinks", generate_hardlinks },
+    { "clones",    generate_clones },
+};
+
+static const BenchBackend backends[] = {
+    { "default",       NULL,                        NULL },
+    { "xxhash",        "DEDUP_FORCE_FAST_HASH",     "xxhash" },
+    { "rapidhash",     "DEDUP_FORCE_FAST_HASH",     "rapidhash" },
+    { "komihash",      "DEDUP_FORCE_FAST_HASH",     "komihash" },
+    { "blake3",        "DEDUP_FORCE_FAST_HASH",     "blake3" },
+    { "memcmp",        "DEDUP_FORCE_EXACT_COMPARE", "memcmp" },
+    { "cpu_xor_or",    "DEDUP_FORCE_EXACT_COMPARE", "cpu_xor_or" },
+    { "cpu_tiles",     "DEDUP_FORCE_EXACT_COMPARE", "cpu_tiles" },
+    { "neon_unrolled", "DEDUP_FORCE_EXACT_COMPARE", "neon_unrolled" },
+    { "avx2_unrolled", "DEDUP_FORCE_EXACT_COMPARE", "avx2_unrolled" },
+};
+
+#define COUNT_OF(a) (sizeof(a) / sizeof((a)[0]))
+
+// Returns true if `name` is one of the comma separated `list`, or if there
+// is no list.
+static bool selected(const char* list, const char* name) {
+    if (!list) {
+        return true;
+    }
+    size_t len = strlen(name);
+    for (const char* p = list; *p;) {
+        const char* end = strchr(p, ',');
+        size_t item_len = end ? (size_t)(end - p) : strlen(p);
+        if (item_len == len && strncmp(p, name, len) == 0) {
+            return true;
+        }
+        p += item_len + (end ? 1 : 0);
+    }
+    return false;
+}
+
+static bool remove_tree(const char* dir) {
+    char command[PATH_MAX + 16];
+    snprintf(command, sizeof(command), "rm -rf '%s'", dir);
+    return system(command) == 0;
+}
+
+// Generates `tree` unless an earlier run left a complete one of the same
+// scale behind.
+static bool prepare_tree(const char* root, const BenchTree* tree, unsigned scale, char* dir, size_t size) {
+    snprintf(dir, size, "%s/%s-%u", root, tree->name, scale);
+    char stamp[PATH_MAX];
+    snprintf(stamp, sizeof(stamp), "%s.complete", dir);
+    if (access(stamp, F_OK) == 0) {
+        return true;
+    }
+
+    fprintf(stderr, "generating %s\n", dir);
+    rng_state = 0x9E3779B97F4A7C15ULL;
+    if (!remove_tree(dir) || !make_dir(dir) || !tree->generate(dir, scale)) {
+        return false;
+    }
+    return write_file(stamp, "", 0);
+}
+
+static bool measure_tree(const char* dir, BenchTotals* totals) {
+    char command[PATH_MAX + 64];
+    snprintf(command, sizeof(command), "find '%s' -type f -print0 | xargs -0 stat -f %%z", dir);
+    FILE* p = popen(command, "r");
+    if (!p) {
+        return false;
+    }
+    *totals = (BenchTotals) {0};
+    unsigned long long size = 0;
+    while (fscanf(p, "%llu", &size) == 1) {
+        totals->files++;
+        totals->bytes += size;
+    }
+    return pclose(p) == 0;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static uint64_t output_value(const char* output, const char* prefix) {
+    const char* line = strstr(output, prefix);
+    return line ? strtoull(line + strlen(prefix), NULL, 10) : 0;
+}
+
+// Runs dedup over `dir` and prints its result. Returns false if dedup
+// couldn't be run or failed.
+static bool run_one(const char* dedup, const char* dir, const BenchTree* tree, const BenchTotals* totals,
+                    const BenchBackend* backend, unsigned threads) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        warn("pipe");
+        return false;
+    }
+
+    char thread_arg[16];
+    snprintf(thread_arg, sizeof(thread_arg), "-t%u", threads);
+
+    double start = now();
+    pid_t pid = fork();
+    if (pid < 0) {
+        warn("fork");
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        if (backend->variable) {
+            setenv(backend->variable, backend->value, 1);
+        }
+        execl(dedup, dedup, "-nP", "-vv", thread_arg, dir, (char*)NULL);
+        _exit(127);
+    }
+    close(fds[1]);
+
+    // dedup also prints what it would replace, only the summary at the end
+    // matters, so the output is cut down to its last half buffer whenever
+    // the buffer fills up
+    char* output = calloc(BENCH_OUTPUT_MAX, 1);
+    size_t used = 0;
+    ssize_t n = 0;
+    while (output && (n = read(fds[0], output + used, BENCH_OUTPUT_MAX - 1 - used)) > 0) {
+        used += (size_t)n;
+        if (used == BENCH_OUTPUT_MAX - 1) {
+            memmove(output, output + used / 2, used - used / 2);
+            used -= used / 2;
+        }
+    }
+    if (output) {
+        output[used] = '\0';
+    }
+    close(fds[0]);
+
+    int status = 0;
+    struct rusage usage = {0};
+    wait4(pid, &status, 0, &usage);
+    double seconds = now() - start;
+
+    bool ok = output && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    if (ok) {
+        uint64_t found = output_value(output, "duplicates found: ");
+        uint64_t syscalls = output_value(output, "resources: ");
+        printf("{\"tree\":\"%s\",\"backend\":\"%s\",\"threads\":%u,\"files\":%" PRIu64 ",\"bytes\":%" PRIu64
+               ",\"duplicates\":%" PRIu64 ",\"seconds\":%.3f,\"files_per_s\":%.0f,\"gib_per_s\":%.3f"
+               ",\"syscalls_per_file\":%.2f,\"peak_rss\":%ld}\n",
+               tree->name, backend->name, threads, totals->files, totals->bytes, found, seconds,
+               (double)totals->files / seconds,
+               (double)totals->bytes / seconds / (1024.0 * 1024.0 * 1024.0),
+               totals->files ? (double)syscalls / (double)totals->files : 0.0,
+               // ru_maxrss is in bytes on macOS
+               (long)usage.ru_maxrss);
+        fflush(stdout);
+    } else {
+        warnx("%s %s with %s on %s failed", dedup, thread_arg, backend->name, tree->name);
+    }
+
+    free(output);
+    return ok;
+}
+
+static void usage(const char* pgm) {
+    fprintf(stderr,
+            "usage: %s [-d dir] [-s scale] [-t threads] [-b backends] [-T trees] dedup\n"
+            "\n"
+            "  -d dir       Where the trees are generated. Default: " BENCH_DEFAULT_DIR "\n"
+            "  -s scale     Multiplies the size of every tree. Default: 1\n"
+            "  -t threads   Comma separated thread counts. Default: 0,1 and the CPU count\n"
+            "  -b backends  Comma separated backends to run, default all of them\n"
+            "  -T trees     Comma separated trees to run, default all of them\n",
+            pgm);
+    exit(2);
+}
+
+int main(int argc, char** argv) {
+    const char* root = BENCH_DEFAULT_DIR;
+    const char* thread_list = NULL;
+    const char* backend_list = NULL;
+    const char* tree_list = NULL;
+    unsigned scale = 1;
+
+    int ch = -1;
+    while ((ch = getopt(argc, argv, "d:s:t:b:T:")) != -1) {
+        switch (ch) {
+            case 'd':
+                root = optarg;
+                break;
+            case 's':
+                scale = (unsigned)strtoul(optarg, NULL, 10);
+                if (scale == 0) {
+                    usage(argv[0]);
+                }
+                break;
+            case 't':
+                thread_list = optarg;
+                break;
+            case 'b':
+                backend_list = optarg;
+                break;
+            case 'T':
+                tree_list = optarg;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (optind + 1 != argc) {
+        usage(argv[0]);
+    }
+    const char* dedup = argv[optind];
+
+    unsigned thread_counts[64];
+    size_t thread_count_count = 0;
+    if (thread_list) {
+        for (const char* p = thread_list; *p && thread_count_count < COUNT_OF(thread_counts);) {
+            char* end = NULL;
+            unsigned long threads = strtoul(p, &end, 10);
+            if (end == p || threads > UINT8_MAX || (*end && *end != ',')) {
+                usage(argv[0]);
+            }
+            thread_counts[thread_count_count++] = (unsigned)threads;
+            p = *end ? end + 1 : end;
+        }
+    } else {
+        int32_t cpus = 0;
+        size_t len = sizeof(cpus);
+        sysctlbyname("hw.ncpu", &cpus, &len, NULL, 0);
+        thread_counts[thread_count_count++] = 0;
+        thread_counts[thread_count_count++] = 1;
+        if (cpus > 1) {
+            thread_counts[thread_count_count++] = (unsigned)cpus;
+        }
+    }
+
+    if (!make_dir(root)) {
+        return 1;
+    }
+
+    bool ok = true;
+    for (size_t t = 0; t < COUNT_OF(trees); t++) {
+        if (!selected(tree_list, trees[t].name)) {
+            continue;
+        }
+
+        char dir[PATH_MAX];
+        BenchTotals totals;
+        if (!prepare_tree(root, &trees[t], scale, dir, sizeof(dir)) || !measure_tree(dir, &totals)) {
+            warnx("could not generate %s", trees[t].name);
+            ok = false;
+            continue;
+        }
+
+        for (size_t b = 0; b < COUNT_OF(backends); b++) {
+            if (!selected(backend_list, backends[b].name)) {
+                continue;
+            }
+            for (size_t i = 0; i < thread_count_count; i++) {
+                ok = run_one(dedup, dir, &trees[t], &totals, &backends[b], thread_counts[i]) && ok;
+            }
+        }
+    }
+
+    return ok ? 0 : 1;
+}
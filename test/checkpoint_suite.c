@@ -0,0 +1,98 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include <check.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../checkpoint.h"
+#include "test_utils.h"
+
+typedef struct ReplayedOrigins {
+    size_t count;
+    char path[PATH_MAX];
+    uint64_t clone_id;
+} ReplayedOrigins;
+
+static void collect_origin(const CheckpointOrigin* origin, void* context) {
+    ReplayedOrigins* origins = context;
+    origins->count++;
+    strlcpy(origins->path, origin->path, sizeof(origins->path));
+    origins->clone_id = origin->clone_id;
+}
+
+START_TEST(checkpoint_resumes_up_to_a_torn_record) {
+    char* dir = make_temp_dir("checkpoint");
+    char journal[PATH_MAX] = {0};
+    snprintf(journal, sizeof(journal), "%s/journal", dir);
+
+    Checkpoint* checkpoint = open_checkpoint(journal, "hash", 1, false, NULL, NULL);
+    ck_assert_ptr_nonnull(checkpoint);
+    CheckpointFile done = { .device = 1, .inode = 2, .size = 3, .mtime = { .tv_sec = 4, .tv_nsec = 5 } };
+    checkpoint_record_done(checkpoint, &done);
+    CheckpointOrigin origin = {
+        .signature = { .device = 1, .size = 1, .quick_hash = 7 },
+        .clone_id = 8,
+        .inode = 2,
+        .path = "/origin",
+    };
+    checkpoint_record_origin(checkpoint, &origin);
+    checkpoint_record_clone(checkpoint, "/origin", "/clone");
+    ck_assert(close_checkpoint(checkpoint));
+
+    // the rest of a record that was being written when the run died
+    int fd = open(journal, O_WRONLY | O_APPEND);
+    ck_assert_int_ge(fd, 0);
+    ck_assert_int_eq(12, write(fd, "torn record.", 12));
+    ck_assert_int_eq(0, close(fd));
+
+    ReplayedOrigins origins = { 0 };
+    checkpoint = open_checkpoint(journal, "hash", 1, true, collect_origin, &origins);
+    ck_assert_ptr_nonnull(checkpoint);
+    ck_assert_uint_eq(1, origins.count);
+    ck_assert_str_eq("/origin", origins.path);
+    ck_assert_uint_eq(8, origins.clone_id);
+    ck_assert_uint_eq(1, checkpoint_resumed_files(checkpoint));
+    ck_assert_uint_eq(1, checkpoint_resumed_clones(checkpoint));
+    ck_assert(checkpoint_is_done(checkpoint, &done));
+    CheckpointFile modified = done;
+    modified.mtime.tv_nsec++;
+    ck_assert(!checkpoint_is_done(checkpoint, &modified));
+
+    // held, a second run can't write to it
+    ck_assert_ptr_null(open_checkpoint(journal, "hash", 1, true, NULL, NULL));
+
+    // continues after the last intact record
+    checkpoint_record_done(checkpoint, &modified);
+    ck_assert(close_checkpoint(checkpoint));
+    checkpoint = open_checkpoint(journal, "hash", 1, true, NULL, NULL);
+    ck_assert_ptr_nonnull(checkpoint);
+    ck_assert_uint_eq(2, checkpoint_resumed_files(checkpoint));
+    ck_assert(close_checkpoint(checkpoint));
+
+    // another mode starts over
+    checkpoint = open_checkpoint(journal, "hash", 2, true, collect_origin, &origins);
+    ck_assert_ptr_nonnull(checkpoint);
+    ck_assert_uint_eq(0, checkpoint_resumed_files(checkpoint));
+    ck_assert_uint_eq(1, origins.count);
+    ck_assert(close_checkpoint(checkpoint));
+
+    ck_assert_int_eq(0, unlink(journal));
+    ck_assert_int_eq(0, rmdir(dir));
+    free(dir);
+} END_TEST
+
+Suite* checkpoint_suite(void) {
+    TCase* tc = tcase_create("checkpoint");
+    tcase_add_test(tc, checkpoint_resumes_up_to_a_torn_record);
+
+    Suite* s = suite_create("checkpoint");
+    suite_add_tcase(s, tc);
+    return s;
+}
@@ -26,12 +26,19 @@
 
 
 #include <sys/attr.h>
+#include <sys/stat.h>
 
 #include <check.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "../clone.h"
+#include "test_utils.h"
 
 START_TEST(clone_path_to_long) {
     char dest[PATH_MAX + 10] = { 0 };
@@ -67,6 +74,55 @@ START_TEST(clone_cannot_replace) {
     ck_assert_int_eq(r, 2);
 } END_TEST
 
+START_TEST(clone_at_name_too_long) {
+    char name[NAME_MAX + 1] = { 0 };
+    memset(name, 'x', NAME_MAX - 1);
+
+    // the staging file's prefix doesn't fit
+    int r = replace_with_clone_at(-1, -1, AT_FDCWD, name);
+    ck_assert_int_eq(r, ENAMETOOLONG);
+} END_TEST
+
+START_TEST(clone_at_bad_src) {
+    int dst_fd = open("test-data/clonefile/clone-dst-acls/bar", O_RDONLY);
+    ck_assert_int_ge(dst_fd, 0);
+    int r = replace_with_clone_at(-1, dst_fd, AT_FDCWD, "test-data-also-does-not-exist");
+    ck_assert_int_eq(r, -1);
+    close(dst_fd);
+} END_TEST
+
+START_TEST(clone_at_rejects_an_empty_clone) {
+    char* dir = make_temp_dir("clone-at-empty");
+    char src[PATH_MAX], dst[PATH_MAX];
+    snprintf(src, sizeof(src), "%s/src", dir);
+    snprintf(dst, sizeof(dst), "%s/dst", dir);
+    write_bytes(src, "", 0);
+    write_bytes(dst, "keep", 4);
+
+    int src_fd = open(src, O_RDONLY);
+    int dst_fd = open(dst, O_RDONLY);
+    int dir_fd = open(dir, O_RDONLY | O_DIRECTORY);
+    ck_assert_int_ge(src_fd, 0);
+    ck_assert_int_ge(dst_fd, 0);
+    ck_assert_int_ge(dir_fd, 0);
+
+    // the staging file is checked like replace_with_clone checks it, and
+    // removed, dst is left as it is
+    ck_assert_int_eq(ENOENT, replace_with_clone_at(src_fd, dst_fd, dir_fd, "dst"));
+    ck_assert_int_ne(0, faccessat(dir_fd, ".~.dst", F_OK, 0));
+    struct stat st;
+    ck_assert_int_eq(0, stat(dst, &st));
+    ck_assert_int_eq(4, st.st_size);
+
+    close(src_fd);
+    close(dst_fd);
+    close(dir_fd);
+    ck_assert_int_eq(0, unlink(src));
+    ck_assert_int_eq(0, unlink(dst));
+    ck_assert_int_eq(0, rmdir(dir));
+    free(dir);
+} END_TEST
+
 char* tmp_name(const char* restrict path, char* restrict out, size_t size);
 
 START_TEST(clone_tmp_name) {
@@ -119,6 +175,9 @@ Suite* clone_suite() {
     tcase_add_test(tc, clone_bad_src);
     tcase_add_test(tc, clone_bad_dst);
     tcase_add_test(tc, clone_cannot_replace);
+    tcase_add_test(tc, clone_at_name_too_long);
+    tcase_add_test(tc, clone_at_bad_src);
+    tcase_add_test(tc, clone_at_rejects_an_empty_clone);
     tcase_add_test(tc, clone_tmp_name);
     tcase_add_test(tc, clone_path_relative_to_test);
 
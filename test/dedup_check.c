@@ -33,6 +33,25 @@ Suite* dedup_link_suite();
 Suite* dedup_symlink_suite();
 Suite* signature_suite();
 Suite* runtime_dispatch_suite();
+Suite* exact_kernels_suite();
+Suite* group_verify_suite();
+Suite* arena_suite();
+Suite* seen_set_suite();
+Suite* metrics_suite();
+Suite* summary_suite();
+Suite* queue_suite();
+Suite* dir_handle_suite();
+Suite* spill_suite();
+Suite* map_suite();
+Suite* checkpoint_suite();
+Suite* watch_suite();
+Suite* device_limit_suite();
+Suite* libdedup_suite();
+Suite* link_cluster_suite();
+Suite* sig_cache_suite();
+Suite* walker_suite();
+Suite* size_gate_suite();
+Suite* file_handle_suite();
 
 int main() {
     SRunner* sr = srunner_create(NULL);
@@ -42,6 +61,25 @@ int main() {
     srunner_add_suite(sr, dedup_symlink_suite());
     srunner_add_suite(sr, signature_suite());
     srunner_add_suite(sr, runtime_dispatch_suite());
+    srunner_add_suite(sr, exact_kernels_suite());
+    srunner_add_suite(sr, group_verify_suite());
+    srunner_add_suite(sr, arena_suite());
+    srunner_add_suite(sr, seen_set_suite());
+    srunner_add_suite(sr, metrics_suite());
+    srunner_add_suite(sr, summary_suite());
+    srunner_add_suite(sr, queue_suite());
+    srunner_add_suite(sr, dir_handle_suite());
+    srunner_add_suite(sr, spill_suite());
+    srunner_add_suite(sr, map_suite());
+    srunner_add_suite(sr, checkpoint_suite());
+    srunner_add_suite(sr, watch_suite());
+    srunner_add_suite(sr, device_limit_suite());
+    srunner_add_suite(sr, libdedup_suite());
+    srunner_add_suite(sr, link_cluster_suite());
+    srunner_add_suite(sr, sig_cache_suite());
+    srunner_add_suite(sr, walker_suite());
+    srunner_add_suite(sr, size_gate_suite());
+    srunner_add_suite(sr, file_handle_suite());
 
     srunner_set_fork_status(sr, CK_NOFORK);
     srunner_run_all(sr, CK_VERBOSE);
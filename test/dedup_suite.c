@@ -27,11 +27,19 @@
 #include <sys/attr.h>
 #include <sys/stat.h>
 #include <sys/acl.h>
+#include <sys/wait.h>
 
 #include <check.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <util.h>
 
 #include "../utils.h"
 #include "test_utils.h"
@@ -186,6 +194,408 @@ START_TEST(dedup_permission_denied) {
     free(output);
 } END_TEST
 
+START_TEST(dedup_unordered_detects_duplicate_files) {
+    char* dir = make_temp_dir("unordered");
+    char a[PATH_MAX] = {0}, b[PATH_MAX] = {0}, c[PATH_MAX] = {0}, cmd[PATH_MAX * 2] = {0};
+    snprintf(a, sizeof(a), "%s/a", dir);
+    snprintf(b, sizeof(b), "%s/b", dir);
+    snprintf(c, sizeof(c), "%s/c", dir);
+    write_bytes(a, "same-data", 9);
+    write_bytes(b, "same-data", 9);
+    write_bytes(c, "diff-data", 9);
+
+    snprintf(cmd, sizeof(cmd), "../dedup -nPU -t4 %s", dir);
+    char* output = run(cmd);
+    ck_assert_ptr_nonnull(strstr(output, "duplicates found: 1\n"));
+    ck_assert_ptr_nonnull(strstr(output, "bytes saved: 9 bytes\n"));
+    free(output);
+
+    ck_assert_int_eq(0, unlink(a));
+    ck_assert_int_eq(0, unlink(b));
+    ck_assert_int_eq(0, unlink(c));
+    ck_assert_int_eq(0, rmdir(dir));
+    free(dir);
+} END_TEST
+
+START_TEST(dedup_parallel_walk_respects_depth) {
+    char* dir = make_temp_dir("walk");
+    char sub[PATH_MAX] = {0}, deeper[PATH_MAX] = {0};
+    char a[PATH_MAX] = {0}, b[PATH_MAX] = {0}, c[PATH_MAX] = {0}, cmd[PATH_MAX * 2] = {0};
+    snprintf(sub, sizeof(sub), "%s/sub", dir);
+    snprintf(deeper, sizeof(deeper), "%s/sub/deeper", dir);
+    snprintf(a, sizeof(a), "%s/a", dir);
+    snprintf(b, sizeof(b), "%s/sub/b", dir);
+    snprintf(c, sizeof(c), "%s/sub/deeper/c", dir);
+    ck_assert_int_eq(0, mkdir(sub, 0755));
+    ck_assert_int_eq(0, mkdir(deeper, 0755));
+    write_bytes(a, "walk-data", 9);
+    write_bytes(b, "walk-data", 9);
+    write_bytes(c, "walk-data", 9);
+
+    snprintf(cmd, sizeof(cmd), "../dedup -nP -t4 -d0 %s", dir);
+    char* output = run(cmd);
+    ck_assert_ptr_nonnull(strstr(output, "duplicates found: 0\n"));
+    free(output);
+
+    snprintf(cmd, sizeof(cmd), "../dedup -nP -t4 -d1 %s", dir);
+    output = run(cmd);
+    ck_assert_ptr_nonnull(strstr(output, "duplicates found: 1\n"));
+    free(output);
+
+    snprintf(cmd, sizeof(cmd), "../dedup -nP -t4 %s", dir);
+    output = run(cmd);
+    ck_assert_ptr_nonnull(strstr(output, "duplicates found: 2\n"));
+    ck_assert_ptr_nonnull(strstr(output, "bytes saved: 18 bytes\n"));
+    free(output);
+
+    ck_assert_int_eq(0, unlink(c));
+    ck_assert_int_eq(0, unlink(b));
+    ck_assert_int_eq(0, unlink(a));
+    ck_assert_int_eq(0, rmdir(deeper));
+    ck_assert_int_eq(0, rmdir(sub));
+    ck_assert_int_eq(0, rmdir(dir));
+    free(dir);
+} END_TEST
+
+START_TEST(dedup_cache_misses_modified_files) {
+    char* dir = make_temp_dir("cache");
+    char a[PATH_MAX] = {0}, b[PATH_MAX] = {0}, cache[PATH_MAX] = {0}, cmd[PATH_MAX * 3] = {0};
+    snprintf(a, sizeof(a), "%s/a", dir);
+    snprintf(b, sizeof(b), "%s/b", dir);
+    snprintf(cache, sizeof(cache), "%s.cache", dir);
+    write_bytes(a, "cache-data", 10);
+    write_bytes(b, "cache-data", 10);
+
+    snprintf(cmd, sizeof(cmd), "../dedup -nP -k %s %s", cache, dir);
+    char* output = run(cmd);
+    ck_assert_ptr_nonnull(strstr(output, "duplicates found: 1\n"));
+    free(output);
+
+    // served from the cache
+    output = run(cmd);
+    ck_assert_ptr_nonnull(strstr(output, "duplicates found: 1\n"));
+    ck_assert_ptr_nonnull(strstr(output, "bytes saved: 10 bytes\n"));
+    free(output);
+
+    // same size, new content, the stale record must not be used
+    write_bytes(b, "cache-diff", 10);
+    output = run(cmd);
+    ck_assert_ptr_nonnull(strstr(output, "duplicates found: 0\n"));
+    free(output);
+
+    ck_assert_int_eq(0, unlink(a));
+    ck_assert_int_eq(0, unlink(b));
+    ck_assert_int_eq(0, unlink(cache));
+    ck_assert_int_eq(0, rmdir(dir));
+    free(dir);
+} END_TEST
+
+START_TEST(dedup_verifies_signature_groups_together) {
+    char* dir = make_temp_dir("group");
+    char path[PATH_MAX] = {0}, cmd[PATH_MAX * 2] = {0};
+
+    const size_t size = 16384;
+    unsigned char* data = malloc(size);
+    ck_assert_ptr_nonnull(data);
+    memset(data, 'A', size);
+
+    // four copies and two near duplicates that share their signature
+    const char* names[] = { "a", "b", "c", "d", "near-1", "near-2" };
+    for (size_t i = 0; i < 6; i++) {
+        if (i == 4) {
+            data[7000] = 'B';
+        } else if (i == 5) {
+            data[12000] = 'C';
+        }
+        snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+        write_bytes(path, data, size);
+    }
+    free(data);
+
+    snprintf(cmd, sizeof(cmd), "../dedup -nP %s", dir);
+    char* output = run(cmd);
+    ck_assert_ptr_nonnull(strstr(output, "duplicates found: 3\n"));
+    free(output);
+
+    for (size_t i = 0; i < 6; i++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+        ck_assert_int_eq(0, unlink(path));
+    }
+    ck_assert_int_eq(0, rmdir(dir));
+    free(dir);
+} END_TEST
+
+START_TEST(dedup_read_ahead_depth_finds_the_same_duplicates) {
+    char* dir = make_temp_dir("readahead");
+    char paths[6][PATH_MAX] = {0};
+    char cmd[PATH_MAX * 2] = {0};
+    for (int i = 0; i < 6; i++) {
+        snprintf(paths[i], sizeof(paths[i]), "%s/%d", dir, i);
+        // four copies and two near copies, all of the same size
+        write_bytes(paths[i], i < 4 ? "read-ahead" : (i == 4 ? "read-aheaX" : "read-aheaY"), 10);
+    }
+
+    static const char* const depths[] = { "-Q0", "-Q1", "-Q32" };
+    for (size_t i = 0; i < sizeof(depths) / sizeof(depths[0]); i++) {
+        snprintf(cmd, sizeof(cmd), "../dedup -nP -t4 %s %s", depths[i], dir);
+        char* output = run(cmd);
+        ck_assert_ptr_nonnull(strstr(output, "duplicates found: 3\n"));
+        ck_assert_ptr_nonnull(strstr(output, "bytes saved: 30 bytes\n"));
+        free(output);
+    }
+
+    for (int i = 0; i < 6; i++) {
+        ck_assert_int_eq(0, unlink(paths[i]));
+    }
+    ck_assert_int_eq(0, rmdir(dir));
+    free(dir);
+} END_TEST
+
+START_TEST(dedup_parallel_pruners_skip_every_hardlink) {
+    char* dir = make_temp_dir("prune");
+    char paths[18][PATH_MAX] = {0};
+    char cmd[PATH_MAX * 2] = {0};
+    for (int i = 0; i < 18; i++) {
+        snprintf(paths[i], sizeof(paths[i]), "%s/%d", dir, i);
+    }
+    // one file with 15 more links to it, and two copies
+    write_bytes(paths[0], "pruned-data", 11);
+    for (int i = 1; i < 16; i++) {
+        ck_assert_int_eq(0, link(paths[0], paths[i]));
+    }
+    write_bytes(paths[16], "pruned-data", 11);
+    write_bytes(paths[17], "pruned-data", 11);
+
+    static const char* const threads[] = { "-t0", "-t1", "-t8" };
+    for (size_t i = 0; i < sizeof(threads) / sizeof(threads[0]); i++) {
+        snprintf(cmd, sizeof(cmd), "../dedup -nP %s %s", threads[i], dir);
+        char* output = run(cmd);
+        ck_assert_ptr_nonnull(strstr(output, "duplicates found: 2\n"));
+        free(output);
+    }
+
+    for (int i = 0; i < 18; i++) {
+        ck_assert_int_eq(0, unlink(paths[i]));
+    }
+    ck_assert_int_eq(0, rmdir(dir));
+    free(dir);
+} END_TEST
+
+START_TEST(dedup_memory_limit_spills_and_finds_the_same_duplicates) {
+    char* dir = make_temp_dir("spill");
+    char paths[6][PATH_MAX] = {0};
+    char cmd[PATH_MAX * 2] = {0};
+    for (int i = 0; i < 6; i++) {
+        snprintf(paths[i], sizeof(paths[i]), "%s/%d", dir, i);
+        // four copies and two near copies, all of the same size
+        write_bytes(paths[i], i < 4 ? "spill-copy" : (i == 4 ? "spill-copX" : "spill-copY"), 10);
+    }
+
+    // a byte leaves room for a single signature, the rest are spilled
+    static const char* const threads[] = { "-t0", "-t4" };
+    for (size_t i = 0; i < sizeof(threads) / sizeof(threads[0]); i++) {
+        snprintf(cmd, sizeof(cmd), "../dedup -nP -M1 %s %s", threads[i], dir);
+        char* output = run(cmd);
+        ck_assert_ptr_nonnull(strstr(output, "duplicates found: 3\n"));
+        ck_assert_ptr_nonnull(strstr(output, "bytes saved: 30 bytes\n"));
+        free(output);
+    }
+
+    for (int i = 0; i < 6; i++) {
+        ck_assert_int_eq(0, unlink(paths[i]));
+    }
+    ck_assert_int_eq(0, rmdir(dir));
+    free(dir);
+} END_TEST
+
+START_TEST(dedup_resume_skips_files_the_checkpoint_finished) {
+    char* dir = make_temp_dir("resume");
+    char* journal_dir = make_temp_dir("journal");
+    char paths[5][PATH_MAX] = {0};
+    char journal[PATH_MAX] = {0}, cmd[PATH_MAX * 3] = {0};
+    for (int i = 0; i < 5; i++) {
+        snprintf(paths[i], sizeof(paths[i]), "%s/%d", dir, i);
+    }
+    for (int i = 0; i < 4; i++) {
+        write_bytes(paths[i], "resumed", 7);
+    }
+    snprintf(journal, sizeof(journal), "%s/journal", journal_dir);
+
+    snprintf(cmd, sizeof(cmd), "../dedup -nP -t4 --checkpoint %s %s", journal, dir);
+    char* output = run(cmd);
+    ck_assert_ptr_nonnull(strstr(output, "duplicates found: 3\n"));
+    free(output);
+
+    // the finished files are skipped, a new copy is matched against the
+    // origin replayed from the journal
+    write_bytes(paths[4], "resumed", 7);
+    snprintf(cmd, sizeof(cmd), "../dedup -nP -t4 --checkpoint %s --resume %s", journal, dir);
+    output = run(cmd);
+    ck_assert_ptr_nonnull(strstr(output, "duplicates found: 1\n"));
+    free(output);
+
+    for (int i = 0; i < 5; i++) {
+        ck_assert_int_eq(0, unlink(paths[i]));
+    }
+    ck_assert_int_eq(0, unlink(journal));
+    ck_assert_int_eq(0, rmdir(journal_dir));
+    ck_assert_int_eq(0, rmdir(dir));
+    free(journal_dir);
+    free(dir);
+} END_TEST
+
+START_TEST(dedup_replaces_hardlinked_duplicates_with_all_their_links) {
+    char* dir = make_temp_dir("cluster");
+    char* outside = make_temp_dir("cluster-outside");
+    char x[PATH_MAX], x2[PATH_MAX], y[PATH_MAX], y2[PATH_MAX], z[PATH_MAX], z2[PATH_MAX];
+    char cmd[PATH_MAX * 2] = {0};
+    snprintf(x, sizeof(x), "%s/x", dir);
+    snprintf(x2, sizeof(x2), "%s/x2", dir);
+    snprintf(y, sizeof(y), "%s/y", dir);
+    snprintf(y2, sizeof(y2), "%s/y2", dir);
+    snprintf(z, sizeof(z), "%s/z", dir);
+    snprintf(z2, sizeof(z2), "%s/z2", outside);
+    // two files with both links in the scan, one with a link outside of it
+    write_bytes(x, "cluster-data", 12);
+    write_bytes(y, "cluster-data", 12);
+    write_bytes(z, "cluster-data", 12);
+    ck_assert_int_eq(0, link(x, x2));
+    ck_assert_int_eq(0, link(y, y2));
+    ck_assert_int_eq(0, link(z, z2));
+
+    snprintf(cmd, sizeof(cmd), "../dedup -t1 %s", dir);
+    free(run(cmd));
+
+    // whichever is the origin, x and y end up clones with their links intact
+    struct stat sx, sx2, sy, sy2, sz, sz2;
+    ck_assert_int_eq(0, lstat(x, &sx));
+    ck_assert_int_eq(0, lstat(x2, &sx2));
+    ck_assert_int_eq(0, lstat(y, &sy));
+    ck_assert_int_eq(0, lstat(y2, &sy2));
+    ck_assert_int_eq(0, lstat(z, &sz));
+    ck_assert_int_eq(0, lstat(z2, &sz2));
+    ck_assert_uint_eq(sx.st_ino, sx2.st_ino);
+    ck_assert_uint_eq(sy.st_ino, sy2.st_ino);
+    ck_assert_uint_eq(sz.st_ino, sz2.st_ino);
+    ck_assert_uint_eq(2, sx.st_nlink);
+    ck_assert_uint_eq(2, sy.st_nlink);
+    ck_assert_uint_ne(sx.st_ino, sy.st_ino);
+    ck_assert_uint_eq(get_clone_id(x), get_clone_id(y));
+
+    ck_assert_int_eq(0, unlink(x));
+    ck_assert_int_eq(0, unlink(x2));
+    ck_assert_int_eq(0, unlink(y));
+    ck_assert_int_eq(0, unlink(y2));
+    ck_assert_int_eq(0, unlink(z));
+    ck_assert_int_eq(0, unlink(z2));
+    ck_assert_int_eq(0, rmdir(dir));
+    ck_assert_int_eq(0, rmdir(outside));
+    free(dir);
+    free(outside);
+} END_TEST
+
+extern char** environ;
+
+START_TEST(dedup_watch_looks_at_files_changed_in_place) {
+    char* dir = make_temp_dir("watch-changed");
+    char real[PATH_MAX] = {0}, x[PATH_MAX], y[PATH_MAX];
+    ck_assert_ptr_nonnull(realpath(dir, real));
+    snprintf(x, sizeof(x), "%s/x", real);
+    snprintf(y, sizeof(y), "%s/y", real);
+    write_bytes(x, "watched-data-1", 14);
+    write_bytes(y, "watched-data-2", 14);
+
+    pid_t pid = 0;
+    char* const argv[] = { "../dedup", "--watch", "-P", "-t1", real, NULL };
+    ck_assert_int_eq(0, posix_spawn(&pid, argv[0], NULL, NULL, argv, environ));
+    sleep(1);
+
+    // y keeps its inode and clone id, but is a copy of x now
+    struct stat before, after;
+    ck_assert_int_eq(0, lstat(y, &before));
+    write_bytes(y, "watched-data-1", 14);
+    ck_assert_int_eq(0, lstat(y, &after));
+    ck_assert_uint_eq(before.st_ino, after.st_ino);
+
+    // settling takes 2 seconds, delivery about 1.5
+    bool cloned = false;
+    for (int i = 0; i < 80 && !cloned; i++) {
+        usleep(100000);
+        cloned = get_clone_id(x) == get_clone_id(y);
+    }
+    kill(pid, SIGINT);
+    int status = 0;
+    ck_assert_int_eq(pid, waitpid(pid, &status, 0));
+    ck_assert(cloned);
+
+    ck_assert_int_eq(0, unlink(x));
+    ck_assert_int_eq(0, unlink(y));
+    ck_assert_int_eq(0, rmdir(dir));
+    free(dir);
+} END_TEST
+
+START_TEST(dedup_draws_the_status_line_only_on_a_terminal) {
+    char* dir = make_temp_dir("status");
+    char real[PATH_MAX] = {0}, a[PATH_MAX], out[PATH_MAX];
+    ck_assert_ptr_nonnull(realpath(dir, real));
+    snprintf(a, sizeof(a), "%s/a", real);
+    snprintf(out, sizeof(out), "%s.out", real);
+    write_bytes(a, "status-data", 11);
+
+    // --watch keeps running for as many frames as it is given
+    char* const argv[] = { "../dedup", "--watch", "-t1", real, NULL };
+
+    posix_spawn_file_actions_t actions;
+    ck_assert_int_eq(0, posix_spawn_file_actions_init(&actions));
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, out, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+    pid_t pid = 0;
+    ck_assert_int_eq(0, posix_spawn(&pid, argv[0], &actions, NULL, argv, environ));
+    posix_spawn_file_actions_destroy(&actions);
+    sleep(1);
+    kill(pid, SIGINT);
+    int status = 0;
+    ck_assert_int_eq(pid, waitpid(pid, &status, 0));
+
+    char seen[8192] = {0};
+    FILE* f = fopen(out, "r");
+    ck_assert_ptr_nonnull(f);
+    ck_assert_uint_lt(fread(seen, 1, sizeof(seen) - 1, f), sizeof(seen));
+    fclose(f);
+    ck_assert_ptr_null(strstr(seen, "WALK/s"));
+    ck_assert_ptr_null(strchr(seen, '\r'));
+    ck_assert_int_eq(0, unlink(out));
+
+    // on a terminal the header is drawn, then the line with the rates
+    int master = -1;
+    pid = forkpty(&master, NULL, NULL, NULL);
+    ck_assert_int_ge(pid, 0);
+    if (pid == 0) {
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    memset(seen, 0, sizeof(seen));
+    size_t len = 0;
+    bool drawn = false;
+    for (int i = 0; i < 30 && !drawn && len < sizeof(seen) - 1; i++) {
+        struct pollfd pfd = { .fd = master, .events = POLLIN };
+        if (poll(&pfd, 1, 100) > 0) {
+            ssize_t n = read(master, seen + len, sizeof(seen) - 1 - len);
+            len += n > 0 ? (size_t)n : 0;
+        }
+        const char* header = strstr(seen, "PATH");
+        drawn = header && strstr(header, "/s ");
+    }
+    kill(pid, SIGINT);
+    ck_assert_int_eq(pid, waitpid(pid, &status, 0));
+    close(master);
+    ck_assert(drawn);
+
+    ck_assert_int_eq(0, unlink(a));
+    ck_assert_int_eq(0, rmdir(dir));
+    free(dir);
+} END_TEST
+
 Suite* dedup_suite() {
     TCase* tc = tcase_create("dedup");
     tcase_add_test(tc, dedup_empty);
@@ -201,9 +611,25 @@ Suite* dedup_suite() {
     tcase_add_test(tc, dedup_help);
     tcase_add_test(tc, dedup_dry_run);
     tcase_add_test(tc, dedup_permission_denied);
+    tcase_add_test(tc, dedup_unordered_detects_duplicate_files);
+    tcase_add_test(tc, dedup_parallel_walk_respects_depth);
+    tcase_add_test(tc, dedup_cache_misses_modified_files);
+    tcase_add_test(tc, dedup_verifies_signature_groups_together);
+    tcase_add_test(tc, dedup_read_ahead_depth_finds_the_same_duplicates);
+    tcase_add_test(tc, dedup_parallel_pruners_skip_every_hardlink);
+    tcase_add_test(tc, dedup_memory_limit_spills_and_finds_the_same_duplicates);
+    tcase_add_test(tc, dedup_resume_skips_files_the_checkpoint_finished);
+    tcase_add_test(tc, dedup_replaces_hardlinked_duplicates_with_all_their_links);
+
+    // waits for --watch to settle
+    TCase* watch = tcase_create("dedup-watch");
+    tcase_set_timeout(watch, 15);
+    tcase_add_test(watch, dedup_watch_looks_at_files_changed_in_place);
+    tcase_add_test(watch, dedup_draws_the_status_line_only_on_a_terminal);
 
     Suite* s = suite_create("dedup");
     suite_add_tcase(s, tc);
+    suite_add_tcase(s, watch);
 
     return s;
 }
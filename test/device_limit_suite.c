@@ -0,0 +1,73 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include <check.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "../device_limit.h"
+#include "../queue.h"
+
+START_TEST(device_limits_park_entries_past_the_limit) {
+    DeviceLimitConfig config = device_limit_defaults();
+    ck_assert(device_limit_parse("hdd=1,network=8", &config));
+    ck_assert_uint_eq(1, config.threads[DEVICE_ROTATIONAL]);
+    ck_assert_uint_eq(8, config.threads[DEVICE_NETWORK]);
+    ck_assert_uint_eq(0, config.threads[DEVICE_SOLID_STATE]);
+    ck_assert(!device_limit_parse("floppy=1", &config));
+    ck_assert(!device_limit_parse("hdd=", &config));
+    ck_assert(!device_limit_parse("hdd=1;ssd=2", &config));
+
+    // whatever /tmp is on gets a single thread
+    ck_assert(device_limit_parse("ssd=1,hdd=1,network=1", &config));
+    DeviceLimits* limits = new_device_limits(&config);
+    ck_assert_ptr_nonnull(limits);
+    struct stat st = {0};
+    ck_assert_int_eq(0, stat("/tmp", &st));
+
+    FileEntry* entries[4];
+    for (int i = 0; i < 4; i++) {
+        entries[i] = new_file_entry("/tmp/entry", st.st_dev, (ino_t)i, 1, 0, 1, (uint64_t)i, 0, 0);
+        ck_assert_ptr_nonnull(entries[i]);
+    }
+    // devices that weren't added aren't limited
+    ck_assert(device_limits_enter(limits, DEVICE_LANE_READ, entries[0]));
+    ck_assert(device_limits_enter(limits, DEVICE_LANE_READ, entries[1]));
+    ck_assert_ptr_null(device_limits_leave(limits, DEVICE_LANE_READ, st.st_dev));
+    ck_assert_ptr_null(device_limits_leave(limits, DEVICE_LANE_READ, st.st_dev));
+
+    DeviceKind kind = DEVICE_KIND_COUNT;
+    ck_assert(device_limits_add(limits, st.st_dev, "/tmp", &kind));
+    ck_assert_int_lt(kind, DEVICE_KIND_COUNT);
+    ck_assert(!device_limits_add(limits, st.st_dev, "/tmp", &kind));
+
+    ck_assert(device_limits_enter(limits, DEVICE_LANE_READ, entries[0]));
+    ck_assert(!device_limits_enter(limits, DEVICE_LANE_READ, entries[1]));
+    ck_assert(!device_limits_enter(limits, DEVICE_LANE_READ, entries[2]));
+    // lanes are limited on their own
+    ck_assert(device_limits_enter(limits, DEVICE_LANE_VISIT, entries[3]));
+    ck_assert_ptr_null(device_limits_leave(limits, DEVICE_LANE_VISIT, st.st_dev));
+
+    // the parked entries are handed out in order, then the device is free
+    ck_assert_ptr_eq(entries[1], device_limits_leave(limits, DEVICE_LANE_READ, st.st_dev));
+    ck_assert_ptr_eq(entries[2], device_limits_leave(limits, DEVICE_LANE_READ, st.st_dev));
+    ck_assert_ptr_null(device_limits_leave(limits, DEVICE_LANE_READ, st.st_dev));
+    ck_assert(device_limits_enter(limits, DEVICE_LANE_READ, entries[3]));
+
+    // one left parked is freed with the limits
+    ck_assert(!device_limits_enter(limits, DEVICE_LANE_READ, entries[2]));
+    free_device_limits(limits);
+    file_entry_free(entries[0]);
+    file_entry_free(entries[1]);
+    file_entry_free(entries[3]);
+} END_TEST
+
+Suite* device_limit_suite(void) {
+    TCase* tc = tcase_create("device_limit");
+    tcase_add_test(tc, device_limits_park_entries_past_the_limit);
+
+    Suite* s = suite_create("device_limit");
+    suite_add_tcase(s, tc);
+    return s;
+}
@@ -0,0 +1,63 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include <check.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../dir_handle.h"
+#include "../file_handle.h"
+#include "test_utils.h"
+
+START_TEST(dir_handles_open_files_by_name_up_to_the_limit) {
+    char* dir = make_temp_dir("dir-handle");
+    char path[PATH_MAX] = {0};
+    snprintf(path, sizeof(path), "%s/a", dir);
+    write_bytes(path, "dir-handle", 10);
+
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    ck_assert_int_ge(fd, 0);
+    dir_handle_set_limit(2);
+    DirHandle* first = new_dir_handle(fd);
+    DirHandle* second = new_dir_handle(fd);
+    ck_assert_ptr_nonnull(first);
+    ck_assert_ptr_nonnull(second);
+    ck_assert_ptr_null(new_dir_handle(fd));
+    close(fd);
+
+    // the handles outlive the descriptor they were made from
+    FileHandle* handle = file_handle_acquire_at(NULL, dir_handle_fd(first), "a", path);
+    ck_assert_ptr_nonnull(handle);
+    ck_assert_str_eq(path, handle->path);
+    ck_assert_int_eq(10, handle->stat.st_size);
+    file_handle_release(NULL, handle);
+
+    // a retained handle stays open until its last release
+    ck_assert_ptr_eq(first, dir_handle_retain(first));
+    dir_handle_release(first);
+    dir_handle_release(second);
+    ck_assert_int_eq(0, faccessat(dir_handle_fd(first), "a", R_OK, 0));
+    DirHandle* third = new_dir_handle(dir_handle_fd(first));
+    ck_assert_ptr_nonnull(third);
+    dir_handle_release(first);
+    dir_handle_release(third);
+    dir_handle_set_limit(0);
+
+    ck_assert_int_eq(AT_FDCWD, dir_handle_fd(NULL));
+    ck_assert_int_eq(0, unlink(path));
+    ck_assert_int_eq(0, rmdir(dir));
+    free(dir);
+} END_TEST
+
+Suite* dir_handle_suite(void) {
+    TCase* tc = tcase_create("dir_handle");
+    tcase_add_test(tc, dir_handles_open_files_by_name_up_to_the_limit);
+
+    Suite* s = suite_create("dir_handle");
+    suite_add_tcase(s, tc);
+    return s;
+}
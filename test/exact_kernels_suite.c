@@ -0,0 +1,55 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include <check.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../exact_kernels.h"
+
+START_TEST(exact_kernels_find_every_difference) {
+    exact_kernel_fn kernels[4] = { exact_kernel_memcmp, exact_kernel_xor_or };
+    size_t kernel_count = 2;
+    if (exact_kernel_neon_unrolled_supported()) {
+        kernels[kernel_count++] = exact_kernel_neon_unrolled;
+    }
+    if (exact_kernel_avx2_unrolled_supported()) {
+        kernels[kernel_count++] = exact_kernel_avx2_unrolled;
+    }
+
+    // long enough for a full check interval of the unrolled kernels plus a
+    // partial one and a tail
+    const size_t size = 2 * 1024 + 128 + 37;
+    unsigned char* a = malloc(size);
+    unsigned char* b = malloc(size);
+    ck_assert_ptr_nonnull(a);
+    ck_assert_ptr_nonnull(b);
+    for (size_t i = 0; i < size; i++) {
+        a[i] = (unsigned char)(i * 31 + 7);
+    }
+    memcpy(b, a, size);
+
+    for (size_t k = 0; k < kernel_count; k++) {
+        for (size_t len = 0; len <= size; len += 61) {
+            ck_assert(kernels[k](a, b, len));
+        }
+        for (size_t i = 0; i < size; i++) {
+            b[i] ^= 0x10;
+            ck_assert(!kernels[k](a, b, size));
+            b[i] = a[i];
+        }
+    }
+
+    free(a);
+    free(b);
+} END_TEST
+
+Suite* exact_kernels_suite(void) {
+    TCase* tc = tcase_create("exact_kernels");
+    tcase_add_test(tc, exact_kernels_find_every_difference);
+
+    Suite* s = suite_create("exact_kernels");
+    suite_add_tcase(s, tc);
+    return s;
+}
@@ -0,0 +1,142 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include <check.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../file_handle.h"
+#include "../signature.h"
+#include "test_utils.h"
+
+static bool fd_open(int fd) {
+    return fcntl(fd, F_GETFD) != -1;
+}
+
+START_TEST(file_handle_cache_reuses_released_handles) {
+    char* dir = make_temp_dir("file-handle");
+    char a[PATH_MAX], b[PATH_MAX];
+    snprintf(a, sizeof(a), "%s/a", dir);
+    snprintf(b, sizeof(b), "%s/b", dir);
+    write_bytes(a, "aaaa", 4);
+    write_bytes(b, "bb", 2);
+
+    FileHandleCache* cache = new_file_handle_cache(1);
+    ck_assert_ptr_nonnull(cache);
+
+    // the next stage gets the descriptor the previous one opened
+    FileHandle* ha = file_handle_acquire(cache, a);
+    ck_assert_ptr_nonnull(ha);
+    int fd = ha->fd;
+    ck_assert_int_eq(4, ha->stat.st_size);
+    file_handle_release(cache, ha);
+    ck_assert(fd_open(fd));
+    ha = file_handle_acquire(cache, a);
+    ck_assert_int_eq(fd, ha->fd);
+
+    // handles in use are kept past the limit, idle ones are closed
+    FileHandle* hb = file_handle_acquire(cache, b);
+    ck_assert_ptr_nonnull(hb);
+    ck_assert_int_eq(2, hb->stat.st_size);
+    ck_assert(fd_open(fd));
+    file_handle_release(cache, hb);
+    file_handle_release(cache, ha);
+    hb = file_handle_acquire(cache, b);
+    ck_assert_ptr_nonnull(hb);
+    ck_assert(!fd_open(fd));
+    file_handle_release(cache, hb);
+
+    free_file_handle_cache(cache);
+    ck_assert_int_eq(0, unlink(b));
+    ck_assert_int_eq(0, unlink(a));
+    ck_assert_int_eq(0, rmdir(dir));
+    free(dir);
+} END_TEST
+
+START_TEST(file_handle_forget_drops_the_replaced_file) {
+    char* dir = make_temp_dir("file-handle-forget");
+    char a[PATH_MAX];
+    snprintf(a, sizeof(a), "%s/a", dir);
+    write_bytes(a, "old", 3);
+
+    FileHandleCache* cache = new_file_handle_cache(4);
+    ck_assert_ptr_nonnull(cache);
+    FileHandle* old = file_handle_acquire(cache, a);
+    ck_assert_ptr_nonnull(old);
+    ino_t old_inode = old->stat.st_ino;
+
+    // forgotten while in use, it still reads the old file until released
+    ck_assert_int_eq(0, unlink(a));
+    write_bytes(a, "newer", 5);
+    file_handle_forget(cache, a);
+    char buf[8] = {0};
+    ck_assert_int_eq(3, pread(old->fd, buf, sizeof(buf), 0));
+    ck_assert_str_eq("old", buf);
+    int fd = old->fd;
+    file_handle_release(cache, old);
+    ck_assert(!fd_open(fd));
+
+    FileHandle* fresh = file_handle_acquire(cache, a);
+    ck_assert_ptr_nonnull(fresh);
+    ck_assert_uint_ne(old_inode, fresh->stat.st_ino);
+    ck_assert_int_eq(5, fresh->stat.st_size);
+    file_handle_release(cache, fresh);
+
+    free_file_handle_cache(cache);
+    ck_assert_int_eq(0, unlink(a));
+    ck_assert_int_eq(0, rmdir(dir));
+    free(dir);
+} END_TEST
+
+START_TEST(file_handle_cache_reopens_a_file_that_grew) {
+    char* dir = make_temp_dir("file-handle-grown");
+    char a[PATH_MAX], b[PATH_MAX];
+    snprintf(a, sizeof(a), "%s/a", dir);
+    snprintf(b, sizeof(b), "%s/b", dir);
+    write_bytes(a, "same", 4);
+    write_bytes(b, "same", 4);
+
+    FileHandleCache* cache = new_file_handle_cache(4);
+    ck_assert_ptr_nonnull(cache);
+    FileHandle* ha = file_handle_acquire(cache, a);
+    FileHandle* hb = file_handle_acquire(cache, b);
+    ck_assert_ptr_nonnull(ha);
+    ck_assert_ptr_nonnull(hb);
+    ck_assert(handles_match_exact_memcmp(ha, hb));
+    file_handle_release(cache, ha);
+
+    // the origin grows in place while its handle is cached, b still
+    // matches what it was
+    int fd = open(a, O_WRONLY | O_APPEND);
+    ck_assert_int_ge(fd, 0);
+    ck_assert_int_eq(4, write(fd, "more", 4));
+    ck_assert_int_eq(0, close(fd));
+
+    ha = file_handle_acquire(cache, a);
+    ck_assert_ptr_nonnull(ha);
+    ck_assert_int_eq(8, ha->stat.st_size);
+    ck_assert(!handles_match_exact_memcmp(ha, hb));
+    file_handle_release(cache, ha);
+    file_handle_release(cache, hb);
+
+    free_file_handle_cache(cache);
+    ck_assert_int_eq(0, unlink(b));
+    ck_assert_int_eq(0, unlink(a));
+    ck_assert_int_eq(0, rmdir(dir));
+    free(dir);
+} END_TEST
+
+Suite* file_handle_suite(void) {
+    TCase* tc = tcase_create("file_handle");
+    tcase_add_test(tc, file_handle_cache_reuses_released_handles);
+    tcase_add_test(tc, file_handle_forget_drops_the_replaced_file);
+    tcase_add_test(tc, file_handle_cache_reopens_a_file_that_grew);
+
+    Suite* s = suite_create("file_handle");
+    suite_add_tcase(s, tc);
+    return s;
+}
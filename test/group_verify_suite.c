@@ -0,0 +1,78 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include <check.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../group_verify.h"
+#include "test_utils.h"
+
+START_TEST(group_verdict_splits_members_into_identical_classes) {
+    char* dir = make_temp_dir("verdict");
+    char paths[6][PATH_MAX] = {{0}};
+    const char* members[6];
+
+    // several tiles long, with differences in the first, a middle and the
+    // last tile
+    const size_t size = 2 * 1024 * 1024 + 123;
+    unsigned char* data = malloc(size);
+    ck_assert_ptr_nonnull(data);
+    for (size_t i = 0; i < size; i++) {
+        data[i] = (unsigned char)(i * 31 + 7);
+    }
+
+    const char* names[] = { "a", "b", "last", "middle", "last-copy", "missing" };
+    for (size_t i = 0; i < 6; i++) {
+        snprintf(paths[i], sizeof(paths[i]), "%s/%s", dir, names[i]);
+        members[i] = paths[i];
+    }
+    write_bytes(paths[0], data, size);
+    write_bytes(paths[1], data, size);
+    data[size - 1] ^= 1;
+    write_bytes(paths[2], data, size);
+    write_bytes(paths[4], data, size);
+    data[size - 1] ^= 1;
+    data[1024 * 1024 + 5] ^= 1;
+    write_bytes(paths[3], data, size);
+    free(data);
+
+    GroupVerdict* verdict = new_group_verdict(NULL, members, 6, size);
+    ck_assert_ptr_nonnull(verdict);
+
+    bool equal = false;
+    ck_assert(group_verdict_lookup(verdict, paths[0], paths[1], &equal));
+    ck_assert(equal);
+    ck_assert(group_verdict_lookup(verdict, paths[2], paths[4], &equal));
+    ck_assert(equal);
+    ck_assert(group_verdict_lookup(verdict, paths[0], paths[2], &equal));
+    ck_assert(!equal);
+    ck_assert(group_verdict_lookup(verdict, paths[0], paths[3], &equal));
+    ck_assert(!equal);
+    ck_assert(group_verdict_lookup(verdict, paths[3], paths[4], &equal));
+    ck_assert(!equal);
+
+    // unreadable members match nothing, unknown paths are left to the caller
+    ck_assert(group_verdict_lookup(verdict, paths[5], paths[0], &equal));
+    ck_assert(!equal);
+    ck_assert(!group_verdict_lookup(verdict, paths[0], "/nonexistent", &equal));
+    free_group_verdict(verdict);
+
+    for (size_t i = 0; i < 5; i++) {
+        ck_assert_int_eq(0, unlink(paths[i]));
+    }
+    ck_assert_int_eq(0, rmdir(dir));
+    free(dir);
+} END_TEST
+
+Suite* group_verify_suite(void) {
+    TCase* tc = tcase_create("group_verify");
+    tcase_add_test(tc, group_verdict_splits_members_into_identical_classes);
+
+    Suite* s = suite_create("group_verify");
+    suite_add_tcase(s, tc);
+    return s;
+}
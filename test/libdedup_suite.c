@@ -0,0 +1,125 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include <check.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/clonefile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../libdedup.h"
+#include "test_utils.h"
+
+typedef struct ScanEvents {
+    size_t count;
+    DedupScanEventKind kind;
+    char path[PATH_MAX];
+    char origin[PATH_MAX];
+} ScanEvents;
+
+static void record_scan_event(const DedupScanEvent* event, void* context) {
+    ScanEvents* events = context;
+    events->count++;
+    events->kind = event->kind;
+    strlcpy(events->path, event->path, sizeof(events->path));
+    strlcpy(events->origin, event->origin, sizeof(events->origin));
+}
+
+START_TEST(dedup_scan_reports_duplicates_of_the_records_fed_in) {
+    char* dir = make_temp_dir("scan");
+    char a[PATH_MAX], b[PATH_MAX], c[PATH_MAX], d[PATH_MAX], linked[PATH_MAX];
+    snprintf(a, sizeof(a), "%s/a", dir);
+    snprintf(b, sizeof(b), "%s/b", dir);
+    snprintf(c, sizeof(c), "%s/c", dir);
+    snprintf(d, sizeof(d), "%s/d", dir);
+    snprintf(linked, sizeof(linked), "%s/link", dir);
+    write_bytes(a, "same-data", 9);
+    write_bytes(b, "same-data", 9);
+    write_bytes(c, "diff-data", 9);
+    write_bytes(d, "unique", 6);
+    ck_assert_int_eq(0, link(a, linked));
+
+    ScanEvents events = {0};
+    DedupScanOptions options = { .fn = record_scan_event, .context = &events };
+    DedupScan* scan = new_dedup_scan(&options);
+    ck_assert_ptr_nonnull(scan);
+
+    // the hard link of a is skipped, the directory isn't a file
+    const char* const records[] = { a, d, linked, c, b, dir };
+    for (size_t i = 0; i < sizeof(records) / sizeof(records[0]); i++) {
+        struct stat st;
+        ck_assert_int_eq(0, lstat(records[i], &st));
+        ck_assert(dedup_scan_add(scan, records[i], &st));
+    }
+    free_dedup_scan(scan);
+
+    ck_assert_uint_eq(1, events.count);
+    ck_assert_int_eq(DEDUP_SCAN_DUPLICATE, events.kind);
+    ck_assert_str_eq(b, events.path);
+    ck_assert_str_eq(a, events.origin);
+
+    ck_assert_int_eq(0, unlink(a));
+    ck_assert_int_eq(0, unlink(b));
+    ck_assert_int_eq(0, unlink(c));
+    ck_assert_int_eq(0, unlink(d));
+    ck_assert_int_eq(0, unlink(linked));
+    ck_assert_int_eq(0, rmdir(dir));
+    free(dir);
+} END_TEST
+
+START_TEST(dedup_scan_keeps_clone_ids_of_other_devices_apart) {
+    char* dir = make_temp_dir("scan-devices");
+    char a[PATH_MAX], other[PATH_MAX], b[PATH_MAX], c[PATH_MAX];
+    snprintf(a, sizeof(a), "%s/a", dir);
+    snprintf(other, sizeof(other), "%s/other", dir);
+    snprintf(b, sizeof(b), "%s/b", dir);
+    snprintf(c, sizeof(c), "%s/c", dir);
+    write_bytes(a, "shared-data", 11);
+    write_bytes(other, "other-data!", 11);
+    ck_assert_int_eq(0, clonefile(a, b, 0));
+    write_bytes(c, "shared-data", 11);
+
+    ScanEvents events = {0};
+    DedupScanOptions options = { .fn = record_scan_event, .context = &events };
+    DedupScan* scan = new_dedup_scan(&options);
+    ck_assert_ptr_nonnull(scan);
+
+    // b and c are recorded as files of another volume, b has the clone id
+    // of a but isn't a clone of anything on its own volume
+    const char* const records[] = { a, other, b, c };
+    for (size_t i = 0; i < sizeof(records) / sizeof(records[0]); i++) {
+        struct stat st;
+        ck_assert_int_eq(0, lstat(records[i], &st));
+        if (i >= 2) {
+            st.st_dev++;
+        }
+        ck_assert(dedup_scan_add(scan, records[i], &st));
+    }
+    free_dedup_scan(scan);
+
+    ck_assert_uint_eq(1, events.count);
+    ck_assert_int_eq(DEDUP_SCAN_DUPLICATE, events.kind);
+    ck_assert_str_eq(c, events.path);
+    ck_assert_str_eq(b, events.origin);
+
+    ck_assert_int_eq(0, unlink(a));
+    ck_assert_int_eq(0, unlink(other));
+    ck_assert_int_eq(0, unlink(b));
+    ck_assert_int_eq(0, unlink(c));
+    ck_assert_int_eq(0, rmdir(dir));
+    free(dir);
+} END_TEST
+
+Suite* libdedup_suite(void) {
+    TCase* tc = tcase_create("libdedup");
+    tcase_add_test(tc, dedup_scan_reports_duplicates_of_the_records_fed_in);
+    tcase_add_test(tc, dedup_scan_keeps_clone_ids_of_other_devices_apart);
+
+    Suite* s = suite_create("libdedup");
+    suite_add_tcase(s, tc);
+    return s;
+}
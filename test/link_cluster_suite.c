@@ -0,0 +1,52 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include <check.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+#include "../link_cluster.h"
+
+static void count_deferred_cluster(const LinkCluster* cluster, void* context) {
+    size_t* complete = context;
+    if (link_cluster_complete(cluster)) {
+        (*complete)++;
+    }
+}
+
+START_TEST(link_clusters_are_complete_once_every_link_is_added) {
+    LinkClusters* clusters = new_link_clusters(0);
+    ck_assert_ptr_nonnull(clusters);
+
+    struct stat two = { .st_dev = 1, .st_ino = 10, .st_nlink = 2, .st_size = 8 };
+    struct stat three = { .st_dev = 1, .st_ino = 11, .st_nlink = 3, .st_size = 8 };
+    struct stat one = { .st_dev = 1, .st_ino = 12, .st_nlink = 1, .st_size = 8 };
+    ck_assert(link_clusters_add(clusters, &two, "/a/two", NULL, NULL));
+    // a directory walked again by --watch adds its links again
+    ck_assert(link_clusters_add(clusters, &two, "/a/two", NULL, NULL));
+    ck_assert(link_clusters_add(clusters, &two, "/b/two", NULL, NULL));
+    ck_assert(link_clusters_add(clusters, &three, "/a/three", NULL, NULL));
+    ck_assert(link_clusters_add(clusters, &three, "/b/three", NULL, NULL));
+    ck_assert(!link_clusters_add(clusters, &one, "/a/one", NULL, NULL));
+
+    // same inode on another device
+    ck_assert(!link_clusters_defer(clusters, 2, 10, "/origin", 0));
+    ck_assert(!link_clusters_defer(clusters, 1, 12, "/origin", 0));
+    ck_assert(link_clusters_defer(clusters, 1, 10, "/origin", 0));
+    ck_assert(link_clusters_defer(clusters, 1, 11, "/origin", 0));
+
+    size_t complete = 0;
+    ck_assert_uint_eq(2, link_clusters_each_deferred(clusters, count_deferred_cluster, &complete));
+    ck_assert_uint_eq(1, complete);
+    free_link_clusters(clusters);
+} END_TEST
+
+Suite* link_cluster_suite(void) {
+    TCase* tc = tcase_create("link_cluster");
+    tcase_add_test(tc, link_clusters_are_complete_once_every_link_is_added);
+
+    Suite* s = suite_create("link_cluster");
+    suite_add_tcase(s, tc);
+    return s;
+}
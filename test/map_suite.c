@@ -0,0 +1,70 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include <check.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../map.h"
+#include "test_utils.h"
+
+// larger than the window files are hashed through
+#define VISITED_FILE_SIZE ((3U << 20) / 2)
+
+START_TEST(visited_tree_hashes_files_larger_than_its_window) {
+    char* dir = make_temp_dir("visited");
+    char* data = malloc(VISITED_FILE_SIZE);
+    ck_assert_ptr_nonnull(data);
+    for (size_t i = 0; i < VISITED_FILE_SIZE; i++) {
+        data[i] = (char)('a' + i % 26);
+    }
+
+    // two copies, and one that only differs past the first window
+    char paths[3][PATH_MAX];
+    for (size_t i = 0; i < 3; i++) {
+        snprintf(paths[i], sizeof(paths[i]), "%s/%zu", dir, i);
+        if (i == 2) {
+            data[VISITED_FILE_SIZE - 2] ^= 1;
+        }
+        write_bytes(paths[i], data, VISITED_FILE_SIZE);
+    }
+
+    rb_tree_t* tree = new_visited_tree();
+    ck_assert_ptr_nonnull(tree);
+    FileMetadata* matches[3];
+    for (size_t i = 0; i < 3; i++) {
+        FileMetadata fm = {
+            .device = 1,
+            .size = VISITED_FILE_SIZE,
+            .path = paths[i],
+            .first = data[0],
+            .last = data[VISITED_FILE_SIZE - 1],
+        };
+        matches[i] = visited_tree_insert(tree, &fm);
+    }
+    ck_assert_ptr_null(matches[0]);
+    ck_assert_ptr_nonnull(matches[1]);
+    ck_assert_str_eq(paths[0], matches[1]->path);
+    ck_assert_ptr_null(matches[2]);
+    free_visited_tree(tree);
+
+    for (size_t i = 0; i < 3; i++) {
+        ck_assert_int_eq(0, unlink(paths[i]));
+    }
+    free(data);
+    ck_assert_int_eq(0, rmdir(dir));
+    free(dir);
+} END_TEST
+
+Suite* map_suite(void) {
+    TCase* tc = tcase_create("map");
+    tcase_add_test(tc, visited_tree_hashes_files_larger_than_its_window);
+
+    Suite* s = suite_create("map");
+    suite_add_tcase(s, tc);
+    return s;
+}
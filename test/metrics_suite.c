@@ -0,0 +1,75 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include <check.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../metrics.h"
+
+START_TEST(stage_timings_count_every_call) {
+    stage_reset_for_tests();
+    for (int i = 0; i < 10; i++) {
+        uint64_t start = stage_clock();
+        usleep(1000);
+        stage_record(STAGE_EXACT, start);
+    }
+
+    StageReport report;
+    stage_report(STAGE_EXACT, &report);
+    ck_assert_uint_eq(10, report.calls);
+    ck_assert_uint_ge(report.total_ns, 10U * 1000U * 1000U);
+    // bucket bounds are within 2x of the real durations
+    ck_assert_uint_ge(report.p50_ns, 1000U * 1000U);
+    ck_assert_uint_le(report.p50_ns, report.p99_ns);
+    ck_assert_uint_le(report.p99_ns, report.max_ns);
+
+    stage_report(STAGE_REPLACE, &report);
+    ck_assert_uint_eq(0, report.calls);
+    stage_reset_for_tests();
+} END_TEST
+
+static Metrics test_metrics;
+
+static void* count_metrics(void* arg) {
+    for (int i = 0; i < 100000; i++) {
+        metrics_add(&test_metrics, METRIC_FOUND, 1);
+        metrics_add(&test_metrics, METRIC_SAVED, 4096);
+    }
+    // entries queued on one thread are taken off on another
+    metrics_add(&test_metrics, METRIC_QUEUED, arg ? 3 : -3);
+    return NULL;
+}
+
+START_TEST(metrics_sum_counts_every_thread) {
+    memset(&test_metrics, 0, sizeof(test_metrics));
+    pthread_t threads[8];
+    for (uintptr_t i = 0; i < 8; i++) {
+        ck_assert_int_eq(0, pthread_create(&threads[i], NULL, count_metrics, (void*)(i % 2)));
+    }
+    for (size_t i = 0; i < 8; i++) {
+        ck_assert_int_eq(0, pthread_join(threads[i], NULL));
+    }
+
+    ck_assert_uint_eq(8U * 100000U, metrics_sum(&test_metrics, METRIC_FOUND));
+    ck_assert_uint_eq(8U * 100000U * 4096U, metrics_sum(&test_metrics, METRIC_SAVED));
+    ck_assert_uint_eq(0, metrics_sum(&test_metrics, METRIC_QUEUED));
+    ck_assert_uint_eq(0, metrics_sum(&test_metrics, METRIC_PRUNED));
+
+    // a shard that went below zero doesn't make the sum wrap around
+    metrics_add(&test_metrics, METRIC_QUEUED, -1);
+    ck_assert_uint_eq(0, metrics_sum(&test_metrics, METRIC_QUEUED));
+} END_TEST
+
+Suite* metrics_suite(void) {
+    TCase* tc = tcase_create("metrics");
+    tcase_add_test(tc, stage_timings_count_every_call);
+    tcase_add_test(tc, metrics_sum_counts_every_thread);
+
+    Suite* s = suite_create("metrics");
+    suite_add_tcase(s, tc);
+    return s;
+}
@@ -0,0 +1,123 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include <check.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "../queue.h"
+
+START_TEST(priority_queue_hands_out_largest_first) {
+    FileEntryQueue* queue = new_file_entry_priority_queue(64);
+    ck_assert_ptr_nonnull(queue);
+
+    // sizes repeat, those of the same size come out in traversal order
+    for (uint64_t sequence = 0; sequence < 64; sequence++) {
+        size_t size = (sequence * 37) % 16;
+        FileEntry* fe = new_file_entry("/file", 1, sequence, 1, 0, size, sequence, 0, 0);
+        ck_assert_ptr_nonnull(fe);
+        ck_assert(file_entry_queue_push(queue, fe));
+    }
+    file_entry_queue_close(queue);
+
+    FileEntry* previous = NULL;
+    FileEntry* fe = NULL;
+    size_t count = 0;
+    while ((fe = file_entry_queue_pop(queue)) != NULL) {
+        if (previous) {
+            ck_assert_uint_ge(previous->size, fe->size);
+            if (previous->size == fe->size) {
+                ck_assert_uint_lt(previous->sequence, fe->sequence);
+            }
+            file_entry_free(previous);
+        }
+        previous = fe;
+        count++;
+    }
+    ck_assert_uint_eq(64, count);
+    file_entry_free(previous);
+    free_file_entry_queue(queue);
+} END_TEST
+
+typedef struct QueueProducer {
+    FileEntryQueue* queue;
+    FileEntry* fe;
+    atomic_bool pushed;
+    bool result;
+} QueueProducer;
+
+static void* push_entry(void* arg) {
+    QueueProducer* producer = arg;
+    producer->result = file_entry_queue_push(producer->queue, producer->fe);
+    atomic_store(&producer->pushed, true);
+    return NULL;
+}
+
+static void* pop_entry(void* arg) {
+    return file_entry_queue_pop(arg);
+}
+
+START_TEST(queue_blocks_producers_while_full) {
+    FileEntryQueue* queue = new_file_entry_queue(2);
+    ck_assert_ptr_nonnull(queue);
+    for (uint64_t sequence = 0; sequence < 2; sequence++) {
+        ck_assert(file_entry_queue_push(queue, new_file_entry("/file", 1, sequence, 1, 0, 1, sequence, 0, 0)));
+    }
+
+    QueueProducer producer = { .queue = queue, .fe = new_file_entry("/file", 1, 2, 1, 0, 1, 2, 0, 0) };
+    ck_assert_ptr_nonnull(producer.fe);
+    pthread_t thread;
+    ck_assert_int_eq(0, pthread_create(&thread, NULL, push_entry, &producer));
+    usleep(100 * 1000);
+    ck_assert(!atomic_load(&producer.pushed));
+
+    // a pop makes room, the entries come out in the order they went in
+    for (uint64_t sequence = 0; sequence < 3; sequence++) {
+        FileEntry* fe = file_entry_queue_pop(queue);
+        ck_assert_ptr_nonnull(fe);
+        ck_assert_uint_eq(sequence, fe->sequence);
+        file_entry_free(fe);
+        if (sequence == 0) {
+            ck_assert_int_eq(0, pthread_join(thread, NULL));
+            ck_assert(producer.result);
+        }
+    }
+    free_file_entry_queue(queue);
+} END_TEST
+
+START_TEST(queue_close_wakes_waiting_consumers) {
+    FileEntryQueue* queue = new_file_entry_queue(4);
+    ck_assert_ptr_nonnull(queue);
+    pthread_t threads[2];
+    for (size_t i = 0; i < 2; i++) {
+        ck_assert_int_eq(0, pthread_create(&threads[i], NULL, pop_entry, queue));
+    }
+    usleep(100 * 1000);
+    file_entry_queue_close(queue);
+    for (size_t i = 0; i < 2; i++) {
+        void* fe = &fe;
+        ck_assert_int_eq(0, pthread_join(threads[i], &fe));
+        ck_assert_ptr_null(fe);
+    }
+
+    // the caller keeps what can't be pushed anymore
+    FileEntry* fe = new_file_entry("/file", 1, 0, 1, 0, 1, 0, 0, 0);
+    ck_assert_ptr_nonnull(fe);
+    ck_assert(!file_entry_queue_push(queue, fe));
+    file_entry_free(fe);
+    free_file_entry_queue(queue);
+} END_TEST
+
+Suite* queue_suite(void) {
+    TCase* tc = tcase_create("queue");
+    tcase_add_test(tc, priority_queue_hands_out_largest_first);
+    tcase_add_test(tc, queue_blocks_producers_while_full);
+    tcase_add_test(tc, queue_close_wakes_waiting_consumers);
+
+    Suite* s = suite_create("queue");
+    suite_add_tcase(s, tc);
+    return s;
+}
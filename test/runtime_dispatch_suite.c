@@ -10,8 +10,11 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include "../fast_hash.h"
 #include "../runtime_caps.h"
 #include "../runtime_dispatch.h"
+#include "../runtime_metal_compare.h"
+#include "../strong_hash.h"
 #include "runtime_dispatch_suite.h"
 
 bool dedup_runtime_witness_compare(const char* a_path, const char* b_path, uint64_t size);
@@ -25,6 +28,7 @@ static void clear_runtime_env(void) {
     unsetenv("DEDUP_WITNESS_THRESHOLD_BYTES");
     unsetenv("DEDUP_GPU_BATCH_THRESHOLD");
     unsetenv("DEDUP_EXACT_LARGE_THRESHOLD_BYTES");
+    unsetenv("DEDUP_FORCE_GPU");
 }
 
 static void write_bytes(const char* path, const void* data, size_t size) {
@@ -58,6 +62,48 @@ START_TEST(runtime_caps_are_cached_and_resettable) {
     ck_assert_ptr_nonnull(caps_c);
 } END_TEST
 
+START_TEST(runtime_caps_calibration_survives_restarts) {
+    clear_runtime_env();
+    char* dir = make_temp_dir("calibration");
+    char path[PATH_MAX] = {0};
+    snprintf(path, sizeof(path), "%s/calibration", dir);
+    setenv("DEDUP_CALIBRATION_CACHE", path, 1);
+
+    dedup_runtime_caps_reset_for_tests();
+    DedupRuntimeCaps measured = *dedup_runtime_caps_get();
+    struct stat st;
+    ck_assert_int_eq(0, stat(path, &st));
+
+    // a second start reads the measurements back instead of taking new ones
+    dedup_runtime_caps_reset_for_tests();
+    const DedupRuntimeCaps* cached = dedup_runtime_caps_get();
+    ck_assert(measured.memcmp_gib_s_4k == cached->memcmp_gib_s_4k);
+    ck_assert(measured.exact_cpu_tiles_gib_s_1m == cached->exact_cpu_tiles_gib_s_1m);
+    ck_assert(measured.fast_hash_xxhash_gib_s_4k == cached->fast_hash_xxhash_gib_s_4k);
+    ck_assert(measured.strong_hash_pmull_poly_gib_s_64k == cached->strong_hash_pmull_poly_gib_s_64k);
+
+    // a cache for other kernels is measured again and replaced
+    const char* other = "dedup-calibration 2\nkernels other\n";
+    write_bytes(path, other, strlen(other));
+    dedup_runtime_caps_reset_for_tests();
+    dedup_runtime_caps_get();
+    char line[64] = {0};
+    FILE* f = fopen(path, "r");
+    ck_assert_ptr_nonnull(f);
+    ck_assert_ptr_nonnull(fgets(line, sizeof(line), f));
+    ck_assert_ptr_nonnull(fgets(line, sizeof(line), f));
+    ck_assert_str_ne("kernels other\n", line);
+    ck_assert_int_eq(0, fclose(f));
+
+    ck_assert(dedup_runtime_caps_recalibrate());
+
+    unsetenv("DEDUP_CALIBRATION_CACHE");
+    dedup_runtime_caps_reset_for_tests();
+    ck_assert_int_eq(0, unlink(path));
+    ck_assert_int_eq(0, rmdir(dir));
+    free(dir);
+} END_TEST
+
 START_TEST(runtime_dispatch_has_expected_defaults) {
     clear_runtime_env();
     dedup_runtime_dispatch_reset_for_tests();
@@ -65,14 +111,38 @@ START_TEST(runtime_dispatch_has_expected_defaults) {
     const DedupRuntimeCaps* caps = dedup_runtime_caps_get();
     const DedupRuntimeDispatch* dispatch = dedup_runtime_dispatch_get();
     ck_assert_ptr_nonnull(dispatch);
-    ck_assert_str_eq("xxhash", dispatch->fast_hash_name);
+    const char* expected_fast_hash_name = "xxhash";
+    double expected_fast_hash_gib_s = caps->fast_hash_xxhash_gib_s_4k;
+    const char* const fast_hash_names[] = { "rapidhash", "komihash", "blake3" };
+    const double fast_hash_gib_s[] = {
+        caps->fast_hash_rapidhash_gib_s_4k, caps->fast_hash_komihash_gib_s_4k, caps->fast_hash_blake3_gib_s_4k,
+    };
+    for (size_t i = 0; i < 3; i++) {
+        if (fast_hash_gib_s[i] > expected_fast_hash_gib_s * 1.1) {
+            expected_fast_hash_name = fast_hash_names[i];
+            expected_fast_hash_gib_s = fast_hash_gib_s[i];
+        }
+    }
+    ck_assert_str_eq(expected_fast_hash_name, dispatch->fast_hash_name);
+    ck_assert_ptr_nonnull(dispatch->fast_hash);
     ck_assert_str_eq("none", dispatch->strong_hash_name);
-    ck_assert_str_eq("none", dispatch->witness_name);
+    ck_assert_ptr_null(dispatch->strong_hash);
+    ck_assert_str_eq("cpu_progressive", dispatch->witness_name);
     ck_assert_str_eq("memcmp", dispatch->exact_small_name);
     const bool cpu_tiles_wins = caps->apple_arm64 && caps->exact_cpu_tiles_gib_s_1m > 0.0 &&
                                  caps->exact_cpu_tiles_gib_s_1m >= caps->memcmp_gib_s_1m;
-    const size_t expected_exact_large_threshold = cpu_tiles_wins ? (1024U * 1024U) : (64U * 1024U);
-    ck_assert_str_eq(cpu_tiles_wins ? "cpu_tiles" : "memcmp", dispatch->exact_large_name);
+    const char* expected_exact_large_name = cpu_tiles_wins ? "cpu_tiles" : "memcmp";
+    double expected_gib_s = cpu_tiles_wins ? caps->exact_cpu_tiles_gib_s_1m : caps->memcmp_gib_s_1m;
+    if (caps->exact_neon_unrolled_gib_s_1m > 0.0 && caps->exact_neon_unrolled_gib_s_1m >= expected_gib_s) {
+        expected_exact_large_name = "neon_unrolled";
+        expected_gib_s = caps->exact_neon_unrolled_gib_s_1m;
+    }
+    if (caps->exact_avx2_unrolled_gib_s_1m > 0.0 && caps->exact_avx2_unrolled_gib_s_1m >= expected_gib_s) {
+        expected_exact_large_name = "avx2_unrolled";
+    }
+    const size_t expected_exact_large_threshold = strcmp(expected_exact_large_name, "memcmp") != 0 ?
+                                                  (1024U * 1024U) : (64U * 1024U);
+    ck_assert_str_eq(expected_exact_large_name, dispatch->exact_large_name);
     ck_assert_uint_eq(expected_exact_large_threshold, dispatch->exact_large_threshold);
     ck_assert_uint_gt(dispatch->witness_threshold, 0);
     ck_assert_uint_gt(dispatch->gpu_batch_threshold, 0);
@@ -99,6 +169,79 @@ START_TEST(runtime_dispatch_honors_overrides) {
     dedup_runtime_dispatch_reset_for_tests();
 } END_TEST
 
+START_TEST(runtime_dispatch_binds_forced_hashes) {
+    const char* const fast_hash_names[] = { "xxhash", "rapidhash", "komihash", "blake3" };
+    const dedup_fast_hash_fn fast_hashes[] = {
+        NULL, fast_hash_rapidhash, fast_hash_komihash, strong_hash_blake3,
+    };
+    for (size_t i = 0; i < 4; i++) {
+        clear_runtime_env();
+        setenv("DEDUP_FORCE_FAST_HASH", fast_hash_names[i], 1);
+        dedup_runtime_dispatch_reset_for_tests();
+
+        const DedupRuntimeDispatch* dispatch = dedup_runtime_dispatch_get();
+        ck_assert_str_eq(fast_hash_names[i], dispatch->fast_hash_name);
+        ck_assert_ptr_nonnull(dispatch->fast_hash);
+        if (fast_hashes[i]) {
+            ck_assert(dispatch->fast_hash == fast_hashes[i]);
+        }
+    }
+
+    const char* const strong_hash_names[] = { "blake3", "sha3", "pmull_poly" };
+    for (size_t i = 0; i < 3; i++) {
+        clear_runtime_env();
+        setenv("DEDUP_FORCE_STRONG_HASH", strong_hash_names[i], 1);
+        dedup_runtime_dispatch_reset_for_tests();
+
+        const DedupRuntimeDispatch* dispatch = dedup_runtime_dispatch_get();
+        ck_assert_str_eq(strong_hash_names[i], dispatch->strong_hash_name);
+        ck_assert_ptr_nonnull(dispatch->strong_hash);
+    }
+
+    clear_runtime_env();
+    setenv("DEDUP_FORCE_STRONG_HASH", "auto", 1);
+    dedup_runtime_dispatch_reset_for_tests();
+    ck_assert_ptr_nonnull(dedup_runtime_dispatch_get()->strong_hash);
+    ck_assert_str_ne("auto", dedup_runtime_dispatch_get()->strong_hash_name);
+
+    clear_runtime_env();
+    dedup_runtime_dispatch_reset_for_tests();
+} END_TEST
+
+START_TEST(strong_hashes_match_reference_digests) {
+    // the first 8 bytes of each digest, little endian
+    ck_assert_uint_eq(0xa6a1f9f5b94913afULL, strong_hash_blake3("", 0));
+    ck_assert_uint_eq(0x66d71ebff8c6ffa7ULL, strong_hash_sha3("", 0));
+    ck_assert_uint_eq(0xb225e24fa75d983aULL, strong_hash_sha3("abc", 3));
+
+    // BLAKE3's own test input, spanning several chunks and tree levels
+    static unsigned char input[102400];
+    for (size_t i = 0; i < sizeof(input); i++) {
+        input[i] = (unsigned char)(i % 251);
+    }
+    ck_assert_uint_eq(0x06a495f039472142ULL, strong_hash_blake3(input, 1024));
+    ck_assert_uint_eq(0xb327eb47ae7802d0ULL, strong_hash_blake3(input, 1025));
+    ck_assert_uint_eq(0x066b14a1413d3ebcULL, strong_hash_blake3(input, 102400));
+    ck_assert_uint_eq(0x7e6667bfe7fa1281ULL, strong_hash_sha3(input, 603));
+
+    // hardware variants agree with the portable code on every tail length
+    for (size_t len = 0; len < 1100; len += 7) {
+        if (strong_hash_sha3_arm_supported()) {
+            ck_assert_uint_eq(strong_hash_sha3(input, len), strong_hash_sha3_arm(input, len));
+        }
+        if (strong_hash_pmull_poly_clmul_supported()) {
+            ck_assert_uint_eq(strong_hash_pmull_poly(input, len), strong_hash_pmull_poly_clmul(input, len));
+        }
+    }
+
+    // the length is part of the polynomial hash, zero padding isn't free
+    ck_assert_uint_ne(strong_hash_pmull_poly(input, 8), strong_hash_pmull_poly(input, 16));
+    unsigned char zeros[16] = {0};
+    ck_assert_uint_ne(strong_hash_pmull_poly(zeros, 8), strong_hash_pmull_poly(zeros, 16));
+    ck_assert_uint_ne(fast_hash_rapidhash(input, 4096), fast_hash_rapidhash(input + 1, 4096));
+    ck_assert_uint_ne(fast_hash_komihash(input, 4096), fast_hash_komihash(input + 1, 4096));
+} END_TEST
+
 START_TEST(runtime_exact_compare_uses_bound_backend) {
     clear_runtime_env();
     dedup_runtime_dispatch_reset_for_tests();
@@ -144,13 +287,156 @@ START_TEST(runtime_witness_compare_defaults_to_non_rejecting) {
     dedup_runtime_dispatch_reset_for_tests();
 } END_TEST
 
+START_TEST(runtime_progressive_witness_rejects_by_stage) {
+    clear_runtime_env();
+    setenv("DEDUP_FORCE_WITNESS", "cpu_progressive", 1);
+    dedup_runtime_dispatch_reset_for_tests();
+
+    char* dir = make_temp_dir("progressive");
+    char a[PATH_MAX] = {0}, b[PATH_MAX] = {0};
+    snprintf(a, sizeof(a), "%s/a", dir);
+    snprintf(b, sizeof(b), "%s/b", dir);
+
+    const size_t size = 4 * 1024 * 1024;
+    unsigned char* data = malloc(size);
+    ck_assert_ptr_nonnull(data);
+    for (size_t i = 0; i < size; i++) {
+        data[i] = (unsigned char)(i * 131 + 17);
+    }
+    write_bytes(a, data, size);
+    write_bytes(b, data, size);
+
+    DedupVerifierStats before = {0};
+    DedupVerifierStats after = {0};
+    dedup_runtime_verifier_stats(&before);
+    ck_assert(dedup_runtime_witness_compare(a, b, size));
+
+    // a difference in the last window is caught by the edges
+    data[size - 1] ^= 1;
+    write_bytes(b, data, size);
+    ck_assert(!dedup_runtime_witness_compare(a, b, size));
+    data[size - 1] ^= 1;
+
+    // a damaged region between the edges is wider than the probe spacing
+    const size_t region = 256 * 1024;
+    for (size_t i = size / 4; i < size / 4 + region; i++) {
+        data[i] ^= 1;
+    }
+    write_bytes(b, data, size);
+    ck_assert(!dedup_runtime_witness_compare(a, b, size));
+    dedup_runtime_verifier_stats(&after);
+    ck_assert_uint_eq(before.rejected[DEDUP_VERIFY_EDGES] + 1, after.rejected[DEDUP_VERIFY_EDGES]);
+    ck_assert_uint_eq(before.rejected[DEDUP_VERIFY_PROBES] + 1, after.rejected[DEDUP_VERIFY_PROBES]);
+
+    // whatever the probes miss passes on, only the exact compare rejects it
+    for (size_t i = size / 4; i < size / 4 + region; i++) {
+        data[i] ^= 1;
+    }
+    data[4097] ^= 1;
+    write_bytes(b, data, size);
+    ck_assert(dedup_runtime_witness_compare(a, b, size));
+    ck_assert(!dedup_runtime_exact_compare(a, b, size));
+    dedup_runtime_verifier_stats(&after);
+    ck_assert_uint_eq(before.rejected[DEDUP_VERIFY_EXACT] + 1, after.rejected[DEDUP_VERIFY_EXACT]);
+    free(data);
+
+    ck_assert_int_eq(0, unlink(a));
+    ck_assert_int_eq(0, unlink(b));
+    ck_assert_int_eq(0, rmdir(dir));
+    free(dir);
+
+    clear_runtime_env();
+    dedup_runtime_dispatch_reset_for_tests();
+} END_TEST
+
+START_TEST(runtime_gpu_backends_match_cpu) {
+    clear_runtime_env();
+    setenv("DEDUP_FORCE_GPU", "1", 1);
+    setenv("DEDUP_EXACT_LARGE_THRESHOLD_BYTES", "1", 1);
+    setenv("DEDUP_GPU_BATCH_THRESHOLD", "1", 1);
+    dedup_runtime_dispatch_reset_for_tests();
+
+    const DedupRuntimeDispatch* dispatch = dedup_runtime_dispatch_get();
+    if (!dedup_metal_compare_available()) {
+        // without a usable device nothing may be bound to the GPU
+        ck_assert_str_eq("cpu_progressive", dispatch->witness_name);
+        ck_assert_str_ne("gpu_exact_stream", dispatch->exact_large_name);
+        clear_runtime_env();
+        dedup_runtime_dispatch_reset_for_tests();
+        return;
+    }
+    ck_assert_str_eq("gpu_witness_stream", dispatch->witness_name);
+    ck_assert_str_eq("gpu_exact_stream", dispatch->exact_large_name);
+
+    char* dir = make_temp_dir("gpu");
+    char a[PATH_MAX] = {0}, b[PATH_MAX] = {0};
+    snprintf(a, sizeof(a), "%s/a", dir);
+    snprintf(b, sizeof(b), "%s/b", dir);
+
+    // not a multiple of the page size, the tail has to be compared too
+    const size_t size = 4 * 1024 * 1024 + 37;
+    unsigned char* data = malloc(size);
+    ck_assert_ptr_nonnull(data);
+    for (size_t i = 0; i < size; i++) {
+        data[i] = (unsigned char)(i * 131 + 17);
+    }
+    write_bytes(a, data, size);
+    write_bytes(b, data, size);
+    ck_assert(dedup_runtime_witness_compare(a, b, size));
+    ck_assert(dedup_runtime_exact_compare(a, b, size));
+
+    DedupVerifierStats before = {0};
+    DedupVerifierStats after = {0};
+    dedup_runtime_verifier_stats(&before);
+
+    data[size - 1] ^= 1;
+    write_bytes(b, data, size);
+    ck_assert(!dedup_runtime_witness_compare(a, b, size));
+    ck_assert(!dedup_runtime_exact_compare(a, b, size));
+    data[size - 1] ^= 1;
+
+    // the witness windows miss this one, the exact kernel doesn't
+    data[4097] ^= 1;
+    write_bytes(b, data, size);
+    ck_assert(dedup_runtime_witness_compare(a, b, size));
+    ck_assert(!dedup_runtime_exact_compare(a, b, size));
+
+    dedup_runtime_verifier_stats(&after);
+    ck_assert_uint_eq(before.rejected[DEDUP_VERIFY_EDGES] + 1, after.rejected[DEDUP_VERIFY_EDGES]);
+    ck_assert_uint_eq(before.rejected[DEDUP_VERIFY_EXACT] + 2, after.rejected[DEDUP_VERIFY_EXACT]);
+
+    FileHandle* ha = file_handle_open(a);
+    FileHandle* hb = file_handle_open(b);
+    bool equal = true;
+    ck_assert(dedup_metal_exact_compare(ha, hb, size, &equal));
+    ck_assert(!equal);
+    ck_assert(dedup_metal_exact_compare(ha, ha, size, &equal));
+    ck_assert(equal);
+    file_handle_close(ha);
+    file_handle_close(hb);
+    free(data);
+
+    ck_assert_int_eq(0, unlink(a));
+    ck_assert_int_eq(0, unlink(b));
+    ck_assert_int_eq(0, rmdir(dir));
+    free(dir);
+
+    clear_runtime_env();
+    dedup_runtime_dispatch_reset_for_tests();
+} END_TEST
+
 Suite* runtime_dispatch_suite(void) {
     TCase* tc = tcase_create("runtime_dispatch");
     tcase_add_test(tc, runtime_caps_are_cached_and_resettable);
+    tcase_add_test(tc, runtime_caps_calibration_survives_restarts);
     tcase_add_test(tc, runtime_dispatch_has_expected_defaults);
     tcase_add_test(tc, runtime_dispatch_honors_overrides);
+    tcase_add_test(tc, runtime_dispatch_binds_forced_hashes);
+    tcase_add_test(tc, strong_hashes_match_reference_digests);
     tcase_add_test(tc, runtime_exact_compare_uses_bound_backend);
     tcase_add_test(tc, runtime_witness_compare_defaults_to_non_rejecting);
+    tcase_add_test(tc, runtime_progressive_witness_rejects_by_stage);
+    tcase_add_test(tc, runtime_gpu_backends_match_cpu);
 
     Suite* s = suite_create("runtime_dispatch");
     suite_add_tcase(s, tc);
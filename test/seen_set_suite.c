@@ -0,0 +1,53 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include <check.h>
+#include <pthread.h>
+#include <stdint.h>
+
+#include "../seen_set.h"
+
+static void* insert_seen_keys(void* arg) {
+    SeenSet* set = arg;
+    size_t duplicates = 0;
+    for (uint64_t i = 0; i < 20000; i++) {
+        duplicates += seen_set_insert(set, 1, i << 32);
+    }
+    return (void*)duplicates;
+}
+
+START_TEST(seen_set_keeps_full_keys_across_threads) {
+    SeenSet* set = new_seen_set(16);
+    ck_assert_ptr_nonnull(set);
+
+    // inodes that only differ above bit 32, on two devices
+    ck_assert(!seen_set_insert(set, 2, 1ULL << 40));
+    ck_assert(!seen_set_insert(set, 2, 1ULL << 41));
+    ck_assert(!seen_set_insert(set, 3, 1ULL << 40));
+    ck_assert(seen_set_insert(set, 2, 1ULL << 40));
+
+    // every key is inserted by all threads, only one of them sees it first
+    pthread_t threads[4];
+    for (size_t i = 0; i < 4; i++) {
+        ck_assert_int_eq(0, pthread_create(&threads[i], NULL, insert_seen_keys, set));
+    }
+    size_t duplicates = 0;
+    for (size_t i = 0; i < 4; i++) {
+        void* result = NULL;
+        ck_assert_int_eq(0, pthread_join(threads[i], &result));
+        duplicates += (size_t)result;
+    }
+    ck_assert_uint_eq(3 * 20000, duplicates);
+
+    free_seen_set(set);
+} END_TEST
+
+Suite* seen_set_suite(void) {
+    TCase* tc = tcase_create("seen_set");
+    tcase_add_test(tc, seen_set_keeps_full_keys_across_threads);
+
+    Suite* s = suite_create("seen_set");
+    suite_add_tcase(s, tc);
+    return s;
+}
@@ -0,0 +1,110 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include <sys/stat.h>
+#include <check.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../sig_cache.h"
+#include "test_utils.h"
+
+#define CACHE_KEYS 5000
+
+static SigCacheKey cache_key(uint64_t inode, long mtime) {
+    return (SigCacheKey) { .device = 1, .inode = (ino_t)inode, .size = 100, .mtime = { .tv_sec = mtime } };
+}
+
+static void store_keys(const char* path, long mtime) {
+    SigCache* cache = open_sig_cache(path, "test");
+    ck_assert_ptr_nonnull(cache);
+    FileSignature sig = { .device = 1, .size = 100, .quick_hash = 7 };
+    for (uint64_t i = 1; i <= CACHE_KEYS; i++) {
+        SigCacheKey key = cache_key(i, mtime);
+        sig_cache_store(cache, &key, &sig);
+    }
+    close_sig_cache(cache);
+}
+
+static off_t cache_size(const char* path) {
+    struct stat st;
+    ck_assert_int_eq(0, stat(path, &st));
+    return st.st_size;
+}
+
+static bool cache_has(SigCache* cache, uint64_t inode, long mtime) {
+    SigCacheKey key = cache_key(inode, mtime);
+    FileSignature* sig = sig_cache_lookup(cache, &key);
+    free(sig);
+    return sig != NULL;
+}
+
+START_TEST(sig_cache_compacts_superseded_records) {
+    char* dir = make_temp_dir("sig-cache");
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/cache", dir);
+
+    store_keys(path, 1);
+    off_t one_run = cache_size(path);
+
+    // a rescan of changed files appends records that replace the live ones
+    store_keys(path, 2);
+    off_t two_runs = cache_size(path);
+    ck_assert_int_gt(two_runs, one_run);
+
+    // the records the pending ones replace count as superseded, so the
+    // third run leaves a single generation of records behind
+    store_keys(path, 3);
+    ck_assert_int_eq(one_run, cache_size(path));
+
+    SigCache* cache = open_sig_cache(path, "test");
+    ck_assert_ptr_nonnull(cache);
+    ck_assert(cache_has(cache, 1, 3));
+    ck_assert(!cache_has(cache, 1, 2));
+    close_sig_cache(cache);
+
+    ck_assert_int_eq(0, unlink(path));
+    ck_assert_int_eq(0, rmdir(dir));
+    free(dir);
+} END_TEST
+
+START_TEST(sig_cache_drops_expired_records) {
+    char* dir = make_temp_dir("sig-cache-expire");
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/cache", dir);
+
+    store_keys(path, 1);
+    off_t stored = cache_size(path);
+
+    // runs that keep using one record renew it, the rest expire
+    for (int run = 0; run < 16; run++) {
+        SigCache* cache = open_sig_cache(path, "test");
+        ck_assert_ptr_nonnull(cache);
+        ck_assert(cache_has(cache, 42, 1));
+        close_sig_cache(cache);
+    }
+    ck_assert_int_lt(cache_size(path), stored);
+
+    SigCache* cache = open_sig_cache(path, "test");
+    ck_assert_ptr_nonnull(cache);
+    ck_assert(cache_has(cache, 42, 1));
+    ck_assert(!cache_has(cache, 43, 1));
+    close_sig_cache(cache);
+
+    ck_assert_int_eq(0, unlink(path));
+    ck_assert_int_eq(0, rmdir(dir));
+    free(dir);
+} END_TEST
+
+Suite* sig_cache_suite(void) {
+    TCase* tc = tcase_create("sig_cache");
+    tcase_add_test(tc, sig_cache_compacts_superseded_records);
+    tcase_add_test(tc, sig_cache_drops_expired_records);
+
+    Suite* s = suite_create("sig_cache");
+    suite_add_tcase(s, tc);
+    return s;
+}
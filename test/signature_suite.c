@@ -3,6 +3,7 @@
 // SPDX-License-Identifier: BSD-2-Clause
 
 #include <check.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,28 +11,14 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include "../runtime_dispatch.h"
 #include "../signature.h"
+#include "../sig_table.h"
 #include "test_utils.h"
 
 bool files_match_exact_xor_or(const char* a_path, const char* b_path);
 bool files_match_exact_cpu_tiles(const char* a_path, const char* b_path);
 
-static void write_bytes(const char* path, const void* data, size_t size) {
-    FILE* f = fopen(path, "wb");
-    ck_assert_ptr_nonnull(f);
-    ck_assert_uint_eq(size, fwrite(data, 1, size, f));
-    ck_assert_int_eq(0, fclose(f));
-}
-
-static char* make_temp_dir(const char* suffix) {
-    size_t len = strlen("/tmp/dedup-signature--XXXXXX") + strlen(suffix) + 1;
-    char* dir = calloc(len, 1);
-    ck_assert_ptr_nonnull(dir);
-    snprintf(dir, len, "/tmp/dedup-signature-%s-XXXXXX", suffix);
-    ck_assert_ptr_nonnull(mkdtemp(dir));
-    return dir;
-}
-
 START_TEST(signature_supports_subword_files) {
     char* dir = make_temp_dir("small");
     char path[PATH_MAX] = {0};
@@ -50,6 +37,43 @@ START_TEST(signature_supports_subword_files) {
     free(dir);
 } END_TEST
 
+// Whichever way compute_signature reads a file, its samples are the 4
+// bytes at the start, 1/3, 2/3 and the end, and its hash is of the first 4 KiB.
+START_TEST(signature_reads_the_same_samples_at_every_size) {
+    char* dir = make_temp_dir("samples");
+    char path[PATH_MAX] = {0};
+    snprintf(path, sizeof(path), "%s/a", dir);
+    const size_t sizes[] = { 3, 4, 5000, 64 * 1024, 64 * 1024 + 1, 300000 };
+    unsigned char* data = malloc(300000);
+    ck_assert_ptr_nonnull(data);
+    for (size_t i = 0; i < 300000; i++) {
+        data[i] = (unsigned char)(i * 2654435761U >> 13);
+    }
+    const DedupRuntimeDispatch* dispatch = dedup_runtime_dispatch_get();
+    dedup_fast_hash_fn hash = dispatch && dispatch->fast_hash ? dispatch->fast_hash : signature_fast_hash_bytes;
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        uint64_t size = sizes[s];
+        write_bytes(path, data, (size_t)size);
+        FileSignature* sig = compute_signature(path, 1, size);
+        ck_assert_ptr_nonnull(sig);
+
+        uint64_t positions[4] = { 0, size / 3, size * 2 / 3, size > 4 ? size - 4 : 0 };
+        for (size_t i = 0; i < 4; i++) {
+            unsigned char raw[sizeof(int32_t)] = {0};
+            memcpy(raw, data + positions[i], size - positions[i] < 4 ? (size_t)(size - positions[i]) : 4);
+            ck_assert_mem_eq(raw, &sig->samples[i], sizeof(raw));
+        }
+        ck_assert_uint_eq(hash(data, size < 4096 ? (size_t)size : 4096), sig->quick_hash);
+        free_signature(sig);
+        ck_assert_int_eq(0, unlink(path));
+    }
+
+    free(data);
+    ck_assert_int_eq(0, rmdir(dir));
+    free(dir);
+} END_TEST
+
 START_TEST(dedup_detects_small_duplicate_files) {
     char* dir = make_temp_dir("small-dedup");
     char a[PATH_MAX] = {0}, b[PATH_MAX] = {0}, cmd[PATH_MAX * 2] = {0};
@@ -142,13 +166,294 @@ START_TEST(files_match_exact_cpu_tiles_handles_equal_and_different_files) {
     free(dir);
 } END_TEST
 
+START_TEST(handles_match_exact_split_finds_differences_in_every_range) {
+    char* dir = make_temp_dir("split");
+    char a[PATH_MAX] = {0}, b[PATH_MAX] = {0};
+    snprintf(a, sizeof(a), "%s/a", dir);
+    snprintf(b, sizeof(b), "%s/b", dir);
+
+    // 64 KiB reads, 5 ranges and a partial last chunk
+    const size_t size = 20 * 64 * 1024 + 123;
+    unsigned char* data = malloc(size);
+    ck_assert_ptr_nonnull(data);
+    for (size_t i = 0; i < size; i++) {
+        data[i] = (unsigned char)(i * 131 + 3);
+    }
+    write_bytes(a, data, size);
+
+    const size_t offsets[] = { 0, 4 * 64 * 1024, 4 * 64 * 1024 + 1, size / 2, size - 1 };
+    for (size_t i = 0; i <= sizeof(offsets) / sizeof(offsets[0]); i++) {
+        bool differs = i < sizeof(offsets) / sizeof(offsets[0]);
+        if (differs) {
+            data[offsets[i]] ^= 0x40;
+        }
+        write_bytes(b, data, size);
+        FileHandle* ha = file_handle_open(a);
+        FileHandle* hb = file_handle_open(b);
+        ck_assert_ptr_nonnull(ha);
+        ck_assert_ptr_nonnull(hb);
+        for (size_t parts = 2; parts <= 5; parts++) {
+            ck_assert(differs != handles_match_exact_split(ha, hb, parts, handles_match_exact_memcmp));
+        }
+        file_handle_close(ha);
+        file_handle_close(hb);
+        if (differs) {
+            data[offsets[i]] ^= 0x40;
+        }
+    }
+
+    free(data);
+    ck_assert_int_eq(0, unlink(a));
+    ck_assert_int_eq(0, unlink(b));
+    ck_assert_int_eq(0, rmdir(dir));
+    free(dir);
+} END_TEST
+
+START_TEST(sig_table_entries_share_their_directory) {
+    SigTable* table = new_sig_table(64, NULL);
+    ck_assert_ptr_nonnull(table);
+
+    static const char* const paths[] = { "/a/dir/one", "/a/dir/two", "/a/other/one", "relative" };
+    const SigTableEntry* entries[4] = {0};
+    for (size_t i = 0; i < 4; i++) {
+        // distinct signatures, nothing is compared
+        FileSignature sig = { .device = 1, .size = 8, .quick_hash = i + 1 };
+        bool inserted = false;
+        ck_assert_ptr_null(sig_table_insert(table, &sig, paths[i], NULL, 0, (ino_t)i, NULL, &inserted));
+        ck_assert(inserted);
+        ck_assert_uint_eq(1, sig_table_candidates(table, &sig, &entries[i], 1));
+        ck_assert_uint_eq(i, entries[i]->inode);
+
+        char path[PATH_MAX];
+        ck_assert(sig_table_entry_path(entries[i], path, sizeof(path)));
+        ck_assert_str_eq(paths[i], path);
+    }
+    ck_assert_ptr_eq(entries[0]->dir, entries[1]->dir);
+    ck_assert_ptr_ne(entries[0]->dir, entries[2]->dir);
+    ck_assert_str_eq("", entries[3]->dir);
+
+    char small[8];
+    ck_assert(!sig_table_entry_path(entries[0], small, sizeof(small)));
+
+    free_sig_table(table);
+} END_TEST
+
+START_TEST(sig_table_grows_and_keeps_every_signature) {
+    // starts with a single group per shard
+    SigTable* table = new_sig_table(0, NULL);
+    ck_assert_ptr_nonnull(table);
+
+    const size_t count = 50000;
+    char path[64];
+    for (size_t i = 0; i < count; i++) {
+        // similar signatures, as files of one size tend to have
+        FileSignature sig = { .device = 1, .size = 4096, .quick_hash = i };
+        snprintf(path, sizeof(path), "/dir/%zu", i);
+        bool inserted = false;
+        ck_assert_ptr_null(sig_table_insert(table, &sig, path, NULL, 0, (ino_t)i, NULL, &inserted));
+        ck_assert(inserted);
+    }
+    ck_assert_uint_eq(count, sig_table_size(table));
+
+    for (size_t i = 0; i < count; i++) {
+        FileSignature sig = { .device = 1, .size = 4096, .quick_hash = i };
+        const SigTableEntry* entry = NULL;
+        ck_assert_uint_eq(1, sig_table_candidates(table, &sig, &entry, 1));
+        ck_assert_uint_eq(i, entry->inode);
+    }
+    FileSignature missing = { .device = 2, .size = 4096, .quick_hash = 1 };
+    const SigTableEntry* entry = NULL;
+    ck_assert_uint_eq(0, sig_table_candidates(table, &missing, &entry, 1));
+
+    SigTableProbeStats stats;
+    size_t collisions = sig_table_collisions(table, &stats);
+    size_t total = 0;
+    for (size_t i = 0; i < SIG_TABLE_PROBE_BUCKETS; i++) {
+        total += stats.groups[i];
+    }
+    ck_assert_uint_eq(count, total);
+    ck_assert_uint_eq(count - stats.groups[0], collisions);
+    ck_assert_uint_ge(stats.max_groups, 1);
+
+    free_sig_table(table);
+} END_TEST
+
+START_TEST(sig_table_finds_entries_by_clone_id) {
+    SigTable* table = new_sig_table(0, NULL);
+    ck_assert_ptr_nonnull(table);
+
+    char path[64];
+    for (size_t i = 0; i < 10000; i++) {
+        FileSignature sig = { .device = 1, .size = 4096, .quick_hash = i };
+        snprintf(path, sizeof(path), "/dir/%zu", i);
+        // every clone id is used by two entries, the first one is found
+        bool inserted = false;
+        sig_table_insert(table, &sig, path, NULL, i / 2, (ino_t)i, NULL, &inserted);
+        ck_assert(inserted);
+    }
+
+    ck_assert_ptr_null(sig_table_find_clone_id(table, 1, 0));
+    ck_assert(!sig_table_has_clone_id(table, 1, 0));
+    ck_assert(!sig_table_has_clone_id(table, 1, 5000));
+    for (uint64_t clone_id = 1; clone_id < 5000; clone_id++) {
+        const SigTableEntry* entry = sig_table_find_clone_id(table, 1, clone_id);
+        ck_assert_ptr_nonnull(entry);
+        ck_assert_uint_eq(clone_id, entry->clone_id);
+        ck_assert_uint_eq(clone_id * 2, entry->inode);
+        ck_assert(sig_table_has_clone_id(table, 1, clone_id));
+        // clone ids are only unique within a volume
+        ck_assert_ptr_null(sig_table_find_clone_id(table, 2, clone_id));
+    }
+
+    // the same clone id on another device is an entry of its own
+    FileSignature sig = { .device = 2, .size = 4096, .quick_hash = 7 };
+    bool inserted = false;
+    sig_table_insert(table, &sig, "/other/7", NULL, 7, 70000, NULL, &inserted);
+    ck_assert(inserted);
+    const SigTableEntry* other = sig_table_find_clone_id(table, 2, 7);
+    ck_assert_ptr_nonnull(other);
+    ck_assert_uint_eq(70000, other->inode);
+    ck_assert_uint_eq(14, sig_table_find_clone_id(table, 1, 7)->inode);
+
+    free_sig_table(table);
+} END_TEST
+
+START_TEST(sig_table_compares_large_signature_groups_by_digest) {
+    char* dir = make_temp_dir("digest");
+    SigTable* table = new_sig_table(0, NULL);
+    ck_assert_ptr_nonnull(table);
+
+    // a shared header, files 0-5 only differ in their last byte, file 6 is
+    // file 2 but for a byte in the header, which no digest window covers
+    enum { FILE_SIZE = 64 * 1024, FILES = 7 };
+    static unsigned char data[FILE_SIZE];
+    char paths[FILES + 1][PATH_MAX];
+    FileSignature sig = { .device = 1, .size = FILE_SIZE, .quick_hash = 7 };
+    for (size_t i = 0; i <= FILES; i++) {
+        memset(data, 'h', sizeof(data));
+        data[FILE_SIZE - 1] = (unsigned char)(i >= 6 ? 2 : i);
+        data[100] = i == 6 ? 'x' : 'h';
+        snprintf(paths[i], sizeof(paths[i]), "%s/%zu", dir, i);
+        write_bytes(paths[i], data, sizeof(data));
+    }
+
+    for (size_t i = 0; i < FILES; i++) {
+        bool inserted = false;
+        ck_assert_ptr_null(sig_table_insert(table, &sig, paths[i], NULL, 0, (ino_t)i, NULL, &inserted));
+        ck_assert(inserted);
+    }
+
+    const SigTableEntry* entries[FILES] = {0};
+    ck_assert_uint_eq(FILES, sig_table_candidates(table, &sig, entries, FILES));
+    for (size_t i = 0; i < FILES; i++) {
+        // newest first
+        ck_assert_uint_eq(FILES - 1 - i, entries[i]->depth);
+        bool escalated = entries[i]->depth >= SIG_TABLE_ESCALATE_DEPTH;
+        ck_assert(!escalated || atomic_load(&entries[i]->digest) != 0);
+    }
+    // the witness still rejects a file whose digest matches
+    ck_assert_uint_eq(atomic_load(&entries[4]->digest), atomic_load(&entries[0]->digest));
+
+    // the copy of file 2 is found through its digest
+    SigTableEntry* found = sig_table_find(table, &sig, paths[FILES], NULL);
+    ck_assert_ptr_nonnull(found);
+    ck_assert_uint_eq(2, found->inode);
+
+    free_sig_table(table);
+    for (size_t i = 0; i <= FILES; i++) {
+        ck_assert_int_eq(0, unlink(paths[i]));
+    }
+    ck_assert_int_eq(0, rmdir(dir));
+    free(dir);
+} END_TEST
+
+START_TEST(sig_table_compares_small_files_in_memory) {
+    char* dir = make_temp_dir("inline");
+    char a[PATH_MAX], b[PATH_MAX], c[PATH_MAX], x[PATH_MAX], y[PATH_MAX];
+    snprintf(a, sizeof(a), "%s/a", dir);
+    snprintf(b, sizeof(b), "%s/b", dir);
+    snprintf(c, sizeof(c), "%s/c", dir);
+    snprintf(x, sizeof(x), "%s/x", dir);
+    snprintf(y, sizeof(y), "%s/y", dir);
+    write_bytes(a, "small file", 10);
+    write_bytes(b, "small file", 10);
+    write_bytes(c, "small file", 10);
+    write_bytes(x, "other file", 10);
+    write_bytes(y, "third file", 10);
+    // content read in the second the file changed in isn't kept
+    struct timespec times[2] = { { .tv_sec = 1 }, { .tv_sec = 1 } };
+    ck_assert_int_eq(0, utimensat(AT_FDCWD, a, times, 0));
+    ck_assert_int_eq(0, utimensat(AT_FDCWD, x, times, 0));
+    ck_assert_int_eq(0, utimensat(AT_FDCWD, y, times, 0));
+
+    SigTable* table = new_sig_table(0, NULL);
+    ck_assert_ptr_nonnull(table);
+    FileSignature sig = { .device = 1, .size = 10, .quick_hash = 3 };
+    struct stat st;
+    bool inserted = false;
+    const SigTableEntry* entry = NULL;
+
+    // the first file of a signature isn't read just to keep its content
+    ck_assert_int_eq(0, stat(x, &st));
+    ck_assert_ptr_null(sig_table_insert(table, &sig, x, NULL, 0, st.st_ino, NULL, &inserted));
+    ck_assert(inserted);
+    ck_assert_uint_eq(1, sig_table_candidates(table, &sig, &entry, 1));
+    ck_assert_ptr_null(entry->content);
+
+    // one that was compared keeps it
+    ck_assert_int_eq(0, stat(a, &st));
+    ck_assert_ptr_null(sig_table_insert(table, &sig, a, NULL, 0, st.st_ino, NULL, &inserted));
+    ck_assert(inserted);
+    ck_assert_uint_eq(1, sig_table_candidates(table, &sig, &entry, 1));
+    ck_assert_ptr_nonnull(entry->content);
+    ck_assert_mem_eq("small file", entry->content->bytes, 10);
+    ck_assert_ptr_eq(entry, sig_table_find(table, &sig, b, NULL));
+
+    // a file changed since it was added is read again, even with its
+    // mtime put back
+    write_bytes(a, "other file", 10);
+    ck_assert_int_eq(0, utimensat(AT_FDCWD, a, times, 0));
+    ck_assert_ptr_null(sig_table_find(table, &sig, b, NULL));
+
+    // a file that just changed is compared by reading it
+    ck_assert_int_eq(0, stat(b, &st));
+    ck_assert_ptr_null(sig_table_insert(table, &sig, b, NULL, 0, st.st_ino, NULL, &inserted));
+    ck_assert(inserted);
+    ck_assert_uint_eq(1, sig_table_candidates(table, &sig, &entry, 1));
+    ck_assert_ptr_null(entry->content);
+    ck_assert_ptr_eq(entry, sig_table_find(table, &sig, c, NULL));
+
+    // without room for content the entry is read like any other
+    table->inline_max = 0;
+    ck_assert_ptr_null(sig_table_insert(table, &sig, y, NULL, 0, 0, NULL, &inserted));
+    ck_assert(inserted);
+    ck_assert_uint_eq(1, sig_table_candidates(table, &sig, &entry, 1));
+    ck_assert_ptr_null(entry->content);
+
+    free_sig_table(table);
+    ck_assert_int_eq(0, unlink(a));
+    ck_assert_int_eq(0, unlink(b));
+    ck_assert_int_eq(0, unlink(c));
+    ck_assert_int_eq(0, unlink(x));
+    ck_assert_int_eq(0, unlink(y));
+    ck_assert_int_eq(0, rmdir(dir));
+    free(dir);
+} END_TEST
+
 Suite* signature_suite() {
     TCase* tc = tcase_create("signature");
     tcase_add_test(tc, signature_supports_subword_files);
+    tcase_add_test(tc, signature_reads_the_same_samples_at_every_size);
     tcase_add_test(tc, dedup_detects_small_duplicate_files);
     tcase_add_test(tc, dedup_rejects_sample_only_signature_collisions);
+    tcase_add_test(tc, sig_table_entries_share_their_directory);
+    tcase_add_test(tc, sig_table_grows_and_keeps_every_signature);
+    tcase_add_test(tc, sig_table_finds_entries_by_clone_id);
+    tcase_add_test(tc, sig_table_compares_large_signature_groups_by_digest);
+    tcase_add_test(tc, sig_table_compares_small_files_in_memory);
     tcase_add_test(tc, files_match_exact_xor_or_handles_equal_and_different_files);
     tcase_add_test(tc, files_match_exact_cpu_tiles_handles_equal_and_different_files);
+    tcase_add_test(tc, handles_match_exact_split_finds_differences_in_every_range);
 
     Suite* s = suite_create("signature");
     suite_add_tcase(s, tc);
@@ -0,0 +1,86 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include <check.h>
+#include <stdint.h>
+
+#include "../size_gate.h"
+
+static FileEntry* new_sized_entry(dev_t device, size_t size, uint64_t sequence) {
+    FileEntry* fe = new_file_entry("/file", device, sequence + 1, 1, 0, size, sequence, 0, 0);
+    ck_assert_ptr_nonnull(fe);
+    return fe;
+}
+
+START_TEST(size_gate_holds_files_until_their_size_repeats) {
+    SizeGate* gate = new_size_gate();
+    ck_assert_ptr_nonnull(gate);
+    FileEntry* out[2] = { NULL, NULL };
+
+    FileEntry* first = new_sized_entry(1, 10, 0);
+    ck_assert_uint_eq(0, size_gate_offer(gate, first, out));
+    ck_assert_uint_eq(0, size_gate_offer(gate, new_sized_entry(1, 20, 1), out));
+    // the same size on another device is another group
+    ck_assert_uint_eq(0, size_gate_offer(gate, new_sized_entry(2, 10, 2), out));
+
+    // the second file releases the first, in traversal order
+    FileEntry* second = new_sized_entry(1, 10, 3);
+    ck_assert_uint_eq(2, size_gate_offer(gate, second, out));
+    ck_assert_ptr_eq(first, out[0]);
+    ck_assert_ptr_eq(second, out[1]);
+    file_entry_free(out[0]);
+    file_entry_free(out[1]);
+
+    FileEntry* third = new_sized_entry(1, 10, 4);
+    ck_assert_uint_eq(1, size_gate_offer(gate, third, out));
+    ck_assert_ptr_eq(third, out[0]);
+    file_entry_free(out[0]);
+
+    // what is left has a size of its own
+    size_t held = 0;
+    FileEntry* fe = NULL;
+    while ((fe = size_gate_drain(gate)) != NULL) {
+        ck_assert(fe->size == 20 || fe->device == 2);
+        file_entry_free(fe);
+        held++;
+    }
+    ck_assert_uint_eq(2, held);
+    free_size_gate(gate);
+} END_TEST
+
+START_TEST(size_gate_open_lets_resumed_groups_through) {
+    SizeGate* gate = new_size_gate();
+    ck_assert_ptr_nonnull(gate);
+    FileEntry* out[2] = { NULL, NULL };
+
+    size_gate_open(gate, 1, 30);
+    FileEntry* fe = new_sized_entry(1, 30, 0);
+    ck_assert_uint_eq(1, size_gate_offer(gate, fe, out));
+    ck_assert_ptr_eq(fe, out[0]);
+    file_entry_free(out[0]);
+
+    // a group holding a file keeps it until the next one
+    FileEntry* held = new_sized_entry(1, 40, 1);
+    ck_assert_uint_eq(0, size_gate_offer(gate, held, out));
+    size_gate_open(gate, 1, 40);
+    fe = new_sized_entry(1, 40, 2);
+    ck_assert_uint_eq(2, size_gate_offer(gate, fe, out));
+    ck_assert_ptr_eq(held, out[0]);
+    ck_assert_ptr_eq(fe, out[1]);
+    file_entry_free(out[0]);
+    file_entry_free(out[1]);
+
+    ck_assert_ptr_null(size_gate_drain(gate));
+    free_size_gate(gate);
+} END_TEST
+
+Suite* size_gate_suite(void) {
+    TCase* tc = tcase_create("size_gate");
+    tcase_add_test(tc, size_gate_holds_files_until_their_size_repeats);
+    tcase_add_test(tc, size_gate_open_lets_resumed_groups_through);
+
+    Suite* s = suite_create("size_gate");
+    suite_add_tcase(s, tc);
+    return s;
+}
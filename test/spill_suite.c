@@ -0,0 +1,97 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include <check.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../signature.h"
+#include "../spill.h"
+#include "test_utils.h"
+
+typedef struct SpillGroups {
+    size_t groups;
+    size_t records;
+    size_t parts;               // handed out with `continued` set
+    uint64_t last_sequence;
+    bool ordered;
+} SpillGroups;
+
+static void collect_spill_group(const SpillRecord* records, size_t count, bool continued, void* context) {
+    SpillGroups* groups = context;
+    if (continued) {
+        groups->parts++;
+    } else {
+        groups->groups++;
+    }
+    for (size_t i = 0; i < count; i++) {
+        const SpillRecord* record = &records[i];
+        ck_assert_int_eq(0, memcmp(&records[0].signature.samples, &record->signature.samples,
+                                   sizeof(record->signature.samples)));
+        ck_assert_uint_eq(records[0].signature.quick_hash, record->signature.quick_hash);
+        if ((i > 0 || continued) && record->sequence <= groups->last_sequence) {
+            groups->ordered = false;
+        }
+        groups->last_sequence = record->sequence;
+        ck_assert_uint_eq(record->sequence, strtoull(strrchr(record->path, '/') + 1, NULL, 10));
+    }
+    groups->records += count;
+}
+
+static FileSignature spill_signature(uint64_t key) {
+    return (FileSignature) {
+        .device = 1,
+        .size = key % 7 + 1,
+        .samples = { (int32_t)key, (int32_t)(key * 3), 0, -1 },
+        .quick_hash = key * 0x9e3779b97f4a7c15ULL,
+    };
+}
+
+START_TEST(spill_set_merges_runs_into_ordered_groups) {
+    // the smallest run, with long paths it takes over a hundred runs
+    SpillSet* set = new_spill_set("/tmp", 0);
+    ck_assert_ptr_nonnull(set);
+
+    char padding[201];
+    memset(padding, 'p', sizeof(padding) - 1);
+    padding[sizeof(padding) - 1] = '\0';
+    char path[PATH_MAX];
+    const size_t count = 30000;
+    for (size_t i = 0; i < count + 300 + 1; i++) {
+        // out of order, each of 500 groups gets 60 records
+        uint64_t sequence = i < count ? (i * 7919) % count : i;
+        uint64_t key = i < count ? sequence % 500 : (i < count + 300 ? 1000 : 2000);
+        snprintf(path, sizeof(path), "/%s/%" PRIu64, padding, sequence);
+        SpillRecord record = {
+            .signature = spill_signature(key),
+            .sequence = sequence,
+            .path = path,
+        };
+        ck_assert(spill_set_add(set, &record));
+    }
+    ck_assert_uint_eq(count + 301, spill_set_count(set));
+
+    SpillGroups groups = { .ordered = true };
+    ck_assert(spill_set_merge(set, collect_spill_group, &groups));
+    free_spill_set(set);
+
+    // the lone record isn't handed out, the group of 300 comes in two parts
+    ck_assert_uint_eq(501, groups.groups);
+    ck_assert_uint_eq(1, groups.parts);
+    ck_assert_uint_eq(count + 300, groups.records);
+    ck_assert(groups.ordered);
+} END_TEST
+
+Suite* spill_suite(void) {
+    TCase* tc = tcase_create("spill");
+    tcase_add_test(tc, spill_set_merges_runs_into_ordered_groups);
+
+    Suite* s = suite_create("spill");
+    suite_add_tcase(s, tc);
+    return s;
+}
@@ -0,0 +1,108 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include <check.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../summary.h"
+
+static void* record_summary(void* arg) {
+    SummaryLog* log = arg;
+    char clone[64];
+    for (uint64_t i = 0; i < 5000; i++) {
+        snprintf(clone, sizeof(clone), "/dir/%" PRIu64 "/\"quoted\"", i);
+        SummaryRecord record = { .origin = "/origin", .clone = clone, .size = i, .quick_hash = i };
+        summary_log_record(log, &record);
+    }
+    return NULL;
+}
+
+START_TEST(summary_log_keeps_records_of_every_thread) {
+    char path[] = "/tmp/dedup-summary-XXXXXX";
+    int fd = mkstemp(path);
+    ck_assert_int_ge(fd, 0);
+    close(fd);
+
+    SummaryLog* log = open_summary_log(path, SUMMARY_JSONL);
+    ck_assert_ptr_nonnull(log);
+    pthread_t threads[4];
+    for (size_t i = 0; i < 4; i++) {
+        ck_assert_int_eq(0, pthread_create(&threads[i], NULL, record_summary, log));
+    }
+    for (size_t i = 0; i < 4; i++) {
+        ck_assert_int_eq(0, pthread_join(threads[i], NULL));
+    }
+    // larger than a buffer
+    size_t long_len = 100 * 1024;
+    char* long_path = malloc(long_len + 1);
+    ck_assert_ptr_nonnull(long_path);
+    memset(long_path, 'a', long_len);
+    long_path[long_len] = '\0';
+    SummaryRecord record = { .origin = "/origin", .clone = long_path };
+    summary_log_record(log, &record);
+    free(long_path);
+    ck_assert(close_summary_log(log));
+
+    FILE* f = fopen(path, "r");
+    ck_assert_ptr_nonnull(f);
+    size_t line_size = long_len + 256;
+    char* line = malloc(line_size);
+    ck_assert_ptr_nonnull(line);
+    size_t clones = 0;
+    char total[64] = "";
+    while (fgets(line, (int)line_size, f)) {
+        if (strncmp(line, "{\"type\":\"clone\",", 16) == 0) {
+            // the quotes are escaped
+            ck_assert(strstr(line, "/\\\"quoted\\\"\",") || strlen(line) > long_len);
+            clones++;
+        } else if (strncmp(line, "{\"type\":\"total\",", 16) == 0) {
+            snprintf(total, sizeof(total), "%s", line);
+        }
+    }
+    free(line);
+    fclose(f);
+    unlink(path);
+
+    ck_assert_uint_eq(4 * 5000 + 1, clones);
+    ck_assert_str_eq("{\"type\":\"total\",\"clones\":20001}\n", total);
+} END_TEST
+
+START_TEST(summary_log_escapes_bytes_that_are_not_utf8) {
+    char path[] = "/tmp/dedup-summary-XXXXXX";
+    int fd = mkstemp(path);
+    ck_assert_int_ge(fd, 0);
+    close(fd);
+
+    SummaryLog* log = open_summary_log(path, SUMMARY_JSONL);
+    ck_assert_ptr_nonnull(log);
+    SummaryRecord record = { .origin = "/caf\xc3\xa9", .clone = "/a\xff\xc3" "b\x01" };
+    summary_log_record(log, &record);
+    ck_assert(close_summary_log(log));
+
+    FILE* f = fopen(path, "r");
+    ck_assert_ptr_nonnull(f);
+    char line[512] = "";
+    ck_assert_ptr_nonnull(fgets(line, sizeof(line), f));
+    fclose(f);
+    unlink(path);
+
+    // valid sequences are kept, the others escaped byte by byte
+    ck_assert_ptr_nonnull(strstr(line, "\"/caf\xc3\xa9\""));
+    ck_assert_ptr_nonnull(strstr(line, "\"/a\\udcff\\udcc3b\\u0001\""));
+} END_TEST
+
+Suite* summary_suite(void) {
+    TCase* tc = tcase_create("summary");
+    tcase_add_test(tc, summary_log_keeps_records_of_every_thread);
+    tcase_add_test(tc, summary_log_escapes_bytes_that_are_not_utf8);
+
+    Suite* s = suite_create("summary");
+    suite_add_tcase(s, tc);
+    return s;
+}
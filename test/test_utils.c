@@ -27,6 +27,8 @@
 #include <check.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "test_utils.h"
 
@@ -44,3 +46,18 @@ char* run(const char* restrict command) {
     return output;
 }
 
+void write_bytes(const char* path, const void* data, size_t size) {
+    FILE* f = fopen(path, "wb");
+    ck_assert_ptr_nonnull(f);
+    ck_assert_uint_eq(size, fwrite(data, 1, size, f));
+    ck_assert_int_eq(0, fclose(f));
+}
+
+char* make_temp_dir(const char* suffix) {
+    size_t len = strlen("/tmp/dedup-test--XXXXXX") + strlen(suffix) + 1;
+    char* dir = calloc(len, 1);
+    ck_assert_ptr_nonnull(dir);
+    snprintf(dir, len, "/tmp/dedup-test-%s-XXXXXX", suffix);
+    ck_assert_ptr_nonnull(mkdtemp(dir));
+    return dir;
+}
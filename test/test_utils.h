@@ -27,6 +27,8 @@
 #ifndef __DEDUP_TEST_UTILS__
 #define __DEDUP_TEST_UTILS__
 
+#include <stddef.h>
+
 /// run a command and return its stdout
 ///
 /// - Parameters:
@@ -34,4 +36,11 @@
 /// - Returns: the `stdout` produced by the command
 char* run(const char* restrict command);
 
+/// write `size` bytes of `data` to a new file at `path`
+void write_bytes(const char* path, const void* data, size_t size);
+
+/// create an empty directory under /tmp, named after `suffix`; the caller
+/// frees the path and removes the directory
+char* make_temp_dir(const char* suffix);
+
 #endif // __DEDUP_TEST_UTILS__
@@ -0,0 +1,113 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include <check.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../walker.h"
+#include "test_utils.h"
+
+// Every entry has the stat fields the walk promises, found the same way
+// through its directory, and comes after the directory it is in.
+static void check_walk(const char* dir, uint8_t thread_count) {
+    char* const paths[] = { (char*)dir, NULL };
+    WalkerOptions options = { .thread_count = thread_count, .max_depth = 16 };
+    Walker* walker = new_walker(paths, &options);
+    ck_assert_ptr_nonnull(walker);
+
+    char dirs[3][PATH_MAX] = {{0}};
+    size_t dir_count = 0, file_count = 0, other_count = 0;
+    WalkEntry entry;
+    while (walker_next(walker, &entry)) {
+        ck_assert_int_ne(WALK_ERROR, entry.info);
+        if (entry.level > 0) {
+            const char* slash = strrchr(entry.path, '/');
+            ck_assert_ptr_nonnull(slash);
+            bool after_parent = false;
+            for (size_t i = 0; i < dir_count; i++) {
+                after_parent |= strlen(dirs[i]) == (size_t)(slash - entry.path) &&
+                                strncmp(dirs[i], entry.path, (size_t)(slash - entry.path)) == 0;
+            }
+            ck_assert(after_parent);
+        }
+
+        struct stat st;
+        ck_assert_int_eq(0, lstat(entry.path, &st));
+        ck_assert_uint_eq(st.st_dev, entry.stat->st_dev);
+        ck_assert_uint_eq(st.st_ino, entry.stat->st_ino);
+        ck_assert_uint_eq(st.st_mode & S_IFMT, entry.stat->st_mode & S_IFMT);
+        struct stat at;
+        ck_assert_int_eq(0, fstatat(dir_handle_fd(entry.dir), entry.name, &at, AT_SYMLINK_NOFOLLOW));
+        ck_assert_uint_eq(st.st_ino, at.st_ino);
+
+        if (entry.info == WALK_DIR) {
+            ck_assert_uint_lt(dir_count, 3);
+            snprintf(dirs[dir_count++], PATH_MAX, "%s", entry.path);
+        } else if (entry.info == WALK_FILE) {
+            ck_assert_int_eq(st.st_size, entry.stat->st_size);
+            ck_assert_uint_eq(st.st_nlink, entry.stat->st_nlink);
+            ck_assert_int_eq(st.st_mtimespec.tv_sec, entry.stat->st_mtimespec.tv_sec);
+            ck_assert_int_eq(st.st_mtimespec.tv_nsec, entry.stat->st_mtimespec.tv_nsec);
+            file_count++;
+        } else {
+            ck_assert_int_eq(WALK_OTHER, entry.info);
+            ck_assert(S_ISLNK(st.st_mode));
+            other_count++;
+        }
+    }
+    free_walker(walker);
+
+    ck_assert_uint_eq(3, dir_count);
+    ck_assert_uint_eq(4, file_count);
+    ck_assert_uint_eq(1, other_count);
+}
+
+START_TEST(walker_reports_what_stat_does) {
+    char* dir = make_temp_dir("walker");
+    char sub[PATH_MAX] = {0}, deeper[PATH_MAX] = {0}, a[PATH_MAX] = {0}, b[PATH_MAX] = {0};
+    char c[PATH_MAX] = {0}, link_path[PATH_MAX] = {0}, symlink_path[PATH_MAX] = {0};
+    snprintf(sub, sizeof(sub), "%s/sub", dir);
+    snprintf(deeper, sizeof(deeper), "%s/sub/deeper", dir);
+    snprintf(a, sizeof(a), "%s/a", dir);
+    snprintf(b, sizeof(b), "%s/sub/b", dir);
+    snprintf(c, sizeof(c), "%s/sub/deeper/c", dir);
+    snprintf(link_path, sizeof(link_path), "%s/sub/link", dir);
+    snprintf(symlink_path, sizeof(symlink_path), "%s/symlink", dir);
+    ck_assert_int_eq(0, mkdir(sub, 0755));
+    ck_assert_int_eq(0, mkdir(deeper, 0755));
+    write_bytes(a, "aaa", 3);
+    write_bytes(b, "bbbbb", 5);
+    write_bytes(c, "ccccccc", 7);
+    ck_assert_int_eq(0, link(a, link_path));
+    ck_assert_int_eq(0, symlink("a", symlink_path));
+
+    // inline on the caller, then ahead of it on a pool
+    check_walk(dir, 0);
+    check_walk(dir, 4);
+
+    ck_assert_int_eq(0, unlink(symlink_path));
+    ck_assert_int_eq(0, unlink(link_path));
+    ck_assert_int_eq(0, unlink(c));
+    ck_assert_int_eq(0, unlink(b));
+    ck_assert_int_eq(0, unlink(a));
+    ck_assert_int_eq(0, rmdir(deeper));
+    ck_assert_int_eq(0, rmdir(sub));
+    ck_assert_int_eq(0, rmdir(dir));
+    free(dir);
+} END_TEST
+
+Suite* walker_suite(void) {
+    TCase* tc = tcase_create("walker");
+    tcase_add_test(tc, walker_reports_what_stat_does);
+
+    Suite* s = suite_create("walker");
+    suite_add_tcase(s, tc);
+    return s;
+}
@@ -0,0 +1,65 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include <check.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../watch.h"
+#include "test_utils.h"
+
+typedef struct WatchedPaths {
+    pthread_mutex_t mutex;
+    size_t batches;
+    char last[PATH_MAX];
+} WatchedPaths;
+
+static void collect_watched(char* const* paths, size_t count, void* context) {
+    WatchedPaths* watched = context;
+    pthread_mutex_lock(&watched->mutex);
+    watched->batches++;
+    strlcpy(watched->last, paths[count - 1], sizeof(watched->last));
+    pthread_mutex_unlock(&watched->mutex);
+}
+
+START_TEST(watcher_hands_out_settled_changes) {
+    char* dir = make_temp_dir("watch");
+    char real[PATH_MAX] = {0}, path[PATH_MAX] = {0};
+    ck_assert_ptr_nonnull(realpath(dir, real));
+    char* const paths[] = { real, NULL };
+
+    WatchedPaths watched = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+    Watcher* watcher = new_watcher(paths, watch_current_event(), 0, collect_watched, &watched);
+    ck_assert_ptr_nonnull(watcher);
+
+    snprintf(path, sizeof(path), "%s/added", real);
+    write_bytes(path, "watched", 7);
+    bool seen = false;
+    // within the 4 seconds a test may take, delivery takes about 1.5
+    for (int i = 0; i < 35 && !seen; i++) {
+        usleep(100000);
+        pthread_mutex_lock(&watched.mutex);
+        seen = strcmp(watched.last, path) == 0;
+        pthread_mutex_unlock(&watched.mutex);
+    }
+    free_watcher(watcher);
+    ck_assert(seen);
+
+    ck_assert_int_eq(0, unlink(path));
+    ck_assert_int_eq(0, rmdir(dir));
+    free(dir);
+} END_TEST
+
+Suite* watch_suite(void) {
+    TCase* tc = tcase_create("watch");
+    tcase_add_test(tc, watcher_hands_out_settled_changes);
+
+    Suite* s = suite_create("watch");
+    suite_add_tcase(s, tc);
+    return s;
+}
@@ -26,8 +26,12 @@
 
 #include <sys/attr.h>
 
+#include <ctype.h>
 #include <err.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -36,6 +40,10 @@
 #define ATTR_BITMAP_COUNT 5
 
 uint64_t get_clone_id(const char* restrict path) {
+    return get_clone_id_at(AT_FDCWD, path);
+}
+
+uint64_t get_clone_id_at(int dir_fd, const char* restrict name) {
     struct attrlist attrList = {
         .bitmapcount = ATTR_BITMAP_COUNT,
         .forkattr = ATTR_CMNEXT_CLONEID,
@@ -47,7 +55,7 @@ uint64_t get_clone_id(const char* restrict path) {
     } __attribute((aligned(4), packed));
     struct UInt64Ref clone_id = { 0 };
 
-    int err = getattrlist(path, &attrList, &clone_id, sizeof(struct UInt64Ref), FSOPT_ATTR_CMN_EXTENDED);
+    int err = getattrlistat(dir_fd, name, &attrList, &clone_id, sizeof(struct UInt64Ref), FSOPT_ATTR_CMN_EXTENDED);
     if (err) {
         return 0;
     }
@@ -76,6 +84,10 @@ int may_share_blocks(const char* restrict path) {
 }
 
 size_t private_size(const char* restrict path) {
+    return private_size_at(AT_FDCWD, path);
+}
+
+size_t private_size_at(int dir_fd, const char* restrict name) {
     struct attrlist attrList = {
         .bitmapcount = ATTR_BITMAP_COUNT,
         .forkattr = ATTR_CMNEXT_PRIVATESIZE,
@@ -87,7 +99,7 @@ size_t private_size(const char* restrict path) {
     } __attribute((aligned(4), packed));
     struct UInt64Ref size_attr = { 0 };
 
-    int err = getattrlist(path, &attrList, &size_attr, sizeof(struct UInt64Ref), FSOPT_ATTR_CMN_EXTENDED);
+    int err = getattrlistat(dir_fd, name, &attrList, &size_attr, sizeof(struct UInt64Ref), FSOPT_ATTR_CMN_EXTENDED);
     if (err) {
         return 0;
     }
@@ -187,3 +199,35 @@ FileMetadata* metadata_from_entry(FileEntry* fe) {
 
     return metadata_dup(&fm);
 }
+
+bool parse_byte_count(const char* restrict s, uint64_t* bytes) {
+    if (!s || !isdigit((unsigned char)*s)) {
+        return false;
+    }
+
+    char* end = NULL;
+    errno = 0;
+    unsigned long long count = strtoull(s, &end, 10);
+    if (errno != 0) {
+        return false;
+    }
+
+    unsigned shift = 0;
+    switch (toupper((unsigned char)*end)) {
+    case '\0': break;
+    case 'K': shift = 10; break;
+    case 'M': shift = 20; break;
+    case 'G': shift = 30; break;
+    case 'T': shift = 40; break;
+    default: return false;
+    }
+    if (*end && end[1] != '\0' && !(toupper((unsigned char)end[1]) == 'B' && end[2] == '\0')) {
+        return false;
+    }
+    if (shift > 0 && count > (UINT64_MAX >> shift)) {
+        return false;
+    }
+
+    *bytes = (uint64_t)count << shift;
+    return true;
+}
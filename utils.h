@@ -37,8 +37,16 @@
 uint64_t get_clone_id(const char* restrict path);
 int may_share_blocks(const char* restrict path);
 size_t private_size(const char* restrict path);
+/// `get_clone_id` and `private_size` of `name` relative to the directory
+/// `dir_fd`, which may be AT_FDCWD.
+uint64_t get_clone_id_at(int dir_fd, const char* restrict name);
+size_t private_size_at(int dir_fd, const char* restrict name);
 ino_t get_inode(const char* restrict path);
 
+/// parses a byte count such as `512M`, the suffixes K, M, G and T are
+/// powers of 1024. returns false if `s` isn't one.
+bool parse_byte_count(const char* restrict s, uint64_t* bytes);
+
 FileMetadata* metadata_from_entry(FileEntry* fe) ATTR_MALLOC(free_metadata, 1);
 
 #endif // __DEDUP_UTIL_H__
@@ -0,0 +1,351 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include "visit_order.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "metrics.h"
+
+#define VISIT_ORDER_STRIPES 64
+
+typedef struct VisitGroup {
+    dev_t device;
+    uint64_t size;
+    bool used;
+    uint64_t issued;      // next ticket to hand out
+    uint64_t next;        // lowest ticket that has not finished
+    uint64_t done_base;   // ticket represented by bit 0 of `done`
+    uint64_t* done;       // tickets after `next` that finished out of order
+    size_t done_words;
+    FileEntry** parked;
+    size_t parked_count;
+    size_t parked_capacity;
+} VisitGroup;
+
+typedef struct VisitStripe {
+    pthread_mutex_t mutex;
+    VisitGroup* groups;
+    size_t capacity; // always a power of 2
+    size_t count;
+} VisitStripe;
+
+struct VisitOrder {
+    VisitStripe stripes[VISIT_ORDER_STRIPES];
+};
+
+static inline uint64_t group_hash(dev_t device, uint64_t size) {
+    uint64_t h = size * 0x9E3779B97F4A7C15ULL;
+    h ^= (uint64_t)device + 0x7F4A7C159E3779B9ULL + (h << 6) + (h >> 2);
+    return h ^ (h >> 31);
+}
+
+VisitOrder* new_visit_order(void) {
+    VisitOrder* order = calloc(1, sizeof(VisitOrder));
+    if (!order) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < VISIT_ORDER_STRIPES; i++) {
+        VisitStripe* s = &order->stripes[i];
+        pthread_mutex_init(&s->mutex, NULL);
+        s->capacity = 64;
+        s->groups = calloc(s->capacity, sizeof(VisitGroup));
+        if (!s->groups) {
+            free_visit_order(order);
+            return NULL;
+        }
+    }
+
+    return order;
+}
+
+void free_visit_order(VisitOrder* order) {
+    if (!order) {
+        return;
+    }
+
+    for (size_t i = 0; i < VISIT_ORDER_STRIPES; i++) {
+        VisitStripe* s = &order->stripes[i];
+        for (size_t j = 0; s->groups && j < s->capacity; j++) {
+            VisitGroup* g = &s->groups[j];
+            if (!g->used) {
+                continue;
+            }
+            for (size_t k = 0; k < g->parked_count; k++) {
+                file_entry_free(g->parked[k]);
+            }
+            free(g->parked);
+            free(g->done);
+        }
+        free(s->groups);
+        pthread_mutex_destroy(&s->mutex);
+    }
+    free(order);
+}
+
+static VisitStripe* stripe_for(VisitOrder* order, uint64_t hash) {
+    return &order->stripes[hash & (VISIT_ORDER_STRIPES - 1)];
+}
+
+static size_t slot_for(const VisitStripe* s, uint64_t hash) {
+    return (size_t)(hash >> 8) & (s->capacity - 1);
+}
+
+static bool stripe_grow(VisitStripe* s) {
+    size_t new_cap = s->capacity * 2;
+    VisitGroup* groups = calloc(new_cap, sizeof(VisitGroup));
+    if (!groups) {
+        return false;
+    }
+
+    size_t mask = new_cap - 1;
+    for (size_t i = 0; i < s->capacity; i++) {
+        VisitGroup* g = &s->groups[i];
+        if (!g->used) {
+            continue;
+        }
+        size_t idx = (size_t)(group_hash(g->device, g->size) >> 8) & mask;
+        while (groups[idx].used) {
+            idx = (idx + 1) & mask;
+        }
+        groups[idx] = *g;
+    }
+
+    free(s->groups);
+    s->groups = groups;
+    s->capacity = new_cap;
+    return true;
+}
+
+static VisitGroup* stripe_find(VisitStripe* s, uint64_t hash, dev_t device, uint64_t size) {
+    size_t mask = s->capacity - 1;
+    for (size_t idx = slot_for(s, hash); s->groups[idx].used; idx = (idx + 1) & mask) {
+        VisitGroup* g = &s->groups[idx];
+        if (g->device == device && g->size == size) {
+            return g;
+        }
+    }
+    return NULL;
+}
+
+// Groups are removed once every ticket they issued has finished so the table
+// only ever holds the sizes that are currently in flight.
+static void stripe_remove(VisitStripe* s, VisitGroup* g) {
+    size_t mask = s->capacity - 1;
+    size_t hole = (size_t)(g - s->groups);
+
+    free(g->parked);
+    free(g->done);
+    memset(g, 0, sizeof(*g));
+    s->count--;
+
+    // backward shift deletion keeps linear probe chains intact without
+    // tombstones
+    for (size_t idx = (hole + 1) & mask; s->groups[idx].used; idx = (idx + 1) & mask) {
+        size_t home = (size_t)(group_hash(s->groups[idx].device, s->groups[idx].size) >> 8) & mask;
+        if (((idx - home) & mask) >= ((idx - hole) & mask)) {
+            s->groups[hole] = s->groups[idx];
+            memset(&s->groups[idx], 0, sizeof(VisitGroup));
+            hole = idx;
+        }
+    }
+}
+
+uint64_t visit_order_ticket(VisitOrder* order, dev_t device, uint64_t size) {
+    if (!order) {
+        return 0;
+    }
+
+    uint64_t hash = group_hash(device, size);
+    VisitStripe* s = stripe_for(order, hash);
+
+    stage_lock(&s->mutex, STAGE_ORDER_LOCK);
+    VisitGroup* g = stripe_find(s, hash, device, size);
+    if (!g) {
+        if ((s->count + 1) * 4 >= s->capacity * 3) {
+            stripe_grow(s);
+        }
+        size_t mask = s->capacity - 1;
+        size_t idx = slot_for(s, hash);
+        while (s->groups[idx].used) {
+            idx = (idx + 1) & mask;
+        }
+        g = &s->groups[idx];
+        *g = (VisitGroup) {
+            .device = device,
+            .size = size,
+            .used = true,
+        };
+        s->count++;
+    }
+    uint64_t ticket = g->issued++;
+    pthread_mutex_unlock(&s->mutex);
+
+    return ticket;
+}
+
+static bool group_park(VisitGroup* g, FileEntry* fe) {
+    if (g->parked_count == g->parked_capacity) {
+        size_t new_cap = g->parked_capacity ? g->parked_capacity * 2 : 4;
+        FileEntry** parked = realloc(g->parked, new_cap * sizeof(FileEntry*));
+        if (!parked) {
+            return false;
+        }
+        g->parked = parked;
+        g->parked_capacity = new_cap;
+    }
+    g->parked[g->parked_count++] = fe;
+    return true;
+}
+
+static bool group_mark_done(VisitGroup* g, uint64_t ticket) {
+    uint64_t bit = ticket - g->done_base;
+    size_t word = (size_t)(bit / 64);
+    if (word >= g->done_words) {
+        size_t new_words = g->done_words ? g->done_words : 1;
+        while (new_words <= word) {
+            new_words *= 2;
+        }
+        uint64_t* done = realloc(g->done, new_words * sizeof(uint64_t));
+        if (!done) {
+            return false;
+        }
+        memset(done + g->done_words, 0, (new_words - g->done_words) * sizeof(uint64_t));
+        g->done = done;
+        g->done_words = new_words;
+    }
+    g->done[word] |= 1ULL << (bit % 64);
+    return true;
+}
+
+static bool group_is_done(const VisitGroup* g, uint64_t ticket) {
+    uint64_t bit = ticket - g->done_base;
+    size_t word = (size_t)(bit / 64);
+    return word < g->done_words && (g->done[word] & (1ULL << (bit % 64)));
+}
+
+static void group_advance(VisitGroup* g) {
+    g->next++;
+    while (group_is_done(g, g->next)) {
+        g->next++;
+    }
+
+    // drop bitmap words that `next` has moved past
+    size_t passed = (size_t)((g->next - g->done_base) / 64);
+    if (passed > 0 && g->done_words > 0) {
+        if (passed >= g->done_words) {
+            memset(g->done, 0, g->done_words * sizeof(uint64_t));
+        } else {
+            memmove(g->done, g->done + passed, (g->done_words - passed) * sizeof(uint64_t));
+            memset(g->done + (g->done_words - passed), 0, passed * sizeof(uint64_t));
+        }
+    }
+    g->done_base += (uint64_t)passed * 64;
+}
+
+bool visit_order_begin(VisitOrder* order, FileEntry* fe) {
+    if (!order) {
+        return true;
+    }
+
+    uint64_t hash = group_hash(fe->device, fe->size);
+    VisitStripe* s = stripe_for(order, hash);
+
+    stage_lock(&s->mutex, STAGE_ORDER_LOCK);
+    VisitGroup* g = stripe_find(s, hash, fe->device, fe->size);
+    // a missing group or a failed park means we can no longer order this
+    // entry, visiting it immediately is the only way to make progress
+    bool runnable = !g || g->next == fe->group_ticket || !group_park(g, fe);
+    pthread_mutex_unlock(&s->mutex);
+
+    return runnable;
+}
+
+FileEntry* visit_order_end(VisitOrder* order, const FileEntry* fe) {
+    if (!order) {
+        return NULL;
+    }
+
+    uint64_t hash = group_hash(fe->device, fe->size);
+    VisitStripe* s = stripe_for(order, hash);
+    FileEntry* runnable = NULL;
+
+    stage_lock(&s->mutex, STAGE_ORDER_LOCK);
+    VisitGroup* g = stripe_find(s, hash, fe->device, fe->size);
+    if (!g) {
+        pthread_mutex_unlock(&s->mutex);
+        return NULL;
+    }
+
+    if (fe->group_ticket < g->next) {
+        // already released by a failed park or bitmap allocation
+    } else if (fe->group_ticket != g->next) {
+        // finished ahead of its turn (pruned or unreadable)
+        if (!group_mark_done(g, fe->group_ticket)) {
+            // without a record of this ticket the group would stall, so give
+            // up on ordering it and release everything that is parked
+            g->next = g->issued;
+        }
+    } else {
+        group_advance(g);
+    }
+
+    for (size_t i = 0; i < g->parked_count; i++) {
+        if (g->parked[i]->group_ticket <= g->next) {
+            runnable = g->parked[i];
+            g->parked[i] = g->parked[--g->parked_count];
+            break;
+        }
+    }
+
+    if (!runnable && g->parked_count == 0 && g->next >= g->issued) {
+        stripe_remove(s, g);
+    }
+    pthread_mutex_unlock(&s->mutex);
+
+    return runnable;
+}
+
+static bool group_unpark(VisitGroup* g, uint64_t ticket, FileEntry** out) {
+    for (size_t i = 0; i < g->parked_count; i++) {
+        if (g->parked[i]->group_ticket == ticket) {
+            *out = g->parked[i];
+            g->parked[i] = g->parked[--g->parked_count];
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t visit_order_take_parked(VisitOrder* order, const FileEntry* fe, FileEntry** out, size_t max) {
+    if (!order || !fe || !out) {
+        return 0;
+    }
+
+    uint64_t hash = group_hash(fe->device, fe->size);
+    VisitStripe* s = stripe_for(order, hash);
+    size_t count = 0;
+
+    stage_lock(&s->mutex, STAGE_ORDER_LOCK);
+    VisitGroup* g = stripe_find(s, hash, fe->device, fe->size);
+    if (g && g->next == fe->group_ticket) {
+        // tickets that finished out of order are no gap, ending the entry
+        // ahead of them skips over them
+        for (uint64_t ticket = fe->group_ticket + 1; count < max && ticket < g->issued; ticket++) {
+            if (group_is_done(g, ticket)) {
+                continue;
+            }
+            if (!group_unpark(g, ticket, &out[count])) {
+                break;
+            }
+            count++;
+        }
+    }
+    pthread_mutex_unlock(&s->mutex);
+
+    return count;
+}
@@ -0,0 +1,57 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#ifndef __DEDUP_VISIT_ORDER_H__
+#define __DEDUP_VISIT_ORDER_H__
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "queue.h"
+
+/// Visit Order
+///
+/// Files are only ever matched against files with the same device and size,
+/// so the "first seen wins clone origin" guarantee only has to hold within a
+/// (device, size) group. Each group hands out tickets in traversal order and
+/// lets exactly one entry at a time, in ticket order, into the signature
+/// table.
+///
+/// An entry that arrives before its turn is parked instead of blocking the
+/// worker. When the predecessor finishes, `visit_order_end` hands the parked
+/// entry back to the caller, which continues with it. Entries that drop out
+/// before being visited (pruned, unreadable) must still be ended so their
+/// successors are released; they may be ended out of order.
+///
+/// All functions accept a NULL order, in which case no ordering is enforced.
+typedef struct VisitOrder VisitOrder;
+
+VisitOrder* new_visit_order(void);
+void free_visit_order(VisitOrder* order);
+
+/// Issue the next ticket for the group of `device` and `size`. Tickets must
+/// be issued in traversal order.
+uint64_t visit_order_ticket(VisitOrder* order, dev_t device, uint64_t size);
+
+/// Returns true if `fe` may enter the signature table now. Otherwise `fe` is
+/// parked, ownership passes to the order, and false is returned.
+bool visit_order_begin(VisitOrder* order, FileEntry* fe);
+
+/// Marks the ticket of `fe` as finished. If this makes a parked entry of the
+/// same group runnable it is removed from the order and returned; the caller
+/// takes ownership of it. Otherwise NULL is returned.
+FileEntry* visit_order_end(VisitOrder* order, const FileEntry* fe);
+
+/// Removes the entries parked directly behind `fe`, the ones holding the
+/// tickets that follow it without a gap, so they can be verified together
+/// with `fe`. `fe` must be the group's current turn. At most `max` entries
+/// are stored in `out`, in ticket order, and their count is returned.
+///
+/// The caller takes ownership of them and must visit and end each of them,
+/// in ticket order, after ending `fe`.
+size_t visit_order_take_parked(VisitOrder* order, const FileEntry* fe, FileEntry** out, size_t max);
+
+#endif // __DEDUP_VISIT_ORDER_H__
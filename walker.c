@@ -0,0 +1,817 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include "walker.h"
+
+#include <sys/attr.h>
+#if defined(__APPLE__)
+#include <sys/vnode.h>
+#endif
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dir_handle.h"
+
+// Directories the pool may have read that the caller has not consumed yet.
+// Past this the pool idles and the caller reads directories itself.
+#define WALKER_RUN_AHEAD 1024
+
+enum {
+    NODE_PENDING,
+    NODE_LISTING,
+    NODE_LISTED,
+    NODE_CANCELLED,
+};
+
+typedef struct WalkNode WalkNode;
+
+typedef struct WalkChild {
+    char* path;
+    struct stat stat;
+    uint64_t clone_id;
+    uint64_t private_size;
+    bool extended;
+    int error;
+    WalkInfo info;
+    WalkNode* node;          // set if the directory will be entered
+} WalkChild;
+
+// A directory that will be entered. Referenced by the deque it was pushed
+// to and by the caller, freed when both are done with it.
+struct WalkNode {
+    const char* path;        // owned by the parent's WalkChild
+    WalkNode* parent;
+    dev_t device;
+    ino_t inode;
+    dev_t root_device;
+    short level;
+    atomic_int state;
+    atomic_int refs;
+    WalkChild* children;
+    size_t child_count;
+    int error;               // errno if the directory could not be read
+    DirHandle* dir;          // kept open for the children, may be NULL
+};
+
+typedef struct WalkDeque {
+    pthread_mutex_t mutex;
+    WalkNode** items;        // ring buffer
+    size_t head;
+    size_t count;
+    size_t capacity;
+} WalkDeque;
+
+typedef struct WalkFrame {
+    WalkNode* node;
+    size_t next;             // next child to return
+    bool skip;
+    bool reported;           // read error has been returned
+} WalkFrame;
+
+struct Walker {
+    WalkerOptions options;
+
+    WalkChild* roots;
+    size_t root_count;
+    size_t next_root;
+
+    WalkFrame* stack;
+    size_t depth;
+    size_t stack_capacity;
+    bool pushed;             // the last returned entry pushed a frame
+
+    // one deque per thread, the last one is filled by the caller
+    WalkDeque* deques;
+    size_t deque_count;
+    pthread_t* threads;
+    size_t thread_count;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t work_cond;    // work queued, room to run ahead, or stop
+    pthread_cond_t listed_cond;  // a directory has been read
+    atomic_long pending;         // nodes sitting in deques
+    atomic_long listed;          // nodes read but not yet consumed
+    bool stop;
+};
+
+typedef struct WalkThread {
+    Walker* walker;
+    size_t index;
+} WalkThread;
+
+static WalkInfo classify(const struct stat* st) {
+    if (S_ISREG(st->st_mode)) {
+        return WALK_FILE;
+    }
+    if (S_ISDIR(st->st_mode)) {
+        return WALK_DIR;
+    }
+    return WALK_OTHER;
+}
+
+static WalkNode* new_node(WalkChild* child, WalkNode* parent, dev_t root_device, short level) {
+    WalkNode* node = calloc(1, sizeof(WalkNode));
+    if (!node) {
+        return NULL;
+    }
+    node->path = child->path;
+    node->parent = parent;
+    node->device = child->stat.st_dev;
+    node->inode = child->stat.st_ino;
+    node->root_device = root_device;
+    node->level = level;
+    atomic_init(&node->state, NODE_PENDING);
+    atomic_init(&node->refs, 2);  // deque and caller
+    return node;
+}
+
+static void node_release(WalkNode* node) {
+    if (atomic_fetch_sub_explicit(&node->refs, 1, memory_order_acq_rel) != 1) {
+        return;
+    }
+    for (size_t i = 0; i < node->child_count; i++) {
+        free(node->children[i].path);
+    }
+    free(node->children);
+    dir_handle_release(node->dir);
+    free(node);
+}
+
+static void deque_push(Walker* w, size_t index, WalkNode* node) {
+    WalkDeque* d = &w->deques[index];
+    pthread_mutex_lock(&d->mutex);
+    if (d->count == d->capacity) {
+        size_t new_cap = d->capacity ? d->capacity * 2 : 64;
+        WalkNode** items = malloc(new_cap * sizeof(WalkNode*));
+        if (!items) {
+            pthread_mutex_unlock(&d->mutex);
+            // nobody will read it ahead of time, the caller will when it
+            // gets there
+            node_release(node);
+            return;
+        }
+        for (size_t i = 0; i < d->count; i++) {
+            items[i] = d->items[(d->head + i) % d->capacity];
+        }
+        free(d->items);
+        d->items = items;
+        d->head = 0;
+        d->capacity = new_cap;
+    }
+    atomic_fetch_add_explicit(&w->pending, 1, memory_order_relaxed);
+    d->items[(d->head + d->count) % d->capacity] = node;
+    d->count++;
+    pthread_mutex_unlock(&d->mutex);
+}
+
+// Owners take from the back so a thread keeps working depth first near the
+// directories it just read, thieves take from the front.
+static WalkNode* deque_take(WalkDeque* d, bool steal) {
+    WalkNode* node = NULL;
+    pthread_mutex_lock(&d->mutex);
+    if (d->count > 0) {
+        if (steal) {
+            node = d->items[d->head];
+            d->head = (d->head + 1) % d->capacity;
+        } else {
+            node = d->items[(d->head + d->count - 1) % d->capacity];
+        }
+        d->count--;
+    }
+    pthread_mutex_unlock(&d->mutex);
+    return node;
+}
+
+static WalkNode* take_work(Walker* w, size_t index) {
+    WalkNode* node = deque_take(&w->deques[index], false);
+    for (size_t i = 1; !node && i < w->deque_count; i++) {
+        node = deque_take(&w->deques[(index + i) % w->deque_count], true);
+    }
+    if (node) {
+        atomic_fetch_sub_explicit(&w->pending, 1, memory_order_relaxed);
+    }
+    return node;
+}
+
+static bool is_ancestor(const WalkNode* node, dev_t device, ino_t inode) {
+    for (; node; node = node->parent) {
+        if (node->device == device && node->inode == inode) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static char* join_path(const char* dir, const char* name) {
+    size_t dir_len = strlen(dir);
+    size_t name_len = strlen(name);
+    // like fts, don't double up a trailing slash of a starting path
+    if (dir_len > 0 && dir[dir_len - 1] == '/') {
+        dir_len--;
+    }
+    char* path = malloc(dir_len + 1 + name_len + 1);
+    if (!path) {
+        return NULL;
+    }
+    memcpy(path, dir, dir_len);
+    path[dir_len] = '/';
+    memcpy(path + dir_len + 1, name, name_len + 1);
+    return path;
+}
+
+static bool append_child(WalkNode* node, size_t* capacity, WalkChild child) {
+    if (node->child_count == *capacity) {
+        size_t new_cap = *capacity ? *capacity * 2 : 16;
+        WalkChild* children = realloc(node->children, new_cap * sizeof(WalkChild));
+        if (!children) {
+            return false;
+        }
+        node->children = children;
+        *capacity = new_cap;
+    }
+    node->children[node->child_count++] = child;
+    return true;
+}
+
+static void read_dir_stat(WalkNode* node, int fd) {
+    DIR* dir = fdopendir(fd);
+    if (!dir) {
+        node->error = errno;
+        close(fd);
+        return;
+    }
+
+    size_t capacity = 0;
+    struct dirent* de = NULL;
+    while ((de = readdir(dir)) != NULL) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) {
+            continue;
+        }
+
+        WalkChild child = { .path = join_path(node->path, de->d_name) };
+        if (!child.path) {
+            node->error = ENOMEM;
+            break;
+        }
+        if (fstatat(fd, de->d_name, &child.stat, AT_SYMLINK_NOFOLLOW) != 0) {
+            child.error = errno;
+            child.info = WALK_ERROR;
+        } else {
+            child.info = classify(&child.stat);
+        }
+
+        if (!append_child(node, &capacity, child)) {
+            free(child.path);
+            node->error = ENOMEM;
+            break;
+        }
+    }
+    closedir(dir);
+}
+
+#if defined(__APPLE__)
+
+#define BULK_BUFFER_SIZE (64 * 1024)
+
+// Attributes are packed in the order of their bits, with ATTR_CMN_ERROR
+// right after the returned attribute set, common attributes first and the
+// extended common attributes (requested through forkattr) last.
+static const struct attrlist bulk_attrs = {
+    .bitmapcount = ATTR_BIT_MAP_COUNT,
+    .commonattr = ATTR_CMN_RETURNED_ATTRS |
+                  ATTR_CMN_NAME |
+                  ATTR_CMN_DEVID |
+                  ATTR_CMN_OBJTYPE |
+                  ATTR_CMN_MODTIME |
+                  ATTR_CMN_ACCESSMASK |
+                  ATTR_CMN_FLAGS |
+                  ATTR_CMN_FILEID |
+                  ATTR_CMN_ERROR,
+    .fileattr = ATTR_FILE_LINKCOUNT | ATTR_FILE_DATALENGTH,
+    .forkattr = ATTR_CMNEXT_PRIVATESIZE | ATTR_CMNEXT_CLONEID,
+};
+
+#define BULK_READ(cursor, value) do { \
+        memcpy(&(value), (cursor), sizeof(value)); \
+        (cursor) += sizeof(value); \
+    } while (0)
+
+static mode_t mode_for_type(fsobj_type_t type) {
+    switch (type) {
+        case VREG: return S_IFREG;
+        case VDIR: return S_IFDIR;
+        case VLNK: return S_IFLNK;
+        case VBLK: return S_IFBLK;
+        case VCHR: return S_IFCHR;
+        case VSOCK: return S_IFSOCK;
+        case VFIFO: return S_IFIFO;
+        default: return 0;
+    }
+}
+
+// Parses one getattrlistbulk record. Returns false if it has no name.
+static bool parse_bulk_entry(const WalkNode* node, const char* record, WalkChild* child) {
+    const char* cursor = record + sizeof(uint32_t);  // record length
+    attribute_set_t returned;
+    BULK_READ(cursor, returned);
+
+    uint32_t error = 0;
+    if (returned.commonattr & ATTR_CMN_ERROR) {
+        BULK_READ(cursor, error);
+    }
+
+    const char* name = NULL;
+    if (returned.commonattr & ATTR_CMN_NAME) {
+        attrreference_t ref;
+        memcpy(&ref, cursor, sizeof(ref));
+        name = cursor + ref.attr_dataoffset;
+        cursor += sizeof(ref);
+    }
+    if (!name) {
+        return false;
+    }
+
+    *child = (WalkChild) { .path = join_path(node->path, name) };
+    if (!child->path) {
+        return false;
+    }
+
+    fsobj_type_t type = VNON;
+    uint32_t access = 0, flags = 0, nlink = 1;
+    uint64_t inode = 0;
+    off_t size = 0, private_size = 0;
+    dev_t device = 0;
+    uint64_t clone_id = 0;
+    struct timespec mtime = { 0 };
+
+    if (returned.commonattr & ATTR_CMN_DEVID) {
+        BULK_READ(cursor, device);
+    }
+    if (returned.commonattr & ATTR_CMN_OBJTYPE) {
+        BULK_READ(cursor, type);
+    }
+    if (returned.commonattr & ATTR_CMN_MODTIME) {
+        BULK_READ(cursor, mtime);
+    }
+    if (returned.commonattr & ATTR_CMN_ACCESSMASK) {
+        BULK_READ(cursor, access);
+    }
+    if (returned.commonattr & ATTR_CMN_FLAGS) {
+        BULK_READ(cursor, flags);
+    }
+    if (returned.commonattr & ATTR_CMN_FILEID) {
+        BULK_READ(cursor, inode);
+    }
+    if (returned.fileattr & ATTR_FILE_LINKCOUNT) {
+        BULK_READ(cursor, nlink);
+    }
+    if (returned.fileattr & ATTR_FILE_DATALENGTH) {
+        BULK_READ(cursor, size);
+    }
+    if (returned.forkattr & ATTR_CMNEXT_PRIVATESIZE) {
+        BULK_READ(cursor, private_size);
+    }
+    if (returned.forkattr & ATTR_CMNEXT_CLONEID) {
+        BULK_READ(cursor, clone_id);
+    }
+
+    if (error) {
+        child->error = (int)error;
+        child->info = WALK_ERROR;
+        return true;
+    }
+
+    child->stat.st_dev = device;
+    child->stat.st_ino = (ino_t)inode;
+    child->stat.st_mode = mode_for_type(type) | (mode_t)(access & ~S_IFMT);
+    child->stat.st_nlink = (nlink_t)nlink;
+    child->stat.st_flags = flags;
+    child->stat.st_size = size;
+    child->stat.st_mtimespec = mtime;
+    child->clone_id = clone_id;
+    child->private_size = (uint64_t)private_size;
+    child->extended = (returned.forkattr & ATTR_CMNEXT_CLONEID) != 0;
+    child->info = classify(&child->stat);
+    return true;
+}
+
+// Returns false if the file system can't enumerate in bulk before anything
+// was read, so the caller can fall back to readdir.
+static bool read_dir_bulk(WalkNode* node, int fd) {
+    char* buffer = malloc(BULK_BUFFER_SIZE);
+    if (!buffer) {
+        node->error = ENOMEM;
+        return true;
+    }
+
+    size_t capacity = 0;
+    bool first = true;
+    for (;;) {
+        int count = getattrlistbulk(fd, (void*)&bulk_attrs, buffer, BULK_BUFFER_SIZE, FSOPT_ATTR_CMN_EXTENDED);
+        if (count < 0) {
+            if (first && (errno == ENOTSUP || errno == EINVAL)) {
+                free(buffer);
+                return false;
+            }
+            node->error = errno;
+            break;
+        }
+        if (count == 0) {
+            break;
+        }
+        first = false;
+
+        const char* record = buffer;
+        for (int i = 0; i < count; i++) {
+            uint32_t length;
+            memcpy(&length, record, sizeof(length));
+
+            WalkChild child;
+            if (parse_bulk_entry(node, record, &child) && !append_child(node, &capacity, child)) {
+                free(child.path);
+                node->error = ENOMEM;
+                break;
+            }
+            record += length;
+        }
+        if (node->error) {
+            break;
+        }
+    }
+
+    free(buffer);
+    close(fd);
+    return true;
+}
+
+#endif // __APPLE__
+
+// Reads and stats the children of `node`, queueing the subdirectories that
+// will be entered on deque `index`.
+static void list_node(Walker* w, WalkNode* node, size_t index) {
+    int fd = open(node->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        node->error = errno;
+    } else {
+        node->dir = new_dir_handle(fd);
+#if defined(__APPLE__)
+        if (!read_dir_bulk(node, fd)) {
+            read_dir_stat(node, fd);
+        }
+#else
+        read_dir_stat(node, fd);
+#endif
+    }
+
+    short level = node->level + 1;
+    size_t queued = 0;
+    for (size_t i = 0; i < node->child_count; i++) {
+        WalkChild* child = &node->children[i];
+        if (child->info != WALK_DIR) {
+            continue;
+        }
+        if (is_ancestor(node, child->stat.st_dev, child->stat.st_ino)) {
+            child->info = WALK_DIR_CYCLE;
+            continue;
+        }
+        if (level > w->options.max_depth) {
+            continue;
+        }
+        if (w->options.one_file_system && child->stat.st_dev != node->root_device) {
+            continue;
+        }
+        child->node = new_node(child, node, node->root_device, level);
+        queued += child->node ? 1 : 0;
+    }
+
+    // pushed last to first so the owner pops them in traversal order
+    for (size_t i = node->child_count; queued > 0 && i > 0; i--) {
+        if (node->children[i - 1].node) {
+            deque_push(w, index, node->children[i - 1].node);
+        }
+    }
+
+    atomic_fetch_add_explicit(&w->listed, 1, memory_order_relaxed);
+    pthread_mutex_lock(&w->mutex);
+    atomic_store_explicit(&node->state, NODE_LISTED, memory_order_release);
+    pthread_cond_broadcast(&w->listed_cond);
+    if (queued > 0) {
+        pthread_cond_broadcast(&w->work_cond);
+    }
+    pthread_mutex_unlock(&w->mutex);
+}
+
+static bool should_run_ahead(Walker* w) {
+    return atomic_load_explicit(&w->pending, memory_order_relaxed) > 0 &&
+           atomic_load_explicit(&w->listed, memory_order_relaxed) < WALKER_RUN_AHEAD;
+}
+
+static void* walk_thread(void* arg) {
+    WalkThread* t = arg;
+    Walker* w = t->walker;
+
+    for (;;) {
+        pthread_mutex_lock(&w->mutex);
+        while (!w->stop && !should_run_ahead(w)) {
+            pthread_cond_wait(&w->work_cond, &w->mutex);
+        }
+        bool stop = w->stop;
+        pthread_mutex_unlock(&w->mutex);
+        if (stop) {
+            break;
+        }
+
+        WalkNode* node = take_work(w, t->index);
+        if (!node) {
+            continue;
+        }
+        int expected = NODE_PENDING;
+        if (atomic_compare_exchange_strong(&node->state, &expected, NODE_LISTING)) {
+            list_node(w, node, t->index);
+        }
+        node_release(node);
+    }
+
+    free(t);
+    return NULL;
+}
+
+// Makes sure `node` has been read, reading it on the calling thread if
+// nobody has picked it up yet.
+static void wait_listed(Walker* w, WalkNode* node) {
+    int expected = NODE_PENDING;
+    if (atomic_compare_exchange_strong(&node->state, &expected, NODE_LISTING)) {
+        list_node(w, node, w->deque_count - 1);
+        return;
+    }
+
+    if (atomic_load_explicit(&node->state, memory_order_acquire) == NODE_LISTED) {
+        return;
+    }
+    pthread_mutex_lock(&w->mutex);
+    while (atomic_load_explicit(&node->state, memory_order_acquire) != NODE_LISTED) {
+        pthread_cond_wait(&w->listed_cond, &w->mutex);
+    }
+    pthread_mutex_unlock(&w->mutex);
+}
+
+// The caller is done with a node that has been read.
+static void node_done(Walker* w, WalkNode* node) {
+    if (atomic_fetch_sub_explicit(&w->listed, 1, memory_order_relaxed) >= WALKER_RUN_AHEAD) {
+        pthread_mutex_lock(&w->mutex);
+        pthread_cond_broadcast(&w->work_cond);
+        pthread_mutex_unlock(&w->mutex);
+    }
+    node_release(node);
+}
+
+// Gives up on `node` and everything below it that the caller has not seen.
+static void release_tree(Walker* w, WalkNode* node) {
+    int expected = NODE_PENDING;
+    if (atomic_compare_exchange_strong(&node->state, &expected, NODE_CANCELLED)) {
+        node_release(node);
+        return;
+    }
+
+    wait_listed(w, node);
+    for (size_t i = 0; i < node->child_count; i++) {
+        if (node->children[i].node) {
+            release_tree(w, node->children[i].node);
+        }
+    }
+    node_done(w, node);
+}
+
+static bool push_frame(Walker* w, WalkNode* node) {
+    if (w->depth == w->stack_capacity) {
+        size_t new_cap = w->stack_capacity ? w->stack_capacity * 2 : 32;
+        WalkFrame* stack = realloc(w->stack, new_cap * sizeof(WalkFrame));
+        if (!stack) {
+            return false;
+        }
+        w->stack = stack;
+        w->stack_capacity = new_cap;
+    }
+    w->stack[w->depth++] = (WalkFrame) { .node = node };
+    return true;
+}
+
+static void stop_threads(Walker* w) {
+    pthread_mutex_lock(&w->mutex);
+    w->stop = true;
+    pthread_cond_broadcast(&w->work_cond);
+    pthread_mutex_unlock(&w->mutex);
+
+    for (size_t i = 0; i < w->thread_count; i++) {
+        pthread_join(w->threads[i], NULL);
+    }
+    w->thread_count = 0;
+}
+
+Walker* new_walker(char* const* paths, const WalkerOptions* options) {
+    Walker* w = calloc(1, sizeof(Walker));
+    if (!w) {
+        return NULL;
+    }
+    w->options = *options;
+    pthread_mutex_init(&w->mutex, NULL);
+    pthread_cond_init(&w->work_cond, NULL);
+    pthread_cond_init(&w->listed_cond, NULL);
+    atomic_init(&w->pending, 0);
+    atomic_init(&w->listed, 0);
+
+    w->deque_count = (size_t)options->thread_count + 1;
+    w->deques = calloc(w->deque_count, sizeof(WalkDeque));
+    w->threads = calloc(w->deque_count, sizeof(pthread_t));
+    while (paths[w->root_count]) {
+        w->root_count++;
+    }
+    w->roots = calloc(w->root_count ? w->root_count : 1, sizeof(WalkChild));
+    if (!w->deques || !w->threads || !w->roots) {
+        free_walker(w);
+        return NULL;
+    }
+    for (size_t i = 0; i < w->deque_count; i++) {
+        pthread_mutex_init(&w->deques[i].mutex, NULL);
+    }
+
+    for (size_t i = 0; i < w->root_count; i++) {
+        WalkChild* root = &w->roots[i];
+        root->path = strdup(paths[i]);
+        if (!root->path) {
+            free_walker(w);
+            return NULL;
+        }
+        if (lstat(root->path, &root->stat) != 0) {
+            root->error = errno;
+            root->info = WALK_ERROR;
+            continue;
+        }
+        root->info = classify(&root->stat);
+        if (root->info == WALK_DIR) {
+            root->node = new_node(root, NULL, root->stat.st_dev, 0);
+        }
+    }
+    for (size_t i = w->root_count; i > 0; i--) {
+        if (w->roots[i - 1].node) {
+            deque_push(w, w->deque_count - 1, w->roots[i - 1].node);
+        }
+    }
+
+    for (size_t i = 0; i < options->thread_count; i++) {
+        WalkThread* t = malloc(sizeof(WalkThread));
+        if (!t) {
+            break;
+        }
+        *t = (WalkThread) { .walker = w, .index = i };
+        if (pthread_create(&w->threads[i], NULL, walk_thread, t) != 0) {
+            free(t);
+            break;
+        }
+        w->thread_count++;
+    }
+
+    return w;
+}
+
+void free_walker(Walker* w) {
+    if (!w) {
+        return;
+    }
+
+    stop_threads(w);
+
+    // unwind a walk that was abandoned part way through, children before
+    // `next` have already been released by their own frames
+    while (w->depth > 0) {
+        WalkFrame* f = &w->stack[--w->depth];
+        if (atomic_load(&f->node->state) != NODE_LISTED) {
+            release_tree(w, f->node);
+            continue;
+        }
+        for (size_t i = f->next; i < f->node->child_count; i++) {
+            if (f->node->children[i].node) {
+                release_tree(w, f->node->children[i].node);
+            }
+        }
+        node_done(w, f->node);
+    }
+    for (; w->next_root < w->root_count; w->next_root++) {
+        if (w->roots[w->next_root].node) {
+            release_tree(w, w->roots[w->next_root].node);
+        }
+    }
+    for (size_t i = 0; w->deques && i < w->deque_count; i++) {
+        WalkNode* node = NULL;
+        while ((node = deque_take(&w->deques[i], true)) != NULL) {
+            node_release(node);
+        }
+        free(w->deques[i].items);
+        pthread_mutex_destroy(&w->deques[i].mutex);
+    }
+
+    for (size_t i = 0; w->roots && i < w->root_count; i++) {
+        free(w->roots[i].path);
+    }
+    free(w->roots);
+    free(w->stack);
+    free(w->deques);
+    free(w->threads);
+    pthread_cond_destroy(&w->listed_cond);
+    pthread_cond_destroy(&w->work_cond);
+    pthread_mutex_destroy(&w->mutex);
+    free(w);
+}
+
+// `dir` is the handle of the directory `child` was read from, if any.
+static bool emit(WalkEntry* entry, const WalkChild* child, short level, DirHandle* dir) {
+    const char* slash = dir ? strrchr(child->path, '/') : NULL;
+    *entry = (WalkEntry) {
+        .path = child->path,
+        .dir = slash ? dir : NULL,
+        .name = slash ? slash + 1 : child->path,
+        .stat = &child->stat,
+        .clone_id = child->clone_id,
+        .private_size = child->private_size,
+        .extended = child->extended,
+        .level = level,
+        .error = child->error,
+        .info = child->info,
+    };
+    return true;
+}
+
+bool walker_next(Walker* w, WalkEntry* entry) {
+    w->pushed = false;
+
+    for (;;) {
+        if (w->depth == 0) {
+            if (w->next_root == w->root_count) {
+                stop_threads(w);
+                return false;
+            }
+            WalkChild* root = &w->roots[w->next_root++];
+            if (root->node) {
+                if (push_frame(w, root->node)) {
+                    w->pushed = true;
+                } else {
+                    release_tree(w, root->node);
+                }
+                root->node = NULL;
+            }
+            return emit(entry, root, 0, NULL);
+        }
+
+        WalkFrame* f = &w->stack[w->depth - 1];
+        WalkNode* node = f->node;
+        if (f->skip) {
+            w->depth--;
+            release_tree(w, node);
+            continue;
+        }
+
+        wait_listed(w, node);
+
+        if (node->error && !f->reported) {
+            f->reported = true;
+            *entry = (WalkEntry) {
+                .path = node->path,
+                .name = node->path,
+                .level = node->level,
+                .error = node->error,
+                .info = WALK_ERROR,
+            };
+            return true;
+        }
+
+        if (f->next < node->child_count) {
+            WalkChild* child = &node->children[f->next++];
+            if (child->node) {
+                if (push_frame(w, child->node)) {
+                    w->pushed = true;
+                } else {
+                    release_tree(w, child->node);
+                    child->node = NULL;
+                }
+            }
+            return emit(entry, child, node->level + 1, node->dir);
+        }
+
+        w->depth--;
+        node_done(w, node);
+    }
+}
+
+void walker_skip(Walker* w) {
+    if (w->pushed && w->depth > 0) {
+        w->stack[w->depth - 1].skip = true;
+        w->pushed = false;
+    }
+}
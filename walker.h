@@ -0,0 +1,74 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#ifndef __DEDUP_WALKER_H__
+#define __DEDUP_WALKER_H__
+
+#include <sys/stat.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "dir_handle.h"
+
+/// Parallel Directory Walker
+///
+/// A pool of threads reads and stats directories ahead of the caller,
+/// pulling directories from per-thread deques and stealing from each other
+/// when they run dry. The caller still sees a single stream of entries in the
+/// same order `fts_read` would produce with `FTS_PHYSICAL` and no comparison
+/// function: depth-first preorder with directory entries in the order they
+/// were read.
+///
+/// The caller never waits on a directory that no thread has picked up yet; it
+/// reads that directory itself. This also bounds how far the pool may run
+/// ahead, and with no threads at all the walk runs inline on the caller.
+typedef struct Walker Walker;
+
+typedef enum WalkInfo {
+    WALK_FILE,       // regular file
+    WALK_DIR,        // directory, preorder
+    WALK_DIR_CYCLE,  // directory that is one of its own ancestors, not entered
+    WALK_OTHER,      // symlink, fifo, device, socket, ...
+    WALK_ERROR,      // see `error`
+} WalkInfo;
+
+/// Directories are enumerated with getattrlistbulk where available, which
+/// returns the stat fields dedup needs along with the APFS clone id and
+/// private size of every child in one call per buffer. `stat` then only has
+/// st_dev, st_ino, st_mode, st_nlink, st_flags, st_size and st_mtimespec
+/// filled in.
+typedef struct WalkEntry {
+    const char* path;
+    DirHandle* dir;           // the open parent directory, may be NULL
+    const char* name;         // `path` relative to `dir`, or all of it
+    const struct stat* stat;  // undefined if `info` is WALK_ERROR
+    uint64_t clone_id;        // ATTR_CMNEXT_CLONEID, valid if `extended`
+    uint64_t private_size;    // ATTR_CMNEXT_PRIVATESIZE, valid if `extended`
+    bool extended;
+    short level;              // 0 for the starting paths
+    int error;                // errno of a failed stat or directory read
+    WalkInfo info;
+} WalkEntry;
+
+typedef struct WalkerOptions {
+    uint8_t thread_count;
+    int max_depth;            // directories below this level are not read
+    bool one_file_system;     // do not enter directories on other devices
+} WalkerOptions;
+
+Walker* new_walker(char* const* paths, const WalkerOptions* options);
+
+/// Frees the walker, stopping the pool if the walk did not run to completion.
+void free_walker(Walker* walker);
+
+/// Fetches the next entry. `path`, `name` and `stat` stay valid until the
+/// next call, the caller retains `dir` to keep it.
+/// A directory that cannot be read is returned a second time, right after
+/// its preorder entry, as WALK_ERROR. Returns false once the walk is done.
+bool walker_next(Walker* walker, WalkEntry* entry);
+
+/// Do not enter the directory that was just returned by `walker_next`.
+void walker_skip(Walker* walker);
+
+#endif // __DEDUP_WALKER_H__
@@ -0,0 +1,264 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include "watch.h"
+
+#include <CoreServices/CoreServices.h>
+#include <dispatch/dispatch.h>
+#include <sys/stat.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// How long FSEvents gathers events before it delivers them. Paths are held
+// for `settle` seconds on top of this anyway.
+#define WATCH_LATENCY 0.5
+
+typedef struct WatchPath {
+    char* path;
+    uint64_t last;          // when the last event arrived, in seconds
+} WatchPath;
+
+struct Watcher {
+    FSEventStreamRef stream;
+    bool scheduled;
+    bool started;
+    dispatch_queue_t queue; // runs the stream's callbacks and the timer
+    dispatch_source_t timer;
+    WatchFn fn;
+    void* context;
+    unsigned settle;
+
+    // only used on `queue`
+    WatchPath* pending;
+    size_t count;
+    size_t capacity;
+};
+
+static uint64_t watch_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec;
+}
+
+static void add_pending(Watcher* watcher, const char* path, uint64_t now) {
+    if (watcher->count == watcher->capacity) {
+        size_t capacity = watcher->capacity ? watcher->capacity * 2 : 256;
+        WatchPath* pending = realloc(watcher->pending, capacity * sizeof(WatchPath));
+        if (!pending) {
+            return;
+        }
+        watcher->pending = pending;
+        watcher->capacity = capacity;
+    }
+
+    char* copy = strdup(path);
+    if (copy) {
+        watcher->pending[watcher->count++] = (WatchPath) { .path = copy, .last = now };
+    }
+}
+
+static void stream_events(ConstFSEventStreamRef stream, void* info, size_t count, void* event_paths,
+                          const FSEventStreamEventFlags flags[], const FSEventStreamEventId ids[]) {
+    Watcher* watcher = info;
+    char** paths = event_paths;
+    uint64_t now = watch_seconds();
+
+    const FSEventStreamEventFlags arrived = kFSEventStreamEventFlagItemCreated |
+                                            kFSEventStreamEventFlagItemModified |
+                                            kFSEventStreamEventFlagItemRenamed;
+    for (size_t i = 0; i < count; i++) {
+        FSEventStreamEventFlags f = flags[i];
+        if (f & kFSEventStreamEventFlagOwnEvent) {
+            continue;
+        }
+
+        // a created or moved directory reports none of its files
+        bool rescan = f & kFSEventStreamEventFlagMustScanSubDirs;
+        bool file = (f & kFSEventStreamEventFlagItemIsFile) && (f & arrived);
+        bool dir = (f & kFSEventStreamEventFlagItemIsDir) &&
+                   (f & (kFSEventStreamEventFlagItemCreated | kFSEventStreamEventFlagItemRenamed));
+        if (rescan || file || dir) {
+            add_pending(watcher, paths[i], now);
+        }
+    }
+}
+
+static int compare_pending(const void* a, const void* b) {
+    const WatchPath* x = a;
+    const WatchPath* y = b;
+    int order = strcmp(x->path, y->path);
+    if (order != 0) {
+        return order;
+    }
+    return (x->last > y->last) - (x->last < y->last);
+}
+
+// Hands out the paths that have settled, once a second.
+static void settle_pending(void* context) {
+    Watcher* watcher = context;
+    if (watcher->count == 0) {
+        return;
+    }
+
+    // the latest event of every path is the last of its run
+    qsort(watcher->pending, watcher->count, sizeof(WatchPath), compare_pending);
+    size_t unique = 0;
+    for (size_t i = 0; i < watcher->count; i++) {
+        if (unique > 0 && strcmp(watcher->pending[unique - 1].path, watcher->pending[i].path) == 0) {
+            free(watcher->pending[unique - 1].path);
+            watcher->pending[unique - 1] = watcher->pending[i];
+        } else {
+            watcher->pending[unique++] = watcher->pending[i];
+        }
+    }
+
+    char** settled = malloc((unique + 1) * sizeof(char*));
+    if (!settled) {
+        watcher->count = unique;
+        return;
+    }
+
+    uint64_t now = watch_seconds();
+    size_t settled_count = 0;
+    size_t kept = 0;
+    for (size_t i = 0; i < unique; i++) {
+        WatchPath* p = &watcher->pending[i];
+        struct stat st;
+        if (now - p->last < watcher->settle) {
+            watcher->pending[kept++] = *p;
+        } else if (lstat(p->path, &st) == 0) {
+            settled[settled_count++] = p->path;
+        } else {
+            // removed or moved away again
+            free(p->path);
+        }
+    }
+    watcher->count = kept;
+    settled[settled_count] = NULL;
+
+    if (settled_count > 0) {
+        watcher->fn(settled, settled_count, watcher->context);
+    }
+    for (size_t i = 0; i < settled_count; i++) {
+        free(settled[i]);
+    }
+    free(settled);
+}
+
+uint64_t watch_current_event(void) {
+    return FSEventsGetCurrentEventId();
+}
+
+Watcher* new_watcher(char* const* paths, uint64_t since, unsigned settle, WatchFn fn, void* context) {
+    if (!paths || !fn) {
+        return NULL;
+    }
+
+    Watcher* watcher = calloc(1, sizeof(Watcher));
+    CFMutableArrayRef roots = CFArrayCreateMutable(kCFAllocatorDefault, 0, &kCFTypeArrayCallBacks);
+    if (!watcher || !roots) {
+        free(watcher);
+        if (roots) {
+            CFRelease(roots);
+        }
+        return NULL;
+    }
+    watcher->fn = fn;
+    watcher->context = context;
+    watcher->settle = settle;
+
+    // FSEvents reports real paths, and only takes those
+    size_t root_count = 0;
+    char real[PATH_MAX];
+    for (size_t i = 0; paths[i]; i++) {
+        CFStringRef root = realpath(paths[i], real)
+            ? CFStringCreateWithFileSystemRepresentation(kCFAllocatorDefault, real)
+            : NULL;
+        if (root) {
+            CFArrayAppendValue(roots, root);
+            CFRelease(root);
+            root_count++;
+        }
+    }
+
+    FSEventStreamContext stream_context = { .info = watcher };
+    if (root_count > 0) {
+        watcher->stream = FSEventStreamCreate(kCFAllocatorDefault, stream_events, &stream_context, roots, since,
+                                              WATCH_LATENCY,
+                                              kFSEventStreamCreateFlagFileEvents |
+                                              kFSEventStreamCreateFlagMarkSelf);
+    }
+    CFRelease(roots);
+    watcher->queue = watcher->stream ? dispatch_queue_create("dedup.watch", DISPATCH_QUEUE_SERIAL) : NULL;
+    watcher->timer = watcher->queue ? dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, watcher->queue) : NULL;
+    if (!watcher->timer) {
+        free_watcher(watcher);
+        return NULL;
+    }
+
+    dispatch_set_context(watcher->timer, watcher);
+    dispatch_source_set_event_handler_f(watcher->timer, settle_pending);
+    dispatch_source_set_timer(watcher->timer, dispatch_time(DISPATCH_TIME_NOW, NSEC_PER_SEC), NSEC_PER_SEC,
+                              NSEC_PER_SEC / 10);
+    dispatch_resume(watcher->timer);
+
+    FSEventStreamSetDispatchQueue(watcher->stream, watcher->queue);
+    watcher->scheduled = true;
+    watcher->started = FSEventStreamStart(watcher->stream);
+    if (!watcher->started) {
+        free_watcher(watcher);
+        return NULL;
+    }
+    return watcher;
+}
+
+// Drops the paths that haven't settled. Runs on the watcher's queue, which
+// owns them, once nothing else is scheduled there.
+static void drop_pending(void* context) {
+    Watcher* watcher = context;
+    for (size_t i = 0; i < watcher->count; i++) {
+        free(watcher->pending[i].path);
+    }
+    watcher->count = 0;
+}
+
+void free_watcher(Watcher* watcher) {
+    if (!watcher) {
+        return;
+    }
+
+    if (watcher->stream) {
+        if (watcher->started) {
+            FSEventStreamStop(watcher->stream);
+        }
+        if (watcher->scheduled) {
+            FSEventStreamInvalidate(watcher->stream);
+        }
+    }
+    if (watcher->timer) {
+        dispatch_source_cancel(watcher->timer);
+    }
+    if (watcher->queue) {
+        // nothing is scheduled after the stream and the timer are stopped,
+        // this waits for whatever is still running
+        dispatch_sync_f(watcher->queue, watcher, drop_pending);
+    }
+    if (watcher->timer) {
+        dispatch_release(watcher->timer);
+    }
+    if (watcher->stream) {
+        FSEventStreamRelease(watcher->stream);
+    }
+    if (watcher->queue) {
+        dispatch_release(watcher->queue);
+    }
+
+    // a watcher that never got a queue has nothing running
+    drop_pending(watcher);
+    free(watcher->pending);
+    free(watcher);
+}
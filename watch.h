@@ -0,0 +1,46 @@
+// Copyright © 2026 TTKB, LLC.
+//
+// SPDX-License-Identifier: BSD-2-Clause
+
+#ifndef __DEDUP_WATCH_H__
+#define __DEDUP_WATCH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// File System Watcher
+///
+/// Follows the changes below a set of paths through FSEvents and hands out
+/// the files that were created, modified or moved there, and the
+/// directories that were created or moved there or that FSEvents asks to be
+/// rescanned because it dropped events.
+///
+/// A path is only handed out once it has had no events for `settle`
+/// seconds, so files are seen once whoever is writing them is done rather
+/// than half written, and a file written in several steps is seen once.
+/// Changes made by this process, such as replacing a file with a clone,
+/// are ignored.
+///
+/// Paths are handed out in batches, one at a time, on a thread of the
+/// watcher's own.
+typedef struct Watcher Watcher;
+
+/// Called with a sorted, NULL terminated array of `count` paths that still
+/// exist. The paths are only valid during the call.
+typedef void (*WatchFn)(char* const* paths, size_t count, void* context);
+
+/// Identifies the point in time of the latest change on the system, see
+/// `new_watcher`.
+uint64_t watch_current_event(void);
+
+/// Starts watching `paths`, a NULL terminated array, for changes since
+/// `since`, a value returned by `watch_current_event`. Changes made while
+/// the caller was busy between the two calls are handed out as well.
+/// Returns NULL if the paths can't be watched.
+Watcher* new_watcher(char* const* paths, uint64_t since, unsigned settle, WatchFn fn, void* context);
+
+/// Stops watching, waiting for a batch that is being handed out. Paths
+/// that haven't settled yet are dropped.
+void free_watcher(Watcher* watcher);
+
+#endif // __DEDUP_WATCH_H__